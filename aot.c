@@ -0,0 +1,1111 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "ast.h"
+#include "builtins.h"
+
+#include "cstring.h/cstring.h"
+
+#define AOT_ERROR_MAX 256
+#define OPERAND_TEXT_MAX 32
+
+// Checked int64_t arithmetic. This deliberately differs from the
+// interpreter, which widens an overflowing int to a big int: the emitted
+// code fails with "integer overflow" instead, so every int stays a plain
+// int64_t.
+static const char *const RUNTIME =
+    "#ifndef FIZZ_FAIL\n"
+    "#define FIZZ_FAIL(message) fizz_fail(message)\n"
+    "static inline void fizz_fail(const char *message) {\n"
+    "  fprintf(stderr, \"runtime error: %s\\n\", message);\n"
+    "  exit(EXIT_FAILURE);\n"
+    "}\n"
+    "#endif\n"
+    "\n"
+    "static inline int64_t fizz_add(int64_t a, int64_t b) {\n"
+    "  if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b))\n"
+    "    FIZZ_FAIL(\"integer overflow\");\n"
+    "  return a + b;\n"
+    "}\n"
+    "\n"
+    "static inline int64_t fizz_sub(int64_t a, int64_t b) {\n"
+    "  if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b))\n"
+    "    FIZZ_FAIL(\"integer overflow\");\n"
+    "  return a - b;\n"
+    "}\n"
+    "\n"
+    "static inline int64_t fizz_mul(int64_t a, int64_t b) {\n"
+    "  bool overflow;\n"
+    "  if (a > 0)\n"
+    "    overflow = b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a;\n"
+    "  else\n"
+    "    overflow = b > 0 ? a < INT64_MIN / b : a != 0 && b < INT64_MAX / a;\n"
+    "  if (overflow)\n"
+    "    FIZZ_FAIL(\"integer overflow\");\n"
+    "  return a * b;\n"
+    "}\n"
+    "\n"
+    "static inline int64_t fizz_div(int64_t a, int64_t b) {\n"
+    "  if (b == 0)\n"
+    "    FIZZ_FAIL(\"division by zero\");\n"
+    "  if (a == INT64_MIN && b == -1)\n"
+    "    FIZZ_FAIL(\"integer overflow\");\n"
+    "  return a / b;\n"
+    "}\n"
+    "\n"
+    "static inline int64_t fizz_neg(int64_t a) {\n"
+    "  if (a == INT64_MIN)\n"
+    "    FIZZ_FAIL(\"integer overflow\");\n"
+    "  return -a;\n"
+    "}\n";
+
+// Code buffer ---------------------------------------------------------------
+
+typedef struct CodeBuffer {
+  char *chars;
+  size_t length;
+  size_t capacity;
+} CodeBuffer;
+
+static CodeBuffer buffer_init(void) {
+  CodeBuffer buffer = {.chars = malloc(256), .length = 0, .capacity = 256};
+  assert(buffer.chars != NULL);
+  buffer.chars[0] = '\0';
+  return buffer;
+}
+
+static void free_buffer(CodeBuffer *self) {
+  free(self->chars);
+  *self = (CodeBuffer){0};
+}
+
+static void buffer_reserve(CodeBuffer *self, size_t extra) {
+  if (self->length + extra < self->capacity)
+    return;
+  while (self->length + extra >= self->capacity)
+    self->capacity *= 2;
+  self->chars = realloc(self->chars, self->capacity);
+  assert(self->chars != NULL);
+}
+
+static void buffer_vprintf(CodeBuffer *self, const char *fmt, va_list args) {
+  va_list copy;
+  va_copy(copy, args);
+  int length = vsnprintf(NULL, 0, fmt, copy);
+  va_end(copy);
+  assert(length >= 0);
+
+  buffer_reserve(self, (size_t)length);
+  vsnprintf(self->chars + self->length, self->capacity - self->length, fmt,
+            args);
+  self->length += (size_t)length;
+}
+
+static void buffer_printf(CodeBuffer *self, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  buffer_vprintf(self, fmt, args);
+  va_end(args);
+}
+
+// `text` goes in front of what is at `at`
+static void buffer_insert(CodeBuffer *self, size_t at, const char *text) {
+  assert(at <= self->length);
+  size_t length = strlen(text);
+  buffer_reserve(self, length);
+  memmove(self->chars + at + length, self->chars + at, self->length - at + 1);
+  memcpy(self->chars + at, text, length);
+  self->length += length;
+}
+
+// Types and scopes ----------------------------------------------------------
+
+// static type of a value
+typedef enum CType {
+  // no value, like the null of a call to echo
+  CTYPE_VOID,
+  CTYPE_INT,
+  CTYPE_BOOL,
+  // control never gets past it
+  CTYPE_NEVER,
+} CType;
+
+static bool has_value(CType type) {
+  return type == CTYPE_INT || type == CTYPE_BOOL;
+}
+
+static const char *ctype_name(CType type) {
+  switch (type) {
+  case CTYPE_INT:
+    return "int64_t";
+  case CTYPE_BOOL:
+    return "bool";
+  default:
+    return "void";
+  }
+}
+
+// the type of a value that can come from either side, false when they
+// disagree
+static bool ctype_join(CType a, CType b, CType *out) {
+  if (a == CTYPE_NEVER || a == b) {
+    *out = b;
+    return true;
+  }
+  if (b == CTYPE_NEVER) {
+    *out = a;
+    return true;
+  }
+  return false;
+}
+
+// a value once the code computing it is emitted, a literal or a temp
+typedef struct Operand {
+  CType type;
+  // -1 for a literal
+  int32_t temp;
+  int64_t literal;
+} Operand;
+
+typedef enum BindingKind { BINDING_VAR, BINDING_FUNCTION } BindingKind;
+
+typedef struct Binding {
+  // borrowed from the AST
+  const String *name;
+  BindingKind kind;
+  // type of a variable, result of a function
+  CType type;
+  int32_t arity;
+  // block the variable was last bound in, -1 while its first `let` runs
+  int32_t block;
+  bool parameter;
+} Binding;
+
+// Names of the top level or of one function. A variable can be read while
+// the block it was bound in is open, so every read is of a variable that
+// was bound on the way there, the interpreter would read a null otherwise.
+typedef struct Scope {
+  Binding *bindings;
+  int32_t size;
+  int32_t capacity;
+  // innermost last
+  int32_t *open_blocks;
+  int32_t num_open;
+  int32_t open_capacity;
+} Scope;
+
+static Scope scope_init(void) {
+  Scope scope = {0};
+  scope.capacity = 8;
+  scope.bindings = malloc(sizeof(Binding) * scope.capacity);
+  scope.open_capacity = 8;
+  scope.open_blocks = malloc(sizeof(int32_t) * scope.open_capacity);
+  assert(scope.bindings != NULL && scope.open_blocks != NULL);
+  return scope;
+}
+
+static void free_scope(Scope *self) {
+  free(self->bindings);
+  free(self->open_blocks);
+}
+
+// index of the binding of `name`, -1 if there is none
+static int32_t scope_find(const Scope *self, const String *name) {
+  for (int32_t i = 0; i < self->size; i++)
+    if (String_cmp((String *)self->bindings[i].name, (String *)name))
+      return i;
+  return -1;
+}
+
+static int32_t scope_add(Scope *self, Binding binding) {
+  if (self->size == self->capacity) {
+    self->capacity *= 2;
+    self->bindings = realloc(self->bindings, sizeof(Binding) * self->capacity);
+    assert(self->bindings != NULL);
+  }
+  self->bindings[self->size] = binding;
+  return self->size++;
+}
+
+static void scope_open(Scope *self, int32_t block) {
+  if (self->num_open == self->open_capacity) {
+    self->open_capacity *= 2;
+    self->open_blocks =
+        realloc(self->open_blocks, sizeof(int32_t) * self->open_capacity);
+    assert(self->open_blocks != NULL);
+  }
+  self->open_blocks[self->num_open++] = block;
+}
+
+static bool scope_is_open(const Scope *self, int32_t block) {
+  for (int32_t i = self->num_open - 1; i >= 0; i--)
+    if (self->open_blocks[i] == block)
+      return true;
+  return false;
+}
+
+static int32_t scope_block(const Scope *self) {
+  assert(self->num_open > 0);
+  return self->open_blocks[self->num_open - 1];
+}
+
+// Compiling -----------------------------------------------------------------
+
+typedef struct AotCompiler {
+  Scope globals;
+  // NULL at the top level
+  Scope *locals;
+  // the function being compiled, calls to it have the result type assumed
+  // for this attempt at compiling it
+  const String *fn_name;
+  int32_t fn_arity;
+  CType fn_assumed;
+  CType fn_result;
+  int32_t fn_self_calls;
+  // statements of the function being compiled or of the top level
+  CodeBuffer *out;
+  int32_t indent;
+  int32_t next_temp;
+  int32_t next_block;
+  CodeBuffer functions;
+  String *error;
+} AotCompiler;
+
+static bool compile_expression(AotCompiler *self, const Expression *expr,
+                               bool want, Operand *out);
+static bool compile_statement(AotCompiler *self, const Statement *st,
+                              CType *flow);
+
+// always returns false, the result of a failed compilation
+static bool aot_error(AotCompiler *self, const char *message,
+                      const Node *node) {
+  char buf[AOT_ERROR_MAX];
+  if (node != NULL) {
+    String source = node->vt->string(node);
+    snprintf(buf, AOT_ERROR_MAX, "%s: %s", message, source.chars);
+    free_string(&source);
+  } else {
+    snprintf(buf, AOT_ERROR_MAX, "%s", message);
+  }
+
+  free_string(self->error);
+  *self->error = String_from(buf);
+  return false;
+}
+
+// one indented line of the current function
+static void line(AotCompiler *self, const char *fmt, ...) {
+  buffer_printf(self->out, "%*s", 2 * self->indent, "");
+  va_list args;
+  va_start(args, fmt);
+  buffer_vprintf(self->out, fmt, args);
+  va_end(args);
+  buffer_printf(self->out, "\n");
+}
+
+// C expression of `operand`, written to `buf`
+static const char *operand_text(const Operand *operand,
+                                char buf[OPERAND_TEXT_MAX]) {
+  if (operand->temp >= 0)
+    snprintf(buf, OPERAND_TEXT_MAX, "t%d", operand->temp);
+  else if (operand->type == CTYPE_BOOL)
+    snprintf(buf, OPERAND_TEXT_MAX, "%s", operand->literal ? "true" : "false");
+  else
+    snprintf(buf, OPERAND_TEXT_MAX, "INT64_C(%" PRId64 ")", operand->literal);
+  return buf;
+}
+
+static Operand new_temp(AotCompiler *self, CType type) {
+  return (Operand){.type = type, .temp = self->next_temp++, .literal = 0};
+}
+
+static bool require_value(AotCompiler *self, const Operand *operand,
+                          const Expression *expr) {
+  if (!has_value(operand->type))
+    return aot_error(self, "expression has no value", expr);
+  return true;
+}
+
+static bool require_type(AotCompiler *self, const Operand *operand,
+                         CType type, const char *message,
+                         const Expression *expr) {
+  if (!require_value(self, operand, expr))
+    return false;
+  return operand->type == type ? true : aot_error(self, message, expr);
+}
+
+static Scope *current_scope(AotCompiler *self) {
+  return self->locals != NULL ? self->locals : &self->globals;
+}
+
+static void open_block(AotCompiler *self) {
+  scope_open(current_scope(self), self->next_block++);
+}
+
+static void close_block(AotCompiler *self) { current_scope(self)->num_open--; }
+
+// globals and locals are prefixed apart, and apart from C keywords
+static const char *var_prefix(bool global) { return global ? "g_" : "l_"; }
+
+static bool compile_identifier(AotCompiler *self, const Identifier *ident,
+                               bool want, Operand *out) {
+  const Expression *expr = (const Expression *)ident;
+  const String *name = &ident->value;
+  const Binding *binding = NULL;
+  bool global = false;
+
+  int32_t index = self->locals != NULL ? scope_find(self->locals, name) : -1;
+  if (index >= 0) {
+    binding = &self->locals->bindings[index];
+    if (!scope_is_open(self->locals, binding->block))
+      return aot_error(self, "variable may be unbound here", expr);
+  } else if (self->fn_name != NULL && String_cmp((String *)self->fn_name,
+                                                 (String *)name)) {
+    return aot_error(self, "functions can only be called", expr);
+  } else if ((index = scope_find(&self->globals, name)) >= 0) {
+    binding = &self->globals.bindings[index];
+    global = true;
+    if (binding->kind == BINDING_FUNCTION)
+      return aot_error(self, "functions can only be called", expr);
+    // inside a function only what the whole top level binds is bound
+    bool bound = self->locals != NULL
+                     ? binding->block == 0
+                     : scope_is_open(&self->globals, binding->block);
+    if (!bound)
+      return aot_error(self, "variable may be unbound here", expr);
+  } else {
+    return aot_error(self, "undefined variable", expr);
+  }
+
+  // copied, a later `let` in the same expression must not change it
+  *out = (Operand){.type = binding->type, .temp = -1, .literal = 0};
+  if (!want)
+    return true;
+  *out = new_temp(self, binding->type);
+  line(self, "%s t%d = %s%s;", ctype_name(out->type), out->temp,
+       var_prefix(global), binding->name->chars);
+  return true;
+}
+
+static bool compile_prefix(AotCompiler *self, const PrefixExpression *prefix,
+                           Operand *out) {
+  const Expression *expr = (const Expression *)prefix;
+  if (prefix->right == NULL)
+    return aot_error(self, "incomplete prefix expression", expr);
+  Operand right;
+  if (!compile_expression(self, prefix->right, true, &right))
+    return false;
+  char text[OPERAND_TEXT_MAX];
+
+  switch (prefix->token.type) {
+  case TOKEN_MINUS:
+    if (!require_type(self, &right, CTYPE_INT, "`-` needs an int", expr))
+      return false;
+    *out = new_temp(self, CTYPE_INT);
+    line(self, "int64_t t%d = fizz_neg(%s);", out->temp,
+         operand_text(&right, text));
+    return true;
+  case TOKEN_PLUS:
+    if (!require_type(self, &right, CTYPE_INT, "`+` needs an int", expr))
+      return false;
+    *out = right;
+    return true;
+  case TOKEN_BANG:
+    if (!require_type(self, &right, CTYPE_BOOL, "`!` needs a boolean", expr))
+      return false;
+    *out = new_temp(self, CTYPE_BOOL);
+    line(self, "bool t%d = !%s;", out->temp, operand_text(&right, text));
+    return true;
+  default:
+    return aot_error(self, "unknown prefix operator", expr);
+  }
+}
+
+static bool compile_infix(AotCompiler *self, const InfixExpression *infix,
+                          Operand *out) {
+  const Expression *expr = (const Expression *)infix;
+  if (infix->left == NULL || infix->right == NULL)
+    return aot_error(self, "incomplete infix expression", expr);
+  Operand left, right;
+  if (!compile_expression(self, infix->left, true, &left) ||
+      !require_value(self, &left, infix->left) ||
+      !compile_expression(self, infix->right, true, &right) ||
+      !require_value(self, &right, infix->right))
+    return false;
+
+  const char *fn = NULL;
+  const char *op = NULL;
+  switch (infix->token.type) {
+  case TOKEN_PLUS:
+    fn = "fizz_add";
+    break;
+  case TOKEN_MINUS:
+    fn = "fizz_sub";
+    break;
+  case TOKEN_ASTERISK:
+    fn = "fizz_mul";
+    break;
+  case TOKEN_SLASH:
+    fn = "fizz_div";
+    break;
+  case TOKEN_LT:
+    op = "<";
+    break;
+  case TOKEN_GT:
+    op = ">";
+    break;
+  case TOKEN_EQ:
+    op = "==";
+    break;
+  case TOKEN_NOT_EQ:
+    op = "!=";
+    break;
+  default:
+    return aot_error(self, "unknown infix operator", expr);
+  }
+
+  bool equality = infix->token.type == TOKEN_EQ ||
+                  infix->token.type == TOKEN_NOT_EQ;
+  if (equality ? left.type != right.type
+               : left.type != CTYPE_INT || right.type != CTYPE_INT)
+    return aot_error(self,
+                     equality ? "operands have different types"
+                              : "arithmetic and ordering need ints",
+                     expr);
+
+  char left_text[OPERAND_TEXT_MAX], right_text[OPERAND_TEXT_MAX];
+  operand_text(&left, left_text);
+  operand_text(&right, right_text);
+  if (fn != NULL) {
+    *out = new_temp(self, CTYPE_INT);
+    line(self, "int64_t t%d = %s(%s, %s);", out->temp, fn, left_text,
+         right_text);
+  } else {
+    *out = new_temp(self, CTYPE_BOOL);
+    line(self, "bool t%d = %s %s %s;", out->temp, left_text, op, right_text);
+  }
+  return true;
+}
+
+// Runs the statements of `block`, `out` is the value of the trailing
+// expression, void without one or CTYPE_NEVER when a statement returns.
+static bool compile_block_value(AotCompiler *self, const BlockStatement *block,
+                                bool want, Operand *out) {
+  *out = (Operand){.type = CTYPE_VOID, .temp = -1, .literal = 0};
+  bool returned = false;
+  for (int32_t i = 0; i < block->statements.size; i++) {
+    const Statement *st = block->statements.data[i];
+    if (st != NULL && i == block->statements.size - 1 &&
+        st->vt->kind == NODE_EXPR_STATEMENT) {
+      const ExpressionStatement *expr_st = (const ExpressionStatement *)st;
+      if (!compile_expression(self, expr_st->expr, want, out))
+        return false;
+      continue;
+    }
+    CType flow;
+    if (!compile_statement(self, st, &flow))
+      return false;
+    returned = returned || flow == CTYPE_NEVER;
+  }
+  if (returned)
+    out->type = CTYPE_NEVER;
+  return true;
+}
+
+// one branch of an if expression, assigning its value to `result`
+static bool compile_branch(AotCompiler *self, const BlockStatement *block,
+                           bool want, int32_t result, CType *type) {
+  self->indent++;
+  open_block(self);
+  Operand value;
+  if (!compile_block_value(self, block, want, &value))
+    return false;
+  char text[OPERAND_TEXT_MAX];
+  if (want && has_value(value.type))
+    line(self, "t%d = %s;", result, operand_text(&value, text));
+  close_block(self);
+  self->indent--;
+  *type = value.type;
+  return true;
+}
+
+static bool compile_if(AotCompiler *self, const IfExpression *if_expr,
+                       bool want, Operand *out) {
+  const Expression *expr = (const Expression *)if_expr;
+  if (if_expr->condition == NULL || if_expr->consequence == NULL)
+    return aot_error(self, "incomplete if expression", expr);
+  Operand condition;
+  if (!compile_expression(self, if_expr->condition, true, &condition) ||
+      !require_type(self, &condition, CTYPE_BOOL,
+                    "conditions have to be booleans", if_expr->condition))
+    return false;
+
+  size_t mark = self->out->length;
+  int32_t result = want ? self->next_temp++ : -1;
+  CType consequence, alternative = CTYPE_VOID;
+  char text[OPERAND_TEXT_MAX];
+  line(self, "if (%s) {", operand_text(&condition, text));
+  if (!compile_branch(self, if_expr->consequence, want, result, &consequence))
+    return false;
+  if (if_expr->alternative != NULL) {
+    line(self, "} else {");
+    if (!compile_branch(self, if_expr->alternative, want, result,
+                        &alternative))
+      return false;
+  }
+  line(self, "}");
+
+  *out = (Operand){.type = CTYPE_VOID, .temp = -1, .literal = 0};
+  if (!want)
+    return true;
+  if (!ctype_join(consequence, alternative, &out->type))
+    return aot_error(self, "branches have values of different types", expr);
+  if (has_value(out->type)) {
+    char declaration[64];
+    snprintf(declaration, sizeof(declaration), "%*s%s t%d = %s;\n",
+             2 * self->indent, "", ctype_name(out->type), result,
+             out->type == CTYPE_BOOL ? "false" : "0");
+    buffer_insert(self->out, mark, declaration);
+    out->temp = result;
+  }
+  return true;
+}
+
+static bool compile_echo(AotCompiler *self, const CallExpression *call,
+                         Operand *out) {
+  CodeBuffer format = buffer_init();
+  CodeBuffer args = buffer_init();
+  bool ok = true;
+  for (int32_t i = 0; i < call->arguments.size && ok; i++) {
+    const Expression *arg = call->arguments.data[i];
+    Operand value;
+    ok = compile_expression(self, arg, true, &value) &&
+         require_value(self, &value, arg);
+    if (!ok)
+      break;
+    char text[OPERAND_TEXT_MAX];
+    operand_text(&value, text);
+    buffer_printf(&format, "%s", i == 0 ? "" : " ");
+    if (value.type == CTYPE_INT) {
+      buffer_printf(&format, "%%\" PRId64 \"");
+      buffer_printf(&args, ", %s", text);
+    } else {
+      buffer_printf(&format, "%%s");
+      buffer_printf(&args, ", %s ? \"true\" : \"false\"", text);
+    }
+  }
+  if (ok)
+    line(self, "printf(\"%s\\n\"%s);", format.chars, args.chars);
+  free_buffer(&format);
+  free_buffer(&args);
+  *out = (Operand){.type = CTYPE_VOID, .temp = -1, .literal = 0};
+  return ok;
+}
+
+static bool compile_call(AotCompiler *self, const CallExpression *call,
+                         Operand *out) {
+  const Expression *expr = (const Expression *)call;
+  if (call->function == NULL ||
+      call->function->vt->kind != NODE_IDENTIFIER)
+    return aot_error(self, "only functions bound by name can be called",
+                     expr);
+  const String *name = &((const Identifier *)call->function)->value;
+
+  // resolved like the interpreter does: locals, the function itself,
+  // globals, then builtins
+  CType result;
+  int32_t arity;
+  bool is_self = false;
+  int32_t index;
+  if (self->locals != NULL && scope_find(self->locals, name) >= 0) {
+    return aot_error(self, "only functions can be called", expr);
+  } else if (self->fn_name != NULL &&
+             String_cmp((String *)self->fn_name, (String *)name)) {
+    result = self->fn_assumed;
+    arity = self->fn_arity;
+    is_self = true;
+  } else if ((index = scope_find(&self->globals, name)) >= 0) {
+    const Binding *binding = &self->globals.bindings[index];
+    if (binding->kind != BINDING_FUNCTION)
+      return aot_error(self, "only functions can be called", expr);
+    result = binding->type;
+    arity = binding->arity;
+  } else if (strcmp(name->chars, "echo") == 0) {
+    return compile_echo(self, call, out);
+  } else {
+    for (int32_t i = 0; i < builtins_count(); i++)
+      if (strcmp(builtin_get(i)->name, name->chars) == 0)
+        return aot_error(self, "builtin has no C translation", expr);
+    return aot_error(self, "undefined function", expr);
+  }
+
+  if (call->arguments.size != arity)
+    return aot_error(self, "wrong number of arguments", expr);
+  CodeBuffer args = buffer_init();
+  for (int32_t i = 0; i < call->arguments.size; i++) {
+    const Expression *arg = call->arguments.data[i];
+    Operand value;
+    if (!compile_expression(self, arg, true, &value) ||
+        !require_type(self, &value, CTYPE_INT, "arguments have to be ints",
+                      arg)) {
+      free_buffer(&args);
+      return false;
+    }
+    char text[OPERAND_TEXT_MAX];
+    buffer_printf(&args, "%s%s", i == 0 ? "" : ", ",
+                  operand_text(&value, text));
+  }
+  self->fn_self_calls += is_self;
+
+  if (has_value(result)) {
+    *out = new_temp(self, result);
+    line(self, "%s t%d = fz_%s(%s);", ctype_name(result), out->temp,
+         name->chars, args.chars);
+  } else {
+    *out = (Operand){.type = CTYPE_VOID, .temp = -1, .literal = 0};
+    line(self, "fz_%s(%s);", name->chars, args.chars);
+  }
+  free_buffer(&args);
+  return true;
+}
+
+static bool compile_expression(AotCompiler *self, const Expression *expr,
+                               bool want, Operand *out) {
+  if (expr == NULL)
+    return aot_error(self, "invalid expression", NULL);
+
+  bool ok;
+  switch (expr->vt->kind) {
+  case NODE_INT_EXPR: {
+    const IntExpr *int_expr = (const IntExpr *)expr;
+    if (int_expr->is_big)
+      return aot_error(self, "big int literals have no C translation", expr);
+    *out = (Operand){
+        .type = CTYPE_INT, .temp = -1, .literal = int_expr->value};
+    return true;
+  }
+  case NODE_BOOLEAN_EXPR:
+    *out = (Operand){.type = CTYPE_BOOL,
+                     .temp = -1,
+                     .literal = ((const BooleanExpression *)expr)->value};
+    return true;
+  case NODE_IDENTIFIER:
+    return compile_identifier(self, (const Identifier *)expr, want, out);
+  case NODE_PREFIX_EXPR:
+    ok = compile_prefix(self, (const PrefixExpression *)expr, out);
+    break;
+  case NODE_INFIX_EXPR:
+    ok = compile_infix(self, (const InfixExpression *)expr, out);
+    break;
+  case NODE_IF_EXPR:
+    return compile_if(self, (const IfExpression *)expr, want, out);
+  case NODE_CALL_EXPR:
+    ok = compile_call(self, (const CallExpression *)expr, out);
+    break;
+  case NODE_FN_EXPR:
+    return aot_error(self, "functions have to be bound by a top level let",
+                     expr);
+  case NODE_STRING_EXPR:
+    return aot_error(self, "strings have no C translation", expr);
+  case NODE_ARRAY_EXPR:
+  case NODE_INDEX_EXPR:
+  case NODE_MAP_EXPR:
+    return aot_error(self, "arrays and maps have no C translation", expr);
+  default:
+    return aot_error(self, "unsupported expression", expr);
+  }
+
+  // a discarded value still has to be computed, it can fail
+  if (ok && !want && out->temp >= 0)
+    line(self, "(void)t%d;", out->temp);
+  return ok;
+}
+
+// assigns `value` to the variable `name`, binding it on first use
+static bool compile_assignment(AotCompiler *self, const Node *node,
+                               const String *name, const Expression *value,
+                               bool global) {
+  Scope *scope = current_scope(self);
+  int32_t index = scope_find(scope, name);
+  if (index >= 0 && scope->bindings[index].kind == BINDING_FUNCTION)
+    return aot_error(self, "functions can only be bound once", node);
+  bool first = index < 0;
+  if (first)
+    // bound before the value like the compiler does, reading it there is
+    // reading a null
+    index = scope_add(scope, (Binding){.name = name,
+                                       .kind = BINDING_VAR,
+                                       .type = CTYPE_VOID,
+                                       .arity = 0,
+                                       .block = -1,
+                                       .parameter = false});
+
+  Operand operand;
+  if (!compile_expression(self, value, true, &operand) ||
+      !require_value(self, &operand, value))
+    return false;
+  // `scope` may have grown while compiling the value
+  Binding *binding = &scope->bindings[index];
+  if (first)
+    binding->type = operand.type;
+  else if (binding->type != operand.type)
+    return aot_error(self, "variables keep the type they were bound with",
+                     node);
+  if (!scope_is_open(scope, binding->block))
+    binding->block = scope_block(scope);
+
+  char text[OPERAND_TEXT_MAX];
+  line(self, "%s%s = %s;", var_prefix(global), name->chars,
+       operand_text(&operand, text));
+  return true;
+}
+
+// Compiles `fn` bound to `name` once with calls to itself returning
+// `assumed`. False with the error set when the body does not compile.
+static bool compile_function_body(AotCompiler *self, const FnExpression *fn,
+                                  const String *name, CType assumed,
+                                  CodeBuffer *body, Scope *locals) {
+  self->locals = locals;
+  self->fn_name = name;
+  self->fn_arity = fn->parameters.size;
+  self->fn_assumed = assumed;
+  self->fn_result = CTYPE_NEVER;
+  self->fn_self_calls = 0;
+  self->out = body;
+  self->indent = 1;
+  self->next_temp = 0;
+
+  open_block(self);
+  for (int32_t i = 0; i < fn->parameters.size; i++)
+    scope_add(locals, (Binding){.name = &fn->parameters.data[i]->value,
+                                .kind = BINDING_VAR,
+                                .type = CTYPE_INT,
+                                .arity = 0,
+                                .block = scope_block(locals),
+                                .parameter = true});
+
+  Operand value;
+  if (!compile_block_value(self, fn->body, true, &value))
+    return false;
+  if (value.type != CTYPE_NEVER) {
+    if (!ctype_join(self->fn_result, value.type, &self->fn_result))
+      return aot_error(self, "function returns values of different types",
+                       (const Node *)fn);
+    char text[OPERAND_TEXT_MAX];
+    if (has_value(value.type))
+      line(self, "return %s;", operand_text(&value, text));
+  }
+  if (self->fn_result == CTYPE_NEVER)
+    self->fn_result = CTYPE_VOID;
+  return true;
+}
+
+static void emit_function(AotCompiler *self, const FnExpression *fn,
+                          const String *name, CType result,
+                          const CodeBuffer *body, const Scope *locals) {
+  CodeBuffer *out = &self->functions;
+  buffer_printf(out, "%s fz_%s(", ctype_name(result), name->chars);
+  for (int32_t i = 0; i < fn->parameters.size; i++)
+    buffer_printf(out, "%sint64_t l_%s", i == 0 ? "" : ", ",
+                  fn->parameters.data[i]->value.chars);
+  buffer_printf(out, "%s) {\n", fn->parameters.size == 0 ? "void" : "");
+  for (int32_t i = 0; i < locals->size; i++) {
+    const Binding *binding = &locals->bindings[i];
+    if (!binding->parameter)
+      buffer_printf(out, "  %s l_%s = %s;\n", ctype_name(binding->type),
+                    binding->name->chars,
+                    binding->type == CTYPE_BOOL ? "false" : "0");
+  }
+  buffer_printf(out, "%s}\n\n", body->chars);
+}
+
+static bool compile_function(AotCompiler *self, const LetStatement *let_st,
+                             const FnExpression *fn) {
+  const Node *node = (const Node *)let_st;
+  const String *name = &let_st->name->value;
+  if (self->locals != NULL || self->globals.num_open != 1)
+    return aot_error(self, "functions have to be bound by a top level let",
+                     node);
+  if (scope_find(&self->globals, name) >= 0)
+    return aot_error(self, "functions can only be bound once", node);
+  if (fn->memoize)
+    return aot_error(self, "@memo functions have no C translation", node);
+  if (fn->body == NULL)
+    return aot_error(self, "missing function body", node);
+  for (int32_t i = 0; i < fn->parameters.size; i++)
+    for (int32_t j = 0; j < i; j++)
+      if (String_cmp(&fn->parameters.data[i]->value,
+                     &fn->parameters.data[j]->value))
+        return aot_error(self, "parameters need distinct names", node);
+
+  CodeBuffer *top_level = self->out;
+  int32_t top_temps = self->next_temp;
+  // the result of calls to itself is guessed, the guess that comes back out
+  // of the body wins
+  static const CType guesses[] = {CTYPE_INT, CTYPE_BOOL, CTYPE_VOID};
+  String first_error = STR_NULL;
+  bool done = false;
+  for (size_t i = 0; i < sizeof(guesses) / sizeof(guesses[0]) && !done; i++) {
+    CodeBuffer body = buffer_init();
+    Scope locals = scope_init();
+    bool ok = compile_function_body(self, fn, name, guesses[i], &body,
+                                    &locals);
+    if (ok && (self->fn_self_calls == 0 || self->fn_result == guesses[i])) {
+      emit_function(self, fn, name, self->fn_result, &body, &locals);
+      scope_add(&self->globals,
+                (Binding){.name = name,
+                          .kind = BINDING_FUNCTION,
+                          .type = self->fn_result,
+                          .arity = fn->parameters.size,
+                          .block = 0,
+                          .parameter = false});
+      done = true;
+    } else if (!ok) {
+      // the error of the likeliest guess is the one reported
+      if (first_error.chars == NULL)
+        first_error = *self->error;
+      else
+        free_string(self->error);
+      *self->error = STR_NULL;
+    }
+    free_buffer(&body);
+    free_scope(&locals);
+  }
+
+  self->locals = NULL;
+  self->fn_name = NULL;
+  self->out = top_level;
+  self->indent = 1;
+  self->next_temp = top_temps;
+  if (done) {
+    free_string(&first_error);
+    return true;
+  }
+  if (first_error.chars != NULL) {
+    free_string(self->error);
+    *self->error = first_error;
+    return false;
+  }
+  return aot_error(self, "calls to the function have no single result type",
+                   node);
+}
+
+static bool compile_let(AotCompiler *self, const LetStatement *let_st) {
+  const Node *node = (const Node *)let_st;
+  if (let_st->name == NULL || let_st->value == NULL)
+    return aot_error(self, "incomplete let statement", node);
+  if (let_st->value->vt->kind == NODE_FN_EXPR)
+    return compile_function(self, let_st,
+                            (const FnExpression *)let_st->value);
+  return compile_assignment(self, node, &let_st->name->value, let_st->value,
+                            self->locals == NULL);
+}
+
+static bool compile_loop_body(AotCompiler *self, const BlockStatement *body,
+                              const Statement *update) {
+  self->indent++;
+  open_block(self);
+  CType flow;
+  for (int32_t i = 0; i < body->statements.size; i++)
+    if (!compile_statement(self, body->statements.data[i], &flow))
+      return false;
+  if (update != NULL && !compile_statement(self, update, &flow))
+    return false;
+  close_block(self);
+  return true;
+}
+
+static bool compile_for(AotCompiler *self, const ForStatement *for_st) {
+  const Node *node = (const Node *)for_st;
+  if (for_st->body == NULL)
+    return aot_error(self, "missing for body", node);
+  bool global = self->locals == NULL;
+
+  if (for_st->variable != NULL) {
+    if (for_st->start == NULL || for_st->end == NULL)
+      return aot_error(self, "incomplete for range", node);
+    const String *name = &for_st->variable->value;
+    if (!compile_assignment(self, node, name, for_st->start, global))
+      return false;
+    if (current_scope(self)->bindings[scope_find(current_scope(self), name)]
+            .type != CTYPE_INT)
+      return aot_error(self, "ranges have to be ints", node);
+    // evaluated once
+    Operand end;
+    if (!compile_expression(self, for_st->end, true, &end) ||
+        !require_type(self, &end, CTYPE_INT, "ranges have to be ints",
+                      for_st->end))
+      return false;
+
+    const char *prefix = var_prefix(global);
+    char text[OPERAND_TEXT_MAX];
+    line(self, "while (%s%s < %s) {", prefix, name->chars,
+         operand_text(&end, text));
+    if (!compile_loop_body(self, for_st->body, NULL))
+      return false;
+    line(self, "%s%s = fizz_add(%s%s, 1);", prefix, name->chars, prefix,
+         name->chars);
+    self->indent--;
+    line(self, "}");
+    return true;
+  }
+
+  CType flow;
+  if (for_st->init != NULL && !compile_statement(self, for_st->init, &flow))
+    return false;
+  line(self, "for (;;) {");
+  if (for_st->condition != NULL) {
+    self->indent++;
+    Operand condition;
+    if (!compile_expression(self, for_st->condition, true, &condition) ||
+        !require_type(self, &condition, CTYPE_BOOL,
+                      "conditions have to be booleans", for_st->condition))
+      return false;
+    char text[OPERAND_TEXT_MAX];
+    line(self, "if (!%s)", operand_text(&condition, text));
+    line(self, "  break;");
+    self->indent--;
+  }
+  if (!compile_loop_body(self, for_st->body, for_st->update))
+    return false;
+  self->indent--;
+  line(self, "}");
+  return true;
+}
+
+static bool compile_return(AotCompiler *self, const ReturnStatement *ret_st) {
+  const Node *node = (const Node *)ret_st;
+  if (ret_st->value == NULL)
+    return aot_error(self, "incomplete return statement", node);
+  bool in_function = self->locals != NULL;
+  Operand value;
+  if (!compile_expression(self, ret_st->value, in_function, &value))
+    return false;
+  if (!in_function) {
+    // the value of the top level goes nowhere
+    line(self, "return;");
+    return true;
+  }
+
+  if (value.type != CTYPE_NEVER &&
+      !ctype_join(self->fn_result, value.type, &self->fn_result))
+    return aot_error(self, "function returns values of different types",
+                     node);
+  char text[OPERAND_TEXT_MAX];
+  if (has_value(value.type))
+    line(self, "return %s;", operand_text(&value, text));
+  else
+    line(self, "return;");
+  return true;
+}
+
+// `flow` is CTYPE_NEVER after a return
+static bool compile_statement(AotCompiler *self, const Statement *st,
+                              CType *flow) {
+  *flow = CTYPE_VOID;
+  if (st == NULL)
+    return aot_error(self, "invalid statement", NULL);
+
+  switch (st->vt->kind) {
+  case NODE_LET_STATEMENT:
+    return compile_let(self, (const LetStatement *)st);
+  case NODE_RETURN_STATEMENT:
+    *flow = CTYPE_NEVER;
+    return compile_return(self, (const ReturnStatement *)st);
+  case NODE_EXPR_STATEMENT: {
+    Operand ignored;
+    return compile_expression(self, ((const ExpressionStatement *)st)->expr,
+                              false, &ignored);
+  }
+  case NODE_BLOCK_STATEMENT: {
+    Operand value;
+    if (!compile_block_value(self, (const BlockStatement *)st, false, &value))
+      return false;
+    *flow = value.type == CTYPE_NEVER ? CTYPE_NEVER : CTYPE_VOID;
+    return true;
+  }
+  case NODE_FOR_STATEMENT:
+    return compile_for(self, (const ForStatement *)st);
+  default:
+    return aot_error(self, "unsupported statement", st);
+  }
+}
+
+bool aot_emit_c(const Program *program, const char *source_name, String *out,
+                String *error) {
+  assert(program != NULL);
+  assert(out != NULL);
+  assert(error != NULL);
+  *out = STR_NULL;
+  *error = STR_NULL;
+
+  CodeBuffer main_body = buffer_init();
+  AotCompiler compiler = {.globals = scope_init(),
+                          .locals = NULL,
+                          .fn_name = NULL,
+                          .out = &main_body,
+                          .indent = 1,
+                          .next_temp = 0,
+                          .next_block = 0,
+                          .functions = buffer_init(),
+                          .error = error};
+  open_block(&compiler);
+
+  bool ok = true;
+  CType flow;
+  for (int32_t i = 0; i < program->statements.size && ok; i++)
+    ok = compile_statement(&compiler, program->statements.data[i], &flow);
+
+  if (ok) {
+    CodeBuffer file = buffer_init();
+    buffer_printf(&file,
+                  "// Generated by `fizzlang compile --emit-c` from %s.\n"
+                  "//\n"
+                  "// Build an executable with `cc -std=c99 -O2`, or a "
+                  "library with\n"
+                  "// `-DFIZZ_NO_MAIN -fPIC -shared` whose users call "
+                  "fizz_main once before\n"
+                  "// any fz_ function.\n\n"
+                  "#include <inttypes.h>\n"
+                  "#include <stdbool.h>\n"
+                  "#include <stdint.h>\n"
+                  "#include <stdio.h>\n"
+                  "#include <stdlib.h>\n\n"
+                  "%s\n",
+                  source_name, RUNTIME);
+    bool any_global = false;
+    for (int32_t i = 0; i < compiler.globals.size; i++) {
+      const Binding *binding = &compiler.globals.bindings[i];
+      if (binding->kind != BINDING_VAR)
+        continue;
+      buffer_printf(&file, "static %s g_%s;\n", ctype_name(binding->type),
+                    binding->name->chars);
+      any_global = true;
+    }
+    buffer_printf(&file,
+                  "%s%s"
+                  "void fizz_main(void) {\n"
+                  "%s"
+                  "}\n\n"
+                  "#ifndef FIZZ_NO_MAIN\n"
+                  "int main(void) {\n"
+                  "  fizz_main();\n"
+                  "  return EXIT_SUCCESS;\n"
+                  "}\n"
+                  "#endif\n",
+                  any_global ? "\n" : "", compiler.functions.chars,
+                  main_body.chars);
+    *out = String_from(file.chars);
+    free_buffer(&file);
+  }
+
+  free_buffer(&main_body);
+  free_buffer(&compiler.functions);
+  free_scope(&compiler.globals);
+  return ok;
+}
@@ -0,0 +1,34 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdbool.h>
+
+#include "parser.h"
+
+#include "cstring.h/cstring.h"
+
+// Translates a program to one self-contained C99 file for
+// `fizzlang compile --emit-c`, to be built with the system compiler instead
+// of being interpreted.
+//
+// Only the int and boolean part of the language is translated. Every value
+// has a static type: function parameters are ints, and function results,
+// variables and globals get the type of their first binding. Functions
+// become plain C functions named `fz_<name>` over int64_t and bool, with no
+// boxing. Division by zero fails as in the interpreter, but an overflowing
+// int is not widened to a big int, the C code fails with "integer
+// overflow". The top level becomes `fizz_main`. The file defines `main`
+// unless it is built with FIZZ_NO_MAIN, and a FIZZ_FAIL(message) macro
+// defined before it replaces the default handler, which prints the message
+// and exits.
+//
+// Programs using strings, arrays, maps, big int literals, @memo, builtins
+// other than echo, or functions as values are rejected. Functions have to be
+// bound once by a `let` at the top level.
+//
+// False with `error` set when the program leaves the subset. `source_name`
+// only goes into the header comment.
+bool aot_emit_c(const Program *program, const char *source_name, String *out,
+                String *error);
+
+#endif // !AOT_H
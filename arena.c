@@ -1 +1,81 @@
+#include <assert.h>
+#include <stdlib.h>
+
 #include "arena.h"
+
+#define CHUNK_HEADER_SIZE ((sizeof(ArenaChunk) + 15) & ~(size_t)15)
+
+static ArenaChunk *chunk_new(size_t capacity) {
+  ArenaChunk *chunk = malloc(CHUNK_HEADER_SIZE + capacity);
+  assert(chunk != NULL);
+  chunk->capacity = capacity;
+  chunk->data = (uint8_t *)chunk + CHUNK_HEADER_SIZE;
+  return chunk;
+}
+
+void *arena_alloc(Arena *self, size_t size) {
+  assert(self != NULL);
+  size = (size + 15) & ~(size_t)15;
+
+  ArenaChunk *chunk = self->current;
+  if (chunk == NULL || chunk->used + size > chunk->capacity) {
+    if (self->spare != NULL && self->spare->capacity >= size) {
+      chunk = self->spare;
+      self->spare = chunk->prev;
+    } else {
+      chunk = chunk_new(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+    }
+    chunk->prev = self->current;
+    chunk->used = 0;
+    self->current = chunk;
+  }
+
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+ArenaMark arena_mark(const Arena *self) {
+  assert(self != NULL);
+  return (ArenaMark){self->current,
+                     self->current != NULL ? self->current->used : 0};
+}
+
+void arena_release(Arena *self, ArenaMark mark) {
+  assert(self != NULL);
+  while (self->current != mark.chunk) {
+    assert(self->current != NULL);
+    ArenaChunk *chunk = self->current;
+    // the first chunk stays current, a region entered while the arena was
+    // empty would otherwise move it to the spare list and back on every use
+    if (mark.chunk == NULL && chunk->prev == NULL &&
+        chunk->capacity == ARENA_CHUNK_SIZE) {
+      chunk->used = 0;
+      return;
+    }
+    self->current = chunk->prev;
+    // an oversized chunk is not worth keeping
+    if (chunk->capacity > ARENA_CHUNK_SIZE) {
+      free(chunk);
+      continue;
+    }
+    chunk->prev = self->spare;
+    self->spare = chunk;
+  }
+  if (mark.chunk != NULL) {
+    assert(mark.used <= mark.chunk->used);
+    mark.chunk->used = mark.used;
+  }
+}
+
+void free_arena(Arena *self) {
+  assert(self != NULL);
+  arena_release(self, (ArenaMark){NULL, 0});
+  free(self->current);
+  self->current = NULL;
+  while (self->spare != NULL) {
+    ArenaChunk *chunk = self->spare;
+    self->spare = chunk->prev;
+    free(chunk);
+  }
+}
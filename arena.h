@@ -1,4 +1,38 @@
 #ifndef ARENA_H
 #define ARENA_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// bytes requested from malloc at a time, larger allocations get a chunk of
+// their own
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct ArenaChunk {
+  struct ArenaChunk *prev;
+  size_t capacity;
+  size_t used;
+  // 16 byte aligned, right after the header
+  uint8_t *data;
+} ArenaChunk;
+
+// Bump allocator released in LIFO order. Chunks emptied by a release are kept
+// for the next allocations instead of going back to malloc.
+typedef struct Arena {
+  ArenaChunk *current;
+  ArenaChunk *spare;
+} Arena;
+
+// everything allocated after the mark is released by arena_release
+typedef struct ArenaMark {
+  ArenaChunk *chunk;
+  size_t used;
+} ArenaMark;
+
+void *arena_alloc(Arena *self, size_t size);
+ArenaMark arena_mark(const Arena *self);
+void arena_release(Arena *self, ArenaMark mark);
+// returns every chunk to malloc, the arena can be used again afterwards
+void free_arena(Arena *self);
+
 #endif // !ARENA_H
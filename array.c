@@ -0,0 +1,115 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "gc.h"
+#include "object.h"
+
+#include "cstring.h/cstring.h"
+
+static bool all_ints(const Value *items, int32_t length) {
+  for (int32_t i = 0; i < length; i++) {
+    if (!IS_INT(items[i]))
+      return false;
+  }
+  return true;
+}
+
+static ArrayObject *array_alloc(Heap *heap, int32_t length, bool packed) {
+  size_t element_size = packed ? sizeof(int64_t) : sizeof(Value);
+  ArrayObject *arr = (ArrayObject *)object_alloc(
+      heap, &ARRAY_VT, sizeof(ArrayObject) + element_size * (size_t)length);
+
+  arr->length = length;
+  arr->packed = packed;
+
+  return arr;
+}
+
+bool array_new(Heap *heap, const Value *items, int32_t length, Value *out) {
+  assert(length >= 0);
+  if (length > ARRAY_MAX_LENGTH)
+    return false;
+
+  // the types of the items stay the same if allocating moves them
+  bool packed = all_ints(items, length);
+  ArrayObject *arr = array_alloc(heap, length, packed);
+
+  if (packed) {
+    int64_t *ints = array_ints(arr);
+    for (int32_t i = 0; i < length; i++)
+      ints[i] = items[i].as.integer;
+  } else {
+    Value *values = array_values(arr);
+    for (int32_t i = 0; i < length; i++) {
+      values[i] = items[i];
+      gc_write_barrier(heap, &arr->base, values[i]);
+    }
+  }
+
+  *out = OBJ_VAL(arr);
+  return true;
+}
+
+bool array_push(Heap *heap, Value array, Value value, Value *out) {
+  assert(IS_ARRAY(array));
+  int32_t length = ((const ArrayObject *)array.as.obj)->length;
+  if (length >= ARRAY_MAX_LENGTH)
+    return false;
+
+  bool packed = ((const ArrayObject *)array.as.obj)->packed && IS_INT(value);
+  heap_push_root(heap, &array);
+  heap_push_root(heap, &value);
+  ArrayObject *arr = array_alloc(heap, length + 1, packed);
+  heap_pop_root(heap);
+  heap_pop_root(heap);
+
+  // the operands may have moved
+  ArrayObject *src = (ArrayObject *)array.as.obj;
+  if (packed) {
+    memcpy(array_ints(arr), array_ints(src), sizeof(int64_t) * length);
+    array_ints(arr)[length] = value.as.integer;
+  } else {
+    // a packed source is widened into tagged values here
+    Value *values = array_values(arr);
+    for (int32_t i = 0; i < length; i++) {
+      values[i] = array_get(src, i);
+      gc_write_barrier(heap, &arr->base, values[i]);
+    }
+    values[length] = value;
+    gc_write_barrier(heap, &arr->base, value);
+  }
+
+  *out = OBJ_VAL(arr);
+  return true;
+}
+
+String array_inspect(const Object *self) {
+  assert(self != NULL);
+  ArrayObject *arr = (ArrayObject *)self;
+
+  StringArray elements = string_array_init(arr->length);
+  for (int32_t i = 0; i < arr->length; i++)
+    string_array_push(&elements, value_inspect(array_get(arr, i)));
+
+  String l_bracket = STR_NEW("[");
+  String r_bracket = STR_NEW("]");
+  String elements_str = string_array_join(&elements, STR_NEW(", "));
+  String out = String_join(3, &l_bracket, &elements_str, &r_bracket);
+  free_string(&elements_str);
+  free_string_array(&elements);
+
+  return out;
+}
+
+void array_trace(Object *self, Heap *heap) {
+  ArrayObject *arr = (ArrayObject *)self;
+  // integers hold no references
+  if (arr->packed)
+    return;
+
+  Value *values = array_values(arr);
+  for (int32_t i = 0; i < arr->length; i++)
+    gc_visit_value(heap, &values[i]);
+}
@@ -0,0 +1,60 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+
+// keeps the allocation size of the generic representation in a uint32_t
+#define ARRAY_MAX_LENGTH ((int32_t)((UINT32_MAX - 64) / sizeof(Value)))
+
+// Immutable runtime array. While every element is an integer the elements
+// are packed as int64_t, half the size of tagged values and without the type
+// words in between, so numeric arrays stay dense and the collector never
+// scans them. An array built with any other element stores tagged values.
+typedef struct ArrayObject {
+  Object base;
+  int32_t length;
+  // the storage holds `length` int64_t instead of `length` values
+  bool packed;
+  // read through array_ints or array_values depending on `packed`
+  Value storage[];
+} ArrayObject;
+
+String array_inspect(const Object *self);
+void array_trace(Object *self, struct Heap *heap);
+
+static const ObjectVT ARRAY_VT = {
+    ._t = OBJ_ARRAY,
+    .inspect = array_inspect,
+    .finalize = NULL,
+    .trace = array_trace,
+};
+
+#define IS_ARRAY(v) IS_OBJ_TYPE(v, OBJ_ARRAY)
+
+static inline int64_t *array_ints(ArrayObject *self) {
+  return (int64_t *)self->storage;
+}
+
+static inline Value *array_values(ArrayObject *self) { return self->storage; }
+
+// element `index`, which has to be in bounds
+static inline Value array_get(ArrayObject *self, int32_t index) {
+  return self->packed ? INT_VAL(array_ints(self)[index])
+                      : array_values(self)[index];
+}
+
+struct Heap;
+
+// array of the `length` values at `items`, which are read after allocating
+// so they have to be reachable from the roots, e.g. on the VM stack. False
+// when the array would be too long.
+bool array_new(struct Heap *heap, const Value *items, int32_t length,
+               Value *out);
+// copy of `array` with `value` appended, the operands are kept alive by the
+// call. False when the array would be too long.
+bool array_push(struct Heap *heap, Value array, Value value, Value *out);
+
+#endif // !ARRAY_H
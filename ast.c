@@ -373,13 +373,14 @@ void operator_expr_destroy(Node *self) {
 #endif
 }
 
-IntExpr *int_expr_new(const Token t, const int value) {
+IntExpr *int_expr_new(const Token t, const int64_t value) {
   IntExpr *int_expr = malloc(sizeof(IntExpr));
   assert(int_expr != NULL);
 
   int_expr->base.vt = &INT_EXPR_VT;
   int_expr->token = t;
   int_expr->value = value;
+  int_expr->is_big = false;
 
   return int_expr;
 }
@@ -408,6 +409,39 @@ void int_expr_destroy(Node *self) {
   free(self);
 }
 
+StringExpr *string_expr_new(const Token t) {
+  assert(t.type == TOKEN_STRING);
+  StringExpr *string_expr = malloc(sizeof(StringExpr));
+  assert(string_expr != NULL);
+
+  string_expr->base.vt = &STRING_EXPR_VT;
+  string_expr->token = t;
+
+  return string_expr;
+}
+
+String string_expr_token_literal(const Node *self) {
+  assert(self != NULL);
+  const StringExpr *string_expr = (const StringExpr *)self;
+  const String *contents = &string_expr->token.literal;
+
+  return String_substr_range(contents, 0, contents->length);
+}
+
+String string_expr_string(const Node *self) {
+  return string_expr_token_literal(self);
+}
+
+void string_expr_destroy(Node *self) {
+  if (self == NULL)
+    return;
+
+#ifdef DEBUG
+  printf("StringExpr Destroyed\n");
+#endif
+  free(self);
+}
+
 ReturnStatement *return_st_new(const Token t, const Expression *value) {
   ReturnStatement *ret_st = malloc(sizeof(ReturnStatement));
 
@@ -694,8 +728,9 @@ String if_expr_string(const Node *self) {
     String temp = String_clone(&out);
     free_string(&out);
 
-    out = String_join(7, &temp, &else_str, &l_brace, &spc, &alt_str, &spc,
-                      &r_brace);
+    out = String_join(7, &temp, &else_str, &l_brace, &empty_str, &alt_str,
+                      &empty_str, &r_brace);
+    free_string(&temp);
     free_string(&alt_str);
   }
 
@@ -728,12 +763,13 @@ FnExpression *fn_expr_new(const Token t, IdentifiersArray parameters,
   fn_expr->token = t;
   fn_expr->parameters = parameters;
   fn_expr->body = body;
+  fn_expr->memoize = false;
   return fn_expr;
 }
 String fn_expr_string(const Node *self) {
   assert(self != NULL);
   FnExpression *fn_expr = (FnExpression *)self;
-  String fn_str = STR_NEW("fn");
+  String fn_str = STR_NEW(fn_expr->memoize ? "@memo fn" : "fn");
   String l_paren = STR_NEW("(");
   String r_paren = STR_NEW(")");
   String l_brace = STR_NEW("{");
@@ -826,3 +862,249 @@ void call_expr_destroy(Node *self) {
 
   free(self);
 }
+
+ArrayExpression *array_expr_new(const Token t, ExpressionsArray elements) {
+  ArrayExpression *array_expr = malloc(sizeof(ArrayExpression));
+  assert(array_expr != NULL);
+
+  array_expr->base.vt = &ARRAY_EXPRESSION_VT;
+  array_expr->token = t;
+  array_expr->elements = elements;
+
+  return array_expr;
+}
+String array_expr_token_literal(const Node *self) {
+  assert(self != NULL);
+
+  ArrayExpression *array_expr = (ArrayExpression *)self;
+  return String_clone(&array_expr->token.literal);
+}
+String array_expr_string(const Node *self) {
+  assert(self != NULL);
+
+  ArrayExpression *array_expr = (ArrayExpression *)self;
+  String l_bracket = STR_NEW("[");
+  String r_bracket = STR_NEW("]");
+  StringArray element_list = string_array_init(array_expr->elements.size);
+  for (int32_t i = 0; i < array_expr->elements.size; i++) {
+    Expression *element = expressions_get(&array_expr->elements, i);
+    string_array_push(&element_list, element->vt->string(element));
+  }
+
+  String elements_str = string_array_join(&element_list, STR_NEW(", "));
+
+  String out = String_join(3, &l_bracket, &elements_str, &r_bracket);
+  free_string(&elements_str);
+  free_string_array(&element_list);
+  return out;
+}
+void array_expr_destroy(Node *self) {
+  if (self == NULL)
+    return;
+
+  ArrayExpression *array_expr = (ArrayExpression *)self;
+  free_token(&array_expr->token);
+  free_expressions(&array_expr->elements);
+
+  free(self);
+}
+
+IndexExpression *index_expr_new(const Token t, Expression *left,
+                                Expression *index) {
+  IndexExpression *index_expr = malloc(sizeof(IndexExpression));
+  assert(index_expr != NULL);
+
+  index_expr->base.vt = &INDEX_EXPRESSION_VT;
+  index_expr->token = t;
+  index_expr->left = left;
+  index_expr->index = index;
+
+  return index_expr;
+}
+String index_expr_token_literal(const Node *self) {
+  assert(self != NULL);
+
+  IndexExpression *index_expr = (IndexExpression *)self;
+  return String_clone(&index_expr->token.literal);
+}
+String index_expr_string(const Node *self) {
+  assert(self != NULL);
+
+  IndexExpression *index_expr = (IndexExpression *)self;
+  String l_paren = STR_NEW("(");
+  String r_paren = STR_NEW(")");
+  String l_bracket = STR_NEW("[");
+  String r_bracket = STR_NEW("]");
+  String left_str = index_expr->left->vt->string(index_expr->left);
+  String index_str = index_expr->index->vt->string(index_expr->index);
+
+  String out = String_join(6, &l_paren, &left_str, &l_bracket, &index_str,
+                           &r_bracket, &r_paren);
+  free_string(&left_str);
+  free_string(&index_str);
+  return out;
+}
+void index_expr_destroy(Node *self) {
+  if (self == NULL)
+    return;
+
+  IndexExpression *index_expr = (IndexExpression *)self;
+  if (index_expr->left != NULL)
+    index_expr->left->vt->destroy(index_expr->left);
+  if (index_expr->index != NULL)
+    index_expr->index->vt->destroy(index_expr->index);
+  free_token(&index_expr->token);
+
+  free(self);
+}
+
+MapExpression *map_expr_new(const Token t, ExpressionsArray keys,
+                            ExpressionsArray values) {
+  assert(keys.size == values.size);
+  MapExpression *map_expr = malloc(sizeof(MapExpression));
+  assert(map_expr != NULL);
+
+  map_expr->base.vt = &MAP_EXPRESSION_VT;
+  map_expr->token = t;
+  map_expr->keys = keys;
+  map_expr->values = values;
+
+  return map_expr;
+}
+String map_expr_token_literal(const Node *self) {
+  assert(self != NULL);
+
+  MapExpression *map_expr = (MapExpression *)self;
+  return String_clone(&map_expr->token.literal);
+}
+String map_expr_string(const Node *self) {
+  assert(self != NULL);
+
+  MapExpression *map_expr = (MapExpression *)self;
+  String l_brace = STR_NEW("{");
+  String r_brace = STR_NEW("}");
+  String colon = STR_NEW(": ");
+  StringArray pair_list = string_array_init(map_expr->keys.size);
+  for (int32_t i = 0; i < map_expr->keys.size; i++) {
+    Expression *key = expressions_get(&map_expr->keys, i);
+    Expression *value = expressions_get(&map_expr->values, i);
+    String key_str = key->vt->string(key);
+    String value_str = value->vt->string(value);
+    string_array_push(&pair_list, String_join(3, &key_str, &colon, &value_str));
+    free_string(&key_str);
+    free_string(&value_str);
+  }
+
+  String pairs_str = string_array_join(&pair_list, STR_NEW(", "));
+
+  String out = String_join(3, &l_brace, &pairs_str, &r_brace);
+  free_string(&pairs_str);
+  free_string_array(&pair_list);
+  return out;
+}
+void map_expr_destroy(Node *self) {
+  if (self == NULL)
+    return;
+
+  MapExpression *map_expr = (MapExpression *)self;
+  free_token(&map_expr->token);
+  free_expressions(&map_expr->keys);
+  free_expressions(&map_expr->values);
+
+  free(self);
+}
+
+ForStatement *for_statement_new(const Token t) {
+  ForStatement *for_st = malloc(sizeof(ForStatement));
+  assert(for_st != NULL);
+
+  for_st->base.vt = &FOR_STATEMENT_VT;
+  for_st->token = t;
+  for_st->init = NULL;
+  for_st->condition = NULL;
+  for_st->update = NULL;
+  for_st->variable = NULL;
+  for_st->start = NULL;
+  for_st->end = NULL;
+  for_st->body = NULL;
+
+  return for_st;
+}
+String for_statement_token_literal(const Node *self) {
+  assert(self != NULL);
+
+  ForStatement *for_st = (ForStatement *)self;
+  return String_clone(&for_st->token.literal);
+}
+
+// string of a loop clause without the `;` a let statement ends with
+static String clause_string(const Node *clause) {
+  if (clause == NULL)
+    return String_from("");
+
+  String str = clause->vt->string(clause);
+  if (str.length > 0 && str.chars[str.length - 1] == ';') {
+    String trimmed = String_substr_range(&str, 0, str.length - 1);
+    free_string(&str);
+    return trimmed;
+  }
+  return str;
+}
+
+String for_statement_string(const Node *self) {
+  assert(self != NULL);
+  ForStatement *for_st = (ForStatement *)self;
+
+  String l_paren = STR_NEW("for (");
+  String r_paren = STR_NEW(") {");
+  String r_brace = STR_NEW("}");
+  String header;
+  if (for_st->variable != NULL) {
+    String in_str = STR_NEW(" in ");
+    String range_str = STR_NEW("..");
+    String start_str = clause_string(for_st->start);
+    String end_str = clause_string(for_st->end);
+    header = String_join(5, &for_st->variable->value, &in_str, &start_str,
+                         &range_str, &end_str);
+    free_string(&start_str);
+    free_string(&end_str);
+  } else {
+    String separator = STR_NEW("; ");
+    String init_str = clause_string(for_st->init);
+    String cond_str = clause_string(for_st->condition);
+    String update_str = clause_string(for_st->update);
+    header = String_join(5, &init_str, &separator, &cond_str, &separator,
+                         &update_str);
+    free_string(&init_str);
+    free_string(&cond_str);
+    free_string(&update_str);
+  }
+
+  String body_str = for_st->body->base.vt->string((Node *)for_st->body);
+  String out = String_join(5, &l_paren, &header, &r_paren, &body_str, &r_brace);
+  free_string(&header);
+  free_string(&body_str);
+
+  return out;
+}
+static void destroy_clause(Node *clause) {
+  if (clause != NULL)
+    clause->vt->destroy(clause);
+}
+
+void for_statement_destroy(Node *self) {
+  if (self == NULL)
+    return;
+
+  ForStatement *for_st = (ForStatement *)self;
+  destroy_clause(for_st->init);
+  destroy_clause(for_st->condition);
+  destroy_clause(for_st->update);
+  destroy_clause((Node *)for_st->variable);
+  destroy_clause(for_st->start);
+  destroy_clause(for_st->end);
+  destroy_clause((Node *)for_st->body);
+  free_token(&for_st->token);
+
+  free(self);
+}
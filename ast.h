@@ -5,10 +5,33 @@
 
 typedef enum NodeType { EXPRESSION, STATEMENT } NodeType;
 
+// concrete node type, used by the compiler to dispatch on the AST shape
+typedef enum NodeKind {
+  NODE_IDENTIFIER,
+  NODE_LET_STATEMENT,
+  NODE_OPERATOR_EXPR,
+  NODE_INT_EXPR,
+  NODE_RETURN_STATEMENT,
+  NODE_EXPR_STATEMENT,
+  NODE_PREFIX_EXPR,
+  NODE_INFIX_EXPR,
+  NODE_BOOLEAN_EXPR,
+  NODE_BLOCK_STATEMENT,
+  NODE_IF_EXPR,
+  NODE_FN_EXPR,
+  NODE_CALL_EXPR,
+  NODE_STRING_EXPR,
+  NODE_ARRAY_EXPR,
+  NODE_INDEX_EXPR,
+  NODE_MAP_EXPR,
+  NODE_FOR_STATEMENT,
+} NodeKind;
+
 typedef struct Node Node;
 
 typedef struct NodeVT {
   NodeType _t;
+  NodeKind kind;
   String (*token_literal)(const Node *self);
   String (*string)(const Node *self);
   void (*destroy)(Node *self);
@@ -107,6 +130,7 @@ void ident_destroy(Node *self);
 
 static const NodeVT IDENTIFIER_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_IDENTIFIER,
     .token_literal = ident_token_literal,
     .string = ident_string,
     .destroy = ident_destroy,
@@ -126,6 +150,7 @@ void let_statement_destroy(Node *self);
 
 static const NodeVT LET_STATEMENT_VT = {
     ._t = STATEMENT,
+    .kind = NODE_LET_STATEMENT,
     .token_literal = let_statement_token_literal,
     .string = let_statement_string,
     .destroy = let_statement_destroy,
@@ -145,6 +170,7 @@ void operator_expr_destroy(Node *self);
 
 static const NodeVT OPERATOR_EXPR_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_OPERATOR_EXPR,
     .token_literal = operator_expr_token_literal,
     .string = operator_expr_string,
     .destroy = operator_expr_destroy,
@@ -153,21 +179,43 @@ static const NodeVT OPERATOR_EXPR_VT = {
 typedef struct IntExpr {
   Expression base;
   Token token;
-  int32_t value;
+  int64_t value;
+  // the literal does not fit in int64_t, its digits are kept in `token`
+  bool is_big;
 } IntExpr;
 
-IntExpr *int_expr_new(const Token t, int value);
+IntExpr *int_expr_new(const Token t, int64_t value);
 String int_expr_token_literal(const Node *self);
 String int_expr_string(const Node *self);
 void int_expr_destroy(Node *self);
 
 static const NodeVT INT_EXPR_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_INT_EXPR,
     .token_literal = int_expr_token_literal,
     .string = int_expr_string,
     .destroy = int_expr_destroy,
 };
 
+typedef struct StringExpr {
+  Expression base;
+  // the contents are the token literal, borrowed from the lexer input
+  Token token;
+} StringExpr;
+
+StringExpr *string_expr_new(const Token t);
+String string_expr_token_literal(const Node *self);
+String string_expr_string(const Node *self);
+void string_expr_destroy(Node *self);
+
+static const NodeVT STRING_EXPR_VT = {
+    ._t = EXPRESSION,
+    .kind = NODE_STRING_EXPR,
+    .token_literal = string_expr_token_literal,
+    .string = string_expr_string,
+    .destroy = string_expr_destroy,
+};
+
 typedef struct {
   Statement base;
   Token token;
@@ -181,6 +229,7 @@ void return_st_destroy(Node *self);
 
 static const NodeVT RETURN_ST_VT = {
     ._t = STATEMENT,
+    .kind = NODE_RETURN_STATEMENT,
     .token_literal = return_st_token_literal,
     .string = return_st_string,
     .destroy = return_st_destroy,
@@ -199,6 +248,7 @@ void expr_st_destroy(Node *self);
 
 static const NodeVT EXPR_ST_VT = {
     ._t = STATEMENT,
+    .kind = NODE_EXPR_STATEMENT,
     .token_literal = expr_st_token_literal,
     .string = expr_st_string,
     .destroy = expr_st_destroy,
@@ -222,6 +272,7 @@ void prefix_expr_destroy(Node *self);
 
 static const NodeVT PREFIX_EXPR_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_PREFIX_EXPR,
     .token_literal = prefix_expr_token_literal,
     .string = prefix_expr_string,
     .destroy = prefix_expr_destroy,
@@ -243,6 +294,7 @@ void infix_expr_destroy(Node *self);
 
 static const NodeVT INFIX_EXPR_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_INFIX_EXPR,
     .token_literal = infix_expr_token_literal,
     .string = infix_expr_string,
     .destroy = infix_expr_destroy,
@@ -261,6 +313,7 @@ void bool_expr_destroy(Node *self);
 
 static const NodeVT BOOLEAN_EXPR_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_BOOLEAN_EXPR,
     .token_literal = bool_expr_token_literal,
     .string = bool_expr_string,
     .destroy = bool_expr_destroy,
@@ -279,6 +332,7 @@ void block_statement_destroy(Node *self);
 
 static const NodeVT BLOCK_STATEMENT_VT = {
     ._t = STATEMENT,
+    .kind = NODE_BLOCK_STATEMENT,
     .token_literal = block_statement_token_literal,
     .string = block_statement_string,
     .destroy = block_statement_destroy,
@@ -301,6 +355,7 @@ void if_expr_destroy(Node *self);
 
 static const NodeVT IF_EXPRESSION_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_IF_EXPR,
     .token_literal = if_expr_token_literal,
     .string = if_expr_string,
     .destroy = if_expr_destroy,
@@ -311,6 +366,8 @@ typedef struct {
   Token token;
   IdentifiersArray parameters;
   BlockStatement *body;
+  // annotated with `@memo`
+  bool memoize;
 } FnExpression;
 
 FnExpression *fn_expr_new(const Token t, IdentifiersArray parameters,
@@ -321,6 +378,7 @@ void fn_expr_destroy(Node *self);
 
 static const NodeVT FN_EXPRESSION_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_FN_EXPR,
     .token_literal = fn_expr_token_literal,
     .string = fn_expr_string,
     .destroy = fn_expr_destroy,
@@ -341,9 +399,101 @@ void call_expr_destroy(Node *self);
 
 static const NodeVT CALL_EXPRESSION_VT = {
     ._t = EXPRESSION,
+    .kind = NODE_CALL_EXPR,
     .token_literal = call_expr_token_literal,
     .string = call_expr_string,
     .destroy = call_expr_destroy,
 };
 
+typedef struct {
+  Expression base;
+  Token token; // '[' token
+  ExpressionsArray elements;
+} ArrayExpression;
+
+ArrayExpression *array_expr_new(const Token t, ExpressionsArray elements);
+String array_expr_token_literal(const Node *self);
+String array_expr_string(const Node *self);
+void array_expr_destroy(Node *self);
+
+static const NodeVT ARRAY_EXPRESSION_VT = {
+    ._t = EXPRESSION,
+    .kind = NODE_ARRAY_EXPR,
+    .token_literal = array_expr_token_literal,
+    .string = array_expr_string,
+    .destroy = array_expr_destroy,
+};
+
+typedef struct {
+  Expression base;
+  Token token; // '[' token
+  Expression *left;
+  Expression *index;
+} IndexExpression;
+
+IndexExpression *index_expr_new(const Token t, Expression *left,
+                                Expression *index);
+String index_expr_token_literal(const Node *self);
+String index_expr_string(const Node *self);
+void index_expr_destroy(Node *self);
+
+static const NodeVT INDEX_EXPRESSION_VT = {
+    ._t = EXPRESSION,
+    .kind = NODE_INDEX_EXPR,
+    .token_literal = index_expr_token_literal,
+    .string = index_expr_string,
+    .destroy = index_expr_destroy,
+};
+
+typedef struct {
+  Expression base;
+  Token token; // '{' token
+  // pairs in source order, `values.data[i]` belongs to `keys.data[i]`
+  ExpressionsArray keys;
+  ExpressionsArray values;
+} MapExpression;
+
+MapExpression *map_expr_new(const Token t, ExpressionsArray keys,
+                            ExpressionsArray values);
+String map_expr_token_literal(const Node *self);
+String map_expr_string(const Node *self);
+void map_expr_destroy(Node *self);
+
+static const NodeVT MAP_EXPRESSION_VT = {
+    ._t = EXPRESSION,
+    .kind = NODE_MAP_EXPR,
+    .token_literal = map_expr_token_literal,
+    .string = map_expr_string,
+    .destroy = map_expr_destroy,
+};
+
+// `for (init; condition; update) {...}` or `for (name in start..end) {...}`.
+// The range form counts `name` up from `start` while it is below `end`, which
+// is evaluated once. Any clause of the first form can be left out.
+typedef struct {
+  Statement base;
+  Token token;
+  Statement *init;
+  Expression *condition;
+  Statement *update;
+  // set for the range form only
+  Identifier *variable;
+  Expression *start;
+  Expression *end;
+  BlockStatement *body;
+} ForStatement;
+
+ForStatement *for_statement_new(const Token t);
+String for_statement_token_literal(const Node *self);
+String for_statement_string(const Node *self);
+void for_statement_destroy(Node *self);
+
+static const NodeVT FOR_STATEMENT_VT = {
+    ._t = STATEMENT,
+    .kind = NODE_FOR_STATEMENT,
+    .token_literal = for_statement_token_literal,
+    .string = for_statement_string,
+    .destroy = for_statement_destroy,
+};
+
 #endif // !AST_H
@@ -0,0 +1,622 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#include "ast.h"
+#include "batch.h"
+
+#include "cstring.h/cstring.h"
+
+#define BATCH_ERROR_MAX 256
+
+typedef struct BatchCompiler {
+  BatchProgram *program;
+  int32_t ops_capacity;
+  int32_t registers_capacity;
+  String *error;
+} BatchCompiler;
+
+static int32_t compile_node(BatchCompiler *self, const Expression *expr,
+                            int32_t guard);
+
+// always returns -1, the register of a failed compilation
+static int32_t batch_error(BatchCompiler *self, const char *message,
+                           const Expression *expr) {
+  char buf[BATCH_ERROR_MAX];
+  String source = expr->vt->string(expr);
+  snprintf(buf, BATCH_ERROR_MAX, "%s: %s", message, source.chars);
+  free_string(&source);
+
+  *self->error = String_from(buf);
+  return -1;
+}
+
+static int32_t add_register(BatchCompiler *self, BatchRegisterKind kind,
+                            BatchType type, int64_t value) {
+  BatchProgram *program = self->program;
+  if (program->num_registers == self->registers_capacity) {
+    self->registers_capacity *= 2;
+    program->registers =
+        realloc(program->registers,
+                sizeof(BatchRegister) * self->registers_capacity);
+    assert(program->registers != NULL);
+  }
+
+  program->registers[program->num_registers] =
+      (BatchRegister){.kind = kind, .type = type, .value = value};
+  return program->num_registers++;
+}
+
+// the register holding the result of the new operation
+static int32_t emit_op(BatchCompiler *self, BatchOpcode opcode, BatchType type,
+                       int32_t a, int32_t b, int32_t c, int32_t guard) {
+  BatchProgram *program = self->program;
+  if (program->num_ops == self->ops_capacity) {
+    self->ops_capacity *= 2;
+    program->ops =
+        realloc(program->ops, sizeof(BatchOp) * self->ops_capacity);
+    assert(program->ops != NULL);
+  }
+
+  int32_t dst = add_register(self, BATCH_REG_TEMP, type, 0);
+  program->ops[program->num_ops++] = (BatchOp){
+      .opcode = opcode, .dst = dst, .a = a, .b = b, .c = c, .guard = guard};
+  return dst;
+}
+
+static BatchType register_type(const BatchCompiler *self, int32_t reg) {
+  return self->program->registers[reg].type;
+}
+
+static int32_t compile_identifier(BatchCompiler *self,
+                                  const Identifier *ident) {
+  BatchProgram *program = self->program;
+  int32_t column = batch_column(program, ident->value.chars);
+  if (column < 0) {
+    column = program->columns.size;
+    string_array_push(&program->columns, String_clone(&ident->value));
+  }
+
+  // one register per column, found again on every later use
+  for (int32_t i = 0; i < program->num_registers; i++)
+    if (program->registers[i].kind == BATCH_REG_COLUMN &&
+        program->registers[i].value == column)
+      return i;
+  return add_register(self, BATCH_REG_COLUMN, BATCH_INT, column);
+}
+
+static int32_t compile_prefix(BatchCompiler *self,
+                              const PrefixExpression *prefix, int32_t guard) {
+  int32_t right = compile_node(self, prefix->right, guard);
+  if (right < 0)
+    return -1;
+  BatchType type = register_type(self, right);
+  const Expression *expr = (const Expression *)prefix;
+
+  switch (prefix->token.type) {
+  case TOKEN_MINUS:
+    if (type != BATCH_INT)
+      return batch_error(self, "`-` needs an int", expr);
+    return emit_op(self, BATCH_NEG, BATCH_INT, right, -1, -1, guard);
+  case TOKEN_PLUS:
+    if (type != BATCH_INT)
+      return batch_error(self, "`+` needs an int", expr);
+    return right;
+  case TOKEN_BANG:
+    if (type != BATCH_BOOL)
+      return batch_error(self, "`!` needs a boolean", expr);
+    return emit_op(self, BATCH_NOT, BATCH_BOOL, right, -1, -1, guard);
+  default:
+    return batch_error(self, "unsupported in batch expressions", expr);
+  }
+}
+
+static int32_t compile_infix(BatchCompiler *self,
+                             const InfixExpression *infix, int32_t guard) {
+  int32_t left = compile_node(self, infix->left, guard);
+  if (left < 0)
+    return -1;
+  int32_t right = compile_node(self, infix->right, guard);
+  if (right < 0)
+    return -1;
+  BatchType left_type = register_type(self, left);
+  BatchType right_type = register_type(self, right);
+  const Expression *expr = (const Expression *)infix;
+
+  BatchOpcode opcode;
+  BatchType type = BATCH_BOOL;
+  switch (infix->token.type) {
+  case TOKEN_EQ:
+  case TOKEN_NOT_EQ:
+    if (left_type != right_type)
+      return batch_error(self, "comparing an int with a boolean", expr);
+    opcode = infix->token.type == TOKEN_EQ ? BATCH_EQ : BATCH_NOT_EQ;
+    return emit_op(self, opcode, type, left, right, -1, guard);
+  case TOKEN_PLUS:
+    opcode = BATCH_ADD;
+    type = BATCH_INT;
+    break;
+  case TOKEN_MINUS:
+    opcode = BATCH_SUB;
+    type = BATCH_INT;
+    break;
+  case TOKEN_ASTERISK:
+    opcode = BATCH_MUL;
+    type = BATCH_INT;
+    break;
+  case TOKEN_SLASH:
+    opcode = BATCH_DIV;
+    type = BATCH_INT;
+    break;
+  case TOKEN_LT:
+    opcode = BATCH_LT;
+    break;
+  case TOKEN_GT:
+    opcode = BATCH_GT;
+    break;
+  default:
+    return batch_error(self, "unsupported in batch expressions", expr);
+  }
+
+  if (left_type != BATCH_INT || right_type != BATCH_INT)
+    return batch_error(self, "operands have to be ints", expr);
+  return emit_op(self, opcode, type, left, right, -1, guard);
+}
+
+// the expression a branch block evaluates to
+static const Expression *branch_value(const BlockStatement *block) {
+  if (block == NULL || block->statements.size != 1)
+    return NULL;
+  const Statement *statement = block->statements.data[0];
+  if (statement->vt->kind != NODE_EXPR_STATEMENT)
+    return NULL;
+  return ((const ExpressionStatement *)statement)->expr;
+}
+
+// Both branches run for every row and a select keeps the one the condition
+// picks. Each branch is guarded by the rows picking it, so a division by
+// zero in the branch that is not taken is no error.
+static int32_t compile_if(BatchCompiler *self, const IfExpression *if_expr,
+                          int32_t guard) {
+  const Expression *expr = (const Expression *)if_expr;
+  const Expression *consequence = branch_value(if_expr->consequence);
+  const Expression *alternative = branch_value(if_expr->alternative);
+  if (consequence == NULL || alternative == NULL)
+    return batch_error(self, "branches have to be single expressions", expr);
+
+  int32_t condition = compile_node(self, if_expr->condition, guard);
+  if (condition < 0)
+    return -1;
+  if (register_type(self, condition) != BATCH_BOOL)
+    return batch_error(self, "the condition has to be a boolean", expr);
+
+  int32_t negated =
+      emit_op(self, BATCH_NOT, BATCH_BOOL, condition, -1, -1, guard);
+  int32_t then_guard = condition, else_guard = negated;
+  if (guard >= 0) {
+    then_guard =
+        emit_op(self, BATCH_AND, BATCH_BOOL, guard, condition, -1, guard);
+    else_guard =
+        emit_op(self, BATCH_AND, BATCH_BOOL, guard, negated, -1, guard);
+  }
+
+  int32_t then_value = compile_node(self, consequence, then_guard);
+  if (then_value < 0)
+    return -1;
+  int32_t else_value = compile_node(self, alternative, else_guard);
+  if (else_value < 0)
+    return -1;
+  BatchType type = register_type(self, then_value);
+  if (type != register_type(self, else_value))
+    return batch_error(self, "branches have different types", expr);
+  return emit_op(self, BATCH_SELECT, type, condition, then_value, else_value,
+                 guard);
+}
+
+static int32_t compile_node(BatchCompiler *self, const Expression *expr,
+                            int32_t guard) {
+  assert(expr != NULL);
+  switch (expr->vt->kind) {
+  case NODE_INT_EXPR: {
+    const IntExpr *int_expr = (const IntExpr *)expr;
+    if (int_expr->is_big)
+      return batch_error(self, "integer literal out of range", expr);
+    return add_register(self, BATCH_REG_CONSTANT, BATCH_INT, int_expr->value);
+  }
+  case NODE_BOOLEAN_EXPR:
+    return add_register(self, BATCH_REG_CONSTANT, BATCH_BOOL,
+                        ((const BooleanExpression *)expr)->value);
+  case NODE_IDENTIFIER:
+    return compile_identifier(self, (const Identifier *)expr);
+  case NODE_PREFIX_EXPR:
+    return compile_prefix(self, (const PrefixExpression *)expr, guard);
+  case NODE_INFIX_EXPR:
+    return compile_infix(self, (const InfixExpression *)expr, guard);
+  case NODE_IF_EXPR:
+    return compile_if(self, (const IfExpression *)expr, guard);
+  default:
+    return batch_error(self, "unsupported in batch expressions", expr);
+  }
+}
+
+BatchProgram *batch_compile(const Expression *expr, String *error) {
+  assert(expr != NULL);
+  assert(error != NULL);
+  *error = STR_NULL;
+  BatchProgram *program = malloc(sizeof(BatchProgram));
+  assert(program != NULL);
+
+  BatchCompiler compiler = {.program = program,
+                            .ops_capacity = 8,
+                            .registers_capacity = 8,
+                            .error = error};
+  program->ops = malloc(sizeof(BatchOp) * compiler.ops_capacity);
+  assert(program->ops != NULL);
+  program->num_ops = 0;
+  program->registers =
+      malloc(sizeof(BatchRegister) * compiler.registers_capacity);
+  assert(program->registers != NULL);
+  program->num_registers = 0;
+  program->columns = string_array_init(4);
+
+  program->result = compile_node(&compiler, expr, -1);
+  if (program->result < 0) {
+    free_batch_program(program);
+    return NULL;
+  }
+  program->type = program->registers[program->result].type;
+  return program;
+}
+
+void free_batch_program(BatchProgram *self) {
+  if (self == NULL)
+    return;
+
+  free(self->ops);
+  free(self->registers);
+  free_string_array(&self->columns);
+  free(self);
+}
+
+int32_t batch_column(const BatchProgram *self, const char *name) {
+  assert(self != NULL);
+  assert(name != NULL);
+  for (int32_t i = 0; i < self->columns.size; i++)
+    if (strcmp(self->columns.data[i].chars, name) == 0)
+      return i;
+  return -1;
+}
+
+// Kernels run one operation over `n` rows and return why a row under its
+// guard failed, NULL when none did. Faults outside the guard are dropped,
+// the result of such a row is never selected. The SSE2 loops handle two
+// rows at a time, the scalar loop the rows left over, or all of them
+// without SSE2.
+typedef struct BatchArgs {
+  const int64_t *a;
+  const int64_t *b;
+  const int64_t *c;
+  // 1 for the rows that count, 0 for the others
+  const int64_t *guard;
+  int64_t *dst;
+  int32_t n;
+} BatchArgs;
+
+typedef const char *(*BatchKernel)(const BatchArgs *args);
+
+#ifdef __SSE2__
+static inline __m128i load_lanes(const int64_t *src) {
+  return _mm_loadu_si128((const __m128i *)src);
+}
+
+static inline void store_lanes(int64_t *dst, __m128i lanes) {
+  _mm_storeu_si128((__m128i *)dst, lanes);
+}
+
+// every bit set in the lanes whose guard is 1
+static inline __m128i guard_mask(const int64_t *guard) {
+  return _mm_sub_epi64(_mm_setzero_si128(), load_lanes(guard));
+}
+
+// the sign bit of a lane holds its fault
+static inline bool any_sign(__m128i lanes) {
+  return _mm_movemask_pd(_mm_castsi128_pd(lanes)) != 0;
+}
+
+// 1 in the lanes where the two values are equal, 0 in the others
+static inline __m128i equal_lanes(__m128i x, __m128i y) {
+  // both 32 bit halves have to match
+  __m128i halves = _mm_cmpeq_epi32(x, y);
+  __m128i both =
+      _mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_and_si128(both, _mm_set1_epi64x(1));
+}
+#endif
+
+static const char *kernel_add(const BatchArgs *args) {
+  const int64_t *a = args->a, *b = args->b, *guard = args->guard;
+  int64_t *dst = args->dst;
+  int32_t i = 0;
+  bool overflow = false;
+#ifdef __SSE2__
+  __m128i faults = _mm_setzero_si128();
+  for (; i + 2 <= args->n; i += 2) {
+    __m128i x = load_lanes(a + i), y = load_lanes(b + i);
+    __m128i sum = _mm_add_epi64(x, y);
+    // the sum has the other sign than both operands
+    __m128i fault =
+        _mm_and_si128(_mm_xor_si128(x, sum), _mm_xor_si128(y, sum));
+    faults = _mm_or_si128(faults, _mm_and_si128(fault, guard_mask(guard + i)));
+    store_lanes(dst + i, sum);
+  }
+  overflow = any_sign(faults);
+#endif
+  for (; i < args->n; i++)
+    overflow |= __builtin_add_overflow(a[i], b[i], &dst[i]) && guard[i];
+  return overflow ? "integer overflow" : NULL;
+}
+
+static const char *kernel_sub(const BatchArgs *args) {
+  const int64_t *a = args->a, *b = args->b, *guard = args->guard;
+  int64_t *dst = args->dst;
+  int32_t i = 0;
+  bool overflow = false;
+#ifdef __SSE2__
+  __m128i faults = _mm_setzero_si128();
+  for (; i + 2 <= args->n; i += 2) {
+    __m128i x = load_lanes(a + i), y = load_lanes(b + i);
+    __m128i diff = _mm_sub_epi64(x, y);
+    // operands of different signs and a difference with the sign of `y`
+    __m128i fault =
+        _mm_and_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, diff));
+    faults = _mm_or_si128(faults, _mm_and_si128(fault, guard_mask(guard + i)));
+    store_lanes(dst + i, diff);
+  }
+  overflow = any_sign(faults);
+#endif
+  for (; i < args->n; i++)
+    overflow |= __builtin_sub_overflow(a[i], b[i], &dst[i]) && guard[i];
+  return overflow ? "integer overflow" : NULL;
+}
+
+// SSE2 has no 64 bit multiply
+static const char *kernel_mul(const BatchArgs *args) {
+  bool overflow = false;
+  for (int32_t i = 0; i < args->n; i++)
+    overflow |=
+        __builtin_mul_overflow(args->a[i], args->b[i], &args->dst[i]) &&
+        args->guard[i];
+  return overflow ? "integer overflow" : NULL;
+}
+
+static const char *kernel_div(const BatchArgs *args) {
+  bool by_zero = false, overflow = false;
+  for (int32_t i = 0; i < args->n; i++) {
+    int64_t x = args->a[i], y = args->b[i];
+    bool zero = y == 0, too_big = y == -1 && x == INT64_MIN;
+    by_zero |= zero && args->guard[i];
+    overflow |= too_big && args->guard[i];
+    args->dst[i] = zero || too_big ? 0 : x / y;
+  }
+  if (by_zero)
+    return "division by zero";
+  return overflow ? "integer overflow" : NULL;
+}
+
+static const char *kernel_neg(const BatchArgs *args) {
+  const int64_t *a = args->a, *guard = args->guard;
+  int64_t *dst = args->dst;
+  int32_t i = 0;
+  bool overflow = false;
+#ifdef __SSE2__
+  __m128i faults = _mm_setzero_si128();
+  for (; i + 2 <= args->n; i += 2) {
+    __m128i x = load_lanes(a + i);
+    __m128i negated = _mm_sub_epi64(_mm_setzero_si128(), x);
+    // only INT64_MIN stays negative
+    __m128i fault = _mm_and_si128(x, negated);
+    faults = _mm_or_si128(faults, _mm_and_si128(fault, guard_mask(guard + i)));
+    store_lanes(dst + i, negated);
+  }
+  overflow = any_sign(faults);
+#endif
+  for (; i < args->n; i++)
+    overflow |= __builtin_sub_overflow(0, a[i], &dst[i]) && guard[i];
+  return overflow ? "integer overflow" : NULL;
+}
+
+// 64 bit compares need SSE4.2
+static const char *kernel_lt(const BatchArgs *args) {
+  int32_t i = 0;
+#ifdef __SSE4_2__
+  for (; i + 2 <= args->n; i += 2) {
+    __m128i less = _mm_cmpgt_epi64(load_lanes(args->b + i),
+                                   load_lanes(args->a + i));
+    store_lanes(args->dst + i, _mm_and_si128(less, _mm_set1_epi64x(1)));
+  }
+#endif
+  for (; i < args->n; i++)
+    args->dst[i] = args->a[i] < args->b[i];
+  return NULL;
+}
+
+static const char *kernel_gt(const BatchArgs *args) {
+  int32_t i = 0;
+#ifdef __SSE4_2__
+  for (; i + 2 <= args->n; i += 2) {
+    __m128i greater = _mm_cmpgt_epi64(load_lanes(args->a + i),
+                                      load_lanes(args->b + i));
+    store_lanes(args->dst + i, _mm_and_si128(greater, _mm_set1_epi64x(1)));
+  }
+#endif
+  for (; i < args->n; i++)
+    args->dst[i] = args->a[i] > args->b[i];
+  return NULL;
+}
+
+static const char *kernel_eq(const BatchArgs *args) {
+  int32_t i = 0;
+#ifdef __SSE2__
+  for (; i + 2 <= args->n; i += 2)
+    store_lanes(args->dst + i, equal_lanes(load_lanes(args->a + i),
+                                           load_lanes(args->b + i)));
+#endif
+  for (; i < args->n; i++)
+    args->dst[i] = args->a[i] == args->b[i];
+  return NULL;
+}
+
+static const char *kernel_not_eq(const BatchArgs *args) {
+  int32_t i = 0;
+#ifdef __SSE2__
+  for (; i + 2 <= args->n; i += 2) {
+    __m128i equal =
+        equal_lanes(load_lanes(args->a + i), load_lanes(args->b + i));
+    store_lanes(args->dst + i, _mm_xor_si128(equal, _mm_set1_epi64x(1)));
+  }
+#endif
+  for (; i < args->n; i++)
+    args->dst[i] = args->a[i] != args->b[i];
+  return NULL;
+}
+
+static const char *kernel_not(const BatchArgs *args) {
+  int32_t i = 0;
+#ifdef __SSE2__
+  for (; i + 2 <= args->n; i += 2)
+    store_lanes(args->dst + i, _mm_xor_si128(load_lanes(args->a + i),
+                                             _mm_set1_epi64x(1)));
+#endif
+  for (; i < args->n; i++)
+    args->dst[i] = args->a[i] ^ 1;
+  return NULL;
+}
+
+static const char *kernel_and(const BatchArgs *args) {
+  int32_t i = 0;
+#ifdef __SSE2__
+  for (; i + 2 <= args->n; i += 2)
+    store_lanes(args->dst + i, _mm_and_si128(load_lanes(args->a + i),
+                                             load_lanes(args->b + i)));
+#endif
+  for (; i < args->n; i++)
+    args->dst[i] = args->a[i] & args->b[i];
+  return NULL;
+}
+
+static const char *kernel_select(const BatchArgs *args) {
+  int32_t i = 0;
+#ifdef __SSE2__
+  for (; i + 2 <= args->n; i += 2) {
+    __m128i picked =
+        _mm_sub_epi64(_mm_setzero_si128(), load_lanes(args->a + i));
+    store_lanes(args->dst + i,
+                _mm_or_si128(_mm_and_si128(picked, load_lanes(args->b + i)),
+                             _mm_andnot_si128(picked,
+                                              load_lanes(args->c + i))));
+  }
+#endif
+  for (; i < args->n; i++)
+    args->dst[i] = args->a[i] ? args->b[i] : args->c[i];
+  return NULL;
+}
+
+static const BatchKernel batch_kernels[] = {
+    [BATCH_ADD] = kernel_add,       [BATCH_SUB] = kernel_sub,
+    [BATCH_MUL] = kernel_mul,       [BATCH_DIV] = kernel_div,
+    [BATCH_NEG] = kernel_neg,       [BATCH_LT] = kernel_lt,
+    [BATCH_GT] = kernel_gt,         [BATCH_EQ] = kernel_eq,
+    [BATCH_NOT_EQ] = kernel_not_eq, [BATCH_NOT] = kernel_not,
+    [BATCH_AND] = kernel_and,       [BATCH_SELECT] = kernel_select,
+};
+
+// Runs the operations chunk by chunk and hands each chunk of results to
+// `ints` or `selection`. Every register has a chunk sized buffer: columns
+// are read in place, constants are filled once.
+static bool run_chunks(const BatchProgram *self, const int64_t *const *columns,
+                       int64_t rows, int64_t *ints, uint64_t *selection,
+                       String *error) {
+  assert(self != NULL);
+  assert(rows >= 0);
+  assert(error != NULL);
+  *error = STR_NULL;
+
+  // one more for the rows outside every `if`
+  int64_t *buffers = malloc(sizeof(int64_t) * BATCH_CHUNK *
+                            (self->num_registers + 1));
+  assert(buffers != NULL);
+  const int64_t **regs = malloc(sizeof(int64_t *) * self->num_registers);
+  assert(regs != NULL);
+
+  int64_t *all_rows = buffers + (int64_t)BATCH_CHUNK * self->num_registers;
+  for (int32_t i = 0; i < BATCH_CHUNK; i++)
+    all_rows[i] = 1;
+  for (int32_t r = 0; r < self->num_registers; r++) {
+    regs[r] = buffers + (int64_t)BATCH_CHUNK * r;
+    if (self->registers[r].kind != BATCH_REG_CONSTANT)
+      continue;
+    for (int32_t i = 0; i < BATCH_CHUNK; i++)
+      buffers[(int64_t)BATCH_CHUNK * r + i] = self->registers[r].value;
+  }
+
+  const char *failure = NULL;
+  for (int64_t start = 0; start < rows && failure == NULL;
+       start += BATCH_CHUNK) {
+    int32_t n = rows - start < BATCH_CHUNK ? rows - start : BATCH_CHUNK;
+    for (int32_t r = 0; r < self->num_registers; r++)
+      if (self->registers[r].kind == BATCH_REG_COLUMN)
+        regs[r] = columns[self->registers[r].value] + start;
+
+    for (int32_t i = 0; i < self->num_ops && failure == NULL; i++) {
+      const BatchOp *op = &self->ops[i];
+      BatchArgs args = {
+          .a = regs[op->a],
+          .b = op->b >= 0 ? regs[op->b] : NULL,
+          .c = op->c >= 0 ? regs[op->c] : NULL,
+          .guard = op->guard >= 0 ? regs[op->guard] : all_rows,
+          .dst = buffers + (int64_t)BATCH_CHUNK * op->dst,
+          .n = n,
+      };
+      failure = batch_kernels[op->opcode](&args);
+    }
+
+    const int64_t *result = regs[self->result];
+    if (ints != NULL) {
+      memcpy(ints + start, result, sizeof(int64_t) * n);
+      continue;
+    }
+    // the chunk starts on a word boundary
+    for (int32_t i = 0; i < n; i += 64) {
+      uint64_t word = 0;
+      for (int32_t bit = 0; bit < 64 && i + bit < n; bit++)
+        word |= (uint64_t)result[i + bit] << bit;
+      selection[(start + i) / 64] = word;
+    }
+  }
+
+  free(regs);
+  free(buffers);
+  if (failure != NULL)
+    *error = String_from(failure);
+  return failure == NULL;
+}
+
+bool batch_eval(const BatchProgram *self, const int64_t *const *columns,
+                int64_t rows, int64_t *out, String *error) {
+  assert(self->type == BATCH_INT);
+  return run_chunks(self, columns, rows, out, NULL, error);
+}
+
+bool batch_select(const BatchProgram *self, const int64_t *const *columns,
+                  int64_t rows, uint64_t *selection, String *error) {
+  assert(self->type == BATCH_BOOL);
+  return run_chunks(self, columns, rows, NULL, selection, error);
+}
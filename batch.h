@@ -0,0 +1,104 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+#include "cstring.h/cstring.h"
+
+// rows evaluated per pass over the operations, a multiple of 64 so each
+// pass fills whole words of a selection bitmap
+#define BATCH_CHUNK 1024
+
+typedef enum BatchType { BATCH_INT, BATCH_BOOL } BatchType;
+
+typedef enum BatchOpcode {
+  BATCH_ADD,
+  BATCH_SUB,
+  BATCH_MUL,
+  BATCH_DIV,
+  BATCH_NEG,
+  BATCH_LT,
+  BATCH_GT,
+  BATCH_EQ,
+  BATCH_NOT_EQ,
+  BATCH_NOT,
+  BATCH_AND,
+  // dst = a ? b : c
+  BATCH_SELECT,
+} BatchOpcode;
+
+typedef enum BatchRegisterKind {
+  // a column of the input, read in place
+  BATCH_REG_COLUMN,
+  // one value for every row
+  BATCH_REG_CONSTANT,
+  // written by an operation
+  BATCH_REG_TEMP,
+} BatchRegisterKind;
+
+typedef struct BatchRegister {
+  BatchRegisterKind kind;
+  BatchType type;
+  // column index, or the value of a constant, booleans are 0 and 1
+  int64_t value;
+} BatchRegister;
+
+// One operation over a chunk of rows. Arithmetic errors only count in the
+// rows where `guard` is 1, the rows whose branch of the enclosing `if`
+// expressions selects the result.
+typedef struct BatchOp {
+  BatchOpcode opcode;
+  int32_t dst;
+  int32_t a;
+  int32_t b;
+  int32_t c;
+  // register of the rows this operation is needed in, -1 for all of them
+  int32_t guard;
+} BatchOp;
+
+// An expression compiled for column at a time evaluation. Its free variables
+// are int columns, and every operation runs over a chunk of rows per
+// dispatch instead of the interpreter running the expression per row. The
+// kernels use SSE2 where the target has it, and predicates come out as
+// selection bitmaps.
+//
+// Read only once compiled, threads may evaluate one program at the same
+// time.
+typedef struct BatchProgram {
+  BatchOp *ops;
+  int32_t num_ops;
+  BatchRegister *registers;
+  int32_t num_registers;
+  // names of the free variables, in order of first use. Evaluation takes
+  // one column per name, in this order.
+  StringArray columns;
+  int32_t result;
+  BatchType type;
+} BatchProgram;
+
+// NULL with `error` set when `expr` uses anything besides int and boolean
+// literals, free variables, arithmetic, comparisons, `!` and if/else
+// expressions picking between two values
+BatchProgram *batch_compile(const Expression *expr, String *error);
+void free_batch_program(BatchProgram *self);
+
+// position of the column for the free variable `name`, -1 if the
+// expression does not use it
+int32_t batch_column(const BatchProgram *self, const char *name);
+
+// Evaluates an int expression for `rows` rows into `out`, row i reading
+// element i of each column. False with `error` set on a division by zero
+// or a result outside int64, `out` is undefined then.
+bool batch_eval(const BatchProgram *self, const int64_t *const *columns,
+                int64_t rows, int64_t *out, String *error);
+
+// Evaluates a predicate for `rows` rows, bit i % 64 of word i / 64 of
+// `selection` is set for the rows it holds for. Bits past the last row are
+// cleared. Fails like batch_eval.
+bool batch_select(const BatchProgram *self, const int64_t *const *columns,
+                  int64_t rows, uint64_t *selection, String *error);
+
+#endif // !BATCH_H
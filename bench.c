@@ -0,0 +1,252 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "gc.h"
+#include "lexer.h"
+#include "parser.h"
+#include "vm.h"
+
+#define CSTRING_IMPLEMENTATION
+#include "cstring.h/cstring.h"
+
+#define BENCH_RUNS 5
+
+typedef struct {
+  const char *name;
+  const char *input;
+  // also run it on a single space heap, printed as `name/ss`
+  bool single_space;
+  // also run it with stop the world old space collections, `name/stw`
+  bool stop_the_world;
+  // also run it without compiling to native code, `name/int`, and as the
+  // compiler emits it without superinstructions, never quickened,
+  // `name/generic`
+  bool interpreted;
+} BenchCase;
+
+static const BenchCase bench_cases[] = {
+    {"fib",
+     "let fib = fn(x) { if (x < 2) { x } else { fib(x - 1) + fib(x - 2) } };"
+     "fib(27);", .interpreted = true},
+    {"loop", "let loop = fn(n, acc) { if (n == 0) { acc } else { "
+             "loop(n - 1, acc + n) } }; loop(3000000, 0);",
+     .interpreted = true},
+    // stays inside int64, every operation takes the fast path
+    {"arith", "let step = fn(n, acc) { if (n == 0) { acc } else { "
+              "step(n - 1, (acc * 7 + n * 3) / 8 - n / 2) } }; "
+              "step(3000000, 1);",
+     .interpreted = true},
+    // crosses into bigints halfway through
+    {"bigint", "let fact = fn(n, acc) { if (n == 0) { acc } else { "
+               "fact(n - 1, acc * n) } }; "
+               "let rep = fn(n) { if (n == 0) { 0 } else { fact(40, 1); "
+               "rep(n - 1) } }; rep(2000);"},
+    // short lived closures, dominated by allocation and collection
+    {"alloc", "let make = fn(x) { fn(y) { x + y } }; "
+              "let loop = fn(n, acc) { if (n == 0) { acc } else { "
+              "loop(n - 1, acc + make(n)(1)) } }; loop(1000000, 0);",
+     true},
+    // the same garbage next to 50k long lived closures
+    {"retain", "let cons = fn(h, t) { fn(f) { f(h, t) } }; "
+               "let build = fn(n, acc) { if (n == 0) { acc } else { "
+               "build(n - 1, cons(n, acc)) } }; let keep = build(50000, 0); "
+               "let make = fn(x) { fn(y) { x + y } }; "
+               "let loop = fn(n, acc) { if (n == 0) { acc } else { "
+               "loop(n - 1, acc + make(n)(1)) } }; loop(1000000, 0);",
+     true, true},
+    // a large old space rebuilt over and over, every round leaves the
+    // previous list behind for an old space collection
+    {"oldgen", "let cons = fn(h, t) { fn(f) { f(h, t) } }; "
+               "let build = fn(n, acc) { if (n == 0) { acc } else { "
+               "build(n - 1, cons(n, acc)) } }; "
+               "let rounds = fn(n) { if (n == 0) { 0 } else { "
+               "build(100000, 0); rounds(n - 1) } }; rounds(20);",
+     false, true},
+    // appends to one growing string, linear with rope nodes
+    {"concat", "let build = fn(n, acc) { if (n == 0) { acc } else { "
+               "build(n - 1, acc + \"abcdefgh\") } }; "
+               "let s = build(500000, \"\"); s == s;"},
+    // config style records built and read field by field
+    {"maps", "let read = fn(n, acc) { if (n == 0) { acc } else { "
+             "let cfg = {\"host\": \"db\", \"port\": n, \"retries\": 3, "
+             "\"limits\": {\"conns\": 10, \"idle\": 2}}; "
+             "read(n - 1, acc + cfg[\"port\"] + cfg[\"retries\"] + "
+             "cfg[\"limits\"][\"conns\"]) } }; read(300000, 0);"},
+    {"for", "let run = fn(n) { let acc = 0; "
+            "for (i in 0..n) { let acc = acc + i * 2; } acc }; run(3000000);"},
+    // function and array literals handed to a callee that only reads them
+    {"hof", "let twice = fn(f, x) { f(f(x)) }; "
+            "let sum = fn(xs) { xs[0] + xs[1] }; "
+            "let run = fn(n) { let acc = 0; for (i in 0..n) { "
+            "let acc = acc + twice(fn(x) { x + i }, 1) + sum([i, 2]); } acc }; "
+            "run(1000000);"},
+};
+
+typedef struct {
+  bool generational;
+  bool concurrent;
+  bool jit;
+  bool quicken;
+} BenchHeap;
+
+static const BenchHeap default_mode = {
+    .generational = true, .concurrent = true, .jit = true, .quicken = true};
+
+// runs the compiled program once and returns the elapsed CPU time in ms,
+// helper threads of the collector included
+static double run_once(Bytecode bytecode, BenchHeap mode, GCStats *gc_stats) {
+  VM *vm = VM_new(bytecode);
+  vm->heap->generational = mode.generational;
+  vm->heap->concurrent = mode.concurrent;
+  if (!mode.jit)
+    vm->jit_threshold = 0;
+  vm->quicken = mode.quicken;
+
+  clock_t start = clock();
+  VMResult result = vm_run(vm);
+  // a cycle still running belongs to this run
+  heap_finish_cycle(vm->heap);
+  clock_t end = clock();
+
+  if (result != VM_OK) {
+    printf("runtime error: %s\n", vm->error.chars);
+    exit(EXIT_FAILURE);
+  }
+  *gc_stats = vm->heap->stats;
+  free_vm(vm);
+
+  return (double)(end - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static void run_bench(const char *name, Bytecode bytecode, BenchHeap mode) {
+  double best = 0, total = 0;
+  GCStats gc_stats;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    double ms = run_once(bytecode, mode, &gc_stats);
+    if (run == 0 || ms < best)
+      best = ms;
+    total += ms;
+  }
+
+  // collector numbers are from the last run
+  const GCPauseHistogram *remark =
+      &gc_stats.pauses_by_kind[GC_PAUSE_REMARK];
+  printf("%-13s %9.2f %9.2f %6llu %8.2f %7llu %7.1f %8.1f %8.2f\n", name,
+         best, total / BENCH_RUNS, (unsigned long long)gc_stats.collections,
+         gc_stats.pauses.total_ns / 1e6,
+         (unsigned long long)gc_pause_percentile_us(&gc_stats.pauses, 0.99),
+         gc_stats.pauses.max_ns / 1000.0, remark->max_ns / 1000.0,
+         gc_stats.concurrent_ns / 1e6);
+}
+
+// Runs every kernel once in the interpreter, with quickening off so the
+// instructions are counted as the compiler emitted them, and prints the
+// most frequent instructions and sequences. This is what the
+// superinstructions in code.h were picked from.
+static int profile_opcodes(void) {
+  OpcodeProfile *profile = OpcodeProfile_new();
+  for (size_t i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); i++) {
+    Parser *p = Parser_new(Lexer_new(String_from(bench_cases[i].input)));
+    Program *program = parse_program(p);
+    assert(p->errors.size == 0);
+
+    Compiler *compiler = Compiler_new();
+    compiler->superinstructions = false;
+    if (!compile_program(compiler, program)) {
+      print_string_array(&compiler->errors);
+      return EXIT_FAILURE;
+    }
+
+    VM *vm = VM_new(compiler_bytecode(compiler));
+    vm->jit_threshold = 0;
+    vm->quicken = false;
+    vm->profile = profile;
+    if (vm_run(vm) != VM_OK) {
+      printf("runtime error: %s\n", vm->error.chars);
+      return EXIT_FAILURE;
+    }
+
+    free_vm(vm);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+
+  const char *titles[] = {"instructions", "pairs", "triples"};
+  for (int32_t length = 1; length <= 3; length++) {
+    String report = opcode_profile_report(profile, length, 12);
+    printf("%s%s:\n%s\n", length > 1 ? "\n" : "", titles[length - 1],
+           report.chars);
+    free_string(&report);
+  }
+  free_opcode_profile(profile);
+
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--profile") == 0)
+    return profile_opcodes();
+
+  printf("%-13s %9s %9s %6s %8s %7s %7s %8s %8s\n", "kernel", "best ms",
+         "mean ms", "gcs", "gc ms", "p99 us", "max us", "rmk us", "conc ms");
+
+  for (size_t i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); i++) {
+    const BenchCase *bench = &bench_cases[i];
+    Parser *p = Parser_new(Lexer_new(String_from(bench->input)));
+    Program *program = parse_program(p);
+    assert(p->errors.size == 0);
+
+    Compiler *compiler = Compiler_new();
+    if (!compile_program(compiler, program)) {
+      print_string_array(&compiler->errors);
+      return EXIT_FAILURE;
+    }
+
+    char name[32];
+    if (bench->interpreted) {
+      Compiler *generic = Compiler_new();
+      generic->superinstructions = false;
+      if (!compile_program(generic, program)) {
+        print_string_array(&generic->errors);
+        return EXIT_FAILURE;
+      }
+      snprintf(name, sizeof(name), "%s/generic", bench->name);
+      BenchHeap mode = default_mode;
+      mode.jit = false;
+      mode.quicken = false;
+      run_bench(name, compiler_bytecode(generic), mode);
+      free_compiler(generic);
+    }
+
+    run_bench(bench->name, compiler_bytecode(compiler), default_mode);
+    if (bench->single_space) {
+      snprintf(name, sizeof(name), "%s/ss", bench->name);
+      BenchHeap mode = default_mode;
+      mode.generational = false;
+      run_bench(name, compiler_bytecode(compiler), mode);
+    }
+    if (bench->stop_the_world) {
+      snprintf(name, sizeof(name), "%s/stw", bench->name);
+      BenchHeap mode = default_mode;
+      mode.concurrent = false;
+      run_bench(name, compiler_bytecode(compiler), mode);
+    }
+    if (bench->interpreted) {
+      snprintf(name, sizeof(name), "%s/int", bench->name);
+      BenchHeap mode = default_mode;
+      mode.jit = false;
+      run_bench(name, compiler_bytecode(compiler), mode);
+    }
+
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+
+  return EXIT_SUCCESS;
+}
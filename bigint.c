@@ -0,0 +1,345 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bigint.h"
+#include "gc.h"
+#include "object.h"
+
+#include "cstring.h/cstring.h"
+
+// sign and magnitude of either an int64_t or a BigInt, never copied since
+// `limbs` may point into `small`
+typedef struct Magnitude {
+  bool negative;
+  int32_t size;
+  const uint32_t *limbs;
+  uint32_t small[2];
+} Magnitude;
+
+static void magnitude_of(Value v, Magnitude *out) {
+  if (IS_INT(v)) {
+    int64_t i = v.as.integer;
+    uint64_t m = i < 0 ? (uint64_t)0 - (uint64_t)i : (uint64_t)i;
+    out->negative = i < 0;
+    out->small[0] = (uint32_t)m;
+    out->small[1] = (uint32_t)(m >> 32);
+    out->size = out->small[1] != 0 ? 2 : (out->small[0] != 0 ? 1 : 0);
+    out->limbs = out->small;
+    return;
+  }
+
+  assert(IS_BIGINT(v));
+  const BigInt *big = (const BigInt *)v.as.obj;
+  out->negative = big->negative;
+  out->size = big->size;
+  out->limbs = big->limbs;
+}
+
+// results are computed in a malloc'd scratch BigInt without an object header,
+// normalize moves them to the heap once the final size is known
+static BigInt *scratch_new(int32_t size) {
+  BigInt *big =
+      malloc(sizeof(BigInt) + sizeof(uint32_t) * (size > 0 ? size : 1));
+  assert(big != NULL);
+
+  big->negative = false;
+  big->size = size;
+  memset(big->limbs, 0, sizeof(uint32_t) * size);
+
+  return big;
+}
+
+// trims the leading zero limbs and demotes to VAL_INT when the value fits,
+// consumes the scratch
+static Value normalize(Heap *heap, BigInt *big) {
+  while (big->size > 0 && big->limbs[big->size - 1] == 0)
+    big->size--;
+
+  if (big->size <= 2) {
+    uint64_t m = big->size == 0 ? 0 : big->limbs[0];
+    if (big->size == 2)
+      m |= (uint64_t)big->limbs[1] << 32;
+
+    bool negative = big->negative;
+    if (m <= (uint64_t)INT64_MAX) {
+      free(big);
+      return INT_VAL(negative ? -(int64_t)m : (int64_t)m);
+    }
+    if (negative && m == (uint64_t)INT64_MAX + 1) {
+      free(big);
+      return INT_VAL(INT64_MIN);
+    }
+  }
+
+  BigInt *out = (BigInt *)object_alloc(
+      heap, &BIGINT_VT, sizeof(BigInt) + sizeof(uint32_t) * big->size);
+  out->negative = big->negative;
+  out->size = big->size;
+  memcpy(out->limbs, big->limbs, sizeof(uint32_t) * big->size);
+  free(big);
+
+  return OBJ_VAL(out);
+}
+
+static int magnitude_compare(const Magnitude *a, const Magnitude *b) {
+  if (a->size != b->size)
+    return a->size < b->size ? -1 : 1;
+
+  for (int32_t i = a->size - 1; i >= 0; i--) {
+    if (a->limbs[i] != b->limbs[i])
+      return a->limbs[i] < b->limbs[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+static BigInt *magnitude_add(const Magnitude *a, const Magnitude *b) {
+  int32_t size = (a->size > b->size ? a->size : b->size) + 1;
+  BigInt *out = scratch_new(size);
+
+  uint64_t carry = 0;
+  for (int32_t i = 0; i < size; i++) {
+    uint64_t sum = carry;
+    if (i < a->size)
+      sum += a->limbs[i];
+    if (i < b->size)
+      sum += b->limbs[i];
+    out->limbs[i] = (uint32_t)sum;
+    carry = sum >> 32;
+  }
+
+  return out;
+}
+
+// |a| must be at least |b|
+static BigInt *magnitude_sub(const Magnitude *a, const Magnitude *b) {
+  BigInt *out = scratch_new(a->size);
+
+  int64_t borrow = 0;
+  for (int32_t i = 0; i < a->size; i++) {
+    int64_t diff = (int64_t)a->limbs[i] - borrow;
+    if (i < b->size)
+      diff -= b->limbs[i];
+    borrow = diff < 0;
+    out->limbs[i] = (uint32_t)(diff + (borrow << 32));
+  }
+
+  return out;
+}
+
+// signed addition, `b_negative` overrides the sign of `b` for subtraction
+static Value add_signed(Heap *heap, const Magnitude *a, const Magnitude *b,
+                        bool b_negative) {
+  BigInt *out;
+
+  if (a->negative == b_negative) {
+    out = magnitude_add(a, b);
+    out->negative = a->negative;
+  } else if (magnitude_compare(a, b) >= 0) {
+    out = magnitude_sub(a, b);
+    out->negative = a->negative;
+  } else {
+    out = magnitude_sub(b, a);
+    out->negative = b_negative;
+  }
+
+  return normalize(heap, out);
+}
+
+Value bigint_add(Heap *heap, Value a, Value b) {
+  Magnitude ma, mb;
+  magnitude_of(a, &ma);
+  magnitude_of(b, &mb);
+
+  return add_signed(heap, &ma, &mb, mb.negative);
+}
+
+Value bigint_sub(Heap *heap, Value a, Value b) {
+  Magnitude ma, mb;
+  magnitude_of(a, &ma);
+  magnitude_of(b, &mb);
+
+  return add_signed(heap, &ma, &mb, !mb.negative);
+}
+
+Value bigint_mul(Heap *heap, Value a, Value b) {
+  Magnitude ma, mb;
+  magnitude_of(a, &ma);
+  magnitude_of(b, &mb);
+
+  BigInt *out = scratch_new(ma.size + mb.size);
+  for (int32_t i = 0; i < ma.size; i++) {
+    uint64_t carry = 0;
+    for (int32_t j = 0; j < mb.size; j++) {
+      uint64_t cur = (uint64_t)ma.limbs[i] * mb.limbs[j] +
+                     out->limbs[i + j] + carry;
+      out->limbs[i + j] = (uint32_t)cur;
+      carry = cur >> 32;
+    }
+    out->limbs[i + mb.size] = (uint32_t)carry;
+  }
+  out->negative = ma.negative != mb.negative;
+
+  return normalize(heap, out);
+}
+
+// divides `limbs` in place by a single limb and returns the remainder
+static uint32_t divide_small(uint32_t *limbs, int32_t size, uint32_t divisor) {
+  uint64_t rem = 0;
+  for (int32_t i = size - 1; i >= 0; i--) {
+    uint64_t cur = (rem << 32) | limbs[i];
+    limbs[i] = (uint32_t)(cur / divisor);
+    rem = cur % divisor;
+  }
+  return (uint32_t)rem;
+}
+
+Value bigint_div(Heap *heap, Value a, Value b) {
+  Magnitude ma, mb;
+  magnitude_of(a, &ma);
+  magnitude_of(b, &mb);
+  assert(mb.size > 0);
+
+  BigInt *quotient = scratch_new(ma.size);
+  quotient->negative = ma.negative != mb.negative;
+
+  if (mb.size == 1) {
+    memcpy(quotient->limbs, ma.limbs, sizeof(uint32_t) * ma.size);
+    divide_small(quotient->limbs, ma.size, mb.limbs[0]);
+    return normalize(heap, quotient);
+  }
+
+  // shift-subtract long division, one bit of the dividend at a time
+  int32_t rem_size = mb.size + 1;
+  uint32_t *rem = calloc(rem_size, sizeof(uint32_t));
+  assert(rem != NULL);
+
+  for (int32_t bit = ma.size * 32 - 1; bit >= 0; bit--) {
+    uint32_t carry = (ma.limbs[bit / 32] >> (bit % 32)) & 1;
+    for (int32_t i = 0; i < rem_size; i++) {
+      uint32_t next = rem[i] >> 31;
+      rem[i] = (rem[i] << 1) | carry;
+      carry = next;
+    }
+
+    Magnitude mr = {false, rem_size, rem, {0, 0}};
+    while (mr.size > 0 && rem[mr.size - 1] == 0)
+      mr.size--;
+    if (magnitude_compare(&mr, &mb) < 0)
+      continue;
+
+    int64_t borrow = 0;
+    for (int32_t i = 0; i < rem_size; i++) {
+      int64_t diff = (int64_t)rem[i] - borrow;
+      if (i < mb.size)
+        diff -= mb.limbs[i];
+      borrow = diff < 0;
+      rem[i] = (uint32_t)(diff + (borrow << 32));
+    }
+    quotient->limbs[bit / 32] |= (uint32_t)1 << (bit % 32);
+  }
+
+  free(rem);
+  return normalize(heap, quotient);
+}
+
+Value bigint_negate(Heap *heap, Value a) {
+  Magnitude ma;
+  magnitude_of(a, &ma);
+
+  BigInt *out = scratch_new(ma.size);
+  memcpy(out->limbs, ma.limbs, sizeof(uint32_t) * ma.size);
+  out->negative = !ma.negative && ma.size > 0;
+
+  return normalize(heap, out);
+}
+
+int bigint_compare(Value a, Value b) {
+  Magnitude ma, mb;
+  magnitude_of(a, &ma);
+  magnitude_of(b, &mb);
+
+  if (ma.negative != mb.negative)
+    return ma.negative ? -1 : 1;
+
+  int cmp = magnitude_compare(&ma, &mb);
+  return ma.negative ? -cmp : cmp;
+}
+
+bool bigint_equals(const BigInt *a, const BigInt *b) {
+  return a->negative == b->negative && a->size == b->size &&
+         memcmp(a->limbs, b->limbs, sizeof(uint32_t) * a->size) == 0;
+}
+
+uint32_t bigint_hash(const BigInt *self) {
+  uint32_t hash = self->negative ? 2166136261u ^ 1u : 2166136261u;
+  for (int32_t i = 0; i < self->size; i++) {
+    hash ^= self->limbs[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+Value bigint_parse(Heap *heap, const String *digits) {
+  assert(digits != NULL);
+  // every decimal digit needs a little less than 4 bits
+  BigInt *out = scratch_new(digits->length / 9 + 2);
+  int32_t used = 0;
+
+  for (int32_t i = 0; i < digits->length; i++) {
+    char ch = digits->chars[i];
+    assert(ch >= '0' && ch <= '9');
+
+    uint64_t carry = (uint64_t)(ch - '0');
+    for (int32_t j = 0; j < used; j++) {
+      uint64_t cur = (uint64_t)out->limbs[j] * 10 + carry;
+      out->limbs[j] = (uint32_t)cur;
+      carry = cur >> 32;
+    }
+    if (carry != 0)
+      out->limbs[used++] = (uint32_t)carry;
+  }
+  out->size = used;
+
+  return normalize(heap, out);
+}
+
+String bigint_inspect(const Object *self) {
+  assert(self != NULL);
+  const BigInt *big = (const BigInt *)self;
+
+  uint32_t *scratch = malloc(sizeof(uint32_t) * (big->size + 1));
+  assert(scratch != NULL);
+  memcpy(scratch, big->limbs, sizeof(uint32_t) * big->size);
+  int32_t size = big->size;
+
+  // base 10^9 chunks, least significant first
+  int32_t max_chunks = big->size * 10 / 9 + 2;
+  uint32_t *chunks = malloc(sizeof(uint32_t) * max_chunks);
+  assert(chunks != NULL);
+  int32_t num_chunks = 0;
+
+  while (size > 0) {
+    chunks[num_chunks++] = divide_small(scratch, size, 1000000000u);
+    while (size > 0 && scratch[size - 1] == 0)
+      size--;
+  }
+
+  char *buf = malloc(num_chunks * 9 + 2);
+  assert(buf != NULL);
+  char *cursor = buf;
+  if (big->negative)
+    *cursor++ = '-';
+  cursor +=
+      sprintf(cursor, "%u", num_chunks > 0 ? chunks[num_chunks - 1] : 0);
+  for (int32_t i = num_chunks - 2; i >= 0; i--)
+    cursor += sprintf(cursor, "%09u", chunks[i]);
+
+  String out = String_from(buf);
+  free(buf);
+  free(chunks);
+  free(scratch);
+
+  return out;
+}
@@ -0,0 +1,54 @@
+#ifndef BIGINT_H
+#define BIGINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+
+// Arbitrary precision integer, only created for values outside the int64_t
+// range. Every operation below takes VAL_INT or BigInt values and returns
+// a VAL_INT whenever the result fits, so the two never overlap.
+typedef struct BigInt {
+  Object base;
+  bool negative;
+  // number of limbs in use, the top limb is never zero
+  int32_t size;
+  // magnitude, least significant limb first
+  uint32_t limbs[];
+} BigInt;
+
+String bigint_inspect(const Object *self);
+
+static const ObjectVT BIGINT_VT = {
+    ._t = OBJ_BIGINT,
+    .inspect = bigint_inspect,
+    .finalize = NULL,
+    .trace = NULL,
+};
+
+#define IS_BIGINT(v) IS_OBJ_TYPE(v, OBJ_BIGINT)
+#define IS_NUMBER(v) (IS_INT(v) || IS_BIGINT(v))
+
+struct Heap;
+
+// A result that does not fit in int64_t is a new BigInt on `heap`, or an
+// unmanaged one when `heap` is NULL. Allocating may collect, the operands
+// have to stay reachable until the call returns.
+
+// decimal digits without a sign
+Value bigint_parse(struct Heap *heap, const String *digits);
+
+Value bigint_add(struct Heap *heap, Value a, Value b);
+Value bigint_sub(struct Heap *heap, Value a, Value b);
+Value bigint_mul(struct Heap *heap, Value a, Value b);
+// truncates towards zero like the int64_t division, `b` must not be zero
+Value bigint_div(struct Heap *heap, Value a, Value b);
+Value bigint_negate(struct Heap *heap, Value a);
+
+// <0, 0 or >0 like strcmp
+int bigint_compare(Value a, Value b);
+bool bigint_equals(const BigInt *a, const BigInt *b);
+uint32_t bigint_hash(const BigInt *self);
+
+#endif // !BIGINT_H
@@ -0,0 +1,101 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "array.h"
+#include "builtins.h"
+#include "map.h"
+#include "parallel.h"
+#include "rope.h"
+#include "vm.h"
+
+#include "cstring.h/cstring.h"
+
+static bool builtin_echo(VM *vm, Value *args, int32_t nargs, Value *out) {
+  for (int32_t i = 0; i < nargs; i++) {
+    if (IS_STRING(args[i])) {
+      // printed strings are often printed again, keep them flat
+      const char *chars =
+          string_flatten(vm->heap, (StringObject *)args[i].as.obj);
+      printf(i == 0 ? "%s" : " %s", chars);
+      continue;
+    }
+    String str = value_inspect(args[i]);
+    printf(i == 0 ? "%s" : " %s", str.chars);
+    free_string(&str);
+  }
+  printf("\n");
+
+  *out = NULL_VAL;
+  return true;
+}
+
+static bool builtin_len(VM *vm, Value *args, int32_t nargs, Value *out) {
+  if (nargs != 1)
+    return vm_error(vm, "wrong number of arguments to len: want=1, got=%d",
+                    nargs);
+
+  if (IS_ARRAY(args[0])) {
+    *out = INT_VAL(((const ArrayObject *)args[0].as.obj)->length);
+  } else if (IS_STRING(args[0])) {
+    *out = INT_VAL(((const StringObject *)args[0].as.obj)->length);
+  } else if (IS_MAP(args[0])) {
+    *out = INT_VAL(((const MapObject *)args[0].as.obj)->count);
+  } else {
+    return vm_error(vm, "argument to len not supported: %s",
+                    value_type_name(args[0]));
+  }
+  return true;
+}
+
+// returns a new array, a non-integer appended to a packed array widens the
+// copy to tagged values
+static bool builtin_push(VM *vm, Value *args, int32_t nargs, Value *out) {
+  if (nargs != 2)
+    return vm_error(vm, "wrong number of arguments to push: want=2, got=%d",
+                    nargs);
+  if (!IS_ARRAY(args[0]))
+    return vm_error(vm, "first argument to push must be ARRAY, got %s",
+                    value_type_name(args[0]));
+
+  if (!array_push(vm->heap, args[0], args[1], out))
+    return vm_error(vm, "array too long");
+  return true;
+}
+
+// fn(x) for every element, split over the VM thread pool for long arrays
+static bool builtin_pmap(VM *vm, Value *args, int32_t nargs, Value *out) {
+  if (nargs != 2)
+    return vm_error(vm, "wrong number of arguments to pmap: want=2, got=%d",
+                    nargs);
+  return parallel_map(vm, args[0], args[1], out);
+}
+
+// preduce(array, init, fn) folds with an associative fn(acc, x)
+static bool builtin_preduce(VM *vm, Value *args, int32_t nargs, Value *out) {
+  if (nargs != 3)
+    return vm_error(vm,
+                    "wrong number of arguments to preduce: want=3, got=%d",
+                    nargs);
+  return parallel_reduce(vm, args[0], args[1], args[2], out);
+}
+
+// pmap and preduce start threads, they are kept out of pure functions so
+// the workers never wait on a pool themselves
+static const BuiltinDef builtins[] = {
+    {"echo", builtin_echo, false},
+    {"len", builtin_len, true},
+    {"push", builtin_push, true},
+    {"pmap", builtin_pmap, false},
+    {"preduce", builtin_preduce, false},
+};
+
+const BuiltinDef *builtin_get(int32_t index) {
+  assert(index >= 0 && index < builtins_count());
+
+  return &builtins[index];
+}
+
+int32_t builtins_count(void) {
+  return (int32_t)(sizeof(builtins) / sizeof(builtins[0]));
+}
@@ -0,0 +1,24 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "object.h"
+
+typedef struct VM VM;
+
+// `args` points at `nargs` values on the VM stack, the result is written to
+// `out`. On failure the builtin reports the error through `vm_error` and
+// returns false.
+typedef bool (*BuiltinFn)(VM *vm, Value *args, int32_t nargs, Value *out);
+
+typedef struct BuiltinDef {
+  const char *name;
+  BuiltinFn fn;
+  // no side effects, calling it keeps the caller pure
+  bool pure;
+} BuiltinDef;
+
+// index of a builtin is its operand in OP_GET_BUILTIN
+const BuiltinDef *builtin_get(int32_t index);
+int32_t builtins_count(void);
+
+#endif // !BUILTINS_H
@@ -0,0 +1,378 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "code.h"
+
+#include "cstring.h/cstring.h"
+
+static const OpDefinition op_definitions[] = {
+#define X(op, w0, w1) {#op, (w0 > 0) + (w1 > 0), {w0, w1}},
+    OPCODE_LIST
+#undef X
+};
+
+const OpDefinition *opcode_lookup(Opcode op) {
+  assert(op >= 0 && op < OPCODE_COUNT);
+
+  return &op_definitions[op];
+}
+
+typedef struct Superinstruction {
+  Opcode op;
+  int32_t length;
+  Opcode sequence[4];
+} Superinstruction;
+
+static const Superinstruction superinstructions[] = {
+#define X(op, ...)                                                             \
+  {op, sizeof((Opcode[]){__VA_ARGS__}) / sizeof(Opcode), {__VA_ARGS__}},
+    SUPERINSTRUCTION_LIST
+#undef X
+};
+
+#define NUM_SUPERINSTRUCTIONS                                                  \
+  ((int32_t)(sizeof(superinstructions) / sizeof(superinstructions[0])))
+
+const Opcode *superinstruction_sequence(Opcode op, int32_t *length) {
+  for (int32_t i = 0; i < NUM_SUPERINSTRUCTIONS; i++) {
+    if (superinstructions[i].op == op) {
+      *length = superinstructions[i].length;
+      return superinstructions[i].sequence;
+    }
+  }
+  return NULL;
+}
+
+Opcode opcode_generic(Opcode op) {
+  switch (op) {
+  case OP_ADD_INT_INT:
+    return OP_ADD;
+  case OP_SUB_INT_INT:
+    return OP_SUB;
+  case OP_LT_INT_INT:
+    return OP_LT;
+  case OP_GT_INT_INT:
+    return OP_GT;
+  case OP_EQ_INT_INT:
+    return OP_EQ;
+  case OP_ADD_INT_CONST:
+  case OP_SUB_INT_CONST:
+  case OP_LT_INT_CONST:
+  case OP_GT_INT_CONST:
+  case OP_EQ_INT_CONST:
+    return OP_CONSTANT;
+  default: {
+    int32_t length;
+    const Opcode *fused = superinstruction_sequence(op, &length);
+    return fused != NULL ? fused[0] : op;
+  }
+  }
+}
+
+Opcode opcode_fused_constant(Opcode next) {
+  switch (next) {
+  case OP_ADD:
+  case OP_ADD_INT_INT:
+    return OP_ADD_INT_CONST;
+  case OP_SUB:
+  case OP_SUB_INT_INT:
+    return OP_SUB_INT_CONST;
+  case OP_LT:
+  case OP_LT_INT_INT:
+    return OP_LT_INT_CONST;
+  case OP_GT:
+  case OP_GT_INT_INT:
+    return OP_GT_INT_CONST;
+  case OP_EQ:
+  case OP_EQ_INT_INT:
+    return OP_EQ_INT_CONST;
+  default:
+    return OP_CONSTANT;
+  }
+}
+
+int32_t opcode_width(Opcode op) {
+  const OpDefinition *def = opcode_lookup(op);
+
+  return 1 + def->operand_widths[0] + def->operand_widths[1];
+}
+
+Instructions instructions_init(int32_t capacity) {
+  assert(capacity >= 0);
+  Instructions ins;
+
+  ins.size = 0;
+  ins.capacity = capacity == 0 ? 16 : capacity;
+  ins.data = malloc(sizeof(uint8_t) * ins.capacity);
+  assert(ins.data != NULL);
+  return ins;
+}
+
+bool instructions_reserve(Instructions *self, int32_t new_capacity) {
+  assert(self != NULL);
+  if (new_capacity <= self->capacity)
+    return true;
+  uint8_t *new_ptr = realloc(self->data, sizeof(uint8_t) * new_capacity);
+
+  if (!new_ptr)
+    return false;
+
+  self->data = new_ptr;
+  self->capacity = new_capacity;
+  return true;
+}
+
+Instructions instructions_clone(const Instructions *src) {
+  assert(src != NULL);
+  Instructions ins = instructions_init(src->size);
+  memcpy(ins.data, src->data, src->size);
+  ins.size = src->size;
+
+  return ins;
+}
+
+void free_instructions(Instructions *self) {
+  if (self == NULL)
+    return;
+
+  if (self->capacity > 0)
+    free(self->data);
+  self->data = NULL;
+  self->size = 0;
+  self->capacity = 0;
+}
+
+static void write_operand(uint8_t *dst, int8_t width, int32_t operand) {
+  switch (width) {
+  case 2:
+    assert(operand >= 0 && operand <= UINT16_MAX);
+    dst[0] = (uint8_t)(operand >> 8);
+    dst[1] = (uint8_t)operand;
+    break;
+  case 1:
+    assert(operand >= 0 && operand <= UINT8_MAX);
+    dst[0] = (uint8_t)operand;
+    break;
+  default:
+    break;
+  }
+}
+
+int32_t instructions_emit(Instructions *self, Opcode op, int32_t operand0,
+                          int32_t operand1) {
+  assert(self != NULL);
+  const OpDefinition *def = opcode_lookup(op);
+  int32_t len = 1 + def->operand_widths[0] + def->operand_widths[1];
+
+  if (self->size + len > self->capacity) {
+    int32_t new_cap = self->capacity > 0 ? self->capacity * 2 : 16;
+    while (new_cap < self->size + len)
+      new_cap *= 2;
+    assert(instructions_reserve(self, new_cap));
+  }
+
+  int32_t position = self->size;
+  uint8_t *dst = &self->data[position];
+  dst[0] = (uint8_t)op;
+  write_operand(dst + 1, def->operand_widths[0], operand0);
+  write_operand(dst + 1 + def->operand_widths[0], def->operand_widths[1],
+                operand1);
+  self->size += len;
+
+  return position;
+}
+
+void instructions_patch(Instructions *self, int32_t position,
+                        int32_t operand0) {
+  assert(self != NULL);
+  assert(position >= 0 && position < self->size);
+
+  const OpDefinition *def = opcode_lookup((Opcode)self->data[position]);
+  write_operand(&self->data[position + 1], def->operand_widths[0], operand0);
+}
+
+static int32_t read_operand(const uint8_t *src, int8_t width) {
+  switch (width) {
+  case 2:
+    return read_u16(src);
+  case 1:
+    return read_u8(src);
+  default:
+    return 0;
+  }
+}
+
+// bytes taken by `length` instructions at `position` if their opcodes are
+// `sequence`, 0 otherwise
+static int32_t match_sequence(const Instructions *self, int32_t position,
+                              const Opcode *sequence, int32_t length) {
+  int32_t i = position;
+  for (int32_t j = 0; j < length; j++) {
+    if (i >= self->size || self->data[i] != sequence[j])
+      return 0;
+    i += opcode_width(sequence[j]);
+  }
+  return i <= self->size ? i - position : 0;
+}
+
+void instructions_fuse(Instructions *self) {
+  assert(self != NULL);
+  int32_t i = 0;
+  while (i < self->size) {
+    Opcode op = (Opcode)self->data[i];
+    int32_t length;
+    const Opcode *fused = superinstruction_sequence(op, &length);
+    if (fused != NULL) {
+      // the tail of an earlier fusion is not a new sequence
+      int32_t span = 0;
+      for (int32_t j = 0; j < length; j++)
+        span += opcode_width(fused[j]);
+      i += span;
+      continue;
+    }
+
+    int32_t span = 0;
+    for (int32_t j = 0; j < NUM_SUPERINSTRUCTIONS && span == 0; j++) {
+      const Superinstruction *super = &superinstructions[j];
+      span = match_sequence(self, i, super->sequence, super->length);
+      if (span > 0)
+        self->data[i] = super->op;
+    }
+    i += span > 0 ? span : opcode_width(op);
+  }
+}
+
+String instructions_string(const Instructions *self) {
+  assert(self != NULL);
+  StringArray lines = string_array_init(self->size / 2 + 1);
+
+  int32_t i = 0;
+  while (i < self->size) {
+    const OpDefinition *def = opcode_lookup((Opcode)self->data[i]);
+    char buf[64];
+    int32_t width0 = def->operand_widths[0];
+    int32_t width1 = def->operand_widths[1];
+
+    switch (def->operand_count) {
+    case 0:
+      snprintf(buf, sizeof(buf), "%04d %s", i, def->name);
+      break;
+    case 1:
+      snprintf(buf, sizeof(buf), "%04d %s %d", i, def->name,
+               read_operand(&self->data[i + 1], width0));
+      break;
+    default:
+      snprintf(buf, sizeof(buf), "%04d %s %d %d", i, def->name,
+               read_operand(&self->data[i + 1], width0),
+               read_operand(&self->data[i + 1 + width0], width1));
+      break;
+    }
+
+    string_array_push(&lines, String_from(buf));
+    i += 1 + width0 + width1;
+  }
+
+  String out = string_array_join(&lines, STR_NEW("\n"));
+  free_string_array(&lines);
+
+  return out;
+}
+
+// OpcodeProfile impl start -----
+OpcodeProfile *OpcodeProfile_new(void) {
+  OpcodeProfile *profile = calloc(1, sizeof(OpcodeProfile));
+  assert(profile != NULL);
+
+  return profile;
+}
+
+void free_opcode_profile(OpcodeProfile *self) { free(self); }
+
+// `code[ip]` follows the instruction recorded `age` steps ago without a jump
+static bool falls_through(const OpcodeProfile *self, int age,
+                          const uint8_t *code, int32_t ip) {
+  const uint8_t *last = self->last_code[age];
+
+  return last == code &&
+         self->last_ip[age] + opcode_width((Opcode)last[self->last_ip[age]]) ==
+             ip;
+}
+
+void opcode_profile_record(OpcodeProfile *self, const uint8_t *code,
+                           int32_t ip) {
+  assert(self != NULL && code != NULL);
+  Opcode op = (Opcode)code[ip];
+  self->singles[op]++;
+
+  if (falls_through(self, 0, code, ip)) {
+    Opcode prev = (Opcode)code[self->last_ip[0]];
+    self->pairs[prev][op]++;
+    if (falls_through(self, 1, code, self->last_ip[0]))
+      self->triples[code[self->last_ip[1]]][prev][op]++;
+  }
+
+  self->last_code[1] = self->last_code[0];
+  self->last_ip[1] = self->last_ip[0];
+  self->last_code[0] = code;
+  self->last_ip[0] = ip;
+}
+
+typedef struct ProfileEntry {
+  uint64_t count;
+  Opcode ops[3];
+} ProfileEntry;
+
+static int compare_entries(const void *a, const void *b) {
+  uint64_t count_a = ((const ProfileEntry *)a)->count;
+  uint64_t count_b = ((const ProfileEntry *)b)->count;
+
+  return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+String opcode_profile_report(const OpcodeProfile *self, int32_t length,
+                             int32_t count) {
+  assert(self != NULL && length >= 1 && length <= 3 && count >= 0);
+  int32_t num_sequences = OPCODE_COUNT;
+  for (int32_t i = 1; i < length; i++)
+    num_sequences *= OPCODE_COUNT;
+
+  ProfileEntry *entries = malloc(sizeof(ProfileEntry) * num_sequences);
+  assert(entries != NULL);
+  uint64_t total = 0;
+  for (int32_t i = 0; i < OPCODE_COUNT; i++)
+    total += self->singles[i];
+
+  for (int32_t i = 0; i < num_sequences; i++) {
+    Opcode a = (Opcode)(i % OPCODE_COUNT);
+    Opcode b = (Opcode)(i / OPCODE_COUNT % OPCODE_COUNT);
+    Opcode c = (Opcode)(i / (OPCODE_COUNT * OPCODE_COUNT));
+    entries[i] = (ProfileEntry){.ops = {a, b, c}};
+    entries[i].count = length == 1   ? self->singles[a]
+                       : length == 2 ? self->pairs[a][b]
+                                     : self->triples[a][b][c];
+  }
+  qsort(entries, num_sequences, sizeof(ProfileEntry), compare_entries);
+
+  StringArray lines = string_array_init(count + 1);
+  for (int32_t i = 0; i < count && i < num_sequences; i++) {
+    if (entries[i].count == 0)
+      break;
+    char buf[160];
+    int n = snprintf(buf, sizeof(buf), "%12llu %5.1f%% ",
+                     (unsigned long long)entries[i].count,
+                     total > 0 ? 100.0 * entries[i].count / total : 0.0);
+    for (int32_t j = 0; j < length; j++)
+      n += snprintf(buf + n, sizeof(buf) - n, " %s",
+                    opcode_lookup(entries[i].ops[j])->name);
+    string_array_push(&lines, String_from(buf));
+  }
+  free(entries);
+
+  String out = string_array_join(&lines, STR_NEW("\n"));
+  free_string_array(&lines);
+
+  return out;
+}
+// OpcodeProfile impl end -----
@@ -0,0 +1,180 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cstring.h/cstring.h"
+
+// X(opcode, width of the first operand, width of the second operand)
+// a width of 0 means the operand is not present
+#define OPCODE_LIST                                                            \
+  X(OP_CONSTANT, 2, 0)                                                         \
+  X(OP_POP, 0, 0)                                                              \
+  X(OP_ADD, 0, 0)                                                              \
+  X(OP_SUB, 0, 0)                                                              \
+  X(OP_MUL, 0, 0)                                                              \
+  X(OP_DIV, 0, 0)                                                              \
+  X(OP_TRUE, 0, 0)                                                             \
+  X(OP_FALSE, 0, 0)                                                            \
+  X(OP_NULL, 0, 0)                                                             \
+  X(OP_EQ, 0, 0)                                                               \
+  X(OP_NOT_EQ, 0, 0)                                                           \
+  X(OP_LT, 0, 0)                                                               \
+  X(OP_GT, 0, 0)                                                               \
+  X(OP_MINUS, 0, 0)                                                            \
+  X(OP_BANG, 0, 0)                                                             \
+  X(OP_ARRAY, 2, 0)                                                            \
+  X(OP_MAP, 2, 0)                                                              \
+  X(OP_INDEX, 0, 0)                                                            \
+  X(OP_GET_FIELD, 2, 2)                                                        \
+  X(OP_JUMP, 2, 0)                                                             \
+  X(OP_JUMP_FALSE, 2, 0)                                                       \
+  X(OP_GET_GLOBAL, 2, 0)                                                       \
+  X(OP_SET_GLOBAL, 2, 0)                                                       \
+  X(OP_GET_LOCAL, 1, 0)                                                        \
+  X(OP_SET_LOCAL, 1, 0)                                                        \
+  X(OP_GET_BUILTIN, 1, 0)                                                      \
+  X(OP_GET_FREE, 1, 0)                                                         \
+  X(OP_CURRENT_CLOSURE, 0, 0)                                                  \
+  X(OP_CLOSURE, 2, 1)                                                          \
+  X(OP_CALL, 1, 2)                                                             \
+  X(OP_TAIL_CALL, 1, 2)                                                        \
+  X(OP_RETURN_VALUE, 0, 0)                                                     \
+  X(OP_RETURN, 0, 0)                                                           \
+  /* literal arguments the callee named by the operand does not let escape */  \
+  X(OP_ENTER_REGION, 2, 0)                                                     \
+  X(OP_LEAVE_REGION, 0, 0)                                                     \
+  X(OP_REGION_ARRAY, 2, 0)                                                     \
+  X(OP_REGION_CLOSURE, 2, 1)                                                   \
+  /* quickened forms, only written by the VM over the instructions above */    \
+  X(OP_ADD_INT_INT, 0, 0)                                                      \
+  X(OP_SUB_INT_INT, 0, 0)                                                      \
+  X(OP_LT_INT_INT, 0, 0)                                                       \
+  X(OP_GT_INT_INT, 0, 0)                                                       \
+  X(OP_EQ_INT_INT, 0, 0)                                                       \
+  /* an integer OP_CONSTANT fused with the operator following it */            \
+  X(OP_ADD_INT_CONST, 2, 0)                                                    \
+  X(OP_SUB_INT_CONST, 2, 0)                                                    \
+  X(OP_LT_INT_CONST, 2, 0)                                                     \
+  X(OP_GT_INT_CONST, 2, 0)                                                     \
+  X(OP_EQ_INT_CONST, 2, 0)                                                     \
+  /* superinstructions, operands are those of the first instruction fused */   \
+  X(OP_LOCAL_CONST_EQ_JUMP_FALSE, 1, 0)                                        \
+  X(OP_LOCAL_CONST_LT_JUMP_FALSE, 1, 0)                                        \
+  X(OP_LOCAL_LOCAL_LT_JUMP_FALSE, 1, 0)                                        \
+  X(OP_LOCAL_CONST_ADD, 1, 0)                                                  \
+  X(OP_LOCAL_CONST_SUB, 1, 0)                                                  \
+  X(OP_LOCAL_CONST_MUL, 1, 0)                                                  \
+  X(OP_GET_LOCAL_2, 1, 0)
+
+typedef enum Opcode {
+#define X(op, w0, w1) op,
+  OPCODE_LIST
+#undef X
+      OPCODE_COUNT
+} Opcode;
+
+// X(superinstruction, instructions it fuses...), longest sequences first.
+// Picked from the sequences `bench --profile` counts most often. The
+// compiler only overwrites the first opcode of a sequence, the rest stays
+// in place so jumps into the middle still land on an instruction and the
+// interpreter can fall back to running the sequence one by one.
+#define SUPERINSTRUCTION_LIST                                                  \
+  X(OP_LOCAL_CONST_EQ_JUMP_FALSE, OP_GET_LOCAL, OP_CONSTANT, OP_EQ,            \
+    OP_JUMP_FALSE)                                                             \
+  X(OP_LOCAL_CONST_LT_JUMP_FALSE, OP_GET_LOCAL, OP_CONSTANT, OP_LT,            \
+    OP_JUMP_FALSE)                                                             \
+  X(OP_LOCAL_LOCAL_LT_JUMP_FALSE, OP_GET_LOCAL, OP_GET_LOCAL, OP_LT,           \
+    OP_JUMP_FALSE)                                                             \
+  X(OP_LOCAL_CONST_ADD, OP_GET_LOCAL, OP_CONSTANT, OP_ADD)                     \
+  X(OP_LOCAL_CONST_SUB, OP_GET_LOCAL, OP_CONSTANT, OP_SUB)                     \
+  X(OP_LOCAL_CONST_MUL, OP_GET_LOCAL, OP_CONSTANT, OP_MUL)                     \
+  X(OP_GET_LOCAL_2, OP_GET_LOCAL, OP_GET_LOCAL)
+
+// instructions fused by `op`, NULL when it is not a superinstruction
+const Opcode *superinstruction_sequence(Opcode op, int32_t *length);
+
+// opcode a quickened instruction was compiled as, or the first instruction a
+// superinstruction fuses, `op` itself for the others. Running that opcode
+// and the instructions after it one by one does the same.
+Opcode opcode_generic(Opcode op);
+
+// quickened form of an integer OP_CONSTANT followed by `next`, OP_CONSTANT
+// when the two do not fuse
+Opcode opcode_fused_constant(Opcode next);
+
+typedef struct OpDefinition {
+  const char *name;
+  int8_t operand_count;
+  int8_t operand_widths[2];
+} OpDefinition;
+
+const OpDefinition *opcode_lookup(Opcode);
+// bytes taken by the opcode and its operands
+int32_t opcode_width(Opcode);
+
+// Instructions impl start ---
+typedef struct Instructions {
+  // 0 for code borrowed from memory someone else owns, like a mapped .fzc
+  // file, it is only read and never freed
+  int32_t capacity;
+  int32_t size;
+  uint8_t *data;
+} Instructions;
+
+Instructions instructions_init(int32_t capacity);
+bool instructions_reserve(Instructions *, int32_t new_capacity);
+Instructions instructions_clone(const Instructions *);
+void free_instructions(Instructions *);
+
+// encodes `op` with its operands at the end of the instructions and returns
+// the position of the opcode
+int32_t instructions_emit(Instructions *, Opcode op, int32_t operand0,
+                          int32_t operand1);
+
+// rewrites the operand of the instruction at `position` in place
+void instructions_patch(Instructions *, int32_t position, int32_t operand0);
+
+// human readable listing of the instructions, one instruction per line
+String instructions_string(const Instructions *);
+
+// overwrites the first opcode of every sequence in SUPERINSTRUCTION_LIST
+// with its superinstruction, sequences fused earlier are left alone
+void instructions_fuse(Instructions *);
+// Instructions impl end ---
+
+// OpcodeProfile impl start ---
+// Dynamic counts of adjacent instructions, collected by the interpreter of a
+// VM with a profile attached. Only instructions falling through into each
+// other count, a sequence broken by a jump, call or return is not one a
+// superinstruction could cover.
+typedef struct OpcodeProfile {
+  uint64_t singles[OPCODE_COUNT];
+  uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];
+  uint64_t triples[OPCODE_COUNT][OPCODE_COUNT][OPCODE_COUNT];
+
+  // the last two instructions recorded, most recent first
+  const uint8_t *last_code[2];
+  int32_t last_ip[2];
+} OpcodeProfile;
+
+OpcodeProfile *OpcodeProfile_new(void);
+void free_opcode_profile(OpcodeProfile *);
+
+// counts the instruction at `code[ip]`
+void opcode_profile_record(OpcodeProfile *, const uint8_t *code, int32_t ip);
+
+// the `count` most frequent sequences of `length` 1 to 3 instructions, one
+// per line with its count and share of all instructions
+String opcode_profile_report(const OpcodeProfile *, int32_t length,
+                             int32_t count);
+// OpcodeProfile impl end ---
+
+static inline uint16_t read_u16(const uint8_t *ins) {
+  return (uint16_t)((ins[0] << 8) | ins[1]);
+}
+
+static inline uint8_t read_u8(const uint8_t *ins) { return ins[0]; }
+
+#endif // !CODE_H
@@ -0,0 +1,1137 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "bigint.h"
+#include "builtins.h"
+#include "code.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+#include "rope.h"
+
+#include "cstring.h/cstring.h"
+
+#define ERROR_STRING_MAX 256
+
+// SymbolTable impl start -----
+SymbolTable *SymbolTable_new(SymbolTable *outer) {
+  SymbolTable *table = malloc(sizeof(SymbolTable));
+  assert(table != NULL);
+
+  table->outer = outer;
+  table->size = 0;
+  table->capacity = 8;
+  table->store = malloc(sizeof(Symbol) * table->capacity);
+  assert(table->store != NULL);
+
+  table->num_free = 0;
+  table->free_capacity = 0;
+  table->free_symbols = NULL;
+
+  table->num_definitions = 0;
+
+  return table;
+}
+
+static Symbol symbol_store(SymbolTable *self, Symbol symbol) {
+  assert(self != NULL);
+  if (self->size == self->capacity) {
+    int32_t new_cap = self->capacity * 2;
+    Symbol *new_ptr = realloc(self->store, sizeof(Symbol) * new_cap);
+    assert(new_ptr != NULL);
+    self->store = new_ptr;
+    self->capacity = new_cap;
+  }
+
+  // later definitions shadow the earlier ones, lookup walks backwards
+  self->store[self->size++] = symbol;
+  return symbol;
+}
+
+Symbol symbol_define(SymbolTable *self, String name) {
+  SymbolScope scope = self->outer == NULL ? SCOPE_GLOBAL : SCOPE_LOCAL;
+  Symbol symbol = {name, scope, self->num_definitions++, false, -1};
+
+  return symbol_store(self, symbol);
+}
+
+Symbol symbol_define_builtin(SymbolTable *self, int32_t index, String name) {
+  return symbol_store(self, (Symbol){name, SCOPE_BUILTIN, index, false, -1});
+}
+
+Symbol symbol_define_function_name(SymbolTable *self, String name) {
+  // calls to itself do not change whether a function is pure
+  return symbol_store(self, (Symbol){name, SCOPE_FUNCTION, 0, true, -1});
+}
+
+static Symbol symbol_define_free(SymbolTable *self, Symbol original) {
+  if (self->num_free == self->free_capacity) {
+    int32_t new_cap = self->free_capacity > 0 ? self->free_capacity * 2 : 4;
+    Symbol *new_ptr = realloc(self->free_symbols, sizeof(Symbol) * new_cap);
+    assert(new_ptr != NULL);
+    self->free_symbols = new_ptr;
+    self->free_capacity = new_cap;
+  }
+
+  // the free list refers to the name owned by the outer table
+  self->free_symbols[self->num_free] = original;
+  Symbol symbol = {String_clone(&original.name), SCOPE_FREE, self->num_free,
+                   original.pure_fn, original.function};
+  self->num_free++;
+
+  return symbol_store(self, symbol);
+}
+
+bool symbol_resolve(SymbolTable *self, const String *name, Symbol *out) {
+  assert(self != NULL);
+  for (int32_t i = self->size - 1; i >= 0; i--) {
+    if (String_cmp(&self->store[i].name, (String *)name)) {
+      *out = self->store[i];
+      return true;
+    }
+  }
+
+  if (self->outer == NULL)
+    return false;
+
+  Symbol outer_symbol;
+  if (!symbol_resolve(self->outer, name, &outer_symbol))
+    return false;
+
+  if (outer_symbol.scope == SCOPE_GLOBAL ||
+      outer_symbol.scope == SCOPE_BUILTIN) {
+    *out = outer_symbol;
+    return true;
+  }
+
+  *out = symbol_define_free(self, outer_symbol);
+  return true;
+}
+
+void symbol_mark_pure_fn(SymbolTable *self, Symbol symbol) {
+  assert(self != NULL);
+  for (int32_t i = self->size - 1; i >= 0; i--) {
+    Symbol *stored = &self->store[i];
+    if (stored->scope == symbol.scope && stored->index == symbol.index) {
+      stored->pure_fn = true;
+      return;
+    }
+  }
+}
+
+void symbol_bind_function(SymbolTable *self, Symbol symbol, int32_t function) {
+  assert(self != NULL);
+  for (int32_t i = self->size - 1; i >= 0; i--) {
+    Symbol *stored = &self->store[i];
+    if (stored->scope == symbol.scope && stored->index == symbol.index) {
+      stored->function = function;
+      return;
+    }
+  }
+}
+
+void free_symbol_table(SymbolTable *self) {
+  if (self == NULL)
+    return;
+
+  for (int32_t i = 0; i < self->size; i++) {
+    free_string(&self->store[i].name);
+  }
+  free(self->store);
+  free(self->free_symbols);
+  free(self);
+}
+// SymbolTable impl end -----
+
+Compiler *Compiler_new(void) {
+  Compiler *c = malloc(sizeof(Compiler));
+  assert(c != NULL);
+
+  c->constants = values_array_init(0);
+  c->symbols = SymbolTable_new(NULL);
+  c->errors = string_array_init(1);
+  c->scope_index = 0;
+  c->num_call_sites = 0;
+  c->num_shape_sites = 0;
+  c->superinstructions = true;
+  c->scopes[0].instructions = instructions_init(0);
+  c->scopes[0].is_pure = false;
+  c->scopes[0].memo_parameters = 0;
+  c->scopes[0].open_regions = 0;
+
+  for (int32_t i = 0; i < builtins_count(); i++) {
+    symbol_define_builtin(c->symbols, i, String_from(builtin_get(i)->name));
+  }
+
+  return c;
+}
+
+void free_compiler(Compiler *self) {
+  if (self == NULL)
+    return;
+
+  for (int32_t i = 0; i <= self->scope_index; i++) {
+    free_instructions(&self->scopes[i].instructions);
+  }
+
+  while (self->symbols != NULL) {
+    SymbolTable *outer = self->symbols->outer;
+    free_symbol_table(self->symbols);
+    self->symbols = outer;
+  }
+
+  free_values(&self->constants);
+  free_string_array(&self->errors);
+  free(self);
+}
+
+static bool compile_error(Compiler *self, const char *message,
+                          const String *detail) {
+  char buf[ERROR_STRING_MAX];
+  snprintf(buf, ERROR_STRING_MAX, "compile error: %s%s", message,
+           detail != NULL ? detail->chars : "");
+  string_array_push(&self->errors, String_from(buf));
+
+  return false;
+}
+
+static Instructions *current_instructions(Compiler *self) {
+  return &self->scopes[self->scope_index].instructions;
+}
+
+static int32_t emit(Compiler *self, Opcode op, int32_t operand0,
+                    int32_t operand1) {
+  return instructions_emit(current_instructions(self), op, operand0, operand1);
+}
+
+static bool add_constant(Compiler *self, Value value, int32_t *index) {
+  if (self->constants.size > UINT16_MAX) {
+    return compile_error(self, "too many constants", NULL);
+  }
+  *index = values_push(&self->constants, value) - 1;
+  return true;
+}
+
+// jumps are absolute offsets, patched once the target is known
+static bool patch_jump(Compiler *self, int32_t jump_position) {
+  Instructions *ins = current_instructions(self);
+  if (ins->size > UINT16_MAX) {
+    return compile_error(self, "function body too large to jump over", NULL);
+  }
+  instructions_patch(ins, jump_position, ins->size);
+  return true;
+}
+
+static void enter_scope(Compiler *self) {
+  self->scope_index++;
+  self->scopes[self->scope_index].instructions = instructions_init(0);
+  self->scopes[self->scope_index].is_pure = true;
+  self->scopes[self->scope_index].memo_parameters = 0;
+  self->scopes[self->scope_index].open_regions = 0;
+  self->symbols = SymbolTable_new(self->symbols);
+}
+
+static Instructions leave_scope(Compiler *self) {
+  Instructions ins = self->scopes[self->scope_index].instructions;
+  self->scope_index--;
+
+  SymbolTable *inner = self->symbols;
+  self->symbols = inner->outer;
+  free_symbol_table(inner);
+
+  return ins;
+}
+
+static bool load_symbol(Compiler *self, Symbol symbol) {
+  switch (symbol.scope) {
+  case SCOPE_GLOBAL:
+    emit(self, OP_GET_GLOBAL, symbol.index, 0);
+    break;
+  case SCOPE_LOCAL:
+    emit(self, OP_GET_LOCAL, symbol.index, 0);
+    break;
+  case SCOPE_BUILTIN:
+    emit(self, OP_GET_BUILTIN, symbol.index, 0);
+    break;
+  case SCOPE_FREE:
+    emit(self, OP_GET_FREE, symbol.index, 0);
+    break;
+  case SCOPE_FUNCTION:
+    emit(self, OP_CURRENT_CLOSURE, 0, 0);
+    break;
+  }
+  return true;
+}
+
+static bool store_symbol(Compiler *self, Symbol symbol) {
+  if (symbol.scope == SCOPE_GLOBAL) {
+    if (symbol.index > UINT16_MAX)
+      return compile_error(self, "too many globals", NULL);
+    emit(self, OP_SET_GLOBAL, symbol.index, 0);
+  } else {
+    assert(symbol.scope == SCOPE_LOCAL);
+    if (symbol.index > UINT8_MAX)
+      return compile_error(self, "too many locals in function", NULL);
+    emit(self, OP_SET_LOCAL, symbol.index, 0);
+  }
+  return true;
+}
+
+// Symbol a `let` of `name` stores into. A name already bound in the same
+// scope keeps its slot, which is how loops update their variables, unless it
+// holds a pure function: code compiled since relies on it staying put.
+static bool bind_name(Compiler *self, const String *name, Symbol *out) {
+  SymbolTable *table = self->symbols;
+  for (int32_t i = table->size - 1; i >= 0; i--) {
+    const Symbol *symbol = &table->store[i];
+    if (!String_cmp((String *)&symbol->name, (String *)name))
+      continue;
+
+    if ((symbol->scope == SCOPE_GLOBAL || symbol->scope == SCOPE_LOCAL) &&
+        !symbol->pure_fn) {
+      if (symbol->scope == SCOPE_LOCAL &&
+          symbol->index < self->scopes[self->scope_index].memo_parameters)
+        return compile_error(self, "cannot bind a @memo parameter again: ",
+                             name);
+      *out = *symbol;
+      return true;
+    }
+    break;
+  }
+
+  *out = symbol_define(table, String_clone(name));
+  return true;
+}
+
+static bool compile_statement(Compiler *self, const Statement *st);
+static bool compile_expression(Compiler *self, const Expression *expr,
+                               bool tail);
+static bool compile_array_expression(Compiler *self,
+                                     const ArrayExpression *array,
+                                     bool in_region);
+
+static bool in_function(const Compiler *self) { return self->scope_index > 0; }
+
+// Compiles the block so it leaves exactly one value on the stack: the value of
+// its trailing expression statement, or null. `tail` marks that value as the
+// result of the enclosing function, so a call producing it can reuse the frame
+static bool compile_block_value(Compiler *self, const BlockStatement *block,
+                                bool tail) {
+  int32_t size = block->statements.size;
+  for (int32_t i = 0; i < size; i++) {
+    const Statement *st = block->statements.data[i];
+    bool is_last = i == size - 1;
+
+    if (is_last && st->vt->kind == NODE_EXPR_STATEMENT) {
+      const ExpressionStatement *expr_st = (const ExpressionStatement *)st;
+      return compile_expression(self, expr_st->expr, tail);
+    }
+
+    if (!compile_statement(self, st))
+      return false;
+  }
+
+  emit(self, OP_NULL, 0, 0);
+  return true;
+}
+
+static void mark_impure(Compiler *self) {
+  self->scopes[self->scope_index].is_pure = false;
+}
+
+// Looks for uses of a parameter that may let its value outlive the call.
+// Calling it, indexing it, comparing it, testing it or handing it to a
+// builtin that only looks at it is fine. Anything else counts as an escape,
+// and so does any use inside a nested function, which captures it.
+typedef struct EscapeQuery {
+  const Compiler *compiler;
+  const String *name;
+  // inside a nested function literal
+  bool captured;
+  // builtins are only trusted when no binding in the function may shadow one
+  bool calls_builtin;
+  bool shadows_builtin;
+} EscapeQuery;
+
+// resolves `name` without capturing it, true when it names a builtin
+static bool names_builtin(const Compiler *self, const String *name,
+                          int32_t *index) {
+  for (const SymbolTable *table = self->symbols; table != NULL;
+       table = table->outer) {
+    for (int32_t i = table->size - 1; i >= 0; i--) {
+      const Symbol *symbol = &table->store[i];
+      if (String_cmp((String *)&symbol->name, (String *)name)) {
+        *index = symbol->index;
+        return symbol->scope == SCOPE_BUILTIN;
+      }
+    }
+  }
+  return false;
+}
+
+// the builtin keeps nothing of its argument at `position`
+static bool builtin_reads_only(int32_t builtin, int32_t position) {
+  const char *name = builtin_get(builtin)->name;
+  return strcmp(name, "len") == 0 || strcmp(name, "echo") == 0 ||
+         (strcmp(name, "push") == 0 && position == 0);
+}
+
+static void note_binding(EscapeQuery *q, const String *name) {
+  int32_t index;
+  if (names_builtin(q->compiler, name, &index))
+    q->shadows_builtin = true;
+}
+
+static bool block_leaks(EscapeQuery *q, const BlockStatement *block);
+
+// `read_only` is set when the value of `expr` is used up where it appears
+static bool expression_leaks(EscapeQuery *q, const Expression *expr,
+                             bool read_only) {
+  if (expr == NULL)
+    return false;
+
+  switch (expr->vt->kind) {
+  case NODE_IDENTIFIER:
+    if (!String_cmp(&((Identifier *)expr)->value, (String *)q->name))
+      return false;
+    return q->captured || !read_only;
+  case NODE_INT_EXPR:
+  case NODE_STRING_EXPR:
+  case NODE_BOOLEAN_EXPR:
+    return false;
+  case NODE_PREFIX_EXPR: {
+    const PrefixExpression *prefix = (const PrefixExpression *)expr;
+    // a prefix `+` hands its operand on as it is
+    return expression_leaks(q, prefix->right,
+                            read_only || prefix->token.type != TOKEN_PLUS);
+  }
+  case NODE_INFIX_EXPR: {
+    // operators build new values, arrays and closures are not operands
+    const InfixExpression *infix = (const InfixExpression *)expr;
+    return expression_leaks(q, infix->left, true) ||
+           expression_leaks(q, infix->right, true);
+  }
+  case NODE_IF_EXPR: {
+    const IfExpression *if_expr = (const IfExpression *)expr;
+    return expression_leaks(q, if_expr->condition, true) ||
+           block_leaks(q, if_expr->consequence) ||
+           block_leaks(q, if_expr->alternative);
+  }
+  case NODE_FN_EXPR: {
+    const FnExpression *fn = (const FnExpression *)expr;
+    for (int32_t i = 0; i < fn->parameters.size; i++)
+      note_binding(q, &fn->parameters.data[i]->value);
+    bool captured = q->captured;
+    q->captured = true;
+    bool leaks = block_leaks(q, fn->body);
+    q->captured = captured;
+    return leaks;
+  }
+  case NODE_CALL_EXPR: {
+    const CallExpression *call = (const CallExpression *)expr;
+    if (expression_leaks(q, call->function, true))
+      return true;
+    int32_t builtin = -1;
+    if (call->function != NULL &&
+        call->function->vt->kind == NODE_IDENTIFIER &&
+        names_builtin(q->compiler, &((Identifier *)call->function)->value,
+                      &builtin))
+      q->calls_builtin = true;
+    else
+      builtin = -1;
+    for (int32_t i = 0; i < call->arguments.size; i++) {
+      bool reads_only = builtin >= 0 && builtin_reads_only(builtin, i);
+      if (expression_leaks(q, call->arguments.data[i], reads_only))
+        return true;
+    }
+    return false;
+  }
+  case NODE_ARRAY_EXPR: {
+    const ArrayExpression *array = (const ArrayExpression *)expr;
+    for (int32_t i = 0; i < array->elements.size; i++) {
+      if (expression_leaks(q, array->elements.data[i], false))
+        return true;
+    }
+    return false;
+  }
+  case NODE_MAP_EXPR: {
+    const MapExpression *map = (const MapExpression *)expr;
+    for (int32_t i = 0; i < map->keys.size; i++) {
+      if (expression_leaks(q, map->keys.data[i], false) ||
+          expression_leaks(q, map->values.data[i], false))
+        return true;
+    }
+    return false;
+  }
+  case NODE_INDEX_EXPR: {
+    const IndexExpression *index_expr = (const IndexExpression *)expr;
+    return expression_leaks(q, index_expr->left, true) ||
+           expression_leaks(q, index_expr->index, true);
+  }
+  default:
+    return true;
+  }
+}
+
+static bool statement_leaks(EscapeQuery *q, const Statement *st) {
+  if (st == NULL)
+    return false;
+
+  switch (st->vt->kind) {
+  case NODE_LET_STATEMENT: {
+    const LetStatement *let_st = (const LetStatement *)st;
+    if (let_st->name != NULL)
+      note_binding(q, &let_st->name->value);
+    return expression_leaks(q, let_st->value, false);
+  }
+  case NODE_RETURN_STATEMENT:
+    return expression_leaks(q, ((const ReturnStatement *)st)->value, false);
+  case NODE_EXPR_STATEMENT:
+    // the last one in a block may be its value
+    return expression_leaks(q, ((const ExpressionStatement *)st)->expr, false);
+  case NODE_BLOCK_STATEMENT:
+    return block_leaks(q, (const BlockStatement *)st);
+  case NODE_FOR_STATEMENT: {
+    const ForStatement *for_st = (const ForStatement *)st;
+    if (for_st->variable != NULL)
+      note_binding(q, &for_st->variable->value);
+    return statement_leaks(q, for_st->init) ||
+           expression_leaks(q, for_st->condition, true) ||
+           statement_leaks(q, for_st->update) ||
+           expression_leaks(q, for_st->start, true) ||
+           expression_leaks(q, for_st->end, true) ||
+           block_leaks(q, for_st->body);
+  }
+  default:
+    return true;
+  }
+}
+
+static bool block_leaks(EscapeQuery *q, const BlockStatement *block) {
+  if (block == NULL)
+    return false;
+  for (int32_t i = 0; i < block->statements.size; i++) {
+    if (statement_leaks(q, block->statements.data[i]))
+      return true;
+  }
+  return false;
+}
+
+// See CompiledFunction.escaping_parameters. Memo tables keep the arguments
+// of a @memo function as keys.
+static uint32_t escaping_parameters(const Compiler *self,
+                                    const FnExpression *fn) {
+  if (fn->memoize)
+    return UINT32_MAX;
+
+  uint32_t escaping = 0;
+  for (int32_t i = 0; i < fn->parameters.size && i < 32; i++) {
+    EscapeQuery q = {self, &fn->parameters.data[i]->value, false, false,
+                     false};
+    for (int32_t j = 0; j < fn->parameters.size; j++)
+      note_binding(&q, &fn->parameters.data[j]->value);
+    if (block_leaks(&q, fn->body) || (q.calls_builtin && q.shadows_builtin))
+      escaping |= UINT32_C(1) << i;
+  }
+  if (fn->parameters.size < 32)
+    escaping |= UINT32_MAX << fn->parameters.size;
+  return escaping;
+}
+
+// `is_pure` receives whether the function body was proven free of side
+// effects and `index` its constant index, both can be NULL. `in_region`
+// allocates the closure in the region of the call it is an argument of.
+static bool compile_fn_expression(Compiler *self, const FnExpression *fn,
+                                  const String *name, bool *is_pure,
+                                  int32_t *index, bool in_region) {
+  if (self->scope_index + 1 >= MAX_SCOPE_DEPTH) {
+    return compile_error(self, "functions nested too deeply", NULL);
+  }
+
+  // before the parameters are bound, they would shadow the builtins
+  uint32_t escaping = escaping_parameters(self, fn);
+  enter_scope(self);
+
+  if (name != NULL) {
+    symbol_define_function_name(self->symbols, String_clone(name));
+  }
+
+  for (int32_t i = 0; i < fn->parameters.size; i++) {
+    Identifier *param = fn->parameters.data[i];
+    symbol_define(self->symbols, String_clone(&param->value));
+  }
+  if (fn->memoize)
+    self->scopes[self->scope_index].memo_parameters = fn->parameters.size;
+
+  if (fn->body == NULL || !compile_block_value(self, fn->body, true)) {
+    Instructions ins = leave_scope(self);
+    free_instructions(&ins);
+    return fn->body == NULL ? compile_error(self, "missing function body", NULL)
+                            : false;
+  }
+  emit(self, OP_RETURN_VALUE, 0, 0);
+
+  bool pure = self->scopes[self->scope_index].is_pure;
+  if (fn->memoize && !pure) {
+    Instructions ins = leave_scope(self);
+    free_instructions(&ins);
+    return name != NULL
+               ? compile_error(self, "@memo function is not pure: ", name)
+               : compile_error(self, "@memo function is not pure", NULL);
+  }
+
+  int32_t num_locals = self->symbols->num_definitions;
+  int32_t num_free = self->symbols->num_free;
+
+  if (num_locals > UINT8_MAX + 1 || num_free > UINT8_MAX) {
+    Instructions ins = leave_scope(self);
+    free_instructions(&ins);
+    return compile_error(self, "too many locals in function", name);
+  }
+
+  // the free list only borrows names from the enclosing tables, it stays
+  // valid once the inner table is gone
+  Symbol *free_symbols = self->symbols->free_symbols;
+  self->symbols->free_symbols = NULL;
+
+  Instructions ins = leave_scope(self);
+  if (self->superinstructions)
+    instructions_fuse(&ins);
+
+  // captured values are pushed by the enclosing scope right before the closure
+  for (int32_t i = 0; i < num_free; i++) {
+    load_symbol(self, free_symbols[i]);
+  }
+  free(free_symbols);
+
+  CompiledFunction *compiled =
+      compiled_function_new(ins, num_locals, fn->parameters.size,
+                            name != NULL ? String_clone(name) : STR_NULL);
+  compiled->memoize = fn->memoize;
+  compiled->pure = pure;
+  compiled->escaping_parameters = escaping;
+  if (is_pure != NULL)
+    *is_pure = pure;
+
+  int32_t constant;
+  if (!add_constant(self, OBJ_VAL(compiled), &constant)) {
+    object_free((Object *)compiled);
+    return false;
+  }
+  if (index != NULL)
+    *index = constant;
+
+  emit(self, in_region ? OP_REGION_CLOSURE : OP_CLOSURE, constant, num_free);
+  return true;
+}
+
+static bool compile_if_expression(Compiler *self, const IfExpression *if_expr,
+                                  bool tail) {
+  if (if_expr->condition == NULL || if_expr->consequence == NULL) {
+    return compile_error(self, "incomplete if expression", NULL);
+  }
+
+  if (!compile_expression(self, if_expr->condition, false))
+    return false;
+
+  int32_t jump_false = emit(self, OP_JUMP_FALSE, 0, 0);
+
+  if (!compile_block_value(self, if_expr->consequence, tail))
+    return false;
+
+  int32_t jump_end = emit(self, OP_JUMP, 0, 0);
+  if (!patch_jump(self, jump_false))
+    return false;
+
+  if (if_expr->alternative == NULL) {
+    emit(self, OP_NULL, 0, 0);
+  } else if (!compile_block_value(self, if_expr->alternative, tail)) {
+    return false;
+  }
+
+  return patch_jump(self, jump_end);
+}
+
+static bool compile_call_expression(Compiler *self,
+                                    const CallExpression *call, bool tail) {
+  if (call->arguments.size > UINT8_MAX) {
+    return compile_error(self, "too many arguments in call", NULL);
+  }
+  if (self->num_call_sites > UINT16_MAX) {
+    return compile_error(self, "too many call sites", NULL);
+  }
+
+  // a call keeps the caller pure only when the callee is known to be pure
+  bool pure_callee = false;
+  int32_t function = -1;
+  if (call->function != NULL && call->function->vt->kind == NODE_IDENTIFIER) {
+    const Identifier *ident = (const Identifier *)call->function;
+    Symbol symbol;
+    if (symbol_resolve(self->symbols, &ident->value, &symbol)) {
+      pure_callee = symbol.scope == SCOPE_BUILTIN
+                        ? builtin_get(symbol.index)->pure
+                        : symbol.pure_fn;
+      function = symbol.scope == SCOPE_BUILTIN ? -1 : symbol.function;
+    }
+  }
+  if (!pure_callee)
+    mark_impure(self);
+
+  // Array and function literals passed where the callee never lets them out
+  // live in a region released as soon as the call returns. The VM checks the
+  // callee is still the function analysed here, the name may have been bound
+  // again since. A tail call leaves no frame to release the region from.
+  uint32_t escaping = UINT32_MAX;
+  if (function >= 0 && !tail) {
+    const CompiledFunction *callee =
+        (const CompiledFunction *)self->constants.data[function].as.obj;
+    if (callee->num_parameters == call->arguments.size)
+      escaping = callee->escaping_parameters;
+  }
+  bool region = false;
+  bool in_region[UINT8_MAX];
+  for (int32_t i = 0; i < call->arguments.size; i++) {
+    NodeKind kind = call->arguments.data[i]->vt->kind;
+    in_region[i] = i < 32 && !(escaping & (UINT32_C(1) << i)) &&
+                   (kind == NODE_FN_EXPR || kind == NODE_ARRAY_EXPR);
+    region = region || in_region[i];
+  }
+
+  if (!compile_expression(self, call->function, false))
+    return false;
+  CompilationScope *scope = &self->scopes[self->scope_index];
+  if (region) {
+    emit(self, OP_ENTER_REGION, function, 0);
+    scope->open_regions++;
+  }
+
+  for (int32_t i = 0; i < call->arguments.size; i++) {
+    const Expression *arg = call->arguments.data[i];
+    bool ok;
+    if (!in_region[i])
+      ok = compile_expression(self, arg, false);
+    else if (arg->vt->kind == NODE_FN_EXPR)
+      ok = compile_fn_expression(self, (const FnExpression *)arg, NULL, NULL,
+                                 NULL, true);
+    else
+      ok = compile_array_expression(self, (const ArrayExpression *)arg, true);
+    if (!ok)
+      return false;
+  }
+
+  // the code after a tail call still returns the value it leaves behind, so
+  // the VM is free to run it as a plain call
+  emit(self, tail ? OP_TAIL_CALL : OP_CALL, call->arguments.size,
+       self->num_call_sites++);
+  if (region) {
+    emit(self, OP_LEAVE_REGION, 0, 0);
+    scope->open_regions--;
+  }
+  return true;
+}
+
+// `in_region` allocates the array in the region of the call it is an
+// argument of
+static bool compile_array_expression(Compiler *self,
+                                     const ArrayExpression *array,
+                                     bool in_region) {
+  if (array->elements.size > UINT16_MAX) {
+    return compile_error(self, "too many elements in array literal", NULL);
+  }
+
+  for (int32_t i = 0; i < array->elements.size; i++) {
+    if (!compile_expression(self, array->elements.data[i], false))
+      return false;
+  }
+
+  emit(self, in_region ? OP_REGION_ARRAY : OP_ARRAY, array->elements.size,
+       0);
+  return true;
+}
+
+static bool compile_map_expression(Compiler *self, const MapExpression *map) {
+  if (map->keys.size > UINT16_MAX) {
+    return compile_error(self, "too many pairs in map literal", NULL);
+  }
+
+  // pairs stay in source order, later duplicates replace earlier values
+  for (int32_t i = 0; i < map->keys.size; i++) {
+    if (!compile_expression(self, map->keys.data[i], false) ||
+        !compile_expression(self, map->values.data[i], false))
+      return false;
+  }
+
+  emit(self, OP_MAP, map->keys.size, 0);
+  return true;
+}
+
+static bool add_string_constant(Compiler *self, const StringExpr *str,
+                                int32_t *index) {
+  // the only copy of the characters, the AST borrows them from the source
+  const String *contents = &str->token.literal;
+  Value value = OBJ_VAL(string_new(NULL, contents->chars, contents->length));
+  if (!add_constant(self, value, index)) {
+    object_free(value.as.obj);
+    return false;
+  }
+  return true;
+}
+
+static bool compile_index_expression(Compiler *self,
+                                     const IndexExpression *index_expr) {
+  if (index_expr->left == NULL || index_expr->index == NULL) {
+    return compile_error(self, "incomplete index expression", NULL);
+  }
+
+  if (!compile_expression(self, index_expr->left, false))
+    return false;
+
+  // a constant key is looked up through the shape cache of its site
+  if (index_expr->index->vt->kind == NODE_STRING_EXPR) {
+    if (self->num_shape_sites > UINT16_MAX) {
+      return compile_error(self, "too many field accesses", NULL);
+    }
+    int32_t key;
+    if (!add_string_constant(self, (const StringExpr *)index_expr->index,
+                             &key))
+      return false;
+    emit(self, OP_GET_FIELD, key, self->num_shape_sites++);
+    return true;
+  }
+
+  if (!compile_expression(self, index_expr->index, false))
+    return false;
+
+  emit(self, OP_INDEX, 0, 0);
+  return true;
+}
+
+static bool compile_infix_expression(Compiler *self,
+                                     const InfixExpression *infix) {
+  if (!compile_expression(self, infix->left, false))
+    return false;
+  if (!compile_expression(self, infix->right, false))
+    return false;
+
+  switch (infix->token.type) {
+  case TOKEN_PLUS:
+    emit(self, OP_ADD, 0, 0);
+    break;
+  case TOKEN_MINUS:
+    emit(self, OP_SUB, 0, 0);
+    break;
+  case TOKEN_ASTERISK:
+    emit(self, OP_MUL, 0, 0);
+    break;
+  case TOKEN_SLASH:
+    emit(self, OP_DIV, 0, 0);
+    break;
+  case TOKEN_EQ:
+    emit(self, OP_EQ, 0, 0);
+    break;
+  case TOKEN_NOT_EQ:
+    emit(self, OP_NOT_EQ, 0, 0);
+    break;
+  case TOKEN_LT:
+    emit(self, OP_LT, 0, 0);
+    break;
+  case TOKEN_GT:
+    emit(self, OP_GT, 0, 0);
+    break;
+  default:
+    return compile_error(self, "unknown infix operator ", &infix->op);
+  }
+
+  return true;
+}
+
+static bool compile_prefix_expression(Compiler *self,
+                                      const PrefixExpression *prefix) {
+  if (!compile_expression(self, prefix->right, false))
+    return false;
+
+  switch (prefix->token.type) {
+  case TOKEN_BANG:
+    emit(self, OP_BANG, 0, 0);
+    break;
+  case TOKEN_MINUS:
+    emit(self, OP_MINUS, 0, 0);
+    break;
+  case TOKEN_PLUS:
+    break;
+  default:
+    return compile_error(self, "unknown prefix operator ", &prefix->op);
+  }
+
+  return true;
+}
+
+static bool compile_expression(Compiler *self, const Expression *expr,
+                               bool tail) {
+  if (expr == NULL) {
+    return compile_error(self, "invalid expression", NULL);
+  }
+
+  switch (expr->vt->kind) {
+  case NODE_INT_EXPR: {
+    const IntExpr *int_expr = (const IntExpr *)expr;
+    // big literals are unmanaged constants like the compiled functions
+    Value value = int_expr->is_big
+                      ? bigint_parse(NULL, &int_expr->token.literal)
+                      : INT_VAL(int_expr->value);
+    int32_t index;
+    if (!add_constant(self, value, &index)) {
+      if (IS_OBJ(value))
+        object_free(value.as.obj);
+      return false;
+    }
+    emit(self, OP_CONSTANT, index, 0);
+    return true;
+  }
+  case NODE_STRING_EXPR: {
+    int32_t index;
+    if (!add_string_constant(self, (const StringExpr *)expr, &index))
+      return false;
+    emit(self, OP_CONSTANT, index, 0);
+    return true;
+  }
+  case NODE_BOOLEAN_EXPR:
+    emit(self, ((const BooleanExpression *)expr)->value ? OP_TRUE : OP_FALSE,
+         0, 0);
+    return true;
+  case NODE_IDENTIFIER: {
+    const Identifier *ident = (const Identifier *)expr;
+    Symbol symbol;
+    if (!symbol_resolve(self->symbols, &ident->value, &symbol)) {
+      return compile_error(self, "undefined variable ", &ident->value);
+    }
+    // globals may be bound again later, only pure functions stay put
+    if (symbol.scope == SCOPE_GLOBAL && !symbol.pure_fn)
+      mark_impure(self);
+    return load_symbol(self, symbol);
+  }
+  case NODE_PREFIX_EXPR:
+    return compile_prefix_expression(self, (const PrefixExpression *)expr);
+  case NODE_INFIX_EXPR:
+    return compile_infix_expression(self, (const InfixExpression *)expr);
+  case NODE_IF_EXPR:
+    return compile_if_expression(self, (const IfExpression *)expr, tail);
+  case NODE_FN_EXPR:
+    return compile_fn_expression(self, (const FnExpression *)expr, NULL,
+                                 NULL, NULL, false);
+  case NODE_CALL_EXPR:
+    return compile_call_expression(self, (const CallExpression *)expr,
+                                   tail && in_function(self));
+  case NODE_ARRAY_EXPR:
+    return compile_array_expression(self, (const ArrayExpression *)expr,
+                                    false);
+  case NODE_MAP_EXPR:
+    return compile_map_expression(self, (const MapExpression *)expr);
+  case NODE_INDEX_EXPR:
+    return compile_index_expression(self, (const IndexExpression *)expr);
+  default:
+    return compile_error(self, "unsupported expression", NULL);
+  }
+}
+
+static bool compile_let_statement(Compiler *self, const LetStatement *let_st) {
+  if (let_st->name == NULL || let_st->value == NULL) {
+    return compile_error(self, "incomplete let statement", NULL);
+  }
+
+  // bound before the value so top level functions can call themselves
+  Symbol symbol;
+  if (!bind_name(self, &let_st->name->value, &symbol))
+    return false;
+
+  bool ok;
+  if (let_st->value->vt->kind == NODE_FN_EXPR) {
+    bool is_pure = false;
+    int32_t index;
+    ok = compile_fn_expression(self, (const FnExpression *)let_st->value,
+                               &let_st->name->value, &is_pure, &index, false);
+    if (ok && is_pure)
+      symbol_mark_pure_fn(self->symbols, symbol);
+    if (ok)
+      symbol_bind_function(self->symbols, symbol, index);
+  } else {
+    ok = compile_expression(self, let_st->value, false);
+    symbol_bind_function(self->symbols, symbol, -1);
+  }
+  if (!ok)
+    return false;
+
+  return store_symbol(self, symbol);
+}
+
+// jumps back to `loop_start`
+static bool emit_loop(Compiler *self, int32_t loop_start) {
+  if (loop_start > UINT16_MAX) {
+    return compile_error(self, "function body too large to jump over", NULL);
+  }
+  emit(self, OP_JUMP, loop_start, 0);
+  return true;
+}
+
+static bool compile_loop_body(Compiler *self, const BlockStatement *body) {
+  // no value is left behind, every iteration starts on the same stack
+  for (int32_t i = 0; i < body->statements.size; i++) {
+    if (!compile_statement(self, body->statements.data[i]))
+      return false;
+  }
+  return true;
+}
+
+// the counter and the end bound live in slots of the enclosing scope, an
+// iteration is a compare-and-branch, the body and an increment
+static bool compile_for_range(Compiler *self, const ForStatement *for_st) {
+  if (for_st->start == NULL || for_st->end == NULL) {
+    return compile_error(self, "incomplete for range", NULL);
+  }
+
+  Symbol counter;
+  if (!compile_expression(self, for_st->start, false) ||
+      !bind_name(self, &for_st->variable->value, &counter) ||
+      !store_symbol(self, counter))
+    return false;
+
+  // no identifier is empty, the bound cannot be named by the body
+  Symbol end = symbol_define(self->symbols, String_from(""));
+  if (!compile_expression(self, for_st->end, false) ||
+      !store_symbol(self, end))
+    return false;
+
+  int32_t one;
+  if (!add_constant(self, INT_VAL(1), &one))
+    return false;
+
+  int32_t loop_start = current_instructions(self)->size;
+  load_symbol(self, counter);
+  load_symbol(self, end);
+  emit(self, OP_LT, 0, 0);
+  int32_t exit_jump = emit(self, OP_JUMP_FALSE, 0, 0);
+
+  if (!compile_loop_body(self, for_st->body))
+    return false;
+
+  load_symbol(self, counter);
+  emit(self, OP_CONSTANT, one, 0);
+  emit(self, OP_ADD, 0, 0);
+  if (!store_symbol(self, counter) || !emit_loop(self, loop_start))
+    return false;
+
+  return patch_jump(self, exit_jump);
+}
+
+static bool compile_for_statement(Compiler *self, const ForStatement *for_st) {
+  if (for_st->body == NULL) {
+    return compile_error(self, "missing for body", NULL);
+  }
+  if (for_st->variable != NULL)
+    return compile_for_range(self, for_st);
+
+  if (for_st->init != NULL && !compile_statement(self, for_st->init))
+    return false;
+
+  int32_t loop_start = current_instructions(self)->size;
+  int32_t exit_jump = -1;
+  if (for_st->condition != NULL) {
+    if (!compile_expression(self, for_st->condition, false))
+      return false;
+    exit_jump = emit(self, OP_JUMP_FALSE, 0, 0);
+  }
+
+  if (!compile_loop_body(self, for_st->body))
+    return false;
+  if (for_st->update != NULL && !compile_statement(self, for_st->update))
+    return false;
+  if (!emit_loop(self, loop_start))
+    return false;
+
+  return exit_jump < 0 || patch_jump(self, exit_jump);
+}
+
+static bool compile_statement(Compiler *self, const Statement *st) {
+  if (st == NULL) {
+    return compile_error(self, "invalid statement", NULL);
+  }
+
+  switch (st->vt->kind) {
+  case NODE_LET_STATEMENT:
+    return compile_let_statement(self, (const LetStatement *)st);
+  case NODE_RETURN_STATEMENT: {
+    const ReturnStatement *ret_st = (const ReturnStatement *)st;
+    // the value of a return is always the result of the function, it is
+    // no tail call when the regions of enclosing calls are left after it
+    int32_t open_regions = self->scopes[self->scope_index].open_regions;
+    if (!compile_expression(self, ret_st->value,
+                            in_function(self) && open_regions == 0))
+      return false;
+    for (int32_t i = 0; i < open_regions; i++)
+      emit(self, OP_LEAVE_REGION, 0, 0);
+    emit(self, OP_RETURN_VALUE, 0, 0);
+    return true;
+  }
+  case NODE_EXPR_STATEMENT: {
+    const ExpressionStatement *expr_st = (const ExpressionStatement *)st;
+    if (!compile_expression(self, expr_st->expr, false))
+      return false;
+    emit(self, OP_POP, 0, 0);
+    return true;
+  }
+  case NODE_BLOCK_STATEMENT:
+    if (!compile_block_value(self, (const BlockStatement *)st, false))
+      return false;
+    emit(self, OP_POP, 0, 0);
+    return true;
+  case NODE_FOR_STATEMENT:
+    return compile_for_statement(self, (const ForStatement *)st);
+  default:
+    return compile_error(self, "unsupported statement", NULL);
+  }
+}
+
+bool compile_program(Compiler *self, Program *program) {
+  assert(self != NULL);
+  assert(program != NULL);
+
+  for (int32_t i = 0; i < program->statements.size; i++) {
+    if (!compile_statement(self, program->statements.data[i]))
+      return false;
+  }
+
+  if (current_instructions(self)->size > UINT16_MAX) {
+    return compile_error(self, "program too large", NULL);
+  }
+  if (self->superinstructions)
+    instructions_fuse(current_instructions(self));
+
+  return true;
+}
+
+void compiler_begin_program(Compiler *self) {
+  assert(self != NULL);
+  assert(self->scope_index == 0);
+  self->scopes[0].instructions.size = 0;
+  free_string_array(&self->errors);
+  self->errors = string_array_init(1);
+}
+
+Bytecode compiler_bytecode(const Compiler *self) {
+  assert(self != NULL);
+
+  SymbolTable *globals = self->symbols;
+  while (globals->outer != NULL)
+    globals = globals->outer;
+
+  return (Bytecode){
+      .instructions = &self->scopes[0].instructions,
+      .constants = &self->constants,
+      .num_globals = globals->num_definitions,
+      .num_call_sites = self->num_call_sites,
+      .num_shape_sites = self->num_shape_sites,
+  };
+}
@@ -0,0 +1,110 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "ast.h"
+#include "code.h"
+#include "object.h"
+#include "parser.h"
+
+#define MAX_SCOPE_DEPTH 256
+
+typedef enum SymbolScope {
+  SCOPE_GLOBAL,
+  SCOPE_LOCAL,
+  SCOPE_BUILTIN,
+  SCOPE_FREE,
+  // the name a function literal was bound to, resolved inside its own body
+  SCOPE_FUNCTION,
+} SymbolScope;
+
+typedef struct Symbol {
+  String name;
+  SymbolScope scope;
+  int32_t index;
+  // bound to a function the compiler proved pure
+  bool pure_fn;
+  // constant index of the function literal last bound to the name, -1 when
+  // it holds anything else
+  int32_t function;
+} Symbol;
+
+typedef struct SymbolTable SymbolTable;
+
+struct SymbolTable {
+  SymbolTable *outer;
+
+  int32_t capacity;
+  int32_t size;
+  Symbol *store;
+
+  // symbols of enclosing functions captured by this one, in capture order
+  int32_t free_capacity;
+  int32_t num_free;
+  Symbol *free_symbols;
+
+  int32_t num_definitions;
+};
+
+SymbolTable *SymbolTable_new(SymbolTable *outer);
+Symbol symbol_define(SymbolTable *self, String name);
+Symbol symbol_define_builtin(SymbolTable *self, int32_t index, String name);
+Symbol symbol_define_function_name(SymbolTable *self, String name);
+// returns false if `name` is not bound in this or any enclosing table
+bool symbol_resolve(SymbolTable *self, const String *name, Symbol *out);
+void symbol_mark_pure_fn(SymbolTable *self, Symbol symbol);
+void symbol_bind_function(SymbolTable *self, Symbol symbol, int32_t function);
+void free_symbol_table(SymbolTable *self);
+
+typedef struct CompilationScope {
+  Instructions instructions;
+  // Cleared as soon as the function body may cause a side effect: a call to
+  // anything not known to be pure, or a read of a global that is not a pure
+  // function. Closures copy what they capture, so binding a captured name
+  // again does not reach them.
+  bool is_pure;
+  // leading locals a @memo function stores its result under when it
+  // returns, they cannot be bound again
+  int32_t memo_parameters;
+  // regions of the calls whose arguments are being compiled, a return
+  // among them leaves them first
+  int32_t open_regions;
+} CompilationScope;
+
+typedef struct Bytecode {
+  const Instructions *instructions;
+  const ValuesArray *constants;
+  int32_t num_globals;
+  // every OP_CALL/OP_TAIL_CALL carries its own index below this
+  int32_t num_call_sites;
+  // every OP_GET_FIELD carries its own index below this
+  int32_t num_shape_sites;
+} Bytecode;
+
+typedef struct Compiler {
+  ValuesArray constants;
+  SymbolTable *symbols;
+  StringArray errors;
+
+  CompilationScope scopes[MAX_SCOPE_DEPTH];
+  int32_t scope_index;
+
+  int32_t num_call_sites;
+  int32_t num_shape_sites;
+
+  // fuse the instruction sequences listed in SUPERINSTRUCTION_LIST
+  bool superinstructions;
+} Compiler;
+
+Compiler *Compiler_new(void);
+void free_compiler(Compiler *self);
+
+// returns false and fills `errors` when the program could not be compiled
+bool compile_program(Compiler *self, Program *program);
+// drops the top level code and the errors of the last program, the globals
+// and constants stay so the next program can use what it defined
+void compiler_begin_program(Compiler *self);
+
+// borrowed view of the compiled program, valid until the compiler is freed
+Bytecode compiler_bytecode(const Compiler *self);
+
+#endif // !COMPILER_H
@@ -0,0 +1,73 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "compiler.h"
+#include "context.h"
+#include "lexer.h"
+#include "parser.h"
+#include "vm.h"
+
+#include "cstring.h/cstring.h"
+
+FizzContext *FizzContext_new(void) {
+  FizzContext *ctx = malloc(sizeof(FizzContext));
+  assert(ctx != NULL);
+
+  ctx->compiler = Compiler_new();
+  // nothing to run yet, fizz_eval loads every program into this VM
+  ctx->vm = VM_new(compiler_bytecode(ctx->compiler));
+  ctx->error = STR_NULL;
+
+  return ctx;
+}
+
+void free_fizz_context(FizzContext *self) {
+  if (self == NULL)
+    return;
+
+  // the VM reads the constant pool of the compiler until it is gone
+  free_vm(self->vm);
+  free_compiler(self->compiler);
+  free_string(&self->error);
+  free(self);
+}
+
+static bool eval_failed(FizzContext *self, const String *message) {
+  self->error = String_clone(message);
+  return false;
+}
+
+bool fizz_eval(FizzContext *self, const char *source, Value *out) {
+  assert(self != NULL);
+  assert(source != NULL);
+  free_string(&self->error);
+  self->error = STR_NULL;
+  *out = NULL_VAL;
+
+  Parser *p = Parser_new(Lexer_new(String_from(source)));
+  Program *program = parse_program(p);
+  bool ok = p->errors.size == 0;
+  if (!ok)
+    eval_failed(self, &p->errors.data[0]);
+
+  if (ok) {
+    compiler_begin_program(self->compiler);
+    ok = compile_program(self->compiler, program);
+    if (!ok)
+      eval_failed(self, &self->compiler->errors.data[0]);
+  }
+
+  if (ok) {
+    vm_load_program(self->vm, compiler_bytecode(self->compiler));
+    ok = vm_run(self->vm) == VM_OK;
+    if (ok)
+      *out = vm_last_popped(self->vm);
+    else
+      eval_failed(self, &self->vm->error);
+  }
+
+  // the compiled code keeps its own copies of names and literals
+  free_program(program);
+  free_parser(p);
+  return ok;
+}
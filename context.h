@@ -0,0 +1,38 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdbool.h>
+
+#include "compiler.h"
+#include "object.h"
+#include "vm.h"
+
+#include "cstring.h/cstring.h"
+
+// One embedded interpreter. It owns everything a program mutates: the
+// compiler with its symbols and constant pool, and the VM with its heap,
+// shapes, caches and thread pool. What contexts share is read only, the
+// keyword, token, opcode and builtin tables, so each thread can drive its
+// own context without any lock. A context is used by one thread at a time.
+//
+// Programs run one after the other and see the globals of the ones before,
+// like the lines of a REPL session.
+typedef struct FizzContext {
+  Compiler *compiler;
+  // settings like `jit_threshold` or `parallel_workers` can be changed
+  // between programs
+  VM *vm;
+  // why the last fizz_eval failed, empty after a success
+  String error;
+} FizzContext;
+
+FizzContext *FizzContext_new(void);
+void free_fizz_context(FizzContext *self);
+
+// parses, compiles and runs `source`. `out` receives the value of the last
+// expression statement, valid until the next program runs. False with
+// `error` set on a syntax, compile or runtime error, the globals defined
+// before stay usable.
+bool fizz_eval(FizzContext *self, const char *source, Value *out);
+
+#endif // !CONTEXT_H
@@ -0,0 +1,138 @@
+// munmap
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "code.h"
+#include "compiler.h"
+#include "frozen.h"
+#include "gc.h"
+#include "jit.h"
+#include "object.h"
+#include "rope.h"
+#include "verify.h"
+
+#include "cstring.h/cstring.h"
+
+// Everything the interpreter would fill in lazily is filled in here, before
+// a second thread can see the program.
+static void freeze_function(CompiledFunction *fn, const ValuesArray *constants,
+                            bool native) {
+  if (native && fn->native == NULL)
+    fn->native = jit_compile(fn, constants);
+  // a negative count stops native_code and loop_native_code before they
+  // count anything, functions without native code stay interpreted
+  fn->calls = -1;
+  fn->back_edges = 0;
+}
+
+static StringArray global_names(const Compiler *compiler,
+                                int32_t num_globals) {
+  const SymbolTable *globals = compiler->symbols;
+  while (globals->outer != NULL)
+    globals = globals->outer;
+
+  const String **names = calloc(num_globals + 1, sizeof(String *));
+  assert(names != NULL);
+  for (int32_t i = 0; i < globals->size; i++) {
+    const Symbol *symbol = &globals->store[i];
+    if (symbol->scope == SCOPE_GLOBAL && symbol->index < num_globals)
+      names[symbol->index] = &symbol->name;
+  }
+
+  StringArray out = string_array_init(num_globals + 1);
+  for (int32_t i = 0; i < num_globals; i++)
+    string_array_push(&out, names[i] != NULL ? String_clone(names[i])
+                                             : String_from(""));
+  free(names);
+  return out;
+}
+
+FrozenProgram *program_freeze(Compiler *compiler, bool native) {
+  assert(compiler != NULL);
+  FrozenProgram *program = malloc(sizeof(FrozenProgram));
+  assert(program != NULL);
+
+  Bytecode bytecode = compiler_bytecode(compiler);
+  program->num_globals = bytecode.num_globals;
+  program->num_call_sites = bytecode.num_call_sites;
+  program->num_shape_sites = bytecode.num_shape_sites;
+  program->global_names = global_names(compiler, bytecode.num_globals);
+
+  // like the main function of a VM, the trailing OP_RETURN halts the top
+  // level once it runs out of code
+  Instructions main_ins = instructions_clone(bytecode.instructions);
+  instructions_emit(&main_ins, OP_RETURN, 0, 0);
+  program->main_fn = compiled_function_new(main_ins, 0, 0, STR_NULL);
+
+  program->constants = compiler->constants;
+  compiler->constants = values_array_init(0);
+
+  // only code the verifier passed is compiled to machine code
+  String error;
+  native = frozen_program_verify(program, &error) && native;
+  free_string(&error);
+
+  for (int32_t i = 0; i < program->constants.size; i++) {
+    Value constant = program->constants.data[i];
+    if (IS_OBJ_TYPE(constant, OBJ_FUNCTION))
+      freeze_function((CompiledFunction *)constant.as.obj,
+                      &program->constants, native);
+    else if (IS_OBJ_TYPE(constant, OBJ_STRING))
+      // cached on first use otherwise, by every thread hashing it
+      string_hash((StringObject *)constant.as.obj);
+  }
+  // the top level runs once per VM, it is not worth compiling
+  freeze_function(program->main_fn, &program->constants, false);
+
+  program->mapping = NULL;
+  program->mapping_size = 0;
+  program->refs = 1;
+  return program;
+}
+
+bool frozen_program_verify(FrozenProgram *self, String *error) {
+  assert(self != NULL);
+  BytecodeLimits limits = {
+      .constants = &self->constants,
+      .num_globals = self->num_globals,
+      .num_call_sites = self->num_call_sites,
+      .num_shape_sites = self->num_shape_sites,
+  };
+  self->verified = bytecode_verify(self->main_fn, &limits, error);
+  return self->verified;
+}
+
+FrozenProgram *frozen_program_retain(FrozenProgram *self) {
+  assert(self != NULL);
+  __atomic_add_fetch(&self->refs, 1, __ATOMIC_RELAXED);
+  return self;
+}
+
+void frozen_program_release(FrozenProgram *self) {
+  if (self == NULL)
+    return;
+  // the last holder has to see what the others did before they let go
+  if (__atomic_sub_fetch(&self->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
+  object_free((Object *)self->main_fn);
+  free_values(&self->constants);
+  free_string_array(&self->global_names);
+  // the functions freed above borrowed their code from it
+  if (self->mapping != NULL)
+    munmap((void *)self->mapping, self->mapping_size);
+  free(self);
+}
+
+int32_t frozen_program_global(const FrozenProgram *self, const char *name) {
+  assert(self != NULL);
+  assert(name != NULL);
+  for (int32_t i = self->global_names.size - 1; i >= 0; i--)
+    if (strcmp(self->global_names.data[i].chars, name) == 0)
+      return i;
+  return -1;
+}
@@ -0,0 +1,60 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compiler.h"
+#include "object.h"
+
+#include "cstring.h/cstring.h"
+
+// A compiled program that never changes again, shared by any number of VMs
+// running it on their own threads. It holds the code only: every VM made
+// with VM_new_frozen keeps its own stack, frames, globals, inline caches and
+// heap, so a thread costs its running state and not another copy of the
+// functions.
+//
+// Nothing running the program writes to it. Its VMs do not quicken, the
+// call and loop counters of the JIT are switched off, and whatever native
+// code the functions have was compiled when freezing.
+typedef struct FrozenProgram {
+  // functions and literals, unmanaged objects only
+  ValuesArray constants;
+  // the top level code followed by OP_RETURN
+  CompiledFunction *main_fn;
+  int32_t num_globals;
+  int32_t num_call_sites;
+  int32_t num_shape_sites;
+  // name each global slot was defined with, a name bound again at the top
+  // level gets a new slot
+  StringArray global_names;
+  // every function passed bytecode_verify, its VMs never run checked
+  bool verified;
+  // read only mapping of the .fzc file the code was loaded from, unmapped
+  // by the last release, NULL for a program frozen in memory
+  const void *mapping;
+  size_t mapping_size;
+  // holders of the program, the last release frees it
+  int32_t refs;
+} FrozenProgram;
+
+// takes the constant pool and the top level code of the program `compiler`
+// compiled last, the compiler can only be freed afterwards. With `native`
+// every function is compiled to machine code now, where the platform has a
+// JIT. The caller holds the one reference of the result.
+FrozenProgram *program_freeze(Compiler *compiler, bool native);
+
+// runs bytecode_verify over the whole program and records the result in
+// `verified`, once before the program is shared
+bool frozen_program_verify(FrozenProgram *self, String *error);
+
+// safe from any thread, returns `self`
+FrozenProgram *frozen_program_retain(FrozenProgram *self);
+void frozen_program_release(FrozenProgram *self);
+
+// slot of the latest global bound to `name`, -1 if there is none
+int32_t frozen_program_global(const FrozenProgram *self, const char *name);
+
+#endif // !FROZEN_H
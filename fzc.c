@@ -0,0 +1,581 @@
+// mmap, fstat
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bigint.h"
+#include "builtins.h"
+#include "code.h"
+#include "frozen.h"
+#include "fzc.h"
+#include "gc.h"
+#include "object.h"
+#include "rope.h"
+
+#include "cstring.h/cstring.h"
+
+#define FZC_MAGIC "FZC"
+#define FZC_VERSION 1
+// read back as another number on a machine of the other byte order
+#define FZC_BYTE_ORDER 0x01020304u
+
+// Layout of a file: the header, the constant records, the global name
+// records, then the payloads they point to. Offsets count from the start of
+// the file. Names and big int digits are NUL terminated in the file, the
+// terminator is not part of their length.
+typedef struct FzcHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t num_opcodes;
+  uint32_t num_builtins;
+  uint32_t num_globals;
+  uint32_t num_call_sites;
+  uint32_t num_shape_sites;
+  uint32_t num_constants;
+  // FzcConstant[num_constants]
+  uint32_t constants_offset;
+  // FzcName[num_globals]
+  uint32_t names_offset;
+  // top level code, ending in OP_RETURN
+  uint32_t main_offset;
+  uint32_t main_size;
+  uint32_t file_size;
+} FzcHeader;
+
+typedef enum FzcConstantType {
+  FZC_INT,
+  FZC_STRING,
+  FZC_BIGINT,
+  FZC_FUNCTION,
+} FzcConstantType;
+
+enum {
+  FZC_MEMOIZE = 1 << 0,
+  FZC_PURE = 1 << 1,
+  // functions without a name leave `name` empty
+  FZC_NAMED = 1 << 2,
+};
+
+typedef struct FzcName {
+  uint32_t offset;
+  uint32_t length;
+} FzcName;
+
+typedef struct FzcConstant {
+  uint32_t type;
+  uint32_t flags;
+  // value of an int
+  int64_t value;
+  // characters of a string, decimal digits of a big int or code of a
+  // function
+  uint32_t offset;
+  uint32_t length;
+  FzcName name;
+  int32_t num_locals;
+  int32_t num_parameters;
+  uint32_t escaping_parameters;
+  uint32_t reserved;
+} FzcConstant;
+
+// FzcWriter impl start -----
+typedef struct FzcWriter {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+} FzcWriter;
+
+static void writer_reserve(FzcWriter *self, size_t extra) {
+  if (self->size + extra <= self->capacity)
+    return;
+  size_t capacity = self->capacity == 0 ? 4096 : self->capacity;
+  while (capacity < self->size + extra)
+    capacity *= 2;
+  uint8_t *data = realloc(self->data, capacity);
+  assert(data != NULL);
+  self->data = data;
+  self->capacity = capacity;
+}
+
+// room for `size` zeroed bytes at the end, returns their offset
+static size_t writer_skip(FzcWriter *self, size_t size) {
+  writer_reserve(self, size);
+  size_t offset = self->size;
+  memset(self->data + offset, 0, size);
+  self->size += size;
+  return offset;
+}
+
+// copies a payload to the end, `terminate` adds a NUL after it
+static FzcName writer_payload(FzcWriter *self, const void *data,
+                              size_t length, bool terminate) {
+  size_t offset = writer_skip(self, length + (terminate ? 1 : 0));
+  if (length > 0)
+    memcpy(self->data + offset, data, length);
+  return (FzcName){.offset = (uint32_t)offset, .length = (uint32_t)length};
+}
+
+static bool write_constant(FzcWriter *self, size_t record, Value constant,
+                           String *error) {
+  FzcConstant c;
+  memset(&c, 0, sizeof(c));
+
+  if (constant.type == VAL_INT) {
+    c.type = FZC_INT;
+    c.value = constant.as.integer;
+  } else if (IS_OBJ_TYPE(constant, OBJ_STRING)) {
+    StringObject *str = (StringObject *)constant.as.obj;
+    const char *chars = string_flatten(NULL, str);
+    FzcName payload = writer_payload(self, chars, str->length, false);
+    c.type = FZC_STRING;
+    c.offset = payload.offset;
+    c.length = payload.length;
+  } else if (IS_OBJ_TYPE(constant, OBJ_BIGINT)) {
+    String digits = value_inspect(constant);
+    FzcName payload = writer_payload(self, digits.chars, digits.length, true);
+    free_string(&digits);
+    c.type = FZC_BIGINT;
+    c.offset = payload.offset;
+    c.length = payload.length;
+  } else if (IS_OBJ_TYPE(constant, OBJ_FUNCTION)) {
+    const CompiledFunction *fn = (const CompiledFunction *)constant.as.obj;
+    if (fn->tree != NULL) {
+      char buf[160];
+      snprintf(buf, sizeof(buf), "function has no bytecode: %.100s",
+               fn->name.chars != NULL ? fn->name.chars : "<anonymous>");
+      *error = String_from(buf);
+      return false;
+    }
+    FzcName code = writer_payload(self, fn->instructions.data,
+                                  fn->instructions.size, false);
+    c.type = FZC_FUNCTION;
+    c.offset = code.offset;
+    c.length = code.length;
+    c.num_locals = fn->num_locals;
+    c.num_parameters = fn->num_parameters;
+    c.escaping_parameters = fn->escaping_parameters;
+    c.flags = (fn->memoize ? FZC_MEMOIZE : 0) | (fn->pure ? FZC_PURE : 0);
+    if (fn->name.chars != NULL) {
+      c.flags |= FZC_NAMED;
+      c.name = writer_payload(self, fn->name.chars, fn->name.length, true);
+    }
+  } else {
+    *error = String_from("constant cannot be saved");
+    return false;
+  }
+
+  memcpy(self->data + record, &c, sizeof(c));
+  return true;
+}
+
+bool fzc_write(const FrozenProgram *program, const char *path, String *error) {
+  assert(program != NULL);
+  assert(path != NULL);
+  assert(error != NULL);
+  *error = STR_NULL;
+
+  FzcWriter writer = {.data = NULL, .size = 0, .capacity = 0};
+  size_t header = writer_skip(&writer, sizeof(FzcHeader));
+  int32_t num_constants = program->constants.size;
+  int32_t num_names = program->global_names.size;
+  size_t constants = writer_skip(&writer, sizeof(FzcConstant) * num_constants);
+  size_t names = writer_skip(&writer, sizeof(FzcName) * num_names);
+
+  for (int32_t i = 0; i < num_constants; i++) {
+    size_t record = constants + sizeof(FzcConstant) * i;
+    if (!write_constant(&writer, record, program->constants.data[i], error)) {
+      free(writer.data);
+      return false;
+    }
+  }
+  for (int32_t i = 0; i < num_names; i++) {
+    const String *name = &program->global_names.data[i];
+    FzcName record = writer_payload(&writer, name->chars, name->length, true);
+    memcpy(writer.data + names + sizeof(FzcName) * i, &record, sizeof(record));
+  }
+  const Instructions *main_ins = &program->main_fn->instructions;
+  FzcName main_code =
+      writer_payload(&writer, main_ins->data, main_ins->size, false);
+
+  if (writer.size > UINT32_MAX) {
+    free(writer.data);
+    *error = String_from("program too large for a .fzc file");
+    return false;
+  }
+
+  FzcHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, FZC_MAGIC, sizeof(h.magic));
+  h.version = FZC_VERSION;
+  h.byte_order = FZC_BYTE_ORDER;
+  h.num_opcodes = OPCODE_COUNT;
+  h.num_builtins = (uint32_t)builtins_count();
+  h.num_globals = (uint32_t)num_names;
+  h.num_call_sites = (uint32_t)program->num_call_sites;
+  h.num_shape_sites = (uint32_t)program->num_shape_sites;
+  h.num_constants = (uint32_t)num_constants;
+  h.constants_offset = (uint32_t)constants;
+  h.names_offset = (uint32_t)names;
+  h.main_offset = main_code.offset;
+  h.main_size = main_code.length;
+  h.file_size = (uint32_t)writer.size;
+  memcpy(writer.data + header, &h, sizeof(h));
+
+  FILE *out = fopen(path, "wb");
+  bool ok = out != NULL &&
+            fwrite(writer.data, 1, writer.size, out) == writer.size;
+  if (out != NULL && fclose(out) != 0)
+    ok = false;
+  free(writer.data);
+
+  if (!ok) {
+    char buf[320];
+    snprintf(buf, sizeof(buf), "could not write file: %.280s", path);
+    *error = String_from(buf);
+  }
+  return ok;
+}
+
+// FzcLoader impl start -----
+typedef struct FzcLoader {
+  const uint8_t *base;
+  size_t size;
+  String *error;
+} FzcLoader;
+
+static bool load_error(FzcLoader *self, const char *message) {
+  if (self->error->chars == NULL)
+    *self->error = String_from(message);
+  return false;
+}
+
+static bool in_file(const FzcLoader *self, uint32_t offset, uint64_t size) {
+  return (uint64_t)offset + size <= self->size;
+}
+
+// the code decodes to whole instructions and ends by returning, running it
+// never reads past its end
+static bool check_code(FzcLoader *self, uint32_t offset, uint32_t size) {
+  if (size == 0 || !in_file(self, offset, size))
+    return load_error(self, "code outside of the file");
+
+  const uint8_t *code = self->base + offset;
+  uint32_t i = 0;
+  uint8_t last = 0;
+  while (i < size) {
+    if (code[i] >= OPCODE_COUNT)
+      return load_error(self, "unknown opcode");
+    last = code[i];
+    i += (uint32_t)opcode_width((Opcode)code[i]);
+  }
+  if (i != size)
+    return load_error(self, "truncated instruction");
+  if (last != OP_RETURN && last != OP_RETURN_VALUE)
+    return load_error(self, "code does not end by returning");
+  return true;
+}
+
+// NUL terminated in the file and free of inner NULs
+static bool load_name(FzcLoader *self, FzcName name, String *out) {
+  if (!in_file(self, name.offset, (uint64_t)name.length + 1))
+    return load_error(self, "name outside of the file");
+  const char *chars = (const char *)self->base + name.offset;
+  if (chars[name.length] != '\0' || memchr(chars, '\0', name.length) != NULL)
+    return load_error(self, "malformed name");
+  *out = String_from(chars);
+  return true;
+}
+
+// borrows the code from the mapping, capacity 0 keeps it from being freed
+// Code checked by check_code, borrowed from the mapping. Region allocations
+// are only safe where the compiler proved the value does not outlive its
+// region, which nothing in a file proves, so code making any gets an own copy
+// with them turned into heap allocations. The regions are still entered and
+// left, empty.
+static Instructions mapped_instructions(const FzcLoader *self,
+                                        uint32_t offset, uint32_t size) {
+  Instructions ins;
+  ins.capacity = 0;
+  ins.size = (int32_t)size;
+  ins.data = (uint8_t *)(self->base + offset);
+
+  for (int32_t ip = 0; ip < ins.size;) {
+    Opcode op = (Opcode)ins.data[ip];
+    if (op == OP_REGION_ARRAY || op == OP_REGION_CLOSURE) {
+      if (ins.capacity == 0)
+        ins = instructions_clone(&ins);
+      ins.data[ip] = op == OP_REGION_ARRAY ? OP_ARRAY : OP_CLOSURE;
+    }
+    ip += opcode_width(op);
+  }
+  return ins;
+}
+
+static bool load_constant(FzcLoader *self, const FzcConstant *c,
+                          Value *out) {
+  switch (c->type) {
+  case FZC_INT:
+    *out = INT_VAL(c->value);
+    return true;
+  case FZC_STRING: {
+    if (c->length > INT32_MAX || !in_file(self, c->offset, c->length))
+      return load_error(self, "string outside of the file");
+    StringObject *str = string_new(
+        NULL, (const char *)self->base + c->offset, (int32_t)c->length);
+    string_hash(str);
+    *out = OBJ_VAL(str);
+    return true;
+  }
+  case FZC_BIGINT: {
+    String digits;
+    if (!load_name(self, (FzcName){c->offset, c->length}, &digits))
+      return false;
+    bool negative = digits.length > 0 && digits.chars[0] == '-';
+    bool valid = digits.length > (negative ? 1 : 0);
+    for (int32_t i = negative ? 1 : 0; i < digits.length; i++)
+      valid = valid && digits.chars[i] >= '0' && digits.chars[i] <= '9';
+    if (!valid) {
+      free_string(&digits);
+      return load_error(self, "malformed big int");
+    }
+    String magnitude =
+        String_substr_range(&digits, negative ? 1 : 0,
+                            digits.length - (negative ? 1 : 0));
+    *out = bigint_parse(NULL, &magnitude);
+    if (negative) {
+      Value positive = *out;
+      *out = bigint_negate(NULL, positive);
+      if (positive.type == VAL_OBJ)
+        object_free(positive.as.obj);
+    }
+    free_string(&magnitude);
+    free_string(&digits);
+    return true;
+  }
+  case FZC_FUNCTION: {
+    if (!check_code(self, c->offset, c->length))
+      return false;
+    // the compiler addresses locals and counts arguments with one byte
+    if (c->num_parameters < 0 || c->num_parameters > UINT8_MAX ||
+        c->num_locals < c->num_parameters || c->num_locals > UINT8_MAX + 1)
+      return load_error(self, "malformed function");
+    String name = STR_NULL;
+    if ((c->flags & FZC_NAMED) && !load_name(self, c->name, &name))
+      return false;
+    CompiledFunction *fn = compiled_function_new(
+        mapped_instructions(self, c->offset, c->length), c->num_locals,
+        c->num_parameters, name);
+    fn->memoize = (c->flags & FZC_MEMOIZE) != 0;
+    fn->pure = (c->flags & FZC_PURE) != 0;
+    fn->escaping_parameters = c->escaping_parameters;
+    // switches the JIT counters off like program_freeze does
+    fn->calls = -1;
+    *out = OBJ_VAL(fn);
+    return true;
+  }
+  default:
+    return load_error(self, "unknown constant type");
+  }
+}
+
+static bool check_header(FzcLoader *self, const FzcHeader *h) {
+  if (memcmp(h->magic, FZC_MAGIC, sizeof(h->magic)) != 0)
+    return load_error(self, "not a .fzc file");
+  if (h->byte_order != FZC_BYTE_ORDER)
+    return load_error(self, "written on a machine of another byte order");
+  if (h->version != FZC_VERSION || h->num_opcodes != OPCODE_COUNT ||
+      h->num_builtins != (uint32_t)builtins_count())
+    return load_error(self, "written by another version of fizzlang");
+  if (h->file_size != self->size)
+    return load_error(self, "file size does not match");
+  if (h->num_constants > UINT16_MAX + 1u || h->num_globals > INT32_MAX ||
+      h->num_call_sites > INT32_MAX || h->num_shape_sites > INT32_MAX)
+    return load_error(self, "malformed header");
+  if (!in_file(self, h->constants_offset,
+               (uint64_t)sizeof(FzcConstant) * h->num_constants) ||
+      !in_file(self, h->names_offset,
+               (uint64_t)sizeof(FzcName) * h->num_globals))
+    return load_error(self, "table outside of the file");
+  return check_code(self, h->main_offset, h->main_size);
+}
+
+static FrozenProgram *load_program(FzcLoader *self) {
+  FzcHeader h;
+  if (self->size < sizeof(h)) {
+    load_error(self, "not a .fzc file");
+    return NULL;
+  }
+  memcpy(&h, self->base, sizeof(h));
+  if (!check_header(self, &h))
+    return NULL;
+
+  ValuesArray constants = values_array_init(h.num_constants);
+  StringArray names = string_array_init(h.num_globals + 1);
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < h.num_constants; i++) {
+    FzcConstant c;
+    memcpy(&c, self->base + h.constants_offset + sizeof(c) * i, sizeof(c));
+    Value constant;
+    ok = load_constant(self, &c, &constant);
+    if (ok)
+      values_push(&constants, constant);
+  }
+  for (uint32_t i = 0; ok && i < h.num_globals; i++) {
+    FzcName record;
+    memcpy(&record, self->base + h.names_offset + sizeof(record) * i,
+           sizeof(record));
+    String name;
+    ok = load_name(self, record, &name);
+    if (ok)
+      string_array_push(&names, name);
+  }
+  if (!ok) {
+    free_values(&constants);
+    free_string_array(&names);
+    return NULL;
+  }
+
+  FrozenProgram *program = malloc(sizeof(FrozenProgram));
+  assert(program != NULL);
+  program->constants = constants;
+  program->main_fn = compiled_function_new(
+      mapped_instructions(self, h.main_offset, h.main_size), 0, 0, STR_NULL);
+  program->main_fn->calls = -1;
+  program->num_globals = (int32_t)h.num_globals;
+  program->num_call_sites = (int32_t)h.num_call_sites;
+  program->num_shape_sites = (int32_t)h.num_shape_sites;
+  program->global_names = names;
+  program->mapping = self->base;
+  program->mapping_size = self->size;
+  program->refs = 1;
+
+  // code the verifier rejects still runs, checked on every instruction
+  String error;
+  frozen_program_verify(program, &error);
+  free_string(&error);
+  return program;
+}
+
+FrozenProgram *fzc_load(const char *path, String *error) {
+  assert(path != NULL);
+  assert(error != NULL);
+  *error = STR_NULL;
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0 ||
+      (uint64_t)st.st_size > UINT32_MAX) {
+    if (fd >= 0)
+      close(fd);
+    char buf[320];
+    snprintf(buf, sizeof(buf), "could not read file: %.280s", path);
+    *error = String_from(buf);
+    return NULL;
+  }
+
+  size_t size = (size_t)st.st_size;
+  void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid once the descriptor is closed
+  close(fd);
+  if (base == MAP_FAILED) {
+    *error = String_from("could not map file");
+    return NULL;
+  }
+
+  FzcLoader loader = {.base = base, .size = size, .error = error};
+  FrozenProgram *program = load_program(&loader);
+  if (program == NULL)
+    munmap(base, size);
+  return program;
+}
+
+bool fzc_is_file(const char *path) {
+  assert(path != NULL);
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+  char magic[4];
+  bool is_fzc = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                memcmp(magic, FZC_MAGIC, sizeof(magic)) == 0;
+  fclose(file);
+  return is_fzc;
+}
+
+// FzcDisassembler impl start -----
+static void push_code(StringArray *lines, const char *title,
+                      const Instructions *ins) {
+  string_array_push(lines, String_from(title));
+  if (ins->size > 0)
+    string_array_push(lines, instructions_string(ins));
+}
+
+String fzc_disassemble(const FrozenProgram *program) {
+  assert(program != NULL);
+  StringArray lines = string_array_init(program->constants.size * 2 + 8);
+  char buf[256];
+
+  string_array_push(&lines,
+                    String_from(program->verified
+                                    ? "verified"
+                                    : "not verified, rejected functions "
+                                      "run checked"));
+  snprintf(buf, sizeof(buf), "globals: %d", program->num_globals);
+  string_array_push(&lines, String_from(buf));
+  for (int32_t i = 0; i < program->global_names.size; i++) {
+    snprintf(buf, sizeof(buf), "  %d %s", i,
+             program->global_names.data[i].chars);
+    string_array_push(&lines, String_from(buf));
+  }
+
+  snprintf(buf, sizeof(buf), "constants: %d", program->constants.size);
+  string_array_push(&lines, String_from(buf));
+  for (int32_t i = 0; i < program->constants.size; i++) {
+    Value constant = program->constants.data[i];
+    if (IS_OBJ_TYPE(constant, OBJ_FUNCTION)) {
+      const CompiledFunction *fn = (const CompiledFunction *)constant.as.obj;
+      snprintf(buf, sizeof(buf), "  %d fn %s (parameters %d, locals %d%s%s)",
+               i, fn->name.chars != NULL ? fn->name.chars : "<anonymous>",
+               fn->num_parameters, fn->num_locals,
+               fn->memoize ? ", memo" : "", fn->pure ? ", pure" : "");
+      string_array_push(&lines, String_from(buf));
+    } else {
+      String value = value_inspect(constant);
+      snprintf(buf, sizeof(buf), "  %d %.200s", i, value.chars);
+      free_string(&value);
+      string_array_push(&lines, String_from(buf));
+    }
+  }
+
+  for (int32_t i = 0; i < program->constants.size; i++) {
+    Value constant = program->constants.data[i];
+    if (!IS_OBJ_TYPE(constant, OBJ_FUNCTION))
+      continue;
+    const CompiledFunction *fn = (const CompiledFunction *)constant.as.obj;
+    if (fn->max_stack >= 0)
+      snprintf(buf, sizeof(buf), "\nfn %d %s, max stack %d:", i,
+               fn->name.chars != NULL ? fn->name.chars : "<anonymous>",
+               fn->max_stack);
+    else
+      snprintf(buf, sizeof(buf), "\nfn %d %s, not verified:", i,
+               fn->name.chars != NULL ? fn->name.chars : "<anonymous>");
+    push_code(&lines, buf, &fn->instructions);
+  }
+  if (program->main_fn->max_stack >= 0)
+    snprintf(buf, sizeof(buf), "\nmain, max stack %d:",
+             program->main_fn->max_stack);
+  else
+    snprintf(buf, sizeof(buf), "\nmain, not verified:");
+  push_code(&lines, buf, &program->main_fn->instructions);
+
+  String out = string_array_join(&lines, STR_NEW("\n"));
+  free_string_array(&lines);
+  return out;
+}
@@ -0,0 +1,47 @@
+#ifndef FZC_H
+#define FZC_H
+
+#include <stdbool.h>
+
+#include "frozen.h"
+
+#include "cstring.h/cstring.h"
+
+// Compiled programs saved to `.fzc` files and run again without parsing or
+// compiling. The file holds the top level code, the constant pool and the
+// global names of a frozen program. Everything in it is found by offsets
+// from the start of the file, nothing depends on where it was written or
+// where it is mapped.
+//
+// Loading maps the file read only and checks its structure: the header, that
+// every table and payload lies inside the file and that every code stream
+// decodes to whole instructions. The code of the functions and of the top
+// level is then run straight from the mapping, only the small objects the
+// constant pool points to are made. Code allocating in a region is the
+// exception: it is copied with those allocations moved to the heap, since
+// nothing in a file proves they stay in their region. The mapping lives as
+// long as the program does. The loaded program goes through
+// bytecode_verify, code it rejects still runs but is checked on every
+// instruction.
+//
+// A file is only loaded by the build that wrote it, or by one with the same
+// opcodes and builtins in the same order, any other is rejected. It is
+// written in the byte order of the machine writing it.
+
+// false with `error` set when the file cannot be written or a function in
+// `program` has no bytecode to save
+bool fzc_write(const FrozenProgram *program, const char *path, String *error);
+
+// NULL with `error` set when the file cannot be read or is not a valid
+// `.fzc` file. The caller holds the one reference of the result, run it with
+// VM_new_frozen.
+FrozenProgram *fzc_load(const char *path, String *error);
+
+// true when the file at `path` starts like a `.fzc` file
+bool fzc_is_file(const char *path);
+
+// listing of the globals, the constant pool and the code of every function
+// and of the top level of `program`, loaded or frozen
+String fzc_disassemble(const FrozenProgram *program);
+
+#endif // !FZC_H
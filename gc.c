@@ -0,0 +1,943 @@
+// clock_gettime, posix_memalign, pthreads
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gc.h"
+#include "object.h"
+
+// gray objects a marker takes from the shared stack at once
+#define GC_MARK_BATCH 64
+// a marker with more gray objects than this hands half of them to idle ones
+#define GC_MARK_SHARE_THRESHOLD 256
+
+// state of a thread marking during a concurrent cycle, the mutator uses one
+// as well while it marks in the pauses
+typedef struct GCMarker {
+  Heap *heap;
+  GCObjectStack local;
+  // set in the pauses, the mutator is stopped and memo tables are safe to read
+  bool in_pause;
+  uint64_t busy_ns;
+} GCMarker;
+
+// routes gc_visit_object to the concurrent marker of the calling thread
+static __thread GCMarker *current_marker;
+
+static const uint32_t size_class_bytes[GC_SIZE_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256,
+};
+
+static uint8_t size_class_of(size_t size) {
+  for (uint8_t i = 0; i < GC_SIZE_CLASSES; i++) {
+    if (size <= size_class_bytes[i])
+      return i;
+  }
+  return GC_LARGE;
+}
+
+// young objects are laid out back to back at this alignment
+static size_t young_bytes(size_t size) { return (size + 7) & ~(size_t)7; }
+
+static GCChunk *chunk_of(const Object *obj) {
+  return (GCChunk *)((uintptr_t)obj & ~(uintptr_t)(GC_CHUNK_SIZE - 1));
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+Heap *Heap_new(void) {
+  Heap *heap = calloc(1, sizeof(Heap));
+  assert(heap != NULL);
+
+  heap->next_gc = GC_MIN_HEAP_SIZE;
+  heap->growth_factor = GC_DEFAULT_GROWTH_FACTOR;
+  heap->generational = true;
+  heap->concurrent = true;
+  heap->mark_threads = GC_DEFAULT_MARK_THREADS;
+  heap->phase = GC_IDLE;
+  pthread_mutex_init(&heap->lock, NULL);
+  pthread_cond_init(&heap->work_available, NULL);
+
+  heap->young = malloc(GC_EDEN_SIZE + 2 * GC_SURVIVOR_SIZE);
+  assert(heap->young != NULL);
+  heap->young_end = heap->young + GC_EDEN_SIZE + 2 * GC_SURVIVOR_SIZE;
+  heap->eden_top = heap->young;
+  heap->survivor_from = heap->young + GC_EDEN_SIZE;
+  heap->survivor_from_top = heap->survivor_from;
+  heap->survivor_to = heap->survivor_from + GC_SURVIVOR_SIZE;
+  heap->survivor_to_top = heap->survivor_to;
+
+  return heap;
+}
+
+// finalizes the objects of a young space that were not copied out of it
+static void release_young(Heap *self, uint8_t *start, uint8_t *end) {
+  uint8_t *cursor = start;
+  while (cursor < end) {
+    Object *obj = (Object *)cursor;
+    cursor += young_bytes(obj->size);
+    if (obj->size_class == GC_FORWARDED)
+      continue;
+
+    self->stats.objects_freed++;
+    self->stats.bytes_freed += young_bytes(obj->size);
+    if (obj->vt->finalize != NULL)
+      obj->vt->finalize(obj);
+  }
+}
+
+void free_heap(Heap *self) {
+  if (self == NULL)
+    return;
+
+  heap_finish_cycle(self);
+  release_young(self, self->young, self->eden_top);
+  release_young(self, self->survivor_from, self->survivor_from_top);
+
+  Object *obj = self->objects;
+  while (obj != NULL) {
+    Object *next = obj->next;
+    if (obj->vt->finalize != NULL)
+      obj->vt->finalize(obj);
+    if (obj->size_class == GC_LARGE)
+      free(obj);
+    obj = next;
+  }
+
+  GCChunk *chunk = self->chunks;
+  while (chunk != NULL) {
+    GCChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  heap_region_release(self, (HeapRegionMark){{NULL, 0}, 0});
+  free_arena(&self->region);
+  free(self->region_objects.items);
+
+  free(self->young);
+  free(self->remembered);
+  free(self->handles);
+  free(self->gray.items);
+  free(self->satb.items);
+  free(self->mark_stack.items);
+  free(self->deferred.items);
+  pthread_mutex_destroy(&self->lock);
+  pthread_cond_destroy(&self->work_available);
+  free(self);
+}
+
+static void stack_push(GCObjectStack *stack, Object *obj) {
+  if (stack->size == stack->capacity) {
+    int32_t new_cap = stack->capacity > 0 ? stack->capacity * 2 : 64;
+    Object **new_ptr = realloc(stack->items, sizeof(Object *) * new_cap);
+    assert(new_ptr != NULL);
+    stack->items = new_ptr;
+    stack->capacity = new_cap;
+  }
+  stack->items[stack->size++] = obj;
+}
+
+void heap_set_roots(Heap *self, GCMarkRootsFn mark_roots, void *ctx) {
+  assert(self != NULL);
+  self->mark_roots = mark_roots;
+  self->roots_ctx = ctx;
+}
+
+HeapRegionMark heap_region_mark(const Heap *self) {
+  assert(self != NULL);
+  return (HeapRegionMark){arena_mark(&self->region),
+                          self->region_objects.size};
+}
+
+void heap_region_release(Heap *self, HeapRegionMark mark) {
+  assert(self != NULL);
+  assert(mark.num_objects <= self->region_objects.size);
+  while (self->region_objects.size > mark.num_objects) {
+    Object *obj = self->region_objects.items[--self->region_objects.size];
+    if (obj->vt->finalize != NULL)
+      obj->vt->finalize(obj);
+    if (self->stress)
+      memset(obj, 0xdd, obj->size);
+  }
+  arena_release(&self->region, mark.arena);
+}
+
+void heap_push_root(Heap *self, Value *slot) {
+  assert(self != NULL);
+  assert(slot != NULL);
+  if (self->num_handles == self->handles_capacity) {
+    int32_t new_cap = self->handles_capacity > 0 ? self->handles_capacity * 2
+                                                 : 8;
+    Value **new_ptr = realloc(self->handles, sizeof(Value *) * new_cap);
+    assert(new_ptr != NULL);
+    self->handles = new_ptr;
+    self->handles_capacity = new_cap;
+  }
+
+  self->handles[self->num_handles++] = slot;
+}
+
+void heap_pop_root(Heap *self) {
+  assert(self != NULL);
+  assert(self->num_handles > 0);
+  self->num_handles--;
+}
+
+static void *alloc_small(Heap *self, uint8_t size_class) {
+  GCFreeBlock *block = self->free_lists[size_class];
+  if (block != NULL) {
+    self->free_lists[size_class] = block->next;
+    return block;
+  }
+
+  uint32_t bytes = size_class_bytes[size_class];
+  GCChunk *chunk = self->current_chunk[size_class];
+  if (chunk == NULL ||
+      GC_CHUNK_DATA_OFFSET + chunk->used + bytes > GC_CHUNK_SIZE) {
+    void *mem = NULL;
+    int failed = posix_memalign(&mem, GC_CHUNK_SIZE, GC_CHUNK_SIZE);
+    assert(!failed && mem != NULL);
+    (void)failed;
+
+    chunk = mem;
+    memset(chunk, 0, sizeof(GCChunk));
+    chunk->size_class = size_class;
+    chunk->next = self->chunks;
+    self->chunks = chunk;
+    self->current_chunk[size_class] = chunk;
+  }
+
+  void *storage = (uint8_t *)chunk + GC_CHUNK_DATA_OFFSET + chunk->used;
+  chunk->used += bytes;
+  return storage;
+}
+
+static size_t old_bytes(const Object *obj) {
+  return obj->size_class == GC_LARGE ? obj->size
+                                     : size_class_bytes[obj->size_class];
+}
+
+// never collects, also used to promote objects in the middle of a collection
+static Object *alloc_old(Heap *self, size_t size) {
+  uint8_t size_class = size_class_of(size);
+  Object *obj;
+
+  if (size_class == GC_LARGE) {
+    obj = malloc(size);
+    assert(obj != NULL);
+  } else {
+    obj = alloc_small(self, size_class);
+  }
+  obj->size_class = size_class;
+  obj->size = (uint32_t)size;
+  // allocated black while a concurrent mark runs
+  obj->marked = self->marking;
+  obj->next = self->objects;
+  self->objects = obj;
+  self->bytes_old += old_bytes(obj);
+
+  return obj;
+}
+
+static void release_old(Heap *self, Object *obj) {
+  size_t bytes = old_bytes(obj);
+  self->bytes_old -= bytes;
+  self->stats.bytes_freed += bytes;
+  self->stats.objects_freed++;
+
+  if (obj->vt->finalize != NULL)
+    obj->vt->finalize(obj);
+  if (obj->size_class == GC_LARGE) {
+    free(obj);
+    return;
+  }
+
+  uint8_t size_class = obj->size_class;
+  // recycled blocks are invisible to the sanitizers, make stale reads obvious
+  if (self->stress)
+    memset(obj, 0xdd, size_class_bytes[size_class]);
+
+  GCFreeBlock *block = (GCFreeBlock *)obj;
+  block->next = self->free_lists[size_class];
+  self->free_lists[size_class] = block;
+  // keeps card scanning away from the block
+  obj->size_class = GC_FREE;
+}
+
+static Object *alloc_young(Heap *self, size_t size) {
+  size_t bytes = young_bytes(size);
+  if (self->eden_top + bytes > self->young + GC_EDEN_SIZE)
+    return NULL;
+
+  Object *obj = (Object *)self->eden_top;
+  self->eden_top += bytes;
+  obj->size_class = GC_YOUNG;
+  obj->marked = false;
+  obj->next = NULL;
+
+  return obj;
+}
+
+static void update_bytes_allocated(Heap *self) {
+  self->bytes_allocated = self->bytes_old +
+                          (size_t)(self->eden_top - self->young) +
+                          (size_t)(self->survivor_from_top -
+                                   self->survivor_from);
+}
+
+static void gc_poll(Heap *self);
+static void collect_old(Heap *self);
+
+Object *object_alloc(Heap *heap, const ObjectVT *vt, size_t size) {
+  assert(vt != NULL);
+  assert(size >= sizeof(Object));
+  Object *obj;
+
+  if (heap != NULL && heap->phase != GC_IDLE)
+    gc_poll(heap);
+
+  if (heap == NULL) {
+    obj = malloc(size);
+    assert(obj != NULL);
+    obj->size_class = GC_UNMANAGED;
+    obj->marked = false;
+    obj->next = NULL;
+  } else if (heap->allocate_in_region) {
+    obj = arena_alloc(&heap->region, size);
+    obj->size_class = GC_REGION;
+    obj->marked = false;
+    obj->next = NULL;
+    stack_push(&heap->region_objects, obj);
+    heap->stats.region_objects++;
+  } else if (heap->generational && size <= GC_MAX_SMALL_SIZE) {
+    if (heap->stress) {
+      // mostly minor collections with an old space one every few allocations
+      if ((heap->stats.collections & 3) != 3)
+        heap_collect_minor(heap);
+      else if (!heap->concurrent)
+        heap_collect(heap);
+      else if (heap->phase == GC_IDLE)
+        heap_start_cycle(heap);
+      else
+        heap_finish_cycle(heap);
+    }
+
+    obj = alloc_young(heap, size);
+    if (obj == NULL) {
+      heap_collect_minor(heap);
+      obj = alloc_young(heap, size);
+      assert(obj != NULL);
+    }
+  } else {
+    if (heap->stress)
+      heap_collect(heap);
+    else if (heap->bytes_old + size > heap->next_gc)
+      collect_old(heap);
+    obj = alloc_old(heap, size);
+  }
+
+  obj->vt = vt;
+  obj->size = (uint32_t)size;
+  obj->remembered = false;
+  obj->age = 0;
+  if (heap != NULL)
+    update_bytes_allocated(heap);
+
+  return obj;
+}
+
+void object_free(Object *obj) {
+  if (obj == NULL)
+    return;
+
+  assert(obj->size_class == GC_UNMANAGED);
+  if (obj->vt->finalize != NULL)
+    obj->vt->finalize(obj);
+  free(obj);
+}
+
+void gc_remember(Heap *self, Object *owner) {
+  // region objects are visited by every collection anyway
+  if (owner->size_class == GC_REGION)
+    return;
+  if (owner->size_class == GC_LARGE) {
+    if (owner->remembered)
+      return;
+    if (self->num_remembered == self->remembered_capacity) {
+      int32_t new_cap =
+          self->remembered_capacity > 0 ? self->remembered_capacity * 2 : 16;
+      Object **new_ptr = realloc(self->remembered, sizeof(Object *) * new_cap);
+      assert(new_ptr != NULL);
+      self->remembered = new_ptr;
+      self->remembered_capacity = new_cap;
+    }
+    owner->remembered = true;
+    self->remembered[self->num_remembered++] = owner;
+    return;
+  }
+
+  assert(owner->size_class < GC_SIZE_CLASSES);
+  GCChunk *chunk = chunk_of(owner);
+  chunk->cards[((uint8_t *)owner - (uint8_t *)chunk) / GC_CARD_SIZE] = 1;
+  chunk->has_dirty_cards = true;
+}
+
+static void forget_remembered(Heap *self, Object *obj) {
+  for (int32_t i = 0; i < self->num_remembered; i++) {
+    if (self->remembered[i] == obj) {
+      self->remembered[i] = self->remembered[--self->num_remembered];
+      obj->remembered = false;
+      return;
+    }
+  }
+}
+
+// copies a live young object to the survivor space, or to the old space once
+// it is old enough, and leaves a forwarding address behind
+static Object *evacuate(Heap *self, Object *obj) {
+  uint8_t age = obj->age + 1;
+  size_t bytes = young_bytes(obj->size);
+  Object *copy;
+
+  if (!self->promote_all && age < GC_PROMOTION_AGE &&
+      self->survivor_to_top + bytes <= self->survivor_to + GC_SURVIVOR_SIZE) {
+    copy = (Object *)self->survivor_to_top;
+    self->survivor_to_top += bytes;
+    memcpy(copy, obj, obj->size);
+  } else {
+    copy = alloc_old(self, obj->size);
+    Object *next = copy->next;
+    uint8_t size_class = copy->size_class;
+    memcpy(copy, obj, obj->size);
+    copy->next = next;
+    copy->size_class = size_class;
+    copy->marked = self->marking;
+    self->stats.bytes_promoted += obj->size;
+    if (copy->vt->trace != NULL)
+      stack_push(&self->gray, copy);
+  }
+  copy->age = age;
+
+  obj->size_class = GC_FORWARDED;
+  obj->next = copy;
+  return copy;
+}
+
+// concurrent marking never looks at young objects, the ones alive when the
+// cycle started are scanned in the initial pause and later ones are newer
+// than the snapshot
+static void mark_object(GCMarker *marker, Object *obj) {
+  if (obj == NULL || heap_is_young(marker->heap, obj) ||
+      obj->size_class == GC_UNMANAGED || obj->size_class == GC_REGION)
+    return;
+  if (__atomic_exchange_n(&obj->marked, true, __ATOMIC_ACQ_REL))
+    return;
+  if (obj->vt->trace != NULL)
+    stack_push(&marker->local, obj);
+}
+
+void gc_visit_object(Heap *self, Object **slot) {
+  GCMarker *marker = current_marker;
+  if (marker != NULL) {
+    // minor collections may update the slot under a helper thread
+    mark_object(marker, __atomic_load_n(slot, __ATOMIC_RELAXED));
+    return;
+  }
+
+  Object *obj = *slot;
+  if (obj == NULL || obj->size_class == GC_UNMANAGED ||
+      obj->size_class == GC_REGION)
+    return;
+
+  if (self->visit_mode == GC_VISIT_EVACUATE) {
+    if (!heap_is_young(self, obj))
+      return;
+    Object *moved =
+        obj->size_class == GC_FORWARDED ? obj->next : evacuate(self, obj);
+    __atomic_store_n(slot, moved, __ATOMIC_RELAXED);
+    if (heap_is_young(self, moved))
+      self->found_young = true;
+    return;
+  }
+
+  // full collections run right after the nursery was emptied
+  assert(!heap_is_young(self, obj));
+  if (obj->marked)
+    return;
+  obj->marked = true;
+  if (obj->vt->trace != NULL)
+    stack_push(&self->gray, obj);
+}
+
+void gc_visit_value(Heap *self, Value *slot) {
+  if (IS_OBJ(*slot))
+    gc_visit_object(self, &slot->as.obj);
+}
+
+static void visit_roots(Heap *self) {
+  if (self->mark_roots != NULL)
+    self->mark_roots(self, self->roots_ctx);
+  for (int32_t i = 0; i < self->num_handles; i++)
+    gc_visit_value(self, self->handles[i]);
+  // region objects stay where they are, only what they hold is visited
+  for (int32_t i = 0; i < self->region_objects.size; i++) {
+    Object *obj = self->region_objects.items[i];
+    if (obj->vt->trace != NULL)
+      obj->vt->trace(obj, self);
+  }
+}
+
+// traces an old object and reports whether it still points into the nursery
+static bool scan_old(Heap *self, Object *obj) {
+  self->found_young = false;
+  obj->vt->trace(obj, self);
+  return self->found_young;
+}
+
+static void scan_dirty_cards(Heap *self, GCChunk *chunk) {
+  uint8_t *base = (uint8_t *)chunk;
+  uint8_t *data = base + GC_CHUNK_DATA_OFFSET;
+  uint32_t block = size_class_bytes[chunk->size_class];
+  bool still_dirty = false;
+
+  for (int32_t card = 0; card < GC_CARDS_PER_CHUNK; card++) {
+    if (!chunk->cards[card])
+      continue;
+    chunk->cards[card] = 0;
+
+    // only objects whose header lies inside the card, the barrier marks the
+    // card of the header
+    uint8_t *card_start = base + card * GC_CARD_SIZE;
+    uint8_t *card_end = card_start + GC_CARD_SIZE;
+    size_t first = card_start <= data
+                       ? 0
+                       : ((size_t)(card_start - data) + block - 1) / block;
+    for (uint8_t *p = data + first * block;
+         p < card_end && p < data + chunk->used; p += block) {
+      Object *obj = (Object *)p;
+      if (obj->size_class != chunk->size_class || obj->vt->trace == NULL)
+        continue;
+      if (scan_old(self, obj)) {
+        chunk->cards[card] = 1;
+        still_dirty = true;
+      }
+    }
+  }
+
+  chunk->has_dirty_cards = still_dirty;
+}
+
+// copying phase shared by minor and full collections, roots, remembered
+// objects and dirty cards are the only way into the nursery
+static void evacuate_young(Heap *self) {
+  self->visit_mode = GC_VISIT_EVACUATE;
+  self->survivor_to_top = self->survivor_to;
+  self->scan = self->survivor_to;
+
+  visit_roots(self);
+
+  int32_t kept = 0;
+  for (int32_t i = 0; i < self->num_remembered; i++) {
+    Object *obj = self->remembered[i];
+    if (scan_old(self, obj))
+      self->remembered[kept++] = obj;
+    else
+      obj->remembered = false;
+  }
+  self->num_remembered = kept;
+
+  for (GCChunk *chunk = self->chunks; chunk != NULL; chunk = chunk->next) {
+    if (chunk->has_dirty_cards)
+      scan_dirty_cards(self, chunk);
+  }
+
+  // Cheney scan of the survivors, interleaved with the promoted objects
+  while (self->scan < self->survivor_to_top || self->gray.size > 0) {
+    while (self->scan < self->survivor_to_top) {
+      Object *obj = (Object *)self->scan;
+      self->scan += young_bytes(obj->size);
+      if (obj->vt->trace != NULL)
+        obj->vt->trace(obj, self);
+    }
+    while (self->gray.size > 0) {
+      Object *obj = self->gray.items[--self->gray.size];
+      if (scan_old(self, obj))
+        gc_remember(self, obj);
+    }
+  }
+
+  release_young(self, self->young, self->eden_top);
+  release_young(self, self->survivor_from, self->survivor_from_top);
+  if (self->stress) {
+    memset(self->young, 0xdd, (size_t)(self->eden_top - self->young));
+    memset(self->survivor_from, 0xdd,
+           (size_t)(self->survivor_from_top - self->survivor_from));
+  }
+
+  uint8_t *from = self->survivor_from;
+  self->survivor_from = self->survivor_to;
+  self->survivor_from_top = self->survivor_to_top;
+  self->survivor_to = from;
+  self->survivor_to_top = from;
+  self->eden_top = self->young;
+}
+
+static void histogram_add(GCPauseHistogram *histogram, uint64_t pause) {
+  histogram->count++;
+  histogram->total_ns += pause;
+  if (pause > histogram->max_ns)
+    histogram->max_ns = pause;
+
+  int32_t bucket = 0;
+  for (uint64_t us = pause / 1000; us > 0 && bucket < GC_PAUSE_BUCKETS - 1;
+       us >>= 1)
+    bucket++;
+  histogram->buckets[bucket]++;
+}
+
+static void record_pause(Heap *self, uint64_t start, GCPauseKind kind) {
+  uint64_t pause = now_ns() - start;
+  self->stats.collections++;
+  self->stats.last_pause_ns = pause;
+  histogram_add(&self->stats.pauses, pause);
+  histogram_add(&self->stats.pauses_by_kind[kind], pause);
+}
+
+uint64_t gc_pause_percentile_us(const GCPauseHistogram *pauses,
+                                double percentile) {
+  assert(pauses != NULL);
+  if (pauses->count == 0)
+    return 0;
+
+  uint64_t seen = 0;
+  for (int32_t i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    seen += pauses->buckets[i];
+    if ((double)seen >= percentile * (double)pauses->count)
+      return (uint64_t)1 << i;
+  }
+  return (uint64_t)1 << (GC_PAUSE_BUCKETS - 1);
+}
+
+void heap_collect_minor(Heap *self) {
+  assert(self != NULL);
+  uint64_t start = now_ns();
+
+  evacuate_young(self);
+  update_bytes_allocated(self);
+
+  self->stats.minor_collections++;
+  record_pause(self, start, GC_PAUSE_MINOR);
+
+  // promotions can push the old space over its limit
+  if (self->bytes_old > self->next_gc)
+    collect_old(self);
+}
+
+static void update_next_gc(Heap *self) {
+  update_bytes_allocated(self);
+  size_t next_gc = (size_t)(self->bytes_old * self->growth_factor);
+  self->next_gc = next_gc > GC_MIN_HEAP_SIZE ? next_gc : GC_MIN_HEAP_SIZE;
+  self->stats.bytes_live = self->bytes_allocated;
+}
+
+void heap_collect(Heap *self) {
+  assert(self != NULL);
+  heap_finish_cycle(self);
+  uint64_t start = now_ns();
+
+  // with the nursery empty the old space can be marked without moving
+  self->promote_all = true;
+  evacuate_young(self);
+  self->promote_all = false;
+
+  for (int32_t i = 0; i < self->num_remembered; i++)
+    self->remembered[i]->remembered = false;
+  self->num_remembered = 0;
+  for (GCChunk *chunk = self->chunks; chunk != NULL; chunk = chunk->next) {
+    memset(chunk->cards, 0, sizeof(chunk->cards));
+    chunk->has_dirty_cards = false;
+  }
+
+  self->visit_mode = GC_VISIT_MARK;
+  visit_roots(self);
+  while (self->gray.size > 0) {
+    Object *obj = self->gray.items[--self->gray.size];
+    obj->vt->trace(obj, self);
+  }
+
+  Object **link = &self->objects;
+  while (*link != NULL) {
+    Object *obj = *link;
+    if (obj->marked) {
+      obj->marked = false;
+      link = &obj->next;
+      continue;
+    }
+    *link = obj->next;
+    release_old(self, obj);
+  }
+
+  update_next_gc(self);
+  record_pause(self, start, GC_PAUSE_FULL);
+}
+
+static void collect_old(Heap *self) {
+  if (!self->concurrent) {
+    heap_collect(self);
+    return;
+  }
+  if (self->phase == GC_IDLE) {
+    heap_start_cycle(self);
+    return;
+  }
+  // the mutator outran the helper threads, wait for them instead of letting
+  // the old space grow without bound
+  if (self->bytes_old > self->next_gc * 2)
+    heap_finish_cycle(self);
+}
+
+// moves gray objects from the shared stack to `marker`, false once every
+// marker ran out of work
+static bool take_work(GCMarker *marker) {
+  Heap *heap = marker->heap;
+  pthread_mutex_lock(&heap->lock);
+
+  while (heap->mark_stack.size == 0 && !heap->mark_done) {
+    // busy markers peek at the count without the lock
+    if (__atomic_add_fetch(&heap->idle_markers, 1, __ATOMIC_RELAXED) ==
+        heap->num_threads) {
+      // nobody holds gray objects that could still be shared
+      __atomic_store_n(&heap->mark_done, true, __ATOMIC_RELEASE);
+      pthread_cond_broadcast(&heap->work_available);
+      break;
+    }
+    pthread_cond_wait(&heap->work_available, &heap->lock);
+    __atomic_sub_fetch(&heap->idle_markers, 1, __ATOMIC_RELAXED);
+  }
+
+  int32_t n = heap->mark_stack.size < GC_MARK_BATCH ? heap->mark_stack.size
+                                                    : GC_MARK_BATCH;
+  for (int32_t i = 0; i < n; i++)
+    stack_push(&marker->local, heap->mark_stack.items[--heap->mark_stack.size]);
+
+  pthread_mutex_unlock(&heap->lock);
+  return n > 0;
+}
+
+static void share_work(GCMarker *marker) {
+  Heap *heap = marker->heap;
+  pthread_mutex_lock(&heap->lock);
+  int32_t half = marker->local.size / 2;
+  for (int32_t i = 0; i < half; i++)
+    stack_push(&heap->mark_stack, marker->local.items[--marker->local.size]);
+  pthread_cond_broadcast(&heap->work_available);
+  pthread_mutex_unlock(&heap->lock);
+}
+
+static void drain_marker(GCMarker *marker) {
+  while (marker->local.size > 0) {
+    Object *obj = marker->local.items[--marker->local.size];
+    obj->vt->trace(obj, marker->heap);
+
+    if (!marker->in_pause &&
+        marker->local.size > GC_MARK_SHARE_THRESHOLD &&
+        __atomic_load_n(&marker->heap->idle_markers, __ATOMIC_RELAXED) > 0)
+      share_work(marker);
+  }
+}
+
+static void *marker_main(void *arg) {
+  GCMarker *marker = arg;
+  uint64_t start = now_ns();
+
+  current_marker = marker;
+  while (take_work(marker))
+    drain_marker(marker);
+  current_marker = NULL;
+
+  marker->busy_ns = now_ns() - start;
+  return NULL;
+}
+
+static void *sweeper_main(void *arg) {
+  Heap *heap = arg;
+  uint64_t start = now_ns();
+
+  // the first object stays linked even when dead, the mutator points at it,
+  // it is caught by the next cycle
+  Object *prev = heap->sweep_start;
+  prev->marked = false;
+  Object *dead = NULL;
+  while (prev->next != NULL) {
+    Object *obj = prev->next;
+    if (obj->marked) {
+      obj->marked = false;
+      prev = obj;
+      continue;
+    }
+    prev->next = obj->next;
+    obj->next = dead;
+    dead = obj;
+  }
+
+  pthread_mutex_lock(&heap->lock);
+  heap->swept = dead;
+  heap->sweep_ns = now_ns() - start;
+  __atomic_store_n(&heap->sweep_done, true, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&heap->lock);
+  return NULL;
+}
+
+bool gc_defer_trace(Heap *self, Object *obj) {
+  GCMarker *marker = current_marker;
+  if (marker == NULL || marker->in_pause)
+    return false;
+
+  pthread_mutex_lock(&self->lock);
+  stack_push(&self->deferred, obj);
+  pthread_mutex_unlock(&self->lock);
+  return true;
+}
+
+void gc_satb_log(Heap *self, Object *old) { stack_push(&self->satb, old); }
+
+void heap_start_cycle(Heap *self) {
+  assert(self != NULL);
+  if (self->phase != GC_IDLE)
+    return;
+  uint64_t start = now_ns();
+
+  // the survivors are scanned like roots below, so the nursery does not have
+  // to be promoted
+  evacuate_young(self);
+  update_bytes_allocated(self);
+
+  self->marking = true;
+  self->phase = GC_MARKING;
+  self->mark_done = false;
+  self->idle_markers = 0;
+
+  GCMarker roots = {.heap = self, .in_pause = true};
+  current_marker = &roots;
+  visit_roots(self);
+  for (uint8_t *cursor = self->survivor_from;
+       cursor < self->survivor_from_top;) {
+    Object *obj = (Object *)cursor;
+    cursor += young_bytes(obj->size);
+    if (obj->vt->trace != NULL)
+      obj->vt->trace(obj, self);
+  }
+  current_marker = NULL;
+
+  free(self->mark_stack.items);
+  self->mark_stack = roots.local;
+
+  self->num_threads = self->mark_threads < 1 ? 1
+                      : self->mark_threads > GC_MAX_MARK_THREADS
+                          ? GC_MAX_MARK_THREADS
+                          : self->mark_threads;
+  self->markers = calloc(self->num_threads, sizeof(GCMarker));
+  assert(self->markers != NULL);
+  for (int32_t i = 0; i < self->num_threads; i++) {
+    self->markers[i].heap = self;
+    int failed = pthread_create(&self->threads[i], NULL, marker_main,
+                                &self->markers[i]);
+    assert(!failed);
+    (void)failed;
+  }
+
+  record_pause(self, start, GC_PAUSE_INITIAL_MARK);
+}
+
+// joins the markers, which stop on their own once the gray objects run out,
+// marks what the barrier logged meanwhile and hands the old space to the
+// sweeper
+static void remark(Heap *self) {
+  uint64_t start = now_ns();
+
+  for (int32_t i = 0; i < self->num_threads; i++) {
+    pthread_join(self->threads[i], NULL);
+    self->stats.concurrent_ns += self->markers[i].busy_ns;
+    free(self->markers[i].local.items);
+  }
+  free(self->markers);
+  self->markers = NULL;
+  self->num_threads = 0;
+
+  GCMarker marker = {.heap = self, .in_pause = true};
+  current_marker = &marker;
+  for (int32_t i = 0; i < self->satb.size; i++)
+    mark_object(&marker, self->satb.items[i]);
+  self->satb.size = 0;
+  // already marked, only the fields the helper threads skipped are left
+  for (int32_t i = 0; i < self->deferred.size; i++)
+    stack_push(&marker.local, self->deferred.items[i]);
+  self->deferred.size = 0;
+  drain_marker(&marker);
+  current_marker = NULL;
+  free(marker.local.items);
+
+  self->marking = false;
+  self->phase = GC_SWEEPING;
+  self->sweep_start = self->objects;
+  self->swept = NULL;
+  if (self->sweep_start == NULL) {
+    self->sweep_done = true;
+  } else {
+    self->sweep_done = false;
+    self->num_threads = 1;
+    int failed = pthread_create(&self->threads[0], NULL, sweeper_main, self);
+    assert(!failed);
+    (void)failed;
+  }
+
+  record_pause(self, start, GC_PAUSE_REMARK);
+}
+
+// returns the objects found dead by the sweeper to the free lists
+static void finish_sweep(Heap *self) {
+  if (self->num_threads > 0)
+    pthread_join(self->threads[0], NULL);
+  self->num_threads = 0;
+
+  Object *obj = self->swept;
+  while (obj != NULL) {
+    Object *next = obj->next;
+    if (obj->remembered)
+      forget_remembered(self, obj);
+    release_old(self, obj);
+    obj = next;
+  }
+  self->swept = NULL;
+  self->sweep_start = NULL;
+  self->phase = GC_IDLE;
+  self->stats.concurrent_ns += self->sweep_ns;
+
+  update_next_gc(self);
+  self->stats.concurrent_cycles++;
+}
+
+static void gc_poll(Heap *self) {
+  if (self->phase == GC_MARKING &&
+      __atomic_load_n(&self->mark_done, __ATOMIC_ACQUIRE))
+    remark(self);
+  else if (self->phase == GC_SWEEPING &&
+           __atomic_load_n(&self->sweep_done, __ATOMIC_ACQUIRE))
+    finish_sweep(self);
+}
+
+void heap_finish_cycle(Heap *self) {
+  assert(self != NULL);
+  if (self->phase == GC_MARKING)
+    remark(self);
+  if (self->phase == GC_SWEEPING)
+    finish_sweep(self);
+}
@@ -0,0 +1,315 @@
+#ifndef GC_H
+#define GC_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "object.h"
+
+// object sizes served from per class free lists in the old space, anything
+// larger gets its own malloc and skips the nursery
+#define GC_SIZE_CLASSES 8
+#define GC_MAX_SMALL_SIZE 256
+// old space chunks hold blocks of a single size class, aligned to their size
+// so the chunk of an object is found by masking its address
+#define GC_CHUNK_SIZE (64 * 1024)
+// granularity of the write barrier inside a chunk
+#define GC_CARD_SIZE 512
+#define GC_CARDS_PER_CHUNK (GC_CHUNK_SIZE / GC_CARD_SIZE)
+
+// young objects are bump allocated in eden, survivors of a minor collection
+// are copied between two survivor spaces until they reach the promotion age
+#define GC_EDEN_SIZE (512 * 1024)
+#define GC_SURVIVOR_SIZE (128 * 1024)
+#define GC_PROMOTION_AGE 2
+
+// `size_class` markers for objects outside the old space free lists
+// allocated in the region, see heap_region_release
+#define GC_REGION 0xfa
+#define GC_YOUNG 0xfb
+// header of a copied young object, `next` holds the new address
+#define GC_FORWARDED 0xfc
+// old space block on a free list
+#define GC_FREE 0xfd
+#define GC_LARGE 0xfe
+// not owned by any heap, e.g. constants, freed with object_free
+#define GC_UNMANAGED 0xff
+
+#define GC_DEFAULT_GROWTH_FACTOR 2.0
+// no full collection happens before the old space reaches this size
+#define GC_MIN_HEAP_SIZE (1024 * 1024)
+
+// bucket 0 counts pauses under 1us, bucket i pauses under 2^i us, the last
+// one everything longer
+#define GC_PAUSE_BUCKETS 24
+
+// helper threads marking the old space during a concurrent cycle
+#define GC_DEFAULT_MARK_THREADS 2
+#define GC_MAX_MARK_THREADS 8
+
+typedef struct Heap Heap;
+
+// visits every root slot with gc_visit_value/gc_visit_object, called at the
+// start of every collection
+typedef void (*GCMarkRootsFn)(Heap *heap, void *ctx);
+
+typedef enum GCPauseKind {
+  GC_PAUSE_MINOR,
+  // stop the world collection of both generations
+  GC_PAUSE_FULL,
+  // opens a concurrent cycle, evacuates the nursery and marks from the roots
+  GC_PAUSE_INITIAL_MARK,
+  // closes the concurrent mark, drains the SATB buffer
+  GC_PAUSE_REMARK,
+  GC_PAUSE_KINDS,
+} GCPauseKind;
+
+typedef struct GCPauseHistogram {
+  uint64_t count;
+  // wall clock time the mutator was stopped
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[GC_PAUSE_BUCKETS];
+} GCPauseHistogram;
+
+typedef struct GCStats {
+  // pauses of every kind
+  uint64_t collections;
+  uint64_t minor_collections;
+  // completed concurrent cycles of the old space
+  uint64_t concurrent_cycles;
+  uint64_t objects_freed;
+  uint64_t bytes_freed;
+  uint64_t bytes_promoted;
+  uint64_t last_pause_ns;
+  GCPauseHistogram pauses;
+  GCPauseHistogram pauses_by_kind[GC_PAUSE_KINDS];
+  // time the helper threads spent marking and sweeping next to the mutator
+  uint64_t concurrent_ns;
+  // bytes still in use right after the last old space collection
+  size_t bytes_live;
+  // objects bump allocated in the region instead of the nursery
+  uint64_t region_objects;
+} GCStats;
+
+// growable stack of objects waiting to be traced or logged
+typedef struct GCObjectStack {
+  Object **items;
+  int32_t size;
+  int32_t capacity;
+} GCObjectStack;
+
+typedef enum GCPhase {
+  GC_IDLE,
+  // helper threads mark the old space, the SATB barrier is armed
+  GC_MARKING,
+  // a helper thread unlinks the dead old objects
+  GC_SWEEPING,
+} GCPhase;
+
+typedef struct GCFreeBlock {
+  struct GCFreeBlock *next;
+} GCFreeBlock;
+
+typedef struct GCChunk {
+  struct GCChunk *next;
+  uint8_t size_class;
+  bool has_dirty_cards;
+  // bytes handed out so far, blocks past this were never allocated
+  uint32_t used;
+  // set for cards holding the header of an old object that may point into
+  // the young generation
+  uint8_t cards[GC_CARDS_PER_CHUNK];
+} GCChunk;
+
+// first block of a chunk, right after the header
+#define GC_CHUNK_DATA_OFFSET ((sizeof(GCChunk) + 15) & ~(size_t)15)
+
+typedef enum GCVisitMode { GC_VISIT_MARK, GC_VISIT_EVACUATE } GCVisitMode;
+
+struct GCMarker;
+
+// Precise generational heap. New objects are bump allocated in a nursery
+// that is evacuated by copying minor collections, the old space is a
+// non-moving mark and sweep heap with size segregated free lists. Old
+// objects that start pointing at young ones are found through a card table
+// kept by gc_write_barrier.
+//
+// The old space is normally collected concurrently. A short pause marks
+// from the roots and the survivors, helper threads mark the rest while the
+// mutator runs, and a second pause drains the values the SATB barrier
+// logged. Objects allocated in the old space meanwhile are born marked, so
+// everything reachable when the cycle started or allocated since survives.
+// Sweeping runs on a helper thread as well, the dead objects are handed back
+// to the mutator which returns them to the free lists.
+struct Heap {
+  // every old object
+  Object *objects;
+  // old space plus the used part of the nursery
+  size_t bytes_allocated;
+  size_t bytes_old;
+  // the old space growing past this size starts a full collection
+  size_t next_gc;
+  // `next_gc` is set to the live size times this factor after a collection
+  double growth_factor;
+  // without a nursery every object goes straight to the old space
+  bool generational;
+  // collect on every allocation and poison freed memory, shakes out values
+  // missing from the roots and the write barrier
+  bool stress;
+  // collect the old space next to the mutator instead of stopping the world
+  bool concurrent;
+  int32_t mark_threads;
+
+  // eden followed by both survivor spaces
+  uint8_t *young;
+  uint8_t *young_end;
+  uint8_t *eden_top;
+  uint8_t *survivor_from;
+  uint8_t *survivor_from_top;
+  uint8_t *survivor_to;
+  uint8_t *survivor_to_top;
+
+  GCFreeBlock *free_lists[GC_SIZE_CLASSES];
+  GCChunk *current_chunk[GC_SIZE_CLASSES];
+  GCChunk *chunks;
+  // large old objects that may point into the young generation
+  Object **remembered;
+  int32_t num_remembered;
+  int32_t remembered_capacity;
+
+  GCMarkRootsFn mark_roots;
+  void *roots_ctx;
+
+  // Objects allocated while `allocate_in_region` is set come from this arena.
+  // The owner proved they are unreachable by the time it releases them, so
+  // they are never moved, marked or swept. Collections only visit what they
+  // point at.
+  Arena region;
+  GCObjectStack region_objects;
+  bool allocate_in_region;
+
+  // value slots registered with heap_push_root
+  Value **handles;
+  int32_t num_handles;
+  int32_t handles_capacity;
+
+  GCVisitMode visit_mode;
+  // promote every survivor, used before a full collection
+  bool promote_all;
+  // an old object being scanned kept a reference to a young one
+  bool found_young;
+  // survivors copied during this minor collection but not scanned yet
+  uint8_t *scan;
+  // marked or promoted objects whose children are not visited yet
+  GCObjectStack gray;
+
+  GCPhase phase;
+  // the SATB barrier is armed and new old objects are allocated marked
+  bool marking;
+  // old values overwritten by the mutator since the cycle started
+  GCObjectStack satb;
+
+  // everything below is shared with the helper threads
+  pthread_mutex_t lock;
+  pthread_cond_t work_available;
+  pthread_t threads[GC_MAX_MARK_THREADS];
+  struct GCMarker *markers;
+  int32_t num_threads;
+  // gray objects up for grabs by any marker
+  GCObjectStack mark_stack;
+  int32_t idle_markers;
+  bool mark_done;
+  // closures whose memo tables are traced in the remark pause, the mutator
+  // updates them in place
+  GCObjectStack deferred;
+  // newest old object when sweeping started, the sweeper owns the list past
+  // it while the mutator keeps pushing in front of it
+  Object *sweep_start;
+  // dead objects unlinked by the sweeper, released by the mutator
+  Object *swept;
+  uint64_t sweep_ns;
+  bool sweep_done;
+
+  GCStats stats;
+};
+
+Heap *Heap_new(void);
+// frees every object still on the heap
+void free_heap(Heap *self);
+
+void heap_set_roots(Heap *self, GCMarkRootsFn mark_roots, void *ctx);
+
+typedef struct HeapRegionMark {
+  ArenaMark arena;
+  int32_t num_objects;
+} HeapRegionMark;
+
+HeapRegionMark heap_region_mark(const Heap *self);
+// finalizes and frees every region object allocated after `mark`
+void heap_region_release(Heap *self, HeapRegionMark mark);
+
+// keeps `*slot` alive across collections and updates it when the value moves,
+// handles are released in LIFO order
+void heap_push_root(Heap *self, Value *slot);
+void heap_pop_root(Heap *self);
+
+// storage for an object of `size` bytes with its header filled in, may
+// collect first and move every young object. A NULL heap returns an
+// unmanaged object.
+Object *object_alloc(Heap *heap, const ObjectVT *vt, size_t size);
+// finalizes and frees an unmanaged object
+void object_free(Object *obj);
+
+// evacuates the nursery only
+void heap_collect_minor(Heap *self);
+// evacuates the nursery into the old space, then marks and sweeps it with
+// the world stopped
+void heap_collect(Heap *self);
+// starts a concurrent cycle of the old space unless one is running
+void heap_start_cycle(Heap *self);
+// waits for the running concurrent cycle, if any, and releases its garbage
+void heap_finish_cycle(Heap *self);
+
+// upper bound in microseconds of the pause below which `percentile` of the
+// recorded pauses fall
+uint64_t gc_pause_percentile_us(const GCPauseHistogram *pauses,
+                                double percentile);
+
+// used by GCMarkRootsFn and ObjectVT.trace, the slot is updated when its
+// object moves
+void gc_visit_value(Heap *self, Value *slot);
+void gc_visit_object(Heap *self, Object **slot);
+// called by a trace function before it visits fields the mutator updates in
+// place, true when it runs on a helper thread and `obj` was queued to be
+// traced again in the remark pause, the fields have to be skipped then
+bool gc_defer_trace(Heap *self, Object *obj);
+
+static inline bool heap_is_young(const Heap *self, const Object *obj) {
+  return (const uint8_t *)obj >= self->young &&
+         (const uint8_t *)obj < self->young_end;
+}
+
+void gc_remember(Heap *self, Object *owner);
+
+// has to follow every store of `value` into a field of `owner` made after
+// the object was allocated
+static inline void gc_write_barrier(Heap *self, Object *owner, Value value) {
+  if (IS_OBJ(value) && heap_is_young(self, value.as.obj) &&
+      !heap_is_young(self, owner))
+    gc_remember(self, owner);
+}
+
+void gc_satb_log(Heap *self, Object *old);
+
+// has to precede every store that overwrites `old` in a field of an old
+// object, keeps what was reachable when the concurrent mark started alive
+static inline void gc_satb_barrier(Heap *self, Value old) {
+  if (self->marking && IS_OBJ(old))
+    gc_satb_log(self, old.as.obj);
+}
+
+#endif // !GC_H
@@ -0,0 +1,780 @@
+// mmap with MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "code.h"
+#include "jit.h"
+#include "object.h"
+#include "vm.h"
+
+#if JIT_SUPPORTED
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef enum Register {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+} Register;
+
+// registers holding the state of the frame, all callee saved so they
+// survive the calls into the runtime
+#define VM_REG RBX
+#define LOCALS_REG R12
+// next free stack slot
+#define SP_REG R13
+#define FRAME_REG R14
+// one past the last stack slot
+#define LIMIT_REG R15
+
+typedef enum Condition {
+  CC_O = 0x0,
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_L = 0xc,
+  CC_G = 0xf,
+} Condition;
+
+// jump targets past the instructions
+typedef enum Stub {
+  STUB_EXIT = -1,
+  STUB_ERROR = -2,
+  STUB_OVERFLOW = -3,
+} Stub;
+
+// rel32 operand waiting for the offset of its target
+typedef struct Fixup {
+  int32_t position;
+  // bytecode offset, or a Stub
+  int32_t target;
+  // what a jump to STUB_ERROR or STUB_OVERFLOW leaves in frame->ip
+  int32_t resume_ip;
+} Fixup;
+
+typedef struct Assembler {
+  uint8_t *code;
+  int32_t size;
+  int32_t capacity;
+
+  Fixup *fixups;
+  int32_t num_fixups;
+  int32_t fixups_capacity;
+  // offset past the instruction being emitted, where the interpreter leaves
+  // frame->ip when that instruction fails
+  int32_t resume_ip;
+} Assembler;
+
+#define VALUE_SIZE ((int32_t)sizeof(Value))
+#define TYPE_OFFSET ((int32_t)offsetof(Value, type))
+#define PAYLOAD_OFFSET ((int32_t)offsetof(Value, as))
+// value slots relative to SP_REG
+#define TOP (-VALUE_SIZE)
+#define SECOND (-2 * VALUE_SIZE)
+
+static void emit_byte(Assembler *a, uint8_t byte) {
+  if (a->size == a->capacity) {
+    a->capacity = a->capacity > 0 ? a->capacity * 2 : 1024;
+    a->code = realloc(a->code, a->capacity);
+    assert(a->code != NULL);
+  }
+  a->code[a->size++] = byte;
+}
+
+static void emit_u32(Assembler *a, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    emit_byte(a, (uint8_t)(value >> (8 * i)));
+}
+
+static void emit_u64(Assembler *a, uint64_t value) {
+  for (int i = 0; i < 8; i++)
+    emit_byte(a, (uint8_t)(value >> (8 * i)));
+}
+
+// opcodes above 0xff are two byte opcodes starting with 0x0f
+static void emit_opcode(Assembler *a, bool wide, uint16_t opcode, int reg,
+                        int rm) {
+  emit_byte(a, 0x40 | (wide ? 8 : 0) | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+  if (opcode > 0xff)
+    emit_byte(a, opcode >> 8);
+  emit_byte(a, opcode & 0xff);
+}
+
+// `opcode` with a register operand and a [base + disp] operand
+static void emit_mem(Assembler *a, bool wide, uint16_t opcode, int reg,
+                     Register base, int32_t disp) {
+  emit_opcode(a, wide, opcode, reg, base);
+  emit_byte(a, 0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP)
+    emit_byte(a, 0x24);
+  emit_u32(a, (uint32_t)disp);
+}
+
+// `opcode` with two register operands
+static void emit_rr(Assembler *a, bool wide, uint16_t opcode, int reg,
+                    int rm) {
+  emit_opcode(a, wide, opcode, reg, rm);
+  emit_byte(a, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void emit_load(Assembler *a, Register dst, Register base,
+                      int32_t disp) {
+  emit_mem(a, true, 0x8b, dst, base, disp);
+}
+
+static void emit_store(Assembler *a, Register base, int32_t disp,
+                       Register src) {
+  emit_mem(a, true, 0x89, src, base, disp);
+}
+
+static void emit_mov(Assembler *a, Register dst, Register src) {
+  emit_rr(a, true, 0x89, src, dst);
+}
+
+static void emit_mov_imm(Assembler *a, Register dst, uint64_t imm) {
+  emit_byte(a, 0x48 | ((dst & 8) >> 3));
+  emit_byte(a, 0xb8 + (dst & 7));
+  emit_u64(a, imm);
+}
+
+// writes a 32 bit immediate, sign extended to 64 bits when `wide`
+static void emit_store_imm(Assembler *a, bool wide, Register base,
+                           int32_t disp, int32_t imm) {
+  emit_mem(a, wide, 0xc7, 0, base, disp);
+  emit_u32(a, (uint32_t)imm);
+}
+
+// /ext group of 0x81 on a register: 0 add, 5 sub, 7 cmp
+static void emit_alu_imm(Assembler *a, bool wide, int ext, Register reg,
+                         int32_t imm) {
+  emit_rr(a, wide, 0x81, ext, reg);
+  emit_u32(a, (uint32_t)imm);
+}
+
+static void emit_shift(Assembler *a, int ext, Register reg, uint8_t count) {
+  emit_rr(a, true, 0xc1, ext, reg);
+  emit_byte(a, count);
+}
+
+static void emit_cmp_type(Assembler *a, int32_t slot, ValueType type) {
+  emit_mem(a, false, 0x81, 7, SP_REG, slot + TYPE_OFFSET);
+  emit_u32(a, (uint32_t)type);
+}
+
+static void emit_push(Assembler *a, Register reg) {
+  if (reg & 8)
+    emit_byte(a, 0x41);
+  emit_byte(a, 0x50 + (reg & 7));
+}
+
+static void emit_pop(Assembler *a, Register reg) {
+  if (reg & 8)
+    emit_byte(a, 0x41);
+  emit_byte(a, 0x58 + (reg & 7));
+}
+
+static void add_fixup(Assembler *a, int32_t position, int32_t target) {
+  if (a->num_fixups == a->fixups_capacity) {
+    a->fixups_capacity = a->fixups_capacity > 0 ? a->fixups_capacity * 2 : 64;
+    a->fixups = realloc(a->fixups, sizeof(Fixup) * a->fixups_capacity);
+    assert(a->fixups != NULL);
+  }
+  a->fixups[a->num_fixups++] = (Fixup){
+      .position = position, .target = target, .resume_ip = a->resume_ip};
+}
+
+// returns the position of the rel32 operand
+static int32_t emit_jcc(Assembler *a, Condition cc) {
+  emit_byte(a, 0x0f);
+  emit_byte(a, 0x80 + cc);
+  emit_u32(a, 0);
+  return a->size - 4;
+}
+
+static int32_t emit_jmp(Assembler *a) {
+  emit_byte(a, 0xe9);
+  emit_u32(a, 0);
+  return a->size - 4;
+}
+
+static void patch_rel32(Assembler *a, int32_t position, int32_t target) {
+  uint32_t rel = (uint32_t)(target - (position + 4));
+  memcpy(&a->code[position], &rel, sizeof(rel));
+}
+
+// points a jump emitted earlier at the current position
+static void patch_here(Assembler *a, int32_t position) {
+  patch_rel32(a, position, a->size);
+}
+
+static void emit_copy_value(Assembler *a, Register dst, int32_t dst_disp,
+                            Register src, int32_t src_disp) {
+  emit_load(a, RAX, src, src_disp);
+  emit_load(a, RCX, src, src_disp + 8);
+  emit_store(a, dst, dst_disp, RAX);
+  emit_store(a, dst, dst_disp + 8, RCX);
+}
+
+static void emit_check_overflow(Assembler *a) {
+  emit_rr(a, true, 0x39, LIMIT_REG, SP_REG);
+  add_fixup(a, emit_jcc(a, CC_AE), STUB_OVERFLOW);
+}
+
+static void emit_push_value(Assembler *a, Value value) {
+  emit_check_overflow(a);
+  emit_store_imm(a, false, SP_REG, TYPE_OFFSET, (int32_t)value.type);
+  int64_t payload;
+  switch (value.type) {
+  case VAL_NULL:
+    payload = 0;
+    break;
+  case VAL_BOOL:
+    payload = value.as.boolean;
+    break;
+  case VAL_BUILTIN:
+    payload = value.as.builtin;
+    break;
+  default:
+    payload = value.as.integer;
+    break;
+  }
+  if (payload >= INT32_MIN && payload <= INT32_MAX) {
+    emit_store_imm(a, true, SP_REG, PAYLOAD_OFFSET, (int32_t)payload);
+  } else {
+    emit_mov_imm(a, RAX, (uint64_t)payload);
+    emit_store(a, SP_REG, PAYLOAD_OFFSET, RAX);
+  }
+  emit_alu_imm(a, true, 0, SP_REG, VALUE_SIZE);
+}
+
+// vm->sp = (sp - vm->stack) / sizeof(Value)
+static void emit_sync_sp(Assembler *a, Register scratch) {
+  emit_mov(a, scratch, SP_REG);
+  emit_mem(a, true, 0x2b, scratch, VM_REG, offsetof(VM, stack));
+  emit_shift(a, 7, scratch, 4);
+  emit_mem(a, false, 0x89, scratch, VM_REG, offsetof(VM, sp));
+}
+
+// Calls a slow path from vm.h with the VM and up to two integer operands.
+// The stack pointer goes through the VM both ways since the callee pushes
+// and pops, a false result leaves through the error stub.
+static void emit_runtime_call(Assembler *a, uint64_t fn, int64_t arg0,
+                              int64_t arg1) {
+  emit_sync_sp(a, RAX);
+  emit_mov(a, RDI, VM_REG);
+  emit_mov_imm(a, RSI, (uint64_t)arg0);
+  emit_mov_imm(a, RDX, (uint64_t)arg1);
+  emit_mov_imm(a, RAX, fn);
+  emit_rr(a, false, 0xff, 2, RAX); // call rax
+  emit_rr(a, false, 0x84, RAX, RAX);
+  add_fixup(a, emit_jcc(a, CC_E), STUB_ERROR);
+
+  emit_mem(a, true, 0x63, RAX, VM_REG, offsetof(VM, sp)); // movsxd
+  emit_shift(a, 4, RAX, 4);
+  emit_mem(a, true, 0x03, RAX, VM_REG, offsetof(VM, stack));
+  emit_mov(a, SP_REG, RAX);
+}
+
+// eax = truthiness of the value on top of the stack
+static void emit_truthy(Assembler *a) {
+  emit_mem(a, false, 0x8b, RAX, SP_REG, TOP + TYPE_OFFSET);
+  emit_alu_imm(a, false, 7, RAX, VAL_BOOL);
+  int32_t not_bool = emit_jcc(a, CC_NE);
+  emit_mem(a, false, 0x0fb6, RAX, SP_REG, TOP + PAYLOAD_OFFSET);
+  int32_t done = emit_jmp(a);
+  patch_here(a, not_bool);
+  emit_alu_imm(a, false, 7, RAX, VAL_NULL);
+  emit_rr(a, false, 0x0f90 + CC_NE, 0, RAX); // setne al
+  emit_rr(a, false, 0x0fb6, RAX, RAX);
+  patch_here(a, done);
+}
+
+// jumps to the returned position unless both operands are integers
+static int32_t emit_both_int(Assembler *a, int32_t *second_check) {
+  emit_cmp_type(a, SECOND, VAL_INT);
+  int32_t first = emit_jcc(a, CC_NE);
+  emit_cmp_type(a, TOP, VAL_INT);
+  *second_check = emit_jcc(a, CC_NE);
+  return first;
+}
+
+static void emit_binary(Assembler *a, Opcode op) {
+  int32_t slow[4];
+  slow[0] = emit_both_int(a, &slow[1]);
+  int32_t num_slow = 2;
+
+  emit_load(a, RAX, SP_REG, SECOND + PAYLOAD_OFFSET);
+  switch (op) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+    emit_mem(a, true, op == OP_ADD ? 0x03 : op == OP_SUB ? 0x2b : 0x0faf, RAX,
+             SP_REG, TOP + PAYLOAD_OFFSET);
+    slow[num_slow++] = emit_jcc(a, CC_O);
+    break;
+  case OP_DIV: {
+    emit_load(a, RCX, SP_REG, TOP + PAYLOAD_OFFSET);
+    emit_alu_imm(a, true, 7, RCX, 0);
+    slow[num_slow++] = emit_jcc(a, CC_E);
+    // INT64_MIN / -1 is the only quotient that overflows
+    emit_alu_imm(a, true, 7, RCX, -1);
+    int32_t divisor_ok = emit_jcc(a, CC_NE);
+    emit_mov_imm(a, RDX, (uint64_t)INT64_MIN);
+    emit_rr(a, true, 0x39, RDX, RAX);
+    slow[num_slow++] = emit_jcc(a, CC_E);
+    patch_here(a, divisor_ok);
+    emit_byte(a, 0x48); // cqo
+    emit_byte(a, 0x99);
+    emit_rr(a, true, 0xf7, 7, RCX); // idiv rcx
+    break;
+  }
+  default: {
+    // comparisons produce a boolean
+    Condition cc = op == OP_LT   ? CC_L
+                   : op == OP_GT ? CC_G
+                   : op == OP_EQ ? CC_E
+                                 : CC_NE;
+    emit_mem(a, true, 0x3b, RAX, SP_REG, TOP + PAYLOAD_OFFSET);
+    emit_rr(a, false, 0x0f90 + cc, 0, RAX);
+    emit_rr(a, false, 0x0fb6, RAX, RAX);
+    emit_store_imm(a, false, SP_REG, SECOND + TYPE_OFFSET, VAL_BOOL);
+    break;
+  }
+  }
+  emit_store(a, SP_REG, SECOND + PAYLOAD_OFFSET, RAX);
+  emit_alu_imm(a, true, 5, SP_REG, VALUE_SIZE);
+  int32_t done = emit_jmp(a);
+
+  for (int32_t i = 0; i < num_slow; i++)
+    patch_here(a, slow[i]);
+  emit_runtime_call(a, (uintptr_t)vm_binary_op, op, 0);
+  patch_here(a, done);
+}
+
+static void emit_negate(Assembler *a) {
+  emit_cmp_type(a, TOP, VAL_INT);
+  int32_t not_int = emit_jcc(a, CC_NE);
+  emit_load(a, RAX, SP_REG, TOP + PAYLOAD_OFFSET);
+  emit_rr(a, true, 0xf7, 3, RAX); // neg rax
+  int32_t overflow = emit_jcc(a, CC_O);
+  emit_store(a, SP_REG, TOP + PAYLOAD_OFFSET, RAX);
+  int32_t done = emit_jmp(a);
+
+  patch_here(a, not_int);
+  patch_here(a, overflow);
+  emit_runtime_call(a, (uintptr_t)vm_negate, 0, 0);
+  patch_here(a, done);
+}
+
+// An integer constant folded into the operator after it. The constant is
+// an immediate of the fast path, otherwise it is pushed and the operator
+// that follows runs as usual.
+static void emit_fused_constant(Assembler *a, Opcode op, Value constant,
+                                int32_t ip) {
+  int64_t k = constant.as.integer;
+  if (k < INT32_MIN || k > INT32_MAX) {
+    emit_push_value(a, constant);
+    return;
+  }
+
+  emit_cmp_type(a, TOP, VAL_INT);
+  int32_t not_int = emit_jcc(a, CC_NE);
+  emit_load(a, RAX, SP_REG, TOP + PAYLOAD_OFFSET);
+  int32_t overflow = -1;
+  if (op == OP_ADD_INT_CONST || op == OP_SUB_INT_CONST) {
+    emit_alu_imm(a, true, op == OP_ADD_INT_CONST ? 0 : 5, RAX, (int32_t)k);
+    overflow = emit_jcc(a, CC_O);
+  } else {
+    Condition cc = op == OP_LT_INT_CONST   ? CC_L
+                   : op == OP_GT_INT_CONST ? CC_G
+                                           : CC_E;
+    emit_alu_imm(a, true, 7, RAX, (int32_t)k);
+    emit_rr(a, false, 0x0f90 + cc, 0, RAX);
+    emit_rr(a, false, 0x0fb6, RAX, RAX);
+    emit_store_imm(a, false, SP_REG, TOP + TYPE_OFFSET, VAL_BOOL);
+  }
+  emit_store(a, SP_REG, TOP + PAYLOAD_OFFSET, RAX);
+  // past the operand and the operator
+  add_fixup(a, emit_jmp(a), ip + 4);
+
+  patch_here(a, not_int);
+  if (overflow >= 0)
+    patch_here(a, overflow);
+  emit_push_value(a, constant);
+}
+
+static bool stack_overflow(VM *vm) { return vm_error(vm, "stack overflow"); }
+
+static void emit_prologue(Assembler *a) {
+  emit_push(a, RBP);
+  emit_mov(a, RBP, RSP);
+  emit_push(a, RBX);
+  emit_push(a, R12);
+  emit_push(a, R13);
+  emit_push(a, R14);
+  emit_push(a, R15);
+  // keeps the stack 16 byte aligned at the calls
+  emit_alu_imm(a, true, 5, RSP, 8);
+
+  emit_mov(a, VM_REG, RDI);
+  emit_mov(a, FRAME_REG, RSI);
+  emit_mov(a, SP_REG, RDX);
+  emit_load(a, RAX, VM_REG, offsetof(VM, stack));
+  emit_mem(a, true, 0x63, LOCALS_REG, FRAME_REG, offsetof(Frame, base_pointer));
+  emit_shift(a, 4, LOCALS_REG, 4);
+  emit_rr(a, true, 0x01, RAX, LOCALS_REG);
+  emit_mem(a, true, 0x8d, LIMIT_REG, RAX, STACK_SIZE * VALUE_SIZE);
+  // the entry point of the first instruction to run
+  emit_rr(a, false, 0xff, 4, RCX);
+}
+
+static void emit_epilogue(Assembler *a) {
+  emit_alu_imm(a, true, 0, RSP, 8);
+  emit_pop(a, R15);
+  emit_pop(a, R14);
+  emit_pop(a, R13);
+  emit_pop(a, R12);
+  emit_pop(a, RBX);
+  emit_pop(a, RBP);
+  emit_byte(a, 0xc3);
+}
+
+static void emit_instruction(Assembler *a, const uint8_t *ins, int32_t ip,
+                             const ValuesArray *constants) {
+  Opcode op = (Opcode)ins[ip];
+  const uint8_t *operands = &ins[ip + 1];
+
+  // the fused instructions keep their own entry points, a superinstruction
+  // only runs the first of them
+  int32_t length;
+  const Opcode *fused = superinstruction_sequence(op, &length);
+  if (fused != NULL)
+    op = fused[0];
+
+  switch (op) {
+  case OP_CONSTANT: {
+    // folded like its quickened form, the interpreter never quickens the
+    // constants inside a superinstruction
+    Value constant = constants->data[read_u16(operands)];
+    Opcode fused_op = opcode_fused_constant((Opcode)ins[ip + 3]);
+    if (IS_INT(constant) && fused_op != OP_CONSTANT)
+      emit_fused_constant(a, fused_op, constant, ip);
+    else
+      emit_push_value(a, constant);
+    break;
+  }
+
+  case OP_POP:
+    emit_alu_imm(a, true, 5, SP_REG, VALUE_SIZE);
+    emit_copy_value(a, VM_REG, offsetof(VM, last_popped), SP_REG, 0);
+    break;
+
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_EQ:
+  case OP_NOT_EQ:
+  case OP_LT:
+  case OP_GT:
+    emit_binary(a, op);
+    break;
+
+  case OP_ADD_INT_INT:
+    emit_binary(a, OP_ADD);
+    break;
+  case OP_SUB_INT_INT:
+    emit_binary(a, OP_SUB);
+    break;
+  case OP_LT_INT_INT:
+    emit_binary(a, OP_LT);
+    break;
+  case OP_GT_INT_INT:
+    emit_binary(a, OP_GT);
+    break;
+  case OP_EQ_INT_INT:
+    emit_binary(a, OP_EQ);
+    break;
+
+  case OP_ADD_INT_CONST:
+  case OP_SUB_INT_CONST:
+  case OP_LT_INT_CONST:
+  case OP_GT_INT_CONST:
+  case OP_EQ_INT_CONST:
+    emit_fused_constant(a, op, constants->data[read_u16(operands)], ip);
+    break;
+
+  case OP_TRUE:
+  case OP_FALSE:
+    emit_push_value(a, BOOL_VAL(op == OP_TRUE));
+    break;
+
+  case OP_NULL:
+    emit_push_value(a, NULL_VAL);
+    break;
+
+  case OP_MINUS:
+    emit_negate(a);
+    break;
+
+  case OP_BANG:
+    emit_truthy(a);
+    emit_alu_imm(a, false, 6, RAX, 1); // xor
+    emit_store_imm(a, false, SP_REG, TOP + TYPE_OFFSET, VAL_BOOL);
+    emit_store(a, SP_REG, TOP + PAYLOAD_OFFSET, RAX);
+    break;
+
+  case OP_ARRAY:
+    emit_runtime_call(a, (uintptr_t)vm_build_array, read_u16(operands), 0);
+    break;
+
+  case OP_REGION_ARRAY:
+    emit_runtime_call(a, (uintptr_t)vm_build_region_array, read_u16(operands),
+                      0);
+    break;
+
+  case OP_MAP:
+    emit_runtime_call(a, (uintptr_t)vm_build_map, read_u16(operands), 0);
+    break;
+
+  case OP_INDEX:
+    emit_runtime_call(a, (uintptr_t)vm_index, 0, 0);
+    break;
+
+  case OP_GET_FIELD:
+    emit_runtime_call(a, (uintptr_t)vm_get_field, read_u16(operands),
+                      read_u16(operands + 2));
+    break;
+
+  case OP_JUMP:
+    add_fixup(a, emit_jmp(a), read_u16(operands));
+    break;
+
+  case OP_JUMP_FALSE:
+    emit_truthy(a);
+    emit_alu_imm(a, true, 5, SP_REG, VALUE_SIZE);
+    emit_alu_imm(a, false, 7, RAX, 0);
+    add_fixup(a, emit_jcc(a, CC_E), read_u16(operands));
+    break;
+
+  case OP_GET_GLOBAL:
+    emit_check_overflow(a);
+    emit_load(a, RDX, VM_REG, offsetof(VM, globals));
+    emit_copy_value(a, SP_REG, 0, RDX, read_u16(operands) * VALUE_SIZE);
+    emit_alu_imm(a, true, 0, SP_REG, VALUE_SIZE);
+    break;
+
+  case OP_SET_GLOBAL:
+    emit_alu_imm(a, true, 5, SP_REG, VALUE_SIZE);
+    emit_load(a, RDX, VM_REG, offsetof(VM, globals));
+    emit_copy_value(a, RDX, read_u16(operands) * VALUE_SIZE, SP_REG, 0);
+    break;
+
+  case OP_GET_LOCAL:
+    emit_check_overflow(a);
+    emit_copy_value(a, SP_REG, 0, LOCALS_REG, read_u8(operands) * VALUE_SIZE);
+    emit_alu_imm(a, true, 0, SP_REG, VALUE_SIZE);
+    break;
+
+  case OP_SET_LOCAL:
+    emit_alu_imm(a, true, 5, SP_REG, VALUE_SIZE);
+    emit_copy_value(a, LOCALS_REG, read_u8(operands) * VALUE_SIZE, SP_REG, 0);
+    break;
+
+  case OP_GET_BUILTIN:
+    emit_push_value(a, BUILTIN_VAL(read_u8(operands)));
+    break;
+
+  case OP_GET_FREE:
+    // the closure moves when it is young, it is loaded from the frame
+    emit_check_overflow(a);
+    emit_load(a, RDX, FRAME_REG, offsetof(Frame, cl));
+    emit_copy_value(a, SP_REG, 0, RDX,
+                    offsetof(Closure, free_vars) +
+                        read_u8(operands) * VALUE_SIZE);
+    emit_alu_imm(a, true, 0, SP_REG, VALUE_SIZE);
+    break;
+
+  case OP_CURRENT_CLOSURE:
+    emit_check_overflow(a);
+    emit_load(a, RDX, FRAME_REG, offsetof(Frame, cl));
+    emit_store_imm(a, false, SP_REG, TYPE_OFFSET, VAL_OBJ);
+    emit_store(a, SP_REG, PAYLOAD_OFFSET, RDX);
+    emit_alu_imm(a, true, 0, SP_REG, VALUE_SIZE);
+    break;
+
+  case OP_CLOSURE:
+    emit_runtime_call(a, (uintptr_t)vm_make_closure, read_u16(operands),
+                      read_u8(operands + 2));
+    break;
+
+  case OP_REGION_CLOSURE:
+    emit_runtime_call(a, (uintptr_t)vm_make_region_closure, read_u16(operands),
+                      read_u8(operands + 2));
+    break;
+
+  case OP_ENTER_REGION:
+    emit_runtime_call(a, (uintptr_t)vm_enter_region, read_u16(operands), 0);
+    break;
+
+  case OP_LEAVE_REGION:
+    emit_runtime_call(a, (uintptr_t)vm_leave_region, 0, 0);
+    break;
+
+  case OP_CALL:
+  case OP_TAIL_CALL:
+  case OP_RETURN_VALUE:
+  case OP_RETURN:
+    // frames are pushed and popped by the interpreter
+    emit_byte(a, 0xb8); // mov eax, ip
+    emit_u32(a, (uint32_t)ip);
+    add_fixup(a, emit_jmp(a), STUB_EXIT);
+    break;
+
+  default:
+    assert(false && "opcode without a template");
+  }
+}
+
+JitCode *jit_compile(const CompiledFunction *fn, const ValuesArray *constants) {
+  assert(fn != NULL && constants != NULL);
+  const Instructions *ins = &fn->instructions;
+
+  int32_t *entries = malloc(sizeof(int32_t) * (ins->size + 1));
+  assert(entries != NULL);
+  for (int32_t i = 0; i <= ins->size; i++)
+    entries[i] = -1;
+
+  Assembler a = {0};
+  emit_prologue(&a);
+  for (int32_t ip = 0; ip < ins->size;
+       ip += opcode_width((Opcode)ins->data[ip])) {
+    entries[ip] = a.size;
+    a.resume_ip = ip + opcode_width((Opcode)ins->data[ip]);
+    emit_instruction(&a, ins->data, ip, constants);
+  }
+
+  // every stub enters with eax holding the offset frame->ip is left at: the
+  // instruction left to the interpreter, or the one past a failing one
+  int32_t stubs[3];
+  stubs[-STUB_OVERFLOW - 1] = a.size;
+  emit_mem(&a, false, 0x89, RAX, FRAME_REG, offsetof(Frame, ip));
+  emit_sync_sp(&a, RCX);
+  emit_mov(&a, RDI, VM_REG);
+  emit_mov_imm(&a, RAX, (uintptr_t)stack_overflow);
+  emit_rr(&a, false, 0xff, 2, RAX);
+  int32_t to_error = emit_jmp(&a);
+  stubs[-STUB_ERROR - 1] = a.size;
+  emit_mem(&a, false, 0x89, RAX, FRAME_REG, offsetof(Frame, ip));
+  emit_sync_sp(&a, RCX);
+  patch_here(&a, to_error);
+  emit_byte(&a, 0xb8); // mov eax, -1
+  emit_u32(&a, (uint32_t)-1);
+  int32_t to_epilogue = emit_jmp(&a);
+  stubs[-STUB_EXIT - 1] = a.size;
+  emit_mem(&a, false, 0x89, RAX, FRAME_REG, offsetof(Frame, ip));
+  emit_sync_sp(&a, RCX);
+  patch_here(&a, to_epilogue);
+  emit_epilogue(&a);
+
+  for (int32_t i = 0; i < a.num_fixups; i++) {
+    Fixup fixup = a.fixups[i];
+    int32_t offset;
+    if (fixup.target == STUB_ERROR || fixup.target == STUB_OVERFLOW) {
+      // out of line so the checks cost nothing until they fail
+      offset = a.size;
+      emit_byte(&a, 0xb8); // mov eax, resume_ip
+      emit_u32(&a, (uint32_t)fixup.resume_ip);
+      patch_rel32(&a, emit_jmp(&a), stubs[-fixup.target - 1]);
+    } else {
+      offset = fixup.target < 0 ? stubs[-fixup.target - 1]
+                                : entries[fixup.target];
+    }
+    assert(offset >= 0 && "jump into the middle of an instruction");
+    patch_rel32(&a, fixup.position, offset);
+  }
+  free(a.fixups);
+
+  // written once, then only executed
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = ((size_t)a.size + page - 1) & ~(page - 1);
+  void *code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    free(a.code);
+    free(entries);
+    return NULL;
+  }
+  memcpy(code, a.code, a.size);
+  free(a.code);
+  if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, size);
+    free(entries);
+    return NULL;
+  }
+
+  JitCode *jit = malloc(sizeof(JitCode));
+  assert(jit != NULL);
+  *jit = (JitCode){.code = code,
+                   .size = size,
+                   .entries = entries,
+                   .num_entries = ins->size};
+  return jit;
+}
+
+void free_jit_code(JitCode *self) {
+  if (self == NULL)
+    return;
+
+  munmap(self->code, self->size);
+  free(self->entries);
+  free(self);
+}
+
+typedef int32_t (*JitEntry)(VM *vm, Frame *frame, Value *sp,
+                            const uint8_t *target);
+
+int32_t jit_run(const JitCode *self, VM *vm, Frame *frame, int32_t ip) {
+  assert(ip >= 0 && ip < self->num_entries && self->entries[ip] >= 0);
+  JitEntry entry = (JitEntry)(void *)self->code;
+  return entry(vm, frame, &vm->stack[vm->sp], self->code + self->entries[ip]);
+}
+
+#else
+
+JitCode *jit_compile(const CompiledFunction *fn, const ValuesArray *constants) {
+  (void)fn;
+  (void)constants;
+  return NULL;
+}
+
+void free_jit_code(JitCode *self) { assert(self == NULL); }
+
+int32_t jit_run(const JitCode *self, struct VM *vm, struct Frame *frame,
+                int32_t ip) {
+  (void)self;
+  (void)vm;
+  (void)frame;
+  (void)ip;
+  assert(false && "no native code on this platform");
+  return -1;
+}
+
+#endif // JIT_SUPPORTED
@@ -0,0 +1,48 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "object.h"
+
+// machine code is only generated on x86-64 Linux, everywhere else every
+// function stays in the interpreter
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// Machine code of one CompiledFunction, built by expanding every bytecode
+// instruction into a fixed snippet. Integer arithmetic and comparisons run
+// inline, everything else calls the slow paths in vm.h. The code works on
+// the VM stack in place and every instruction has its own entry point, so
+// a frame moves between the interpreter and the native code at any
+// instruction boundary. Calls and returns are left to the interpreter.
+typedef struct JitCode {
+  uint8_t *code;
+  // bytes mapped at `code`
+  size_t size;
+  // offset into `code` of the instruction starting at each bytecode offset,
+  // -1 inside an instruction
+  int32_t *entries;
+  int32_t num_entries;
+} JitCode;
+
+// NULL when the platform has no JIT or the code could not be mapped
+JitCode *jit_compile(const CompiledFunction *fn, const ValuesArray *constants);
+void free_jit_code(JitCode *self);
+
+struct VM;
+struct Frame;
+
+// runs `frame` from the instruction at `ip` until it reaches a call or a
+// return and returns the offset of that instruction, or -1 after a runtime
+// error. The VM stack pointer and `frame->ip` are up to date either way,
+// after an error `frame->ip` is past the failing instruction as the
+// interpreter leaves it.
+int32_t jit_run(const JitCode *self, struct VM *vm, struct Frame *frame,
+                int32_t ip);
+
+#endif // !JIT_H
@@ -33,6 +33,20 @@ char peek_char(const Lexer *self) {
   return String_char_at(&self->input, self->read_position);
 }
 
+// the opening quote is the current character, leaves the closing one there
+// and returns false when the input ends first
+bool read_string(Lexer *self, String *out) {
+  int32_t position = self->position + 1;
+  do {
+    read_char(self);
+  } while (self->ch != '"' && self->ch != '\0');
+
+  *out = STR_NULL;
+  out->chars = self->input.chars + position;
+  out->length = self->position - position;
+  return self->ch == '"';
+}
+
 String read_number(Lexer *self) {
   int32_t position = self->position;
   while (is_digit(self->ch)) {
@@ -66,6 +80,9 @@ Token Token_from_char(TokenType type, char ch) {
 }
 
 Token Token_clone(const Token *src) {
+  // both refer to the same input
+  if (src->type == TOKEN_STRING)
+    return *src;
   return (Token){src->type, String_clone(&src->literal)};
 }
 TokenType lookup_ident(String *literal) {
@@ -99,6 +116,17 @@ Token next_token(Lexer *l) {
   case ',':
     t = Token_from_char(TOKEN_COMMA, l->ch);
     break;
+  case ':':
+    t = Token_from_char(TOKEN_COLON, l->ch);
+    break;
+  case '.':
+    if (peek_char(l) == '.') {
+      read_char(l);
+      t.type = TOKEN_RANGE;
+      t.literal = String_from("..");
+    } else
+      t = Token_from_char(TOKEN_ILLEGAL, l->ch);
+    break;
   case '/':
     t = Token_from_char(TOKEN_SLASH, l->ch);
     break;
@@ -131,9 +159,25 @@ Token next_token(Lexer *l) {
   case '}':
     t = Token_from_char(TOKEN_RBRACE, l->ch);
     break;
+  case '[':
+    t = Token_from_char(TOKEN_LBRACKET, l->ch);
+    break;
+  case ']':
+    t = Token_from_char(TOKEN_RBRACKET, l->ch);
+    break;
   case ';':
     t = Token_from_char(TOKEN_SEMICOLON, l->ch);
     break;
+  case '@':
+    t = Token_from_char(TOKEN_AT, l->ch);
+    break;
+  case '"':
+    if (read_string(l, &t.literal)) {
+      t.type = TOKEN_STRING;
+    } else {
+      t = Token_from_char(TOKEN_ILLEGAL, '"');
+    }
+    break;
   case '\0':
     t = Token_from_char(TOKEN_EOF, '\0');
     break;
@@ -163,12 +207,18 @@ Token next_token(Lexer *l) {
 
 void print_token(Token *t) {
   printf("t.type = %s\n", token_type_to_string(t->type));
-  printf("t.literal = %s\n", t->literal.chars);
+  printf("t.literal = %.*s\n", t->literal.length, t->literal.chars);
 }
 
 void free_token(Token *t) {
   if (t == NULL || t->literal.chars == NULL)
     return;
+  // borrowed from the input
+  if (t->type == TOKEN_STRING) {
+    t->type = 0;
+    t->literal = STR_NULL;
+    return;
+  }
 
   t->type = 0;
   free_string(&t->literal);
@@ -11,12 +11,18 @@
   X(TOKEN_ILLEGAL)                                                             \
   X(TOKEN_IDENT)                                                               \
   X(TOKEN_INT)                                                                 \
+  X(TOKEN_STRING)                                                              \
   X(TOKEN_COMMA)                                                               \
   X(TOKEN_SEMICOLON)                                                           \
+  X(TOKEN_COLON)                                                               \
+  X(TOKEN_RANGE)                                                               \
   X(TOKEN_LPAREN)                                                              \
   X(TOKEN_RPAREN)                                                              \
   X(TOKEN_LBRACE)                                                              \
   X(TOKEN_RBRACE)                                                              \
+  X(TOKEN_LBRACKET)                                                            \
+  X(TOKEN_RBRACKET)                                                            \
+  X(TOKEN_AT)                                                                  \
   X(TOKEN_ASSIGN)                                                              \
   X(TOKEN_PLUS)                                                                \
   X(TOKEN_MINUS)                                                               \
@@ -35,6 +41,7 @@
   X(TOKEN_TRUE)                                                                \
   X(TOKEN_FALSE)                                                               \
   X(TOKEN_FOR)                                                                 \
+  X(TOKEN_IN)                                                                  \
   X(TOKEN_EOF)
 
 typedef enum u8 {
@@ -48,6 +55,9 @@ const char *token_type_to_string(TokenType);
 
 typedef struct {
   TokenType type;
+  // the literal of a TOKEN_STRING is its contents between the quotes. It
+  // points into the lexer input instead of being copied, is not NUL
+  // terminated and is only valid as long as the lexer.
   String literal;
 } Token;
 
@@ -69,6 +79,7 @@ static const KeywordsMap keywords_map[] = {
 
     {"return", TOKEN_RETURN}, {"true", TOKEN_TRUE},
     {"false", TOKEN_FALSE},   {"for", TOKEN_FOR},
+    {"in", TOKEN_IN},
 };
 
 Lexer *Lexer_new(String input);
@@ -1,11 +1,56 @@
 #include "parser.h"
 #include "repl.h"
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define CSTRING_IMPLEMENTATION
 #include "cstring.h/cstring.h"
 
-int main(void) {
+static int compile_usage(void) {
+  printf("usage: fizzlang compile --emit-c <file> [-o <out>]\n"
+         "       fizzlang compile <file> -o <out.fzc>\n");
+  return EXIT_FAILURE;
+}
+
+// fizzlang compile --emit-c <file> [-o <out>] translates to C, without
+// --emit-c the bytecode is saved to a .fzc file
+static int compile_command(int argc, char **argv) {
+  const char *path = NULL;
+  const char *out_path = NULL;
+  bool emit_c = false;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--emit-c") == 0)
+      emit_c = true;
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      out_path = argv[++i];
+    else if (path == NULL && argv[i][0] != '-')
+      path = argv[i];
+    else
+      return compile_usage();
+  }
+
+  if (path == NULL || (!emit_c && out_path == NULL))
+    return compile_usage();
+  return emit_c ? compile_file_to_c(path, out_path)
+                : compile_file_to_fzc(path, out_path);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "compile") == 0) {
+    return compile_command(argc - 2, argv + 2);
+  }
+  if (argc > 1 && strcmp(argv[1], "disasm") == 0) {
+    if (argc != 3) {
+      printf("usage: fizzlang disasm <file>\n");
+      return EXIT_FAILURE;
+    }
+    return disassemble_file(argv[2]);
+  }
+  if (argc > 1) {
+    return run_file(argv[1]);
+  }
 
   printf("\n-----------------------------------------\n");
   printf("Hello, Fellow programmer\n");
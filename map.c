@@ -0,0 +1,244 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "gc.h"
+#include "map.h"
+#include "object.h"
+#include "rope.h"
+#include "shape.h"
+
+#include "cstring.h/cstring.h"
+
+// bit i is set when control byte i of the group equals `byte`
+static inline uint32_t group_match(const uint8_t *group, uint8_t byte) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+  uint32_t mask = 0;
+  for (int32_t i = 0; i < MAP_GROUP_WIDTH; i++)
+    mask |= (uint32_t)(group[i] == byte) << i;
+  return mask;
+#endif
+}
+
+static inline uint8_t hash_ctrl(uint32_t hash) { return hash & 0x7f; }
+
+// first group probed for `hash`, the low bits went into the control byte
+static inline uint32_t hash_group(uint32_t hash, uint32_t group_mask) {
+  return (hash >> 7) & group_mask;
+}
+
+bool map_key_is_hashable(Value key) {
+  return IS_INT(key) || IS_BOOL(key) || IS_OBJ_TYPE(key, OBJ_STRING) ||
+         IS_OBJ_TYPE(key, OBJ_BIGINT);
+}
+
+// smallest table that keeps the load at 7/8 at most, so every probe
+// sequence reaches a group with a free slot
+static int32_t table_capacity(int32_t count) {
+  int32_t capacity = MAP_GROUP_WIDTH;
+  while (capacity - capacity / 8 < count)
+    capacity *= 2;
+  return capacity;
+}
+
+// slot holding `key`, or the free slot it goes into when it is missing
+static int32_t find_slot(MapObject *self, Value key, uint32_t hash,
+                         bool *found) {
+  const MapEntry *entries = map_entries(self);
+  const int32_t *slots = map_slots(self);
+  uint32_t group_mask = (uint32_t)self->capacity / MAP_GROUP_WIDTH - 1;
+  uint32_t group = hash_group(hash, group_mask);
+
+  // triangular steps visit every group of a power of two table
+  for (uint32_t step = 1;; step++) {
+    const uint8_t *ctrl = self->ctrl + group * MAP_GROUP_WIDTH;
+    for (uint32_t match = group_match(ctrl, hash_ctrl(hash)); match != 0;
+         match &= match - 1) {
+      int32_t slot = group * MAP_GROUP_WIDTH + __builtin_ctz(match);
+      const MapEntry *entry = &entries[slots[slot]];
+      if (entry->hash == hash && value_equals(entry->key, key)) {
+        *found = true;
+        return slot;
+      }
+    }
+
+    uint32_t empty = group_match(ctrl, MAP_CTRL_EMPTY);
+    if (empty != 0) {
+      *found = false;
+      return group * MAP_GROUP_WIDTH + __builtin_ctz(empty);
+    }
+    group = (group + step) & group_mask;
+  }
+}
+
+// shape of a record holding the keys at `items`, NULL when they do not fit
+// one. `slots` receives the field of every pair.
+static const Shape *record_shape(ShapeTable *shapes, const Value *items,
+                                 int32_t num_pairs, int32_t *slots) {
+  if (shapes == NULL || num_pairs > SHAPE_MAX_FIELDS)
+    return NULL;
+
+  // checked first so mixed keys do not leave shapes behind
+  for (int32_t i = 0; i < num_pairs; i++) {
+    if (!IS_STRING(items[2 * i]))
+      return NULL;
+  }
+
+  Shape *shape = shapes->root;
+  for (int32_t i = 0; i < num_pairs; i++) {
+    StringObject *str = (StringObject *)items[2 * i].as.obj;
+    slots[i] = shape_field_index(shape, str);
+    if (slots[i] >= 0)
+      continue;
+    slots[i] = shape->num_fields;
+    shape = shape_add_field(shapes, shape, str);
+    if (shape == NULL)
+      return NULL;
+  }
+
+  return shape;
+}
+
+static bool record_new(Heap *heap, const Shape *shape, const Value *items,
+                       int32_t num_pairs, const int32_t *slots, Value *out) {
+  MapObject *map = (MapObject *)object_alloc(
+      heap, &MAP_VT, sizeof(MapObject) + sizeof(Value) * shape->num_fields);
+  map->count = shape->num_fields;
+  map->capacity = 0;
+  map->shape = shape;
+
+  Value *fields = map_fields(map);
+  for (int32_t i = 0; i < num_pairs; i++)
+    fields[slots[i]] = items[2 * i + 1];
+  for (int32_t i = 0; i < map->count; i++)
+    gc_write_barrier(heap, &map->base, fields[i]);
+
+  *out = OBJ_VAL(map);
+  return true;
+}
+
+bool map_new(Heap *heap, ShapeTable *shapes, const Value *items,
+             int32_t num_pairs, Value *out) {
+  assert(num_pairs >= 0);
+  if (num_pairs > MAP_MAX_COUNT)
+    return false;
+
+  int32_t record_slots[SHAPE_MAX_FIELDS];
+  const Shape *shape = record_shape(shapes, items, num_pairs, record_slots);
+  if (shape != NULL)
+    return record_new(heap, shape, items, num_pairs, record_slots, out);
+
+  int32_t capacity = table_capacity(num_pairs);
+  size_t size = sizeof(MapObject) +
+                (sizeof(uint8_t) + sizeof(int32_t)) * (size_t)capacity +
+                sizeof(MapEntry) * (size_t)num_pairs;
+  MapObject *map = (MapObject *)object_alloc(heap, &MAP_VT, size);
+  map->count = 0;
+  map->capacity = capacity;
+  map->shape = NULL;
+  memset(map->ctrl, MAP_CTRL_EMPTY, capacity);
+
+  MapEntry *entries = map_entries(map);
+  int32_t *slots = map_slots(map);
+  for (int32_t i = 0; i < num_pairs; i++) {
+    Value key = items[2 * i];
+    assert(map_key_is_hashable(key));
+    // strings keep their hash, a key seen again is not rehashed
+    uint32_t hash = value_hash(key);
+
+    bool found;
+    int32_t slot = find_slot(map, key, hash, &found);
+    if (found) {
+      entries[slots[slot]].value = items[2 * i + 1];
+      continue;
+    }
+
+    map->ctrl[slot] = hash_ctrl(hash);
+    slots[slot] = map->count;
+    entries[map->count++] =
+        (MapEntry){.key = key, .value = items[2 * i + 1], .hash = hash};
+  }
+
+  for (int32_t i = 0; i < map->count; i++) {
+    gc_write_barrier(heap, &map->base, entries[i].key);
+    gc_write_barrier(heap, &map->base, entries[i].value);
+  }
+
+  *out = OBJ_VAL(map);
+  return true;
+}
+
+bool map_get(MapObject *self, Value key, Value *out) {
+  assert(map_key_is_hashable(key));
+  if (self->shape != NULL) {
+    int32_t slot = IS_STRING(key) ? shape_field_index(
+                                        self->shape, (StringObject *)key.as.obj)
+                                  : -1;
+    if (slot < 0)
+      return false;
+    *out = map_fields(self)[slot];
+    return true;
+  }
+
+  bool found;
+  int32_t slot = find_slot(self, key, value_hash(key), &found);
+  if (!found)
+    return false;
+
+  *out = map_entries(self)[map_slots(self)[slot]].value;
+  return true;
+}
+
+String map_inspect(const Object *self) {
+  assert(self != NULL);
+  MapObject *map = (MapObject *)self;
+
+  String colon = STR_NEW(": ");
+  StringArray pairs = string_array_init(map->count);
+  for (int32_t i = 0; i < map->count; i++) {
+    String key, value;
+    if (map->shape != NULL) {
+      key = String_from(map->shape->keys[i].chars);
+      value = value_inspect(map_fields(map)[i]);
+    } else {
+      key = value_inspect(map_entries(map)[i].key);
+      value = value_inspect(map_entries(map)[i].value);
+    }
+    string_array_push(&pairs, String_join(3, &key, &colon, &value));
+    free_string(&key);
+    free_string(&value);
+  }
+
+  String l_brace = STR_NEW("{");
+  String r_brace = STR_NEW("}");
+  String pairs_str = string_array_join(&pairs, STR_NEW(", "));
+  String out = String_join(3, &l_brace, &pairs_str, &r_brace);
+  free_string(&pairs_str);
+  free_string_array(&pairs);
+
+  return out;
+}
+
+void map_trace(Object *self, Heap *heap) {
+  MapObject *map = (MapObject *)self;
+  if (map->shape != NULL) {
+    Value *fields = map_fields(map);
+    for (int32_t i = 0; i < map->count; i++)
+      gc_visit_value(heap, &fields[i]);
+    return;
+  }
+
+  MapEntry *entries = map_entries(map);
+  for (int32_t i = 0; i < map->count; i++) {
+    gc_visit_value(heap, &entries[i].key);
+    gc_visit_value(heap, &entries[i].value);
+  }
+}
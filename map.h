@@ -0,0 +1,92 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+
+// control bytes compared at once when probing, one SSE2 register
+#define MAP_GROUP_WIDTH 16
+// control byte of a free slot, a used slot holds the low 7 bits of the hash
+// of its key so the top bit tells them apart
+#define MAP_CTRL_EMPTY 0x80
+// keeps the allocation size in a uint32_t
+#define MAP_MAX_COUNT (1 << 24)
+
+typedef struct MapEntry {
+  Value key;
+  Value value;
+  // value_hash of the key, compared before the keys themselves
+  uint32_t hash;
+} MapEntry;
+
+// Immutable runtime map. The probe table is open addressing over groups of
+// MAP_GROUP_WIDTH control bytes, a lookup compares the 7 hash bits of every
+// slot in a group with one SIMD compare and only looks at the entries whose
+// bits match. The slots hold indices into a dense entry array kept in
+// insertion order, so iteration and printing follow the source.
+//
+// Everything lives in the one allocation:
+//   uint8_t ctrl[capacity];
+//   int32_t slots[capacity];
+//   MapEntry entries[count];
+//
+// Maps with a few string keys are records instead. Their keys are described
+// by a shared shape and only the values are stored, in slot order:
+//   Value fields[count];
+typedef struct MapObject {
+  Object base;
+  int32_t count;
+  // slots in the probe table, a power of two no smaller than a group, 0 for
+  // records
+  int32_t capacity;
+  // hidden class of a record, NULL for hash tables
+  const struct Shape *shape;
+  uint8_t ctrl[];
+} MapObject;
+
+String map_inspect(const Object *self);
+void map_trace(Object *self, struct Heap *heap);
+
+static const ObjectVT MAP_VT = {
+    ._t = OBJ_MAP,
+    .inspect = map_inspect,
+    .finalize = NULL,
+    .trace = map_trace,
+};
+
+#define IS_MAP(v) IS_OBJ_TYPE(v, OBJ_MAP)
+
+static inline int32_t *map_slots(MapObject *self) {
+  return (int32_t *)(self->ctrl + self->capacity);
+}
+
+static inline MapEntry *map_entries(MapObject *self) {
+  return (MapEntry *)(map_slots(self) + self->capacity);
+}
+
+static inline Value *map_fields(MapObject *self) {
+  assert(self->shape != NULL);
+  return (Value *)self->ctrl;
+}
+
+// keys compared by value, anything else could only be found by identity
+bool map_key_is_hashable(Value key);
+
+struct Heap;
+struct ShapeTable;
+
+// map of the `num_pairs` key value pairs at `items`, keys at even and
+// values at odd indices. A later pair replaces the value of an earlier one
+// with the same key but keeps its position. The items are read after
+// allocating so they have to be reachable from the roots, every key has to
+// be hashable. Maps with only string keys become records with a shape from
+// `shapes` when it is not NULL. False when the map would be too large.
+bool map_new(struct Heap *heap, struct ShapeTable *shapes, const Value *items,
+             int32_t num_pairs, Value *out);
+// false when `key` is not in the map
+bool map_get(MapObject *self, Value key, Value *out);
+
+#endif // !MAP_H
@@ -0,0 +1,193 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc.h"
+#include "memo.h"
+#include "object.h"
+
+// power of two and at least twice the allocated entries keeps the chains
+// short, every entry is linked into the new buckets
+static void memo_rehash(MemoTable *self) {
+  int32_t num_buckets = 1;
+  while (num_buckets < self->allocated * 2)
+    num_buckets <<= 1;
+  free(self->buckets);
+  self->num_buckets = num_buckets;
+  self->buckets = malloc(sizeof(int32_t) * num_buckets);
+  assert(self->buckets != NULL);
+  for (int32_t i = 0; i < num_buckets; i++)
+    self->buckets[i] = -1;
+
+  for (int32_t i = 0; i < self->size; i++) {
+    int32_t *bucket = &self->buckets[self->entries[i].hash & (num_buckets - 1)];
+    self->entries[i].chain_next = *bucket;
+    *bucket = i;
+  }
+}
+
+// room for `allocated` entries, the entries keep their indices so the
+// recency list stays as it is
+static void memo_resize(MemoTable *self, int32_t allocated) {
+  self->allocated = allocated;
+  self->entries = realloc(self->entries, sizeof(MemoEntry) * allocated);
+  assert(self->entries != NULL);
+  int32_t num_keys = self->arity > 0 ? self->arity * allocated : 1;
+  self->keys = realloc(self->keys, sizeof(Value) * num_keys);
+  assert(self->keys != NULL);
+  memo_rehash(self);
+}
+
+MemoTable *MemoTable_new(int32_t arity, int32_t capacity) {
+  assert(arity >= 0);
+  assert(capacity > 0);
+  MemoTable *table = malloc(sizeof(MemoTable));
+  assert(table != NULL);
+
+  table->arity = arity;
+  table->capacity = capacity;
+  table->size = 0;
+  table->buckets = NULL;
+  table->entries = NULL;
+  table->keys = NULL;
+  table->lru_head = -1;
+  table->lru_tail = -1;
+
+  memo_resize(table, capacity < MEMO_INITIAL_CAPACITY ? capacity
+                                                      : MEMO_INITIAL_CAPACITY);
+  return table;
+}
+
+void free_memo_table(MemoTable *self) {
+  if (self == NULL)
+    return;
+
+  free(self->buckets);
+  free(self->entries);
+  free(self->keys);
+  free(self);
+}
+
+bool memo_key_is_hashable(const Value *args, int32_t nargs) {
+  for (int32_t i = 0; i < nargs; i++) {
+    if (IS_OBJ(args[i]))
+      return false;
+  }
+  return true;
+}
+
+static uint32_t hash_args(const Value *args, int32_t nargs) {
+  uint32_t hash = 2166136261u;
+  for (int32_t i = 0; i < nargs; i++) {
+    hash ^= value_hash(args[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static bool keys_equal(const Value *a, const Value *b, int32_t nargs) {
+  for (int32_t i = 0; i < nargs; i++) {
+    if (!value_equals(a[i], b[i]))
+      return false;
+  }
+  return true;
+}
+
+static Value *entry_key(MemoTable *self, int32_t index) {
+  return &self->keys[index * self->arity];
+}
+
+static void lru_unlink(MemoTable *self, int32_t index) {
+  MemoEntry *entry = &self->entries[index];
+  if (entry->lru_prev != -1)
+    self->entries[entry->lru_prev].lru_next = entry->lru_next;
+  else
+    self->lru_head = entry->lru_next;
+
+  if (entry->lru_next != -1)
+    self->entries[entry->lru_next].lru_prev = entry->lru_prev;
+  else
+    self->lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(MemoTable *self, int32_t index) {
+  MemoEntry *entry = &self->entries[index];
+  entry->lru_prev = -1;
+  entry->lru_next = self->lru_head;
+  if (self->lru_head != -1)
+    self->entries[self->lru_head].lru_prev = index;
+  self->lru_head = index;
+  if (self->lru_tail == -1)
+    self->lru_tail = index;
+}
+
+bool memo_lookup(MemoTable *self, const Value *args, Value *out) {
+  assert(self != NULL);
+  uint32_t hash = hash_args(args, self->arity);
+  int32_t index = self->buckets[hash & (self->num_buckets - 1)];
+
+  while (index != -1) {
+    MemoEntry *entry = &self->entries[index];
+    if (entry->hash == hash &&
+        keys_equal(entry_key(self, index), args, self->arity)) {
+      if (self->lru_head != index) {
+        lru_unlink(self, index);
+        lru_push_front(self, index);
+      }
+      *out = entry->result;
+      return true;
+    }
+    index = entry->chain_next;
+  }
+
+  return false;
+}
+
+static void bucket_remove(MemoTable *self, int32_t index) {
+  int32_t *link = &self->buckets[self->entries[index].hash &
+                                 (self->num_buckets - 1)];
+  while (*link != index) {
+    assert(*link != -1);
+    link = &self->entries[*link].chain_next;
+  }
+  *link = self->entries[index].chain_next;
+}
+
+Value memo_store(MemoTable *self, const Value *args, Value result) {
+  assert(self != NULL);
+  int32_t index;
+  Value evicted = NULL_VAL;
+
+  if (self->size == self->allocated && self->allocated < self->capacity)
+    memo_resize(self, self->allocated * 2 < self->capacity
+                          ? self->allocated * 2
+                          : self->capacity);
+
+  if (self->size < self->allocated) {
+    index = self->size++;
+  } else {
+    // reuse the slot of the least recently used entry
+    index = self->lru_tail;
+    lru_unlink(self, index);
+    bucket_remove(self, index);
+    evicted = self->entries[index].result;
+  }
+
+  MemoEntry *entry = &self->entries[index];
+  entry->hash = hash_args(args, self->arity);
+  entry->result = result;
+  memcpy(entry_key(self, index), args, sizeof(Value) * self->arity);
+
+  int32_t *bucket = &self->buckets[entry->hash & (self->num_buckets - 1)];
+  entry->chain_next = *bucket;
+  *bucket = index;
+
+  lru_push_front(self, index);
+  return evicted;
+}
+
+void memo_trace(MemoTable *self, Heap *heap) {
+  assert(self != NULL);
+  for (int32_t i = 0; i < self->size; i++)
+    gc_visit_value(heap, &self->entries[i].result);
+}
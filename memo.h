@@ -0,0 +1,62 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+
+// maximum number of cached results per memoized closure
+#define MEMO_CAPACITY 4096
+// entries a table starts with, it doubles up to its capacity as it fills
+#define MEMO_INITIAL_CAPACITY 16
+
+typedef struct MemoEntry {
+  uint32_t hash;
+  // next entry in the same bucket, -1 ends the chain
+  int32_t chain_next;
+  // neighbours in the recency list, -1 at either end
+  int32_t lru_prev;
+  int32_t lru_next;
+  Value result;
+} MemoEntry;
+
+// Results of a pure function keyed on its argument values. Bounded to
+// `capacity` entries, the least recently used entry is evicted first. The
+// storage starts small and grows while the table fills, so a closure called
+// with a few distinct arguments does not pay for a full table.
+typedef struct MemoTable {
+  int32_t arity;
+  int32_t capacity;
+  // entries there is storage for, at most `capacity`
+  int32_t allocated;
+  int32_t size;
+
+  int32_t num_buckets;
+  int32_t *buckets;
+
+  MemoEntry *entries;
+  // `arity` argument values per entry
+  Value *keys;
+
+  int32_t lru_head; // most recently used
+  int32_t lru_tail; // evicted next
+} MemoTable;
+
+MemoTable *MemoTable_new(int32_t arity, int32_t capacity);
+void free_memo_table(MemoTable *self);
+
+// only scalar arguments are used as keys, calls with any other argument
+// bypass the table
+bool memo_key_is_hashable(const Value *args, int32_t nargs);
+
+bool memo_lookup(MemoTable *self, const Value *args, Value *out);
+// returns the result evicted to make room, or NULL_VAL, the caller runs it
+// through gc_satb_barrier
+Value memo_store(MemoTable *self, const Value *args, Value result);
+
+struct Heap;
+// marks the cached results, the keys are scalars
+void memo_trace(MemoTable *self, struct Heap *heap);
+
+#endif // !MEMO_H
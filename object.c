@@ -0,0 +1,285 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bigint.h"
+#include "gc.h"
+#include "jit.h"
+#include "memo.h"
+#include "object.h"
+#include "rope.h"
+
+#include "cstring.h/cstring.h"
+
+bool value_is_truthy(Value v) {
+  switch (v.type) {
+  case VAL_NULL:
+    return false;
+  case VAL_BOOL:
+    return v.as.boolean;
+  default:
+    return true;
+  }
+}
+
+bool value_equals(Value a, Value b) {
+  if (a.type != b.type)
+    return false;
+
+  switch (a.type) {
+  case VAL_NULL:
+    return true;
+  case VAL_BOOL:
+    return a.as.boolean == b.as.boolean;
+  case VAL_INT:
+    return a.as.integer == b.as.integer;
+  case VAL_BUILTIN:
+    return a.as.builtin == b.as.builtin;
+  case VAL_OBJ:
+    if (a.as.obj->vt->_t == OBJ_BIGINT && b.as.obj->vt->_t == OBJ_BIGINT)
+      return bigint_equals((const BigInt *)a.as.obj,
+                           (const BigInt *)b.as.obj);
+    if (a.as.obj->vt->_t == OBJ_STRING && b.as.obj->vt->_t == OBJ_STRING)
+      return string_equals((const StringObject *)a.as.obj,
+                           (const StringObject *)b.as.obj);
+    return a.as.obj == b.as.obj;
+  }
+
+  return false;
+}
+
+uint32_t value_hash(Value v) {
+  uint64_t bits;
+  switch (v.type) {
+  case VAL_NULL:
+    bits = 0;
+    break;
+  case VAL_BOOL:
+    bits = v.as.boolean;
+    break;
+  case VAL_INT:
+    bits = (uint64_t)v.as.integer;
+    break;
+  case VAL_BUILTIN:
+    bits = (uint32_t)v.as.builtin;
+    break;
+  case VAL_OBJ:
+  default:
+    if (v.as.obj->vt->_t == OBJ_BIGINT)
+      bits = bigint_hash((const BigInt *)v.as.obj);
+    else if (v.as.obj->vt->_t == OBJ_STRING)
+      bits = string_hash((StringObject *)v.as.obj);
+    else
+      bits = (uint64_t)(uintptr_t)v.as.obj;
+    break;
+  }
+
+  // splitmix64 finalizer, mixed with the type so 0 and false differ
+  bits ^= (uint64_t)v.type << 56;
+  bits = (bits ^ (bits >> 30)) * 0xbf58476d1ce4e5b9ull;
+  bits = (bits ^ (bits >> 27)) * 0x94d049bb133111ebull;
+  bits ^= bits >> 31;
+
+  return (uint32_t)bits;
+}
+
+String value_inspect(Value v) {
+  switch (v.type) {
+  case VAL_NULL:
+    return String_from("null");
+  case VAL_BOOL:
+    return String_from(v.as.boolean ? "true" : "false");
+  case VAL_INT: {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%" PRId64, v.as.integer);
+    return String_from(buf);
+  }
+  case VAL_BUILTIN:
+    return String_from("builtin function");
+  case VAL_OBJ:
+    return v.as.obj->vt->inspect(v.as.obj);
+  }
+
+  return String_from("");
+}
+
+const char *value_type_name(Value v) {
+  switch (v.type) {
+  case VAL_NULL:
+    return "NULL";
+  case VAL_BOOL:
+    return "BOOLEAN";
+  case VAL_INT:
+    return "INTEGER";
+  case VAL_BUILTIN:
+    return "BUILTIN";
+  case VAL_OBJ:
+    switch (v.as.obj->vt->_t) {
+    case OBJ_FUNCTION:
+      return "COMPILED_FUNCTION";
+    case OBJ_CLOSURE:
+      return "CLOSURE";
+    case OBJ_BIGINT:
+      return "INTEGER";
+    case OBJ_STRING:
+      return "STRING";
+    case OBJ_ARRAY:
+      return "ARRAY";
+    case OBJ_MAP:
+      return "MAP";
+    }
+  }
+
+  return "UNKNOWN";
+}
+
+// ValuesArray impl start -----
+ValuesArray values_array_init(int32_t capacity) {
+  assert(capacity >= 0);
+  ValuesArray arr;
+
+  arr.size = 0;
+  arr.capacity = capacity == 0 ? 16 : capacity;
+  arr.data = malloc(sizeof(Value) * arr.capacity);
+  assert(arr.data != NULL);
+  return arr;
+}
+
+bool values_reserve(ValuesArray *self, int32_t new_capacity) {
+  assert(self != NULL);
+  if (new_capacity <= self->capacity)
+    return true;
+  Value *new_ptr = realloc(self->data, sizeof(Value) * new_capacity);
+
+  if (!new_ptr)
+    return false;
+
+  self->data = new_ptr;
+  self->capacity = new_capacity;
+  return true;
+}
+
+// realloc the area and push the data
+int32_t values_push(ValuesArray *self, Value data) {
+  assert(self != NULL);
+  if (self->capacity == self->size) {
+    int32_t new_cap = self->capacity > 0 ? self->capacity * 2 : 1;
+    assert(values_reserve(self, new_cap));
+  }
+
+  self->data[self->size] = data;
+  return ++self->size;
+}
+
+Value values_get(const ValuesArray *self, int32_t index) {
+  assert(self != NULL);
+  assert(index >= 0);
+  assert(index < self->size);
+
+  return self->data[index];
+}
+
+void free_values(ValuesArray *self) {
+  if (self == NULL)
+    return;
+
+  for (int32_t i = 0; i < self->size; i++) {
+    if (!IS_OBJ(self->data[i]))
+      continue;
+    object_free(self->data[i].as.obj);
+  }
+
+  free(self->data);
+  self->data = NULL;
+  self->size = 0;
+  self->capacity = 0;
+}
+// ValuesArray impl end -----
+
+CompiledFunction *compiled_function_new(Instructions instructions,
+                                        int32_t num_locals,
+                                        int32_t num_parameters, String name) {
+  CompiledFunction *fn = (CompiledFunction *)object_alloc(
+      NULL, &COMPILED_FUNCTION_VT, sizeof(CompiledFunction));
+
+  fn->instructions = instructions;
+  fn->num_locals = num_locals;
+  fn->num_parameters = num_parameters;
+  fn->name = name;
+  fn->memoize = false;
+  fn->pure = false;
+  fn->escaping_parameters = UINT32_MAX;
+  fn->max_stack = -1;
+  fn->free_reads = 0;
+  fn->calls = 0;
+  fn->back_edges = 0;
+  fn->native = NULL;
+  fn->tree = NULL;
+
+  return fn;
+}
+
+String compiled_function_inspect(const Object *self) {
+  assert(self != NULL);
+  const CompiledFunction *fn = (const CompiledFunction *)self;
+  char buf[128];
+  snprintf(buf, sizeof(buf), "CompiledFunction[%s]",
+           fn->name.length > 0 ? fn->name.chars : "anonymous");
+
+  return String_from(buf);
+}
+
+void compiled_function_finalize(Object *self) {
+  assert(self != NULL);
+
+  CompiledFunction *fn = (CompiledFunction *)self;
+  free_instructions(&fn->instructions);
+  free_string(&fn->name);
+  free_jit_code(fn->native);
+}
+
+Closure *closure_new(Heap *heap, CompiledFunction *fn, int32_t num_free) {
+  assert(fn != NULL);
+  assert(num_free >= 0);
+  Closure *cl = (Closure *)object_alloc(
+      heap, &CLOSURE_VT, sizeof(Closure) + sizeof(Value) * num_free);
+
+  cl->fn = fn;
+  cl->memo = NULL;
+  cl->num_free = num_free;
+  for (int32_t i = 0; i < num_free; i++)
+    cl->free_vars[i] = NULL_VAL;
+
+  return cl;
+}
+
+String closure_inspect(const Object *self) {
+  assert(self != NULL);
+  const Closure *cl = (const Closure *)self;
+  char buf[128];
+  snprintf(buf, sizeof(buf), "Closure[%s]",
+           cl->fn->name.length > 0 ? cl->fn->name.chars : "anonymous");
+
+  return String_from(buf);
+}
+
+// the closure does not own its function, that belongs to the constant pool
+void closure_finalize(Object *self) {
+  assert(self != NULL);
+
+  Closure *cl = (Closure *)self;
+  free_memo_table(cl->memo);
+}
+
+void closure_trace(Object *self, Heap *heap) {
+  Closure *cl = (Closure *)self;
+  for (int32_t i = 0; i < cl->num_free; i++)
+    gc_visit_value(heap, &cl->free_vars[i]);
+  // the table is created and updated in place by calls
+  if (cl->fn->memoize && gc_defer_trace(heap, self))
+    return;
+  if (cl->memo != NULL)
+    memo_trace(cl->memo, heap);
+}
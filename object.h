@@ -0,0 +1,177 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cstring.h/cstring.h"
+
+#include "code.h"
+
+typedef enum ValueType {
+  VAL_NULL,
+  VAL_BOOL,
+  VAL_INT,
+  VAL_BUILTIN,
+  VAL_OBJ,
+} ValueType;
+
+typedef struct Object Object;
+
+// Runtime value, small values are stored inline and only heap values are
+// reached through `as.obj`
+typedef struct Value {
+  ValueType type;
+  union {
+    bool boolean;
+    int64_t integer;
+    // index into the builtins table
+    int32_t builtin;
+    Object *obj;
+  } as;
+} Value;
+
+#define NULL_VAL ((Value){VAL_NULL, {.integer = 0}})
+#define BOOL_VAL(b) ((Value){VAL_BOOL, {.boolean = (b)}})
+#define INT_VAL(i) ((Value){VAL_INT, {.integer = (i)}})
+#define BUILTIN_VAL(i) ((Value){VAL_BUILTIN, {.builtin = (i)}})
+#define OBJ_VAL(o) ((Value){VAL_OBJ, {.obj = (Object *)(o)}})
+
+#define IS_NULL(v) ((v).type == VAL_NULL)
+#define IS_BOOL(v) ((v).type == VAL_BOOL)
+#define IS_INT(v) ((v).type == VAL_INT)
+#define IS_BUILTIN(v) ((v).type == VAL_BUILTIN)
+#define IS_OBJ(v) ((v).type == VAL_OBJ)
+
+bool value_is_truthy(Value);
+bool value_equals(Value, Value);
+// hash consistent with value_equals
+uint32_t value_hash(Value);
+String value_inspect(Value);
+const char *value_type_name(Value);
+
+typedef enum ObjectType {
+  OBJ_FUNCTION,
+  OBJ_CLOSURE,
+  OBJ_BIGINT,
+  OBJ_STRING,
+  OBJ_ARRAY,
+  OBJ_MAP,
+} ObjectType;
+
+struct Heap;
+
+typedef struct ObjectVT {
+  ObjectType _t;
+  String (*inspect)(const Object *self);
+  // releases what the object owns but not the object itself, can be NULL
+  void (*finalize)(Object *self);
+  // visits every value slot the object holds, NULL for leaf objects
+  void (*trace)(Object *self, struct Heap *heap);
+} ObjectVT;
+
+// Abstract heap object super-class/parent
+struct Object {
+  const ObjectVT *vt;
+  // intrusive list of every object owned by a heap
+  Object *next;
+  // allocation size in bytes
+  uint32_t size;
+  // free list the storage goes back to, see gc.h
+  uint8_t size_class;
+  bool marked;
+  // minor collections survived
+  uint8_t age;
+  // on the heap's remembered set
+  bool remembered;
+};
+
+#define IS_OBJ_TYPE(v, t) (IS_OBJ(v) && (v).as.obj->vt->_t == (t))
+
+// ValuesArray impl start ---
+typedef struct ValuesArray {
+  int32_t capacity;
+  int32_t size;
+  Value *data;
+} ValuesArray;
+
+ValuesArray values_array_init(int32_t capacity);
+// realloc the arena and push the data
+int32_t values_push(ValuesArray *, Value data);
+bool values_reserve(ValuesArray *, int32_t new_capacity);
+Value values_get(const ValuesArray *, int32_t index);
+// frees every unmanaged object stored in the array
+void free_values(ValuesArray *);
+// ValuesArray impl end ---
+
+// compiled body of a `fn` literal, stored in the constant pool
+typedef struct CompiledFunction {
+  Object base;
+  Instructions instructions;
+  int32_t num_locals;
+  int32_t num_parameters;
+  // name of the let binding the literal was bound to, can be empty
+  String name;
+  // set for `@memo` functions the compiler proved pure
+  bool memoize;
+  // the compiler proved the body free of side effects
+  bool pure;
+  // bit i is set unless the compiler proved parameter i never outlives a
+  // call, parameters past the width of the mask always escape
+  uint32_t escaping_parameters;
+  // deepest the stack goes above the locals, -1 until bytecode_verify
+  // passed the function
+  int32_t max_stack;
+  // free variables the code reads, set by bytecode_verify. A closure of a
+  // verified function capturing fewer still runs checked.
+  int32_t free_reads;
+  // calls counted towards the JIT threshold, -1 once compiling failed
+  int32_t calls;
+  // backward jumps taken in the interpreter, counted towards the OSR
+  // threshold
+  int32_t back_edges;
+  // machine code of the function, NULL until it gets hot
+  struct JitCode *native;
+  // body of a function of the closure tier, which has no instructions.
+  // Owned by its TreeProgram.
+  struct TreeNode *tree;
+} CompiledFunction;
+
+// unmanaged, the function is owned by whoever holds the constant pool
+CompiledFunction *compiled_function_new(Instructions instructions,
+                                        int32_t num_locals,
+                                        int32_t num_parameters, String name);
+String compiled_function_inspect(const Object *self);
+void compiled_function_finalize(Object *self);
+
+static const ObjectVT COMPILED_FUNCTION_VT = {
+    ._t = OBJ_FUNCTION,
+    .inspect = compiled_function_inspect,
+    .finalize = compiled_function_finalize,
+    .trace = NULL,
+};
+
+// a compiled function together with the values it captured
+typedef struct Closure {
+  Object base;
+  CompiledFunction *fn;
+  // cached results, created on the first call of a memoized function
+  struct MemoTable *memo;
+  int32_t num_free;
+  Value free_vars[];
+} Closure;
+
+Closure *closure_new(struct Heap *heap, CompiledFunction *fn,
+                     int32_t num_free);
+String closure_inspect(const Object *self);
+void closure_finalize(Object *self);
+void closure_trace(Object *self, struct Heap *heap);
+
+static const ObjectVT CLOSURE_VT = {
+    ._t = OBJ_CLOSURE,
+    .inspect = closure_inspect,
+    .finalize = closure_finalize,
+    .trace = closure_trace,
+};
+
+#endif // !OBJECT_H
@@ -0,0 +1,400 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "bigint.h"
+#include "builtins.h"
+#include "gc.h"
+#include "map.h"
+#include "parallel.h"
+#include "pool.h"
+#include "rope.h"
+#include "shape.h"
+#include "vm.h"
+
+#include "cstring.h/cstring.h"
+
+// ranges a job is split into per worker at most, enough for the idle ones
+// to steal from the busy ones without paying for a split per element
+#define PARALLEL_RANGES_PER_WORKER 8
+
+static Value copy_value(Heap *heap, ShapeTable *shapes, Value value);
+
+static void push_roots(Heap *heap, Value *slots, int32_t count) {
+  for (int32_t i = 0; i < count; i++) {
+    slots[i] = NULL_VAL;
+    heap_push_root(heap, &slots[i]);
+  }
+}
+
+static void pop_roots(Heap *heap, int32_t count) {
+  for (int32_t i = 0; i < count; i++)
+    heap_pop_root(heap);
+}
+
+// `count` values copied into `slots`, which stay roots until the caller
+// built the object holding them and pops them
+static void copy_rooted(Heap *heap, ShapeTable *shapes, const Value *values,
+                        int32_t count, Value *slots) {
+  push_roots(heap, slots, count);
+  for (int32_t i = 0; i < count; i++)
+    slots[i] = copy_value(heap, shapes, values[i]);
+}
+
+// the length was fine for the array the items came from
+static void new_array(Heap *heap, const Value *items, int32_t length,
+                      Value *out) {
+  bool built = array_new(heap, items, length, out);
+  assert(built);
+  (void)built;
+}
+
+static Value copy_array(Heap *heap, ShapeTable *shapes, ArrayObject *src) {
+  Value *items = malloc(sizeof(Value) * (src->length > 0 ? src->length : 1));
+  assert(items != NULL);
+  Value out;
+  if (src->packed) {
+    for (int32_t i = 0; i < src->length; i++)
+      items[i] = INT_VAL(array_ints(src)[i]);
+    new_array(heap, items, src->length, &out);
+  } else {
+    copy_rooted(heap, shapes, array_values(src), src->length, items);
+    new_array(heap, items, src->length, &out);
+    pop_roots(heap, src->length);
+  }
+  free(items);
+  return out;
+}
+
+static Value copy_map(Heap *heap, ShapeTable *shapes, MapObject *src) {
+  Value *pairs =
+      malloc(sizeof(Value) * 2 * (src->count > 0 ? src->count : 1));
+  assert(pairs != NULL);
+  push_roots(heap, pairs, 2 * src->count);
+  for (int32_t i = 0; i < src->count; i++) {
+    if (src->shape != NULL) {
+      const ShapeKey *key = &src->shape->keys[i];
+      pairs[2 * i] = OBJ_VAL(string_new(heap, key->chars, key->length));
+      pairs[2 * i + 1] = copy_value(heap, shapes, map_fields(src)[i]);
+    } else {
+      pairs[2 * i] = copy_value(heap, shapes, map_entries(src)[i].key);
+      pairs[2 * i + 1] = copy_value(heap, shapes, map_entries(src)[i].value);
+    }
+  }
+
+  Value out;
+  bool built = map_new(heap, shapes, pairs, src->count, &out);
+  assert(built);
+  (void)built;
+  pop_roots(heap, 2 * src->count);
+  free(pairs);
+  return out;
+}
+
+static Value copy_closure(Heap *heap, ShapeTable *shapes, Closure *src) {
+  Value *free_vars = malloc(sizeof(Value) * (src->num_free + 1));
+  assert(free_vars != NULL);
+  copy_rooted(heap, shapes, src->free_vars, src->num_free, free_vars);
+
+  // the function is a constant shared by every VM, the memo table is not
+  Closure *cl = closure_new(heap, src->fn, src->num_free);
+  for (int32_t i = 0; i < src->num_free; i++) {
+    cl->free_vars[i] = free_vars[i];
+    gc_write_barrier(heap, &cl->base, free_vars[i]);
+  }
+
+  pop_roots(heap, src->num_free);
+  free(free_vars);
+  return OBJ_VAL(cl);
+}
+
+// Deep copy of `value` on `heap`, which may belong to another VM on another
+// thread. The source is only read, its heap must not run meanwhile. Values
+// are immutable so the copy is as good as the original, objects shared in
+// the source are copied once per reference.
+static Value copy_value(Heap *heap, ShapeTable *shapes, Value value) {
+  if (!IS_OBJ(value) || value.as.obj->size_class == GC_UNMANAGED)
+    return value;
+
+  Object *obj = value.as.obj;
+  switch (obj->vt->_t) {
+  case OBJ_BIGINT: {
+    const BigInt *src = (const BigInt *)obj;
+    BigInt *big = (BigInt *)object_alloc(
+        heap, &BIGINT_VT, sizeof(BigInt) + sizeof(uint32_t) * src->size);
+    big->negative = src->negative;
+    big->size = src->size;
+    memcpy(big->limbs, src->limbs, sizeof(uint32_t) * src->size);
+    return OBJ_VAL(big);
+  }
+  case OBJ_STRING: {
+    const StringObject *src = (const StringObject *)obj;
+    // flattening would write to the source
+    char *chars = malloc((size_t)src->length + 1);
+    assert(chars != NULL);
+    string_copy_chars(src, chars);
+    StringObject *str = string_new(heap, chars, src->length);
+    free(chars);
+    return OBJ_VAL(str);
+  }
+  case OBJ_ARRAY:
+    return copy_array(heap, shapes, (ArrayObject *)obj);
+  case OBJ_MAP:
+    return copy_map(heap, shapes, (MapObject *)obj);
+  case OBJ_CLOSURE:
+    return copy_closure(heap, shapes, (Closure *)obj);
+  case OBJ_FUNCTION:
+    // functions are constants, unmanaged and handled above
+    break;
+  }
+  assert(false && "object type without a copy");
+  return NULL_VAL;
+}
+
+bool parallel_fn_is_pure(Value fn) {
+  if (IS_BUILTIN(fn))
+    return builtin_get(fn.as.builtin)->pure;
+  return IS_OBJ_TYPE(fn, OBJ_CLOSURE) && ((Closure *)fn.as.obj)->fn->pure;
+}
+
+static bool check_arguments(VM *vm, const char *name, Value array, Value fn) {
+  if (!IS_ARRAY(array))
+    return vm_error(vm, "first argument to %s must be ARRAY, got %s", name,
+                    value_type_name(array));
+  if (!IS_BUILTIN(fn) && !IS_OBJ_TYPE(fn, OBJ_CLOSURE))
+    return vm_error(vm, "function argument to %s must be a function, got %s",
+                    name, value_type_name(fn));
+  if (!parallel_fn_is_pure(fn))
+    return vm_error(vm, "function passed to %s is not pure", name);
+  return true;
+}
+
+// worker VM running the ranges of one job on one thread
+typedef struct ParallelWorker {
+  VM *vm;
+  // copy of the mapped or folded function on the worker heap
+  Value fn;
+} ParallelWorker;
+
+typedef struct ParallelJob {
+  VM *vm;
+  ArrayObject *array;
+  Value fn;
+  bool reduce;
+  // indexed by pool worker, created by the first range a worker runs
+  ParallelWorker *workers;
+  // a map leaves the result of every element here, a reduce the fold of
+  // each range at the index it starts at. The values live on the heap of
+  // the worker that made them, which keeps them as roots.
+  Value *results;
+  // end of the range starting at each index, set by a reduce
+  int32_t *ends;
+
+  pthread_mutex_t lock;
+  // first runtime error of a worker
+  String error;
+} ParallelJob;
+
+static ParallelWorker *job_worker(ParallelJob *job, int32_t index) {
+  ParallelWorker *worker = &job->workers[index];
+  if (worker->vm != NULL)
+    return worker;
+
+  VM *vm = VM_new_worker(job->vm);
+  // the only globals a pure function can read are pure functions
+  for (int32_t i = 0; i < vm->num_globals; i++) {
+    Value global = job->vm->globals[i];
+    if (IS_OBJ_TYPE(global, OBJ_CLOSURE) && parallel_fn_is_pure(global))
+      vm->globals[i] = copy_value(vm->heap, vm->shapes, global);
+  }
+  worker->fn = copy_value(vm->heap, vm->shapes, job->fn);
+  heap_push_root(vm->heap, &worker->fn);
+  worker->vm = vm;
+  return worker;
+}
+
+static bool job_failed(ParallelJob *job, const VM *vm) {
+  pthread_mutex_lock(&job->lock);
+  if (job->error.chars == NULL)
+    job->error = String_from(vm->error.chars);
+  pthread_mutex_unlock(&job->lock);
+  return false;
+}
+
+static bool run_range(void *ctx, int32_t index, int32_t start, int32_t end) {
+  ParallelJob *job = ctx;
+  ParallelWorker *worker = job_worker(job, index);
+  VM *vm = worker->vm;
+
+  if (!job->reduce) {
+    for (int32_t i = start; i < end; i++) {
+      Value x = copy_value(vm->heap, vm->shapes, array_get(job->array, i));
+      if (!vm_call(vm, worker->fn, &x, 1, &job->results[i]))
+        return job_failed(job, vm);
+      heap_push_root(vm->heap, &job->results[i]);
+    }
+    return true;
+  }
+
+  Value acc = copy_value(vm->heap, vm->shapes, array_get(job->array, start));
+  heap_push_root(vm->heap, &acc);
+  for (int32_t i = start + 1; i < end; i++) {
+    Value x = copy_value(vm->heap, vm->shapes, array_get(job->array, i));
+    Value args[2] = {acc, x};
+    if (!vm_call(vm, worker->fn, args, 2, &acc)) {
+      heap_pop_root(vm->heap);
+      return job_failed(job, vm);
+    }
+  }
+  heap_pop_root(vm->heap);
+
+  job->results[start] = acc;
+  heap_push_root(vm->heap, &job->results[start]);
+  job->ends[start] = end;
+  return true;
+}
+
+// pool of the VM, NULL when the work stays on the calling thread
+static WorkPool *job_pool(VM *vm, int32_t length) {
+  if (length < vm->parallel_min_length || length < 2)
+    return NULL;
+  if (vm->pool == NULL) {
+    int32_t workers = vm->parallel_workers > 0 ? vm->parallel_workers
+                                               : pool_core_count();
+    if (workers > POOL_MAX_WORKERS)
+      workers = POOL_MAX_WORKERS;
+    if (workers < 2)
+      return NULL;
+    vm->pool = WorkPool_new(workers);
+  }
+  return vm->pool;
+}
+
+// runs `job` on the pool, false after recording the first worker error
+static bool run_job(VM *vm, WorkPool *pool, ParallelJob *job) {
+  int32_t length = job->array->length;
+  job->workers = calloc(pool->num_workers, sizeof(ParallelWorker));
+  job->results = malloc(sizeof(Value) * length);
+  job->ends = calloc(length, sizeof(int32_t));
+  assert(job->workers != NULL && job->results != NULL && job->ends != NULL);
+  pthread_mutex_init(&job->lock, NULL);
+  job->error = STR_NULL;
+
+  int32_t grain = length / (pool->num_workers * PARALLEL_RANGES_PER_WORKER);
+  if (work_pool_run(pool, length, grain > 0 ? grain : 1, run_range, job))
+    return true;
+  vm_error(vm, "%s", job->error.chars);
+  return false;
+}
+
+static void free_job(ParallelJob *job, int32_t num_workers) {
+  for (int32_t i = 0; i < num_workers; i++)
+    free_vm(job->workers[i].vm);
+  free(job->workers);
+  free(job->results);
+  free(job->ends);
+  pthread_mutex_destroy(&job->lock);
+  free_string(&job->error);
+}
+
+static bool map_here(VM *vm, Value array, Value fn, Value *out) {
+  int32_t length = ((ArrayObject *)array.as.obj)->length;
+  heap_push_root(vm->heap, &array);
+  heap_push_root(vm->heap, &fn);
+  Value *items = malloc(sizeof(Value) * (length > 0 ? length : 1));
+  assert(items != NULL);
+  push_roots(vm->heap, items, length);
+
+  bool ok = true;
+  for (int32_t i = 0; i < length && ok; i++) {
+    Value x = array_get((ArrayObject *)array.as.obj, i);
+    ok = vm_call(vm, fn, &x, 1, &items[i]);
+  }
+  if (ok)
+    new_array(vm->heap, items, length, out);
+
+  pop_roots(vm->heap, length + 2);
+  free(items);
+  return ok;
+}
+
+bool parallel_map(VM *vm, Value array, Value fn, Value *out) {
+  assert(vm != NULL);
+  if (!check_arguments(vm, "pmap", array, fn))
+    return false;
+  int32_t length = ((ArrayObject *)array.as.obj)->length;
+  WorkPool *pool = job_pool(vm, length);
+  if (pool == NULL)
+    return map_here(vm, array, fn, out);
+
+  ParallelJob job = {.vm = vm,
+                     .array = (ArrayObject *)array.as.obj,
+                     .fn = fn,
+                     .reduce = false};
+  bool ok = run_job(vm, pool, &job);
+  if (ok) {
+    // the workers are done, their heaps are only read from here on
+    Value *items = malloc(sizeof(Value) * length);
+    assert(items != NULL);
+    copy_rooted(vm->heap, vm->shapes, job.results, length, items);
+    new_array(vm->heap, items, length, out);
+    pop_roots(vm->heap, length);
+    free(items);
+  }
+
+  free_job(&job, pool->num_workers);
+  return ok;
+}
+
+static bool reduce_here(VM *vm, Value array, Value init, Value fn,
+                        Value *out) {
+  int32_t length = ((ArrayObject *)array.as.obj)->length;
+  heap_push_root(vm->heap, &array);
+  heap_push_root(vm->heap, &fn);
+  Value acc = init;
+  heap_push_root(vm->heap, &acc);
+
+  bool ok = true;
+  for (int32_t i = 0; i < length && ok; i++) {
+    Value args[2] = {acc, array_get((ArrayObject *)array.as.obj, i)};
+    ok = vm_call(vm, fn, args, 2, &acc);
+  }
+  *out = acc;
+
+  pop_roots(vm->heap, 3);
+  return ok;
+}
+
+bool parallel_reduce(VM *vm, Value array, Value init, Value fn, Value *out) {
+  assert(vm != NULL);
+  if (!check_arguments(vm, "preduce", array, fn))
+    return false;
+  int32_t length = ((ArrayObject *)array.as.obj)->length;
+  WorkPool *pool = job_pool(vm, length);
+  if (pool == NULL)
+    return reduce_here(vm, array, init, fn, out);
+
+  ParallelJob job = {.vm = vm,
+                     .array = (ArrayObject *)array.as.obj,
+                     .fn = fn,
+                     .reduce = true};
+  bool ok = run_job(vm, pool, &job);
+  if (ok) {
+    // the folds of the ranges are folded into `init` in array order
+    heap_push_root(vm->heap, &fn);
+    Value acc = init;
+    heap_push_root(vm->heap, &acc);
+    for (int32_t i = 0; i < length && ok; i = job.ends[i]) {
+      Value part = copy_value(vm->heap, vm->shapes, job.results[i]);
+      Value args[2] = {acc, part};
+      ok = vm_call(vm, fn, args, 2, &acc);
+    }
+    *out = acc;
+    pop_roots(vm->heap, 2);
+  }
+
+  free_job(&job, pool->num_workers);
+  return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+
+struct VM;
+
+// fn(x) for every element x of `array`, in order. `fn` has to be pure: long
+// arrays are split over the threads of the VM pool, each running its part
+// in a worker VM with its own heap on copies of the elements, and the
+// results are copied back. False after recording a runtime error.
+bool parallel_map(struct VM *vm, Value array, Value fn, Value *out);
+
+// folds the elements of `array` into `init` with fn(acc, x). The parts run
+// on the pool fold their elements starting from the first one and are then
+// folded into `init` in order, so `fn` has to be pure and associative.
+bool parallel_reduce(struct VM *vm, Value array, Value init, Value fn,
+                     Value *out);
+
+// `fn` runs without side effects, so calls to it may run on any thread
+bool parallel_fn_is_pure(Value fn);
+
+#endif // !PARALLEL_H
@@ -29,6 +29,8 @@ Precedence precedence_map(TokenType tt) {
     return PREC_PRODUCT;
   case TOKEN_LPAREN:
     return PREC_FN_CALL;
+  case TOKEN_LBRACKET:
+    return PREC_INDEX;
 
   default:
     return PREC_INVALID;
@@ -91,14 +93,19 @@ Parser *Parser_new(Lexer *l) {
   register_prefix(p, TOKEN_IDENT, (PrefixParseFn)parse_identifier);
   register_prefix(p, TOKEN_IF, (PrefixParseFn)parse_if_expression);
   register_prefix(p, TOKEN_INT, (PrefixParseFn)parse_int_expr);
+  register_prefix(p, TOKEN_STRING, (PrefixParseFn)parse_string_expr);
   register_prefix(p, TOKEN_LPAREN, (PrefixParseFn)parse_grouped_expression);
   register_prefix(p, TOKEN_TRUE, (PrefixParseFn)parse_boolean_expression);
   register_prefix(p, TOKEN_FALSE, (PrefixParseFn)parse_boolean_expression);
   register_prefix(p, TOKEN_BANG, (PrefixParseFn)parse_prefix_expression);
   register_prefix(p, TOKEN_MINUS, (PrefixParseFn)parse_prefix_expression);
   register_prefix(p, TOKEN_PLUS, (PrefixParseFn)parse_prefix_expression);
+  register_prefix(p, TOKEN_AT, (PrefixParseFn)parse_annotated_expression);
+  register_prefix(p, TOKEN_LBRACKET, (PrefixParseFn)parse_array_expression);
+  register_prefix(p, TOKEN_LBRACE, (PrefixParseFn)parse_map_expression);
 
   register_infix(p, TOKEN_LPAREN, (InfixParseFn)parse_call_expression);
+  register_infix(p, TOKEN_LBRACKET, (InfixParseFn)parse_index_expression);
   register_infix(p, TOKEN_IDENT, (InfixParseFn)parse_infix_expression);
   register_infix(p, TOKEN_INT, (InfixParseFn)parse_infix_expression);
   register_infix(p, TOKEN_PLUS, (InfixParseFn)parse_infix_expression);
@@ -190,6 +197,9 @@ Statement *parse_statement(Parser *self) {
   case TOKEN_RETURN:
     return (Statement *)parse_return_statement(self);
 
+  case TOKEN_FOR:
+    return (Statement *)parse_for_statement(self);
+
   default:
     return (Statement *)parse_expression_statement(self);
   }
@@ -270,6 +280,77 @@ LetStatement *parse_let_statement(Parser *self) {
 
   return let_st;
 }
+static ForStatement *abandon_for_statement(ForStatement *for_st) {
+  for_statement_destroy((Node *)for_st);
+  return NULL;
+}
+
+// `name in start..end`, the current token is the name
+static bool parse_for_range(Parser *self, ForStatement *for_st) {
+  for_st->variable = ident_new(Token_clone(&self->curr_token),
+                               String_clone(&self->curr_token.literal));
+  parser_next_token(self);
+  parser_next_token(self);
+
+  for_st->start = parse_expression(self, PREC_LOWEST);
+  if (!expect_peek(self, TOKEN_RANGE))
+    return false;
+  parser_next_token(self);
+
+  for_st->end = parse_expression(self, PREC_LOWEST);
+  return expect_peek(self, TOKEN_RPAREN);
+}
+
+// `init; condition; update`, the current token starts the init clause
+static bool parse_for_clauses(Parser *self, ForStatement *for_st) {
+  if (!is_parser_curr_token(self, TOKEN_SEMICOLON)) {
+    // a statement stops on its trailing semicolon when it has one
+    for_st->init = parse_statement(self);
+    if (!is_parser_curr_token(self, TOKEN_SEMICOLON) &&
+        !expect_peek(self, TOKEN_SEMICOLON))
+      return false;
+  }
+  parser_next_token(self);
+
+  if (!is_parser_curr_token(self, TOKEN_SEMICOLON)) {
+    for_st->condition = parse_expression(self, PREC_LOWEST);
+    if (!expect_peek(self, TOKEN_SEMICOLON))
+      return false;
+  }
+  parser_next_token(self);
+
+  if (!is_parser_curr_token(self, TOKEN_RPAREN)) {
+    for_st->update = parse_statement(self);
+    if (!expect_peek(self, TOKEN_RPAREN))
+      return false;
+  }
+  return true;
+}
+
+ForStatement *parse_for_statement(Parser *self) {
+  assert(self != NULL);
+  ForStatement *for_st = for_statement_new(Token_clone(&self->curr_token));
+
+  if (!expect_peek(self, TOKEN_LPAREN)) {
+    return abandon_for_statement(for_st);
+  }
+  parser_next_token(self);
+
+  bool is_range = is_parser_curr_token(self, TOKEN_IDENT) &&
+                  is_parser_peek_token(self, TOKEN_IN);
+  if (!(is_range ? parse_for_range(self, for_st)
+                 : parse_for_clauses(self, for_st))) {
+    return abandon_for_statement(for_st);
+  }
+
+  if (!expect_peek(self, TOKEN_LBRACE)) {
+    return abandon_for_statement(for_st);
+  }
+  for_st->body = parse_block_statement(self);
+
+  return for_st;
+}
+
 Identifier *parse_identifier(Parser *self) {
   assert(self != NULL);
 
@@ -379,10 +460,38 @@ ExpressionStatement *parse_expression_statement(Parser *self) {
   return stmt;
 }
 
+// returns false when the digits are not a number or overflow int64_t
+static bool parse_int64(const String *digits, int64_t *out) {
+  if (digits->length == 0)
+    return false;
+
+  int64_t value = 0;
+  for (int32_t i = 0; i < digits->length; i++) {
+    char ch = digits->chars[i];
+    if (ch < '0' || ch > '9')
+      return false;
+    if (__builtin_mul_overflow(value, 10, &value) ||
+        __builtin_add_overflow(value, ch - '0', &value))
+      return false;
+  }
+
+  *out = value;
+  return true;
+}
+
+static bool is_digits(const String *str) {
+  for (int32_t i = 0; i < str->length; i++) {
+    if (str->chars[i] < '0' || str->chars[i] > '9')
+      return false;
+  }
+  return str->length > 0;
+}
+
 IntExpr *parse_int_expr(Parser *self) {
-  int32_t value;
-  bool is_success = String_to_int(&self->curr_token.literal, &value);
-  if (!is_success) {
+  int64_t value = 0;
+  bool is_success = parse_int64(&self->curr_token.literal, &value);
+  bool is_big = !is_success && is_digits(&self->curr_token.literal);
+  if (!is_success && !is_big) {
     String error_str = String_join(
         2, String_from("ERROR: converting string to int for value: "),
         &self->curr_token.literal);
@@ -391,10 +500,16 @@ IntExpr *parse_int_expr(Parser *self) {
     return NULL;
   }
   IntExpr *int_expr = int_expr_new(Token_clone(&self->curr_token), value);
+  int_expr->is_big = is_big;
 
   return int_expr;
 }
 
+StringExpr *parse_string_expr(Parser *self) {
+  assert(self != NULL);
+  return string_expr_new(Token_clone(&self->curr_token));
+}
+
 Expression *parse_grouped_expression(Parser *self) {
   assert(self != NULL);
 
@@ -525,6 +640,33 @@ FnExpression *parse_func_expression(Parser *self) {
   return fn_expr;
 }
 
+// `@memo fn(...) {...}`, the only annotation so far
+FnExpression *parse_annotated_expression(Parser *self) {
+  assert(self != NULL);
+
+  if (!expect_peek(self, TOKEN_IDENT)) {
+    return NULL;
+  }
+
+  String memo = STR_NEW("memo");
+  if (!String_cmp(&self->curr_token.literal, &memo)) {
+    String prefix = STR_NEW("Parser error: unknown annotation @");
+    push_error(self, String_join(2, &prefix, &self->curr_token.literal));
+    return NULL;
+  }
+
+  if (!expect_peek(self, TOKEN_FUNCTION)) {
+    return NULL;
+  }
+
+  FnExpression *fn_expr = parse_func_expression(self);
+  if (fn_expr != NULL) {
+    fn_expr->memoize = true;
+  }
+
+  return fn_expr;
+}
+
 CallExpression *parse_call_expression(Parser *self, Expression *left) {
   assert(self != NULL);
   assert(left != NULL);
@@ -539,17 +681,21 @@ CallExpression *parse_call_expression(Parser *self, Expression *left) {
 }
 
 ExpressionsArray parse_argument_list(Parser *self) {
+  return parse_expression_list(self, TOKEN_RPAREN);
+}
+
+ExpressionsArray parse_expression_list(Parser *self, TokenType end) {
   assert(self != NULL);
-  if (is_parser_peek_token(self, TOKEN_RPAREN)) {
+  if (is_parser_peek_token(self, end)) {
     parser_next_token(self);
     return expressions_array_init(0);
   }
   ExpressionsArray expr_arr = expressions_array_init(0);
 
-  // move to the first arguement expr token
+  // move to the first expression token
   parser_next_token(self);
 
-  // push the first argument expression
+  // push the first expression
   expressions_push(&expr_arr, parse_expression(self, PREC_LOWEST));
   while (is_parser_peek_token(self, TOKEN_COMMA)) {
     parser_next_token(self);
@@ -557,12 +703,64 @@ ExpressionsArray parse_argument_list(Parser *self) {
     expressions_push(&expr_arr, parse_expression(self, PREC_LOWEST));
   }
 
-  if (!expect_peek(self, TOKEN_RPAREN)) {
-    push_error(self, String_from("Parser error: expected "
-                                 "TOKEN_RPAREN"));
+  if (!expect_peek(self, end)) {
+    String prefix = STR_NEW("Parser error: expected ");
+    String expected = STR_NEW(token_type_to_string(end));
+    push_error(self, String_join(2, &prefix, &expected));
     free_expressions(&expr_arr);
     return expressions_array_init(0);
   }
 
   return expr_arr;
 }
+
+ArrayExpression *parse_array_expression(Parser *self) {
+  assert(self != NULL);
+  Token token = Token_clone(&self->curr_token);
+
+  return array_expr_new(token, parse_expression_list(self, TOKEN_RBRACKET));
+}
+
+MapExpression *parse_map_expression(Parser *self) {
+  assert(self != NULL);
+  MapExpression *map_expr =
+      map_expr_new(Token_clone(&self->curr_token), expressions_array_init(0),
+                   expressions_array_init(0));
+
+  while (!is_parser_peek_token(self, TOKEN_RBRACE)) {
+    parser_next_token(self);
+    expressions_push(&map_expr->keys, parse_expression(self, PREC_LOWEST));
+    if (!expect_peek(self, TOKEN_COLON)) {
+      map_expr_destroy((Node *)map_expr);
+      return NULL;
+    }
+
+    parser_next_token(self);
+    expressions_push(&map_expr->values, parse_expression(self, PREC_LOWEST));
+    if (!is_parser_peek_token(self, TOKEN_RBRACE) &&
+        !expect_peek(self, TOKEN_COMMA)) {
+      map_expr_destroy((Node *)map_expr);
+      return NULL;
+    }
+  }
+
+  parser_next_token(self);
+  return map_expr;
+}
+
+IndexExpression *parse_index_expression(Parser *self, Expression *left) {
+  assert(self != NULL);
+  assert(left != NULL);
+  IndexExpression *index_expr =
+      index_expr_new(Token_clone(&self->curr_token), left, NULL);
+
+  parser_next_token(self);
+  index_expr->index = parse_expression(self, PREC_LOWEST);
+
+  if (!expect_peek(self, TOKEN_RBRACKET)) {
+    index_expr_destroy((Node *)index_expr);
+    return NULL;
+  }
+
+  return index_expr;
+}
@@ -16,6 +16,7 @@ typedef enum Precedence {
   PREC_PRODUCT,     // *
   PREC_PREFIX,      // -X or !X
   PREC_FN_CALL,     // someFunction(X)
+  PREC_INDEX,       // array[index]
 } Precedence;
 
 Precedence precedence_map(TokenType);
@@ -65,9 +66,11 @@ Identifier *parse_identifier(Parser *self);
 Statement *parse_if_statement(Parser *self);
 IfExpression *parse_if_expression(Parser *self);
 ReturnStatement *parse_return_statement(Parser *self);
+ForStatement *parse_for_statement(Parser *self);
 Expression *parse_expression(Parser *self, Precedence prec);
 OperatorExpr *parse_operator_expr(Parser *self);
 IntExpr *parse_int_expr(Parser *self);
+StringExpr *parse_string_expr(Parser *self);
 Expression *parse_grouped_expression(Parser *self);
 ExpressionStatement *parse_expression_statement(Parser *self);
 BooleanExpression *parse_boolean_expression(Parser *self);
@@ -75,10 +78,16 @@ BlockStatement *parse_block_statement(Parser *self);
 FnExpression *parse_func_expression(Parser *self);
 IdentifiersArray parse_func_parameters(Parser *self);
 PrefixExpression *parse_prefix_expression(Parser *self);
+FnExpression *parse_annotated_expression(Parser *self);
+ArrayExpression *parse_array_expression(Parser *self);
+MapExpression *parse_map_expression(Parser *self);
 
 // Infix Expressions
 CallExpression *parse_call_expression(Parser *self, Expression *left);
 ExpressionsArray parse_argument_list(Parser *self);
+// comma separated expressions up to the `end` token
+ExpressionsArray parse_expression_list(Parser *self, TokenType end);
+IndexExpression *parse_index_expression(Parser *self, Expression *left);
 InfixExpression *parse_infix_expression(Parser *self, Expression *left);
 
 #endif // !PARSER_H
@@ -0,0 +1,219 @@
+// sysconf(_SC_NPROCESSORS_ONLN), sched_yield, pthreads
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+static void deque_init(WorkDeque *self) {
+  pthread_mutex_init(&self->lock, NULL);
+  self->items = NULL;
+  self->top = 0;
+  self->bottom = 0;
+  self->capacity = 0;
+}
+
+static void free_deque(WorkDeque *self) {
+  pthread_mutex_destroy(&self->lock);
+  free(self->items);
+}
+
+static void deque_push(WorkDeque *self, WorkRange range) {
+  pthread_mutex_lock(&self->lock);
+  if (self->top == self->bottom) {
+    self->top = 0;
+    self->bottom = 0;
+  }
+  if (self->bottom == self->capacity) {
+    int32_t new_cap = self->capacity > 0 ? self->capacity * 2 : 32;
+    WorkRange *new_ptr = realloc(self->items, sizeof(WorkRange) * new_cap);
+    assert(new_ptr != NULL);
+    self->items = new_ptr;
+    self->capacity = new_cap;
+  }
+  self->items[self->bottom++] = range;
+  pthread_mutex_unlock(&self->lock);
+}
+
+// takes the range pushed last when `steal` is false, the oldest one
+// otherwise
+static bool deque_take(WorkDeque *self, bool steal, WorkRange *out) {
+  pthread_mutex_lock(&self->lock);
+  bool found = self->top < self->bottom;
+  if (found)
+    *out = steal ? self->items[self->top++] : self->items[--self->bottom];
+  pthread_mutex_unlock(&self->lock);
+  return found;
+}
+
+static bool find_work(WorkPool *self, int32_t worker, WorkRange *out) {
+  if (deque_take(&self->deques[worker], false, out))
+    return true;
+  for (int32_t i = 1; i < self->num_workers; i++) {
+    int32_t victim = (worker + i) % self->num_workers;
+    if (deque_take(&self->deques[victim], true, out)) {
+      __atomic_fetch_add(&self->steals, 1, __ATOMIC_RELAXED);
+      return true;
+    }
+  }
+  return false;
+}
+
+// runs ranges of the current job until none is left anywhere
+static void work(WorkPool *self, int32_t worker) {
+  WorkDeque *own = &self->deques[worker];
+  while (__atomic_load_n(&self->remaining, __ATOMIC_ACQUIRE) > 0) {
+    WorkRange range;
+    if (!find_work(self, worker, &range)) {
+      // the last ranges are still running elsewhere
+      sched_yield();
+      continue;
+    }
+
+    while (range.end - range.start > self->grain) {
+      int32_t middle = range.start + (range.end - range.start) / 2;
+      deque_push(own, (WorkRange){middle, range.end});
+      range.end = middle;
+    }
+
+    if (!__atomic_load_n(&self->cancelled, __ATOMIC_ACQUIRE) &&
+        !self->run(self->ctx, worker, range.start, range.end))
+      __atomic_store_n(&self->cancelled, true, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&self->remaining, range.end - range.start,
+                       __ATOMIC_ACQ_REL);
+  }
+}
+
+typedef struct WorkerStart {
+  WorkPool *pool;
+  int32_t worker;
+} WorkerStart;
+
+static void *worker_main(void *arg) {
+  WorkerStart start = *(WorkerStart *)arg;
+  free(arg);
+  WorkPool *self = start.pool;
+
+  uint64_t seen = 0;
+  pthread_mutex_lock(&self->lock);
+  for (;;) {
+    while (!self->shutdown && self->generation == seen)
+      pthread_cond_wait(&self->job_ready, &self->lock);
+    if (self->shutdown)
+      break;
+    seen = self->generation;
+    self->busy++;
+    pthread_mutex_unlock(&self->lock);
+
+    work(self, start.worker);
+
+    pthread_mutex_lock(&self->lock);
+    if (--self->busy == 0)
+      pthread_cond_broadcast(&self->job_done);
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  return NULL;
+}
+
+int32_t pool_core_count(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1)
+    return 1;
+  return cores > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : (int32_t)cores;
+}
+
+WorkPool *WorkPool_new(int32_t num_workers) {
+  assert(num_workers > 0 && num_workers <= POOL_MAX_WORKERS);
+  WorkPool *pool = malloc(sizeof(WorkPool));
+  assert(pool != NULL);
+
+  pool->num_workers = num_workers;
+  pool->deques = malloc(sizeof(WorkDeque) * num_workers);
+  assert(pool->deques != NULL);
+  for (int32_t i = 0; i < num_workers; i++)
+    deque_init(&pool->deques[i]);
+  pool->threads = malloc(sizeof(pthread_t) * num_workers);
+  assert(pool->threads != NULL);
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->job_ready, NULL);
+  pthread_cond_init(&pool->job_done, NULL);
+  pool->generation = 0;
+  pool->busy = 0;
+  pool->shutdown = false;
+  pool->run = NULL;
+  pool->ctx = NULL;
+  pool->grain = 1;
+  pool->remaining = 0;
+  pool->cancelled = false;
+  pool->steals = 0;
+
+  // worker 0 is whoever calls work_pool_run
+  for (int32_t i = 1; i < num_workers; i++) {
+    WorkerStart *start = malloc(sizeof(WorkerStart));
+    assert(start != NULL);
+    *start = (WorkerStart){pool, i};
+    if (pthread_create(&pool->threads[i], NULL, worker_main, start) != 0) {
+      free(start);
+      pool->num_workers = i;
+      free_work_pool(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+void free_work_pool(WorkPool *self) {
+  if (self == NULL)
+    return;
+
+  pthread_mutex_lock(&self->lock);
+  self->shutdown = true;
+  pthread_cond_broadcast(&self->job_ready);
+  pthread_mutex_unlock(&self->lock);
+  for (int32_t i = 1; i < self->num_workers; i++)
+    pthread_join(self->threads[i], NULL);
+
+  for (int32_t i = 0; i < self->num_workers; i++)
+    free_deque(&self->deques[i]);
+  free(self->deques);
+  free(self->threads);
+  pthread_mutex_destroy(&self->lock);
+  pthread_cond_destroy(&self->job_ready);
+  pthread_cond_destroy(&self->job_done);
+  free(self);
+}
+
+bool work_pool_run(WorkPool *self, int32_t length, int32_t grain,
+                   WorkRangeFn run, void *ctx) {
+  assert(self != NULL);
+  assert(length >= 0 && grain > 0);
+  if (length == 0)
+    return true;
+
+  pthread_mutex_lock(&self->lock);
+  self->run = run;
+  self->ctx = ctx;
+  self->grain = grain;
+  self->cancelled = false;
+  __atomic_store_n(&self->remaining, length, __ATOMIC_RELEASE);
+  deque_push(&self->deques[0], (WorkRange){0, length});
+  self->generation++;
+  pthread_cond_broadcast(&self->job_ready);
+  pthread_mutex_unlock(&self->lock);
+
+  work(self, 0);
+
+  // a helper may still be returning from its last range
+  pthread_mutex_lock(&self->lock);
+  while (self->busy > 0)
+    pthread_cond_wait(&self->job_done, &self->lock);
+  pthread_mutex_unlock(&self->lock);
+
+  return !self->cancelled;
+}
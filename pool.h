@@ -0,0 +1,78 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// upper bound on the workers of one pool, whatever the core count
+#define POOL_MAX_WORKERS 64
+
+// runs the items in [start, end) on worker `worker`, false cancels every
+// range that did not start yet
+typedef bool (*WorkRangeFn)(void *ctx, int32_t worker, int32_t start,
+                            int32_t end);
+
+typedef struct WorkRange {
+  int32_t start;
+  int32_t end;
+} WorkRange;
+
+// Ranges waiting to run. The owner pushes and pops at the bottom, the other
+// workers steal from the top, so a thief takes the oldest and largest range
+// while the owner keeps working on the part it split off last.
+typedef struct WorkDeque {
+  pthread_mutex_t lock;
+  WorkRange *items;
+  int32_t top;
+  int32_t bottom;
+  int32_t capacity;
+} WorkDeque;
+
+// Work-stealing scheduler with one deque per worker. The calling thread is
+// worker 0 and the others sleep on their own threads between jobs. A job is
+// a range of item indices that starts on the deque of worker 0. Whoever
+// holds a range larger than the grain splits it in halves and leaves the
+// upper half on its deque, so the work is split only as far as idle workers
+// come asking for it.
+typedef struct WorkPool {
+  int32_t num_workers;
+  WorkDeque *deques;
+  pthread_t *threads;
+
+  pthread_mutex_t lock;
+  pthread_cond_t job_ready;
+  pthread_cond_t job_done;
+  // bumped for every job, a worker joins each generation once
+  uint64_t generation;
+  // helper threads inside the current job
+  int32_t busy;
+  bool shutdown;
+
+  WorkRangeFn run;
+  void *ctx;
+  int32_t grain;
+  // items not run or skipped yet, the job is over at 0
+  int32_t remaining;
+  bool cancelled;
+
+  // ranges taken from the deque of another worker
+  uint64_t steals;
+} WorkPool;
+
+// pool of `num_workers` workers counting the caller, NULL when no thread
+// could be started
+WorkPool *WorkPool_new(int32_t num_workers);
+// waits for the helper threads to exit
+void free_work_pool(WorkPool *self);
+
+// online cores, at least 1
+int32_t pool_core_count(void);
+
+// calls `run` on ranges covering [0, length) until every item ran, ranges
+// are never longer than `grain` items. Returns false when a call returned
+// false, the ranges that had not started by then are skipped.
+bool work_pool_run(WorkPool *self, int32_t length, int32_t grain,
+                   WorkRangeFn run, void *ctx);
+
+#endif // !POOL_H
@@ -1,10 +1,17 @@
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "lexer.h"
 
+#include "aot.h"
+#include "compiler.h"
+#include "frozen.h"
+#include "fzc.h"
+#include "parser.h"
 #include "repl.h"
+#include "vm.h"
 
 const size_t BUF_SIZE = 1024;
 
@@ -27,3 +34,185 @@ void start_repl(void) {
     free_lexer(lx);
   }
 }
+
+// parser of the script at `path`, NULL when it cannot be read
+static Parser *parse_file(const char *path, Program **program) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("could not open file: %s\n", path);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char *source = malloc(length + 1);
+  assert(source != NULL);
+  size_t read = fread(source, 1, length, file);
+  source[read] = '\0';
+  fclose(file);
+
+  Parser *p = Parser_new(Lexer_new(String_from(source)));
+  free(source);
+  *program = parse_program(p);
+  return p;
+}
+
+// runs a program saved by compile_file_to_fzc
+static int run_fzc_file(const char *path) {
+  String error;
+  FrozenProgram *program = fzc_load(path, &error);
+  if (program == NULL) {
+    printf("load error: %s\n", error.chars);
+    free_string(&error);
+    return EXIT_FAILURE;
+  }
+
+  int status = EXIT_SUCCESS;
+  VM *vm = VM_new_frozen(program);
+  if (vm_run(vm) != VM_OK) {
+    printf("runtime error: %s\n", vm->error.chars);
+    status = EXIT_FAILURE;
+  }
+  free_vm(vm);
+  frozen_program_release(program);
+  return status;
+}
+
+int run_file(const char *path) {
+  if (fzc_is_file(path))
+    return run_fzc_file(path);
+
+  Program *program;
+  Parser *p = parse_file(path, &program);
+  if (p == NULL)
+    return EXIT_FAILURE;
+
+  if (p->errors.size != 0) {
+    print_errors(p);
+    free_program(program);
+    free_parser(p);
+    return EXIT_FAILURE;
+  }
+
+  int status = EXIT_SUCCESS;
+  Compiler *compiler = Compiler_new();
+  if (!compile_program(compiler, program)) {
+    print_string_array(&compiler->errors);
+    status = EXIT_FAILURE;
+  } else {
+    VM *vm = VM_new(compiler_bytecode(compiler));
+    if (vm_run(vm) != VM_OK) {
+      printf("runtime error: %s\n", vm->error.chars);
+      status = EXIT_FAILURE;
+    }
+    free_vm(vm);
+  }
+
+  free_compiler(compiler);
+  free_program(program);
+  free_parser(p);
+
+  return status;
+}
+
+int compile_file_to_c(const char *path, const char *out_path) {
+  Program *program;
+  Parser *p = parse_file(path, &program);
+  if (p == NULL)
+    return EXIT_FAILURE;
+
+  if (p->errors.size != 0) {
+    print_errors(p);
+    free_program(program);
+    free_parser(p);
+    return EXIT_FAILURE;
+  }
+
+  int status = EXIT_SUCCESS;
+  String code, error;
+  if (!aot_emit_c(program, path, &code, &error)) {
+    printf("compile error: %s\n", error.chars);
+    free_string(&error);
+    status = EXIT_FAILURE;
+  } else {
+    FILE *out = out_path != NULL ? fopen(out_path, "wb") : stdout;
+    if (out == NULL) {
+      printf("could not open file: %s\n", out_path);
+      status = EXIT_FAILURE;
+    } else {
+      fputs(code.chars, out);
+      if (out != stdout)
+        fclose(out);
+    }
+    free_string(&code);
+  }
+
+  free_program(program);
+  free_parser(p);
+
+  return status;
+}
+
+// the script at `path` compiled and frozen, NULL after printing its errors
+static FrozenProgram *freeze_file(const char *path) {
+  Program *program;
+  Parser *p = parse_file(path, &program);
+  if (p == NULL)
+    return NULL;
+
+  FrozenProgram *frozen = NULL;
+  if (p->errors.size != 0) {
+    print_errors(p);
+  } else {
+    Compiler *compiler = Compiler_new();
+    if (!compile_program(compiler, program))
+      print_string_array(&compiler->errors);
+    else
+      frozen = program_freeze(compiler, false);
+    free_compiler(compiler);
+  }
+
+  free_program(program);
+  free_parser(p);
+  return frozen;
+}
+
+int compile_file_to_fzc(const char *path, const char *out_path) {
+  FrozenProgram *program = freeze_file(path);
+  if (program == NULL)
+    return EXIT_FAILURE;
+
+  int status = EXIT_SUCCESS;
+  String error;
+  if (!fzc_write(program, out_path, &error)) {
+    printf("compile error: %s\n", error.chars);
+    free_string(&error);
+    status = EXIT_FAILURE;
+  }
+  frozen_program_release(program);
+  return status;
+}
+
+int disassemble_file(const char *path) {
+  FrozenProgram *program;
+  if (fzc_is_file(path)) {
+    String error;
+    program = fzc_load(path, &error);
+    if (program == NULL) {
+      printf("load error: %s\n", error.chars);
+      free_string(&error);
+    }
+  } else {
+    program = freeze_file(path);
+  }
+  if (program == NULL)
+    return EXIT_FAILURE;
+
+  String listing = fzc_disassemble(program);
+  printf("%s\n", listing.chars);
+  free_string(&listing);
+  frozen_program_release(program);
+  return EXIT_SUCCESS;
+}
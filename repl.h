@@ -6,4 +6,20 @@ String accept_input(void);
 
 void start_repl(void);
 
+// parses, compiles and runs the script at `path`, or runs the .fzc file at
+// `path`, returns the exit status
+int run_file(const char *path);
+
+// translates the script at `path` to C, written to `out_path` or to stdout
+// when it is NULL, returns the exit status
+int compile_file_to_c(const char *path, const char *out_path);
+
+// compiles the script at `path` to the .fzc file `out_path`, returns the
+// exit status
+int compile_file_to_fzc(const char *path, const char *out_path);
+
+// prints the bytecode of the script or .fzc file at `path`, returns the
+// exit status
+int disassemble_file(const char *path);
+
 #endif // !REPL_H
@@ -0,0 +1,289 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc.h"
+#include "object.h"
+#include "rope.h"
+
+#include "cstring.h/cstring.h"
+
+static bool is_rope(const StringObject *self) { return self->left != NULL; }
+
+static const char *leaf_chars(const StringObject *self) {
+  return self->flat != NULL ? self->flat : self->chars;
+}
+
+// rope nodes are walked with an explicit stack since concatenating in a loop
+// builds them arbitrarily deep
+void string_copy_chars(const StringObject *self, char *out) {
+  const StringObject **pending = NULL;
+  int32_t size = 0;
+  int32_t capacity = 0;
+
+  const StringObject *node = self;
+  for (;;) {
+    while (is_rope(node)) {
+      if (size == capacity) {
+        capacity = capacity > 0 ? capacity * 2 : 16;
+        pending = realloc(pending, sizeof(StringObject *) * capacity);
+        assert(pending != NULL);
+      }
+      pending[size++] = node->right;
+      node = node->left;
+    }
+
+    memcpy(out, leaf_chars(node), node->length);
+    out += node->length;
+    if (size == 0)
+      break;
+    node = pending[--size];
+  }
+
+  free(pending);
+}
+
+StringObject *string_new(Heap *heap, const char *chars, int32_t length) {
+  assert(length >= 0);
+  StringObject *str = (StringObject *)object_alloc(
+      heap, &STRING_VT, sizeof(StringObject) + (size_t)length + 1);
+
+  str->length = length;
+  str->hash = 0;
+  str->left = NULL;
+  str->right = NULL;
+  str->flat = NULL;
+  memcpy(str->chars, chars, length);
+  str->chars[length] = '\0';
+
+  return str;
+}
+
+bool string_concat(Heap *heap, Value a, Value b, Value *out) {
+  assert(IS_STRING(a) && IS_STRING(b));
+  const StringObject *left = (const StringObject *)a.as.obj;
+  const StringObject *right = (const StringObject *)b.as.obj;
+
+  if (left->length == 0 || right->length == 0) {
+    *out = left->length == 0 ? b : a;
+    return true;
+  }
+  if (left->length > INT32_MAX - 1 - right->length)
+    return false;
+  int32_t length = left->length + right->length;
+
+  heap_push_root(heap, &a);
+  heap_push_root(heap, &b);
+  StringObject *str;
+  if (length < ROPE_MIN_LENGTH) {
+    str = (StringObject *)object_alloc(
+        heap, &STRING_VT, sizeof(StringObject) + (size_t)length + 1);
+    str->left = NULL;
+    str->right = NULL;
+  } else {
+    str = (StringObject *)object_alloc(heap, &STRING_VT, sizeof(StringObject));
+  }
+  heap_pop_root(heap);
+  heap_pop_root(heap);
+
+  // the operands may have moved
+  left = (const StringObject *)a.as.obj;
+  right = (const StringObject *)b.as.obj;
+  str->length = length;
+  str->hash = 0;
+  str->flat = NULL;
+  if (length < ROPE_MIN_LENGTH) {
+    string_copy_chars(left, str->chars);
+    string_copy_chars(right, str->chars + left->length);
+    str->chars[length] = '\0';
+  } else {
+    str->left = (StringObject *)left;
+    str->right = (StringObject *)right;
+    gc_write_barrier(heap, &str->base, a);
+    gc_write_barrier(heap, &str->base, b);
+  }
+
+  *out = OBJ_VAL(str);
+  return true;
+}
+
+const char *string_flatten(Heap *heap, StringObject *self) {
+  assert(self != NULL);
+  if (!is_rope(self))
+    return leaf_chars(self);
+
+  char *flat = malloc((size_t)self->length + 1);
+  assert(flat != NULL);
+  string_copy_chars(self, flat);
+  flat[self->length] = '\0';
+
+  // the halves are dropped while a concurrent mark may still need them
+  gc_satb_barrier(heap, OBJ_VAL(self->left));
+  gc_satb_barrier(heap, OBJ_VAL(self->right));
+  __atomic_store_n(&self->left, NULL, __ATOMIC_RELAXED);
+  __atomic_store_n(&self->right, NULL, __ATOMIC_RELAXED);
+  self->flat = flat;
+
+  return flat;
+}
+
+// characters of `self` in one piece, a malloc'd copy for unflattened ropes
+static const char *contents(const StringObject *self, char **scratch) {
+  *scratch = NULL;
+  if (!is_rope(self))
+    return leaf_chars(self);
+
+  *scratch = malloc((size_t)self->length + 1);
+  assert(*scratch != NULL);
+  string_copy_chars(self, *scratch);
+  (*scratch)[self->length] = '\0';
+  return *scratch;
+}
+
+// Leaves of a rope from its last to its first. Descending into the right
+// half first keeps only left halves pending, one at a time for the ropes
+// appending in a loop builds.
+typedef struct LeafCursor {
+  const StringObject **pending;
+  int32_t size;
+  int32_t capacity;
+  const StringObject *inline_pending[16];
+} LeafCursor;
+
+static void cursor_init(LeafCursor *self, const StringObject *str) {
+  self->pending = self->inline_pending;
+  self->size = 0;
+  self->capacity = sizeof(self->inline_pending) / sizeof(StringObject *);
+  self->pending[self->size++] = str;
+}
+
+static void cursor_push(LeafCursor *self, const StringObject *str) {
+  if (self->size == self->capacity) {
+    self->capacity *= 2;
+    if (self->pending == self->inline_pending) {
+      self->pending = malloc(sizeof(StringObject *) * self->capacity);
+      assert(self->pending != NULL);
+      memcpy(self->pending, self->inline_pending,
+             sizeof(self->inline_pending));
+    } else {
+      self->pending =
+          realloc(self->pending, sizeof(StringObject *) * self->capacity);
+      assert(self->pending != NULL);
+    }
+  }
+  self->pending[self->size++] = str;
+}
+
+// the next leaf towards the start, NULL after the first one
+static const StringObject *cursor_next(LeafCursor *self) {
+  if (self->size == 0)
+    return NULL;
+  const StringObject *node = self->pending[--self->size];
+  while (is_rope(node)) {
+    cursor_push(self, node->left);
+    node = node->right;
+  }
+  return node;
+}
+
+static void cursor_free(LeafCursor *self) {
+  if (self->pending != self->inline_pending)
+    free(self->pending);
+}
+
+// ropes are compared leaf by leaf from their ends, without copying them
+bool string_equals(const StringObject *a, const StringObject *b) {
+  if (a == b)
+    return true;
+  if (a->length != b->length ||
+      (a->hash != 0 && b->hash != 0 && a->hash != b->hash))
+    return false;
+  if (!is_rope(a) && !is_rope(b))
+    return memcmp(leaf_chars(a), leaf_chars(b), a->length) == 0;
+
+  LeafCursor left, right;
+  cursor_init(&left, a);
+  cursor_init(&right, b);
+  const StringObject *leaf_a = NULL, *leaf_b = NULL;
+  // characters of the current leaves not compared yet, at their start
+  int32_t rest_a = 0, rest_b = 0;
+  bool equal = true;
+  for (int32_t remaining = a->length; equal && remaining > 0;) {
+    while (rest_a == 0) {
+      leaf_a = cursor_next(&left);
+      rest_a = leaf_a->length;
+    }
+    while (rest_b == 0) {
+      leaf_b = cursor_next(&right);
+      rest_b = leaf_b->length;
+    }
+    int32_t chunk = rest_a < rest_b ? rest_a : rest_b;
+    rest_a -= chunk;
+    rest_b -= chunk;
+    remaining -= chunk;
+    equal = memcmp(leaf_chars(leaf_a) + rest_a, leaf_chars(leaf_b) + rest_b,
+                   chunk) == 0;
+  }
+  cursor_free(&left);
+  cursor_free(&right);
+
+  return equal;
+}
+
+bool string_equals_chars(const StringObject *self, const char *chars,
+                         int32_t length) {
+  if (self->length != length)
+    return false;
+  if (!is_rope(self))
+    return memcmp(leaf_chars(self), chars, length) == 0;
+
+  LeafCursor cursor;
+  cursor_init(&cursor, self);
+  bool equal = true;
+  const StringObject *leaf;
+  while (equal && (leaf = cursor_next(&cursor)) != NULL) {
+    length -= leaf->length;
+    equal = memcmp(leaf_chars(leaf), chars + length, leaf->length) == 0;
+  }
+  cursor_free(&cursor);
+
+  return equal;
+}
+
+uint32_t string_hash(StringObject *self) {
+  if (self->hash != 0)
+    return self->hash;
+
+  char *scratch;
+  const char *chars = contents(self, &scratch);
+  uint32_t hash = 2166136261u;
+  for (int32_t i = 0; i < self->length; i++) {
+    hash ^= (uint8_t)chars[i];
+    hash *= 16777619u;
+  }
+  free(scratch);
+
+  // 0 marks a hash that was not computed yet
+  self->hash = hash != 0 ? hash : 1;
+  return self->hash;
+}
+
+String string_inspect(const Object *self) {
+  assert(self != NULL);
+  char *scratch;
+  String out = String_from(contents((const StringObject *)self, &scratch));
+  free(scratch);
+
+  return out;
+}
+
+void string_finalize(Object *self) {
+  assert(self != NULL);
+  free(((StringObject *)self)->flat);
+}
+
+void string_trace(Object *self, Heap *heap) {
+  StringObject *str = (StringObject *)self;
+  gc_visit_object(heap, (Object **)&str->left);
+  gc_visit_object(heap, (Object **)&str->right);
+}
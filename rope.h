@@ -0,0 +1,62 @@
+#ifndef ROPE_H
+#define ROPE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+
+// concatenations shorter than this are copied into a flat string, longer
+// ones share their halves in a rope node
+#define ROPE_MIN_LENGTH 24
+
+// Immutable runtime string. A flat string keeps its characters inline, a
+// rope node only points at the two strings it concatenates, so building a
+// string with `+` in a loop is linear. Ropes are copied into a single buffer
+// the first time their characters are needed in one piece.
+typedef struct StringObject {
+  Object base;
+  int32_t length;
+  // 0 until the string is first hashed
+  uint32_t hash;
+  // halves of a rope node, NULL for flat strings and flattened ropes
+  struct StringObject *left;
+  struct StringObject *right;
+  // characters of a flattened rope, owned by the node
+  char *flat;
+  // characters of a flat string, NUL terminated
+  char chars[];
+} StringObject;
+
+String string_inspect(const Object *self);
+void string_finalize(Object *self);
+void string_trace(Object *self, struct Heap *heap);
+
+static const ObjectVT STRING_VT = {
+    ._t = OBJ_STRING,
+    .inspect = string_inspect,
+    .finalize = string_finalize,
+    .trace = string_trace,
+};
+
+#define IS_STRING(v) IS_OBJ_TYPE(v, OBJ_STRING)
+
+struct Heap;
+
+// flat copy of `length` bytes at `chars`, unmanaged when `heap` is NULL
+StringObject *string_new(struct Heap *heap, const char *chars, int32_t length);
+// `a` followed by `b`, false when the result would be too long. Allocating
+// may collect, the operands are kept alive by the call.
+bool string_concat(struct Heap *heap, Value a, Value b, Value *out);
+// characters in one NUL terminated piece, turns a rope node into a flat one
+const char *string_flatten(struct Heap *heap, StringObject *self);
+
+// writes the `length` characters of `self` to `out`, without a terminator
+void string_copy_chars(const StringObject *self, char *out);
+
+bool string_equals(const StringObject *a, const StringObject *b);
+bool string_equals_chars(const StringObject *self, const char *chars,
+                         int32_t length);
+uint32_t string_hash(StringObject *self);
+
+#endif // !ROPE_H
@@ -0,0 +1,102 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rope.h"
+#include "shape.h"
+
+static Shape *shape_new(int32_t num_fields) {
+  Shape *shape = malloc(sizeof(Shape));
+  assert(shape != NULL);
+
+  shape->num_fields = num_fields;
+  shape->keys = NULL;
+  if (num_fields > 0) {
+    shape->keys = malloc(sizeof(ShapeKey) * num_fields);
+    assert(shape->keys != NULL);
+  }
+  shape->transitions = NULL;
+  shape->num_transitions = 0;
+  shape->transitions_capacity = 0;
+
+  return shape;
+}
+
+static void free_shape(Shape *self) {
+  for (int32_t i = 0; i < self->num_transitions; i++)
+    free_shape(self->transitions[i]);
+
+  if (self->num_fields > 0)
+    free((char *)self->keys[self->num_fields - 1].chars);
+  free(self->keys);
+  free(self->transitions);
+  free(self);
+}
+
+ShapeTable *ShapeTable_new(void) {
+  ShapeTable *table = malloc(sizeof(ShapeTable));
+  assert(table != NULL);
+
+  table->root = shape_new(0);
+  table->num_shapes = 1;
+
+  return table;
+}
+
+void free_shape_table(ShapeTable *self) {
+  if (self == NULL)
+    return;
+
+  free_shape(self->root);
+  free(self);
+}
+
+static bool key_matches(const ShapeKey *key, StringObject *str) {
+  return key->hash == string_hash(str) && key->length == str->length &&
+         string_equals_chars(str, key->chars, key->length);
+}
+
+Shape *shape_add_field(ShapeTable *table, Shape *self, StringObject *key) {
+  assert(self->num_fields < SHAPE_MAX_FIELDS);
+  assert(shape_field_index(self, key) < 0);
+
+  for (int32_t i = 0; i < self->num_transitions; i++) {
+    Shape *child = self->transitions[i];
+    if (key_matches(&child->keys[self->num_fields], key))
+      return child;
+  }
+
+  if (table->num_shapes == SHAPE_MAX_SHAPES)
+    return NULL;
+
+  Shape *child = shape_new(self->num_fields + 1);
+  if (self->num_fields > 0)
+    memcpy(child->keys, self->keys, sizeof(ShapeKey) * self->num_fields);
+
+  char *chars = malloc((size_t)key->length + 1);
+  assert(chars != NULL);
+  string_copy_chars(key, chars);
+  chars[key->length] = '\0';
+  child->keys[self->num_fields] = (ShapeKey){
+      .chars = chars, .length = key->length, .hash = string_hash(key)};
+
+  if (self->num_transitions == self->transitions_capacity) {
+    self->transitions_capacity =
+        self->transitions_capacity > 0 ? self->transitions_capacity * 2 : 2;
+    self->transitions = realloc(
+        self->transitions, sizeof(Shape *) * self->transitions_capacity);
+    assert(self->transitions != NULL);
+  }
+  self->transitions[self->num_transitions++] = child;
+  table->num_shapes++;
+
+  return child;
+}
+
+int32_t shape_field_index(const Shape *self, StringObject *key) {
+  for (int32_t i = 0; i < self->num_fields; i++) {
+    if (key_matches(&self->keys[i], key))
+      return i;
+  }
+  return -1;
+}
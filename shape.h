@@ -0,0 +1,53 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rope.h"
+
+// maps with more fields than this keep the hash table layout
+#define SHAPE_MAX_FIELDS 16
+// shapes created per table before new key sets fall back to hash tables,
+// bounds the tree when keys are computed at runtime
+#define SHAPE_MAX_SHAPES 4096
+
+typedef struct ShapeKey {
+  // owned by the shape that added the field, shared with its descendants
+  const char *chars;
+  int32_t length;
+  // string_hash of the key
+  uint32_t hash;
+} ShapeKey;
+
+// Hidden class of a record like map, the string keys it holds in slot
+// order. Shapes form a transition tree rooted at the empty shape, adding the
+// same key to the same shape always yields the same child, so every map
+// built with the same keys in the same order shares one shape and keeps its
+// values in a flat array indexed by slot. Shapes are never freed before
+// their table.
+typedef struct Shape {
+  int32_t num_fields;
+  // every field in slot order, the last one is the field this shape added
+  // to its parent
+  ShapeKey *keys;
+
+  struct Shape **transitions;
+  int32_t num_transitions;
+  int32_t transitions_capacity;
+} Shape;
+
+typedef struct ShapeTable {
+  Shape *root;
+  int32_t num_shapes;
+} ShapeTable;
+
+ShapeTable *ShapeTable_new(void);
+void free_shape_table(ShapeTable *self);
+
+// `self` with `key` appended, NULL when the table is full
+Shape *shape_add_field(ShapeTable *table, Shape *self, StringObject *key);
+// slot of `key`, -1 when the shape has no such field
+int32_t shape_field_index(const Shape *self, StringObject *key);
+
+#endif // !SHAPE_H
@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -16,6 +18,24 @@
 
 #include "repl.h"
 
+#include "aot.h"
+#include "array.h"
+#include "batch.h"
+#include "bigint.h"
+#include "compiler.h"
+#include "context.h"
+#include "frozen.h"
+#include "fzc.h"
+#include "gc.h"
+#include "jit.h"
+#include "map.h"
+#include "memo.h"
+#include "rope.h"
+#include "shape.h"
+#include "tree.h"
+#include "verify.h"
+#include "vm.h"
+
 #define CSTRING_IMPLEMENTATION
 #include <cstring.h/cstring.h>
 
@@ -66,6 +86,7 @@
 void check_parser_errors(Parser *p);
 
 void test_token_scanning(void);
+void test_string_tokens(void);
 void test_start_repl_stdin(void);
 void test_let_statements(void);
 void test_return_statments(void);
@@ -78,10 +99,43 @@ void test_operator_precedence_parsing(void);
 void test_if_expression_parsing(void);
 void test_fn_expression_parsing(void);
 void test_call_expression_parsing(void);
+void test_for_statement_parsing(void);
+void test_vm_integer_expressions(void);
+void test_vm_functions_and_closures(void);
+void test_compiler_tail_positions(void);
+void test_vm_tail_calls(void);
+void test_memo_table_eviction(void);
+void test_vm_memoized_functions(void);
+void test_vm_call_site_caches(void);
+void test_vm_big_integers(void);
+void test_vm_strings(void);
+void test_vm_arrays(void);
+void test_vm_maps(void);
+void test_vm_record_shapes(void);
+void test_vm_for_loops(void);
+void test_jit_matches_interpreter(void);
+void test_jit_on_stack_replacement(void);
+void test_vm_quickening(void);
+void test_vm_superinstructions(void);
+void test_vm_region_arguments(void);
+void test_vm_parallel_builtins(void);
+void test_context_programs(void);
+void test_context_threads(void);
+void test_frozen_program_threads(void);
+void test_batch_expressions(void);
+void test_tree_programs(void);
+void test_aot_c_translation(void);
+void test_fzc_files(void);
+void test_bytecode_verifier(void);
+void test_gc_roots_and_stats(void);
+void test_gc_generations(void);
+void test_gc_concurrent_cycle(void);
+void test_vm_gc_stress(void);
 
 int main() {
 
   test_token_scanning();
+  test_string_tokens();
   // test_start_repl_stdin();
   test_let_statements();
   test_return_statments();
@@ -94,10 +148,2305 @@ int main() {
   test_if_expression_parsing();
   test_fn_expression_parsing();
   test_call_expression_parsing();
+  test_for_statement_parsing();
+  test_vm_integer_expressions();
+  test_vm_functions_and_closures();
+  test_compiler_tail_positions();
+  test_vm_tail_calls();
+  test_memo_table_eviction();
+  test_vm_memoized_functions();
+  test_vm_call_site_caches();
+  test_vm_big_integers();
+  test_vm_strings();
+  test_vm_arrays();
+  test_vm_maps();
+  test_vm_record_shapes();
+  test_vm_for_loops();
+  test_jit_matches_interpreter();
+  test_jit_on_stack_replacement();
+  test_vm_quickening();
+  test_vm_superinstructions();
+  test_vm_region_arguments();
+  test_vm_parallel_builtins();
+  test_context_programs();
+  test_context_threads();
+  test_frozen_program_threads();
+  test_batch_expressions();
+  test_tree_programs();
+  test_aot_c_translation();
+  test_fzc_files();
+  test_bytecode_verifier();
+  test_gc_roots_and_stats();
+  test_gc_generations();
+  test_gc_concurrent_cycle();
+  test_vm_gc_stress();
 
   return 0;
 }
 
+typedef struct {
+  const char *input;
+  int64_t expected;
+} VMTestCase;
+
+void run_vm_test_cases(VMTestCase *test_cases, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    VMTestCase test_case = test_cases[i];
+    Parser *p = Parser_new(Lexer_new(String_from(test_case.input)));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+
+    Compiler *compiler = Compiler_new();
+    if (!compile_program(compiler, program)) {
+      print_string_array(&compiler->errors);
+      assert(false);
+    }
+
+    VM *vm = VM_new(compiler_bytecode(compiler));
+    if (vm_run(vm) != VM_OK) {
+      printf("input = %s\nruntime error: %s\n", test_case.input,
+             vm->error.chars);
+      assert(false);
+    }
+
+    Value result = vm_last_popped(vm);
+    if (!IS_INT(result) || result.as.integer != test_case.expected) {
+      printf("input = %s\n", test_case.input);
+      ASSERT_EQ("%" PRId64, result.as.integer, test_case.expected);
+      assert(IS_INT(result));
+    }
+
+    free_vm(vm);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+}
+
+VM *compile_and_run(const char *input, Compiler **compiler) {
+  Parser *p = Parser_new(Lexer_new(String_from(input)));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+
+  *compiler = Compiler_new();
+  if (!compile_program(*compiler, program)) {
+    printf("input = %s\n", input);
+    print_string_array(&(*compiler)->errors);
+    assert(false);
+  }
+  VM *vm = VM_new(compiler_bytecode(*compiler));
+  assert(vm_run(vm) == VM_OK);
+
+  free_program(program);
+  free_parser(p);
+  return vm;
+}
+
+typedef struct {
+  const char *input;
+  const char *expected;
+} InspectTestCase;
+
+void run_inspect_test_cases(InspectTestCase *test_cases, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    Compiler *compiler;
+    VM *vm = compile_and_run(test_cases[i].input, &compiler);
+
+    String result = value_inspect(vm_last_popped(vm));
+    if (strcmp(result.chars, test_cases[i].expected) != 0) {
+      printf("input = %s\n", test_cases[i].input);
+      ASSERT_EQ("%s", result.chars, test_cases[i].expected);
+    }
+
+    free_string(&result);
+    free_vm(vm);
+    free_compiler(compiler);
+  }
+}
+
+void test_vm_integer_expressions(void) {
+  TEST_STARTED;
+  VMTestCase test_cases[] = {
+      {"1 + 2", 3},
+      {"10 * (20 + 2)", 220},
+      {"-7 / 2", -3},
+      {"50 / 2 * 2 + 10 - 5", 55},
+      {"let a = 5; let b = a * 2; b - a", 5},
+      {"if (1 < 2) { 10 } else { 20 }", 10},
+      {"if (1 > 2) { 10 } else { 20 }", 20},
+      {"if (!(1 == 1)) { 10 } else { if (2 != 3) { 30 } }", 30},
+  };
+
+  run_vm_test_cases(test_cases, sizeof(test_cases) / sizeof(test_cases[0]));
+  TEST_PASSED;
+}
+
+void test_vm_functions_and_closures(void) {
+  TEST_STARTED;
+  VMTestCase test_cases[] = {
+      {"let add = fn(a, b) { return a + b; }; add(11, 58);", 69},
+      {"let add = fn(a, b) { a + b; }; add(1, 2);", 3},
+      {"let fibonacci = fn(x) { if (x == 0) { 0 } else { if (x == 1) { 1 } "
+       "else { fibonacci(x - 1) + fibonacci(x - 2); } } }; fibonacci(15);",
+       610},
+      {"let twice = fn(f, x) { return f(f(x)); }; "
+       "let addFive = fn(x) { return x + 5; }; twice(addFive, 10);",
+       20},
+      {"let adder = fn(a) { fn(b) { a + b } }; let addThree = adder(3); "
+       "addThree(4);",
+       7},
+      {"let outer = fn() { let inner = fn(n) { if (n == 0) { 1 } else { "
+       "n * inner(n - 1) } }; inner(5) }; outer();",
+       120},
+  };
+
+  run_vm_test_cases(test_cases, sizeof(test_cases) / sizeof(test_cases[0]));
+  TEST_PASSED;
+}
+
+typedef struct {
+  const char *input;
+  const char *call_op;
+} TailPositionTestCase;
+
+void test_compiler_tail_positions(void) {
+  TEST_STARTED;
+  TailPositionTestCase test_cases[] = {
+      {"fn(n) { return f(n); }", "OP_TAIL_CALL"},
+      {"fn(n) { f(n) }", "OP_TAIL_CALL"},
+      {"fn(n) { if (n) { f(n) } else { g(n) } }", "OP_TAIL_CALL"},
+      {"fn(n) { 1 + f(n) }", "OP_CALL"},
+      {"fn(n) { f(n); 1 }", "OP_CALL"},
+      {"fn(n) { let x = f(n); x }", "OP_CALL"},
+  };
+
+  for (size_t i = 0; i < sizeof(test_cases) / sizeof(test_cases[0]); i++) {
+    TailPositionTestCase test_case = test_cases[i];
+    char input[256];
+    snprintf(input, sizeof(input), "let f = 0; let g = 0; %s",
+             test_case.input);
+    Parser *p = Parser_new(Lexer_new(String_from(input)));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+
+    Compiler *compiler = Compiler_new();
+    assert(compile_program(compiler, program));
+
+    Value constant = compiler->constants.data[compiler->constants.size - 1];
+    assert(IS_OBJ_TYPE(constant, OBJ_FUNCTION));
+    CompiledFunction *fn = (CompiledFunction *)constant.as.obj;
+    String listing = instructions_string(&fn->instructions);
+
+    bool has_tail_call = strstr(listing.chars, "OP_TAIL_CALL") != NULL;
+    bool expects_tail_call = strcmp(test_case.call_op, "OP_TAIL_CALL") == 0;
+    if (has_tail_call != expects_tail_call) {
+      printf("input = %s\n%s\n", test_case.input, listing.chars);
+      assert(has_tail_call == expects_tail_call);
+    }
+
+    free_string(&listing);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+  TEST_PASSED;
+}
+
+void test_vm_tail_calls(void) {
+  TEST_STARTED;
+  // each of these recurses far deeper than MAX_FRAMES
+  VMTestCase test_cases[] = {
+      {"let count = fn(n, acc) { if (n == 0) { acc } else { "
+       "count(n - 1, acc + 1) } }; count(100000, 0);",
+       100000},
+      {"let down = fn(n) { if (n > 0) { return down(n - 1); } n }; "
+       "down(50000);",
+       0},
+      {"let bounce = fn(f, n) { if (n == 0) { 1 } else { f(f, n - 1) } }; "
+       "bounce(bounce, 20000);",
+       1},
+      {"let run = fn() { let loop = fn(n, acc) { if (n == 0) { acc } else { "
+       "loop(n - 1, acc + 2) } }; loop(30000, 0) }; run();",
+       60000},
+  };
+
+  run_vm_test_cases(test_cases, sizeof(test_cases) / sizeof(test_cases[0]));
+  TEST_PASSED;
+}
+
+void test_memo_table_eviction(void) {
+  TEST_STARTED;
+  MemoTable *table = MemoTable_new(1, 2);
+  Value one = INT_VAL(1), two = INT_VAL(2), three = INT_VAL(3);
+  Value out;
+
+  memo_store(table, &one, INT_VAL(10));
+  memo_store(table, &two, INT_VAL(20));
+  // touching 1 makes 2 the least recently used entry
+  assert(memo_lookup(table, &one, &out));
+  ASSERT_EQ("%" PRId64, out.as.integer, INT64_C(10));
+
+  memo_store(table, &three, INT_VAL(30));
+  assert(!memo_lookup(table, &two, &out));
+  assert(memo_lookup(table, &one, &out));
+  assert(memo_lookup(table, &three, &out));
+  ASSERT_EQ("%" PRId64, out.as.integer, INT64_C(30));
+  ASSERT_EQ("%d", table->size, 2);
+  free_memo_table(table);
+
+  // the storage grows with the entries and stops at the capacity
+  table = MemoTable_new(1, 100);
+  ASSERT_EQ("%d", table->allocated, MEMO_INITIAL_CAPACITY);
+  for (int64_t i = 0; i < 150; i++) {
+    Value key = INT_VAL(i);
+    memo_store(table, &key, INT_VAL(i * 2));
+  }
+  ASSERT_EQ("%d", table->allocated, 100);
+  for (int64_t i = 50; i < 150; i++) {
+    Value key = INT_VAL(i);
+    assert(memo_lookup(table, &key, &out));
+    ASSERT_EQ("%" PRId64, out.as.integer, i * 2);
+  }
+  free_memo_table(table);
+  TEST_PASSED;
+}
+
+void test_vm_memoized_functions(void) {
+  TEST_STARTED;
+  VMTestCase test_cases[] = {
+      // exponential without the memo table
+      {"let fibonacci = @memo fn(x) { if (x < 2) { x } else { "
+       "fibonacci(x - 1) + fibonacci(x - 2) } }; fibonacci(40);",
+       102334155},
+      {"let square = fn(x) { x * x }; "
+       "let sumSquares = @memo fn(a, b) { square(a) + square(b) }; "
+       "sumSquares(3, 4) + sumSquares(3, 4);",
+       50},
+      {"let make = fn(k) { @memo fn(x) { x + k } }; "
+       "let addOne = make(1); let addTwo = make(2); addOne(5) + addTwo(5);",
+       13},
+  };
+  run_vm_test_cases(test_cases, sizeof(test_cases) / sizeof(test_cases[0]));
+
+  const char *impure_inputs[] = {
+      "let f = @memo fn(x) { echo(x); x };",
+      "let g = fn(x) { x }; let f = @memo fn(h, x) { h(x) };",
+      "let k = 2; let f = @memo fn(x) { x * k };",
+  };
+
+  for (size_t i = 0; i < sizeof(impure_inputs) / sizeof(impure_inputs[0]);
+       i++) {
+    Parser *p = Parser_new(Lexer_new(String_from(impure_inputs[i])));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+
+    Compiler *compiler = Compiler_new();
+    assert(!compile_program(compiler, program));
+    assert(strstr(compiler->errors.data[0].chars, "not pure") != NULL);
+
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+  TEST_PASSED;
+}
+
+void test_vm_call_site_caches(void) {
+  TEST_STARTED;
+  Compiler *compiler;
+
+  // a single monomorphic site inside the loop
+  VM *vm = compile_and_run("let count = fn(n) { if (n == 0) { 0 } else { "
+                           "1 + count(n - 1) } }; count(500);",
+                           &compiler);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(500));
+  ASSERT_EQ("%d", vm->num_call_caches, 2);
+  assert(vm->ic_hits >= 499);
+  ASSERT_EQ("%d", vm->call_caches[0].size, 1);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // the site in `apply` sees five different functions
+  vm = compile_and_run(
+      "let apply = fn(f, x) { f(x) }; "
+      "let a = fn(x) { x + 1 }; let b = fn(x) { x + 2 }; "
+      "let c = fn(x) { x + 3 }; let d = fn(x) { x + 4 }; "
+      "let e = fn(x) { x + 5 }; "
+      "apply(a, 0) + apply(b, 0) + apply(c, 0) + apply(d, 0) + apply(e, 0) + "
+      "apply(a, 0);",
+      &compiler);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(16));
+  assert(vm->call_caches[0].megamorphic);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  TEST_PASSED;
+}
+
+void test_vm_big_integers(void) {
+  TEST_STARTED;
+  VMTestCase int_cases[] = {
+      {"9223372036854775807 - 1 + 1", INT64_MAX},
+      {"-9223372036854775807 - 1", INT64_MIN},
+      // overflowing intermediates come back down to int64
+      {"9223372036854775807 * 4 / 8", INT64_MAX / 2},
+      {"99999999999999999999999 - 99999999999999999999998", 1},
+      {"-(-9223372036854775807 - 1) - 1", INT64_MAX},
+  };
+  run_vm_test_cases(int_cases, sizeof(int_cases) / sizeof(int_cases[0]));
+
+#define FACT                                                                   \
+  "let fact = fn(n) { if (n < 2) { 1 } else { n * fact(n - 1) } }; "
+  InspectTestCase test_cases[] = {
+      {"9223372036854775807 + 1", "9223372036854775808"},
+      {"-9223372036854775807 - 3", "-9223372036854775810"},
+      {"(-9223372036854775807 - 1) / -1", "9223372036854775808"},
+      {FACT "fact(30)", "265252859812191058636308480000000"},
+      {FACT "-fact(25)", "-15511210043330985984000000"},
+      {FACT "fact(30) / fact(28)", "870"},
+      {FACT "fact(30) / 10000000000000000000000", "26525285981"},
+      {FACT "fact(30) / -fact(31)", "0"},
+      {"100000000000000000000 == 100000000000000000000", "true"},
+      {"100000000000000000000 > 9223372036854775807", "true"},
+      {FACT "-100000000000000000000 < -fact(20)", "true"},
+  };
+
+  run_inspect_test_cases(test_cases,
+                         sizeof(test_cases) / sizeof(test_cases[0]));
+#undef FACT
+  TEST_PASSED;
+}
+
+void test_vm_strings(void) {
+  TEST_STARTED;
+#define APPEND                                                                 \
+  "let app = fn(n, acc) { if (n == 0) { acc } else { "                         \
+  "app(n - 1, acc + \"ab\") } }; "
+#define PREPEND                                                                \
+  "let pre = fn(n, acc) { if (n == 0) { acc } else { "                         \
+  "pre(n - 1, \"ab\" + acc) } }; "
+  InspectTestCase test_cases[] = {
+      {"\"Hornet\"", "Hornet"},
+      {"\"\"", ""},
+      {"\"foo\" + \"bar\"", "foobar"},
+      {"let name = \"Hornet\"; name + \" \" + name", "Hornet Hornet"},
+      {"\"\" + \"x\" + \"\"", "x"},
+      {"\"a\" + \"b\" == \"ab\"", "true"},
+      {"\"ab\" != \"ba\"", "true"},
+      // long enough for rope nodes, compared against a flat literal
+      {"\"long enough to become \" + \"a rope node\"",
+       "long enough to become a rope node"},
+      {"(\"long enough to become \" + \"a rope \") + \"node\" == "
+       "\"long enough to become a rope node\"",
+       "true"},
+      {"\"long enough to become \" + (\"a rope \" + \"node\") == "
+       "(\"long enough to become \" + \"a rope \") + \"node\"",
+       "true"},
+      // ropes leaning either way, compared and looked up without flattening
+      {APPEND PREPEND "app(500, \"\") == pre(500, \"\")", "true"},
+      {APPEND PREPEND "app(500, \"\") == pre(499, \"\") + \"ax\"", "false"},
+      {APPEND PREPEND "\"x\" + app(499, \"\") + \"b\" == pre(500, \"\")",
+       "false"},
+      {APPEND "{\"abababababababababababab\": 1}[app(12, \"\")]", "1"},
+      {APPEND "{\"abababababababababababax\": 1}[app(12, \"\")]", "null"},
+  };
+
+  run_inspect_test_cases(test_cases,
+                         sizeof(test_cases) / sizeof(test_cases[0]));
+#undef APPEND
+#undef PREPEND
+
+  // appending in a loop builds a rope instead of copying the prefix again
+  Compiler *compiler;
+  VM *vm = compile_and_run(
+      "let build = fn(n, acc) { if (n == 0) { acc } else { "
+      "build(n - 1, acc + \"ab\") } }; build(100000, \"\");",
+      &compiler);
+  Value result = vm_last_popped(vm);
+  assert(IS_STRING(result));
+  StringObject *str = (StringObject *)result.as.obj;
+  ASSERT_EQ("%d", str->length, 200000);
+  assert(str->left != NULL);
+  const char *chars = string_flatten(vm->heap, str);
+  assert(str->left == NULL && str->right == NULL);
+  assert(strlen(chars) == 200000);
+  assert(chars[0] == 'a' && chars[199999] == 'b');
+  free_vm(vm);
+  free_compiler(compiler);
+
+  TEST_PASSED;
+}
+
+void test_vm_arrays(void) {
+  TEST_STARTED;
+  InspectTestCase test_cases[] = {
+      {"[]", "[]"},
+      {"[1, 2 * 3, 4 + 5]", "[1, 6, 9]"},
+      {"[1, \"two\", true, [3]]", "[1, two, true, [3]]"},
+      {"[1, 2, 3][0]", "1"},
+      {"[1, 2, 3][1 + 1]", "3"},
+      {"let a = [1, 2, 3]; a[0] + a[1] * a[2]", "7"},
+      {"[[1, 1], [2, 2]][1][0]", "2"},
+      {"[1, 2, 3][3]", "null"},
+      {"[1, 2, 3][-1]", "null"},
+      {"[\"a\", \"b\"][1]", "b"},
+      {"len([])", "0"},
+      {"len([1, 2, 3])", "3"},
+      {"len(\"four\")", "4"},
+      {"push([1, 2], 3)", "[1, 2, 3]"},
+      {"push([1, 2], \"x\")", "[1, 2, x]"},
+      {"let a = [1]; let b = push(a, 2); len(a) + len(b)", "3"},
+  };
+
+  run_inspect_test_cases(test_cases,
+                         sizeof(test_cases) / sizeof(test_cases[0]));
+
+  // integer elements are packed, anything else keeps the array generic
+  struct {
+    const char *input;
+    bool packed;
+  } layouts[] = {
+      {"[1, 2, 3]", true},
+      {"[]", true},
+      {"[1, 100000000000000000000]", false},
+      {"push([1, 2], 3)", true},
+      {"push([1, 2], true)", false},
+      {"push([1, \"a\"], 3)", false},
+  };
+  for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+    Compiler *compiler;
+    VM *vm = compile_and_run(layouts[i].input, &compiler);
+    Value result = vm_last_popped(vm);
+    assert(IS_ARRAY(result));
+    ArrayObject *arr = (ArrayObject *)result.as.obj;
+    ASSERT_EQ("%d", arr->packed, layouts[i].packed);
+    // a packed element takes the space of its integer only
+    if (arr->packed)
+      assert(arr->base.size ==
+             sizeof(ArrayObject) + sizeof(int64_t) * arr->length);
+    free_vm(vm);
+    free_compiler(compiler);
+  }
+
+  const char *errors[] = {
+      "[1][true]",
+      "1[0]",
+      "len(1)",
+      "push(1, 2)",
+  };
+  for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+    Parser *p = Parser_new(Lexer_new(String_from(errors[i])));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+    Compiler *compiler = Compiler_new();
+    assert(compile_program(compiler, program));
+    VM *vm = VM_new(compiler_bytecode(compiler));
+    assert(vm_run(vm) == VM_RUNTIME_ERROR);
+    free_vm(vm);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+
+  TEST_PASSED;
+}
+
+void test_vm_maps(void) {
+  TEST_STARTED;
+  InspectTestCase test_cases[] = {
+      {"{}", "{}"},
+      {"{\"name\": \"Shakra\", \"height\": 9}", "{name: Shakra, height: 9}"},
+      {"{\"name\": \"Shakra\", \"height\": 9}[\"height\"]", "9"},
+      {"{1: \"one\", true: \"yes\", \"two\": 2}[true]", "yes"},
+      {"{1 + 1: 2 * 2}[2]", "4"},
+      {"{\"a\": 1}[\"b\"]", "null"},
+      {"{\"a\": 1}[1]", "null"},
+      // the key is compared by value, not by identity
+      {"let k = \"na\" + \"me\"; {\"name\": 7}[k]", "7"},
+      {"{100000000000000000000: 1}[10000000000 * 10000000000]", "1"},
+      // a duplicate keeps the first position and the last value
+      {"{\"a\": 1, \"b\": 2, \"a\": 3}", "{a: 3, b: 2}"},
+      {"len({\"a\": 1, \"b\": 2, \"a\": 3})", "2"},
+      {"let cfg = {\"db\": {\"port\": 5432}}; cfg[\"db\"][\"port\"]",
+       "5432"},
+  };
+
+  run_inspect_test_cases(test_cases,
+                         sizeof(test_cases) / sizeof(test_cases[0]));
+
+  // enough keys to probe past the first group of a table several groups big
+  enum { NUM_KEYS = 1000 };
+  String input = String_from("let m = {");
+  for (int32_t i = 0; i < NUM_KEYS; i++) {
+    char pair[32];
+    snprintf(pair, sizeof(pair), "%s%d: %d", i == 0 ? "" : ", ", i * 7, i);
+    String pair_str = STR_NEW(pair);
+    String joined = String_join(2, &input, &pair_str);
+    free_string(&input);
+    input = joined;
+  }
+  String tail = STR_NEW("}; m[693] + m[6993] + len(m);");
+  String joined = String_join(2, &input, &tail);
+  free_string(&input);
+
+  Compiler *compiler;
+  VM *vm = compile_and_run(joined.chars, &compiler);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer,
+            (int64_t)(99 + 999 + NUM_KEYS));
+  Value m = vm->globals[0];
+  assert(IS_MAP(m));
+  MapObject *map = (MapObject *)m.as.obj;
+  ASSERT_EQ("%d", map->count, NUM_KEYS);
+  assert(map->capacity >= NUM_KEYS + NUM_KEYS / 8);
+  for (int32_t i = 0; i < NUM_KEYS; i++) {
+    Value value;
+    assert(map_get(map, INT_VAL(i * 7), &value));
+    ASSERT_EQ("%" PRId64, value.as.integer, (int64_t)i);
+    // the entries stay in insertion order
+    ASSERT_EQ("%" PRId64, map_entries(map)[i].key.as.integer,
+              (int64_t)i * 7);
+  }
+  Value missing;
+  assert(!map_get(map, INT_VAL(1), &missing));
+  free_vm(vm);
+  free_compiler(compiler);
+  free_string(&joined);
+
+  const char *errors[] = {
+      "{[1]: 2}",
+      "{\"a\": 1}[[1]]",
+      "{fn(x) { x }: 1}",
+  };
+  for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+    Parser *p = Parser_new(Lexer_new(String_from(errors[i])));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+    Compiler *compiler = Compiler_new();
+    assert(compile_program(compiler, program));
+    VM *vm = VM_new(compiler_bytecode(compiler));
+    assert(vm_run(vm) == VM_RUNTIME_ERROR);
+    free_vm(vm);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+
+  TEST_PASSED;
+}
+
+void test_vm_record_shapes(void) {
+  TEST_STARTED;
+  Compiler *compiler;
+  VM *vm = compile_and_run(
+      "let a = {\"x\": 1, \"y\": 2}; let b = {\"x\": 3, \"y\": 4}; "
+      "let c = {\"y\": 5, \"x\": 6}; let d = {\"x\": 7}; "
+      "let e = {\"x\": 8, 1: 9};",
+      &compiler);
+  MapObject *a = (MapObject *)vm->globals[0].as.obj;
+  MapObject *b = (MapObject *)vm->globals[1].as.obj;
+  MapObject *c = (MapObject *)vm->globals[2].as.obj;
+  MapObject *d = (MapObject *)vm->globals[3].as.obj;
+  MapObject *e = (MapObject *)vm->globals[4].as.obj;
+  // the same keys in the same order share a shape, a prefix is its parent
+  assert(a->shape != NULL && a->shape == b->shape);
+  assert(c->shape != NULL && c->shape != a->shape);
+  assert(d->shape == vm->shapes->root->transitions[0]);
+  assert(d->shape->transitions[0] == a->shape);
+  ASSERT_EQ("%d", a->shape->num_fields, 2);
+  ASSERT_EQ("%" PRId64, map_fields(b)[1].as.integer, (int64_t)4);
+  ASSERT_EQ("%" PRId64, map_fields(c)[0].as.integer, (int64_t)5);
+  // keys other than strings keep the hash table
+  assert(e->shape == NULL && e->capacity > 0);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  InspectTestCase test_cases[] = {
+      {"{\"x\": 1, \"y\": 2}[\"y\"]", "2"},
+      {"{\"x\": 1, \"y\": 2}[\"z\"]", "null"},
+      {"let k = \"y\"; {\"x\": 1, \"y\": 2}[k]", "2"},
+      {"{\"x\": 1, \"y\": 2}[1]", "null"},
+      {"{\"x\": 1, 2: 3}[\"x\"]", "1"},
+      // one site sees records of two shapes and a hash table
+      {"let get = fn(m) { m[\"x\"] }; "
+       "get({\"x\": 1}) + get({\"y\": 2, \"x\": 3}) + get({\"x\": 5, 1: 1})",
+       "9"},
+  };
+  run_inspect_test_cases(test_cases,
+                         sizeof(test_cases) / sizeof(test_cases[0]));
+
+  // after the first miss every read of a site is a hit on its shape
+  vm = compile_and_run(
+      "let sum = fn(n, acc) { if (n == 0) { acc } else { "
+      "let p = {\"x\": n, \"y\": 1}; sum(n - 1, acc + p[\"x\"] + p[\"y\"]) "
+      "} }; sum(100, 0);",
+      &compiler);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, (int64_t)5150);
+  ASSERT_EQ("%d", vm->num_shape_caches, 2);
+  ASSERT_EQ("%" PRIu64, vm->shape_misses, (uint64_t)2);
+  ASSERT_EQ("%" PRIu64, vm->shape_hits, (uint64_t)198);
+  ASSERT_EQ("%d", vm->shape_caches[0].size, 1);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // a site reading records of too many shapes stops caching them
+  vm = compile_and_run(
+      "let get = fn(m) { m[\"x\"] }; get({\"x\": 1}); get({\"a\": 1, \"x\": 1}); "
+      "get({\"b\": 1, \"x\": 1}); get({\"c\": 1, \"x\": 1}); "
+      "get({\"d\": 1, \"x\": 1});",
+      &compiler);
+  assert(vm->shape_caches[0].megamorphic);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // past SHAPE_MAX_FIELDS keys a map is a hash table
+  String input = String_from("{");
+  for (int32_t i = 0; i <= SHAPE_MAX_FIELDS; i++) {
+    char pair[32];
+    snprintf(pair, sizeof(pair), "%s\"k%d\": %d", i == 0 ? "" : ", ", i, i);
+    String pair_str = STR_NEW(pair);
+    String joined = String_join(2, &input, &pair_str);
+    free_string(&input);
+    input = joined;
+  }
+  String tail = STR_NEW("}");
+  String joined = String_join(2, &input, &tail);
+  free_string(&input);
+  vm = compile_and_run(joined.chars, &compiler);
+  assert(((MapObject *)vm_last_popped(vm).as.obj)->shape == NULL);
+  free_vm(vm);
+  free_compiler(compiler);
+  free_string(&joined);
+
+  TEST_PASSED;
+}
+
+void test_vm_for_loops(void) {
+  TEST_STARTED;
+  VMTestCase test_cases[] = {
+      {"let sum = 0; for (i in 0..10) { let sum = sum + i; } sum;", 45},
+      {"let n = 0; for (i in 5..5) { let n = n + 1; } "
+       "for (i in 5..2) { let n = n + 1; } n;",
+       0},
+      {"let fact = fn(n) { let acc = 1; "
+       "for (i in 1..n + 1) { let acc = acc * i; } acc }; fact(10);",
+       3628800},
+      // the end bound is evaluated once
+      {"let n = 3; let runs = 0; "
+       "for (i in 0..n) { let n = n + 1; let runs = runs + 1; } runs;",
+       3},
+      {"let total = 0; let a = [1, 2, 3]; for (i in 0..len(a)) { "
+       "for (j in 0..len(a)) { let total = total + a[i] * a[j]; } } total;",
+       36},
+      {"let n = 0; for (let i = 0; i < 4; let i = i + 1) { let n = n + i; } "
+       "n * 10 + i;",
+       64},
+      {"let k = 10; for (; k > 0;) { let k = k - 3; } k;", -2},
+      {"let find = fn(limit) { for (i in 0..limit) { "
+       "if (i * i > 50) { return i; } } -1 }; find(100) * 10 + find(5);",
+       79},
+      // closures copy the counter when they are created
+      {"let g = fn() { let f = 0; "
+       "for (i in 0..3) { if (i == 1) { let f = fn() { i }; } } f }; g()();",
+       1},
+  };
+  run_vm_test_cases(test_cases, sizeof(test_cases) / sizeof(test_cases[0]));
+
+  // a million iterations neither allocate nor grow the stack
+  Compiler *compiler;
+  VM *vm = compile_and_run(
+      "let run = fn(n) { let acc = 0; for (i in 0..n) { "
+      "let acc = acc + i * 2; } acc }; run(1000000);",
+      &compiler);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer,
+            (int64_t)999999000000);
+  ASSERT_EQ("%" PRIu64, vm->heap->stats.collections, (uint64_t)0);
+  ASSERT_EQ("%d", vm->sp, 0);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // the memo table is keyed on the parameters as they are on return
+  Parser *p = Parser_new(Lexer_new(String_from(
+      "let f = @memo fn(n) { for (i in 0..3) { let n = n + 1; } n };")));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  compiler = Compiler_new();
+  assert(!compile_program(compiler, program));
+  free_compiler(compiler);
+  free_program(program);
+  free_parser(p);
+
+  TEST_PASSED;
+}
+
+// result or error message of running `bytecode` in a fresh VM
+static String run_with_jit(Bytecode bytecode, int32_t threshold,
+                           int32_t *compiled) {
+  VM *vm = VM_new(bytecode);
+  vm->jit_threshold = threshold;
+  String out = vm_run(vm) == VM_OK ? value_inspect(vm_last_popped(vm))
+                                   : String_from(vm->error.chars);
+  *compiled = vm->jit_compiled;
+  free_vm(vm);
+  return out;
+}
+
+void test_jit_matches_interpreter(void) {
+  TEST_STARTED;
+  const char *inputs[] = {
+      "let f = fn(a, b) { (a * 7 + b) / 3 - -a }; f(5, 2) + f(-9, 4);",
+      // overflows into a BigInt on the slow path and back
+      "let f = fn(a) { a * a * a - a * a * a + 1 }; f(9223372036);",
+      "let f = fn(a, b) { a / b }; f(-9223372036854775807 - 1, -1);",
+      "let f = fn(a, b) { [a < b, a > b, a == b, a != b, !a, !!b] }; "
+      "[f(1, 2), f(2, 2), f(true, false), f(\"x\", \"x\")];",
+      "let f = fn(x) { if (x) { 1 } else { if (!x) { 2 } } }; "
+      "[f(true), f(false), f(0), f(\"\"), f(fn() { 0 }())];",
+      "let g = 10; let f = fn(n) { let m = n + g; fn(k) { m * k } }; "
+      "f(1)(2) + f(3)(4);",
+      "let f = fn(n) { let r = {\"a\": n, \"b\": [n, n * 2]}; "
+      "r[\"b\"][1] + r[\"a\"] + len(r) }; f(20);",
+      "let f = fn(s) { s + \"!\" }; f(f(\"hi\"));",
+      "let f = fn(n) { let acc = 0; for (i in 0..n) { "
+      "let acc = acc + i * i; } acc }; f(100);",
+      "let fib = fn(x) { if (x < 2) { x } else { fib(x - 1) + fib(x - 2) } };"
+      "fib(15);",
+      "let loop = fn(n, acc) { if (n == 0) { acc } else { "
+      "loop(n - 1, acc + n) } }; loop(5000, 0);",
+      // constants folded into their operators, inside superinstructions
+      // too, fall back on overflow, wide constants and other types
+      "let f = fn(a) { [a - 1, a + 3, a + 3000000000, a < 5, a > 5, "
+      "a == 5] }; [f(9223372036854775807), f(-9223372036854775807 - 1), "
+      "f(5)];",
+      "let f = fn(a) { if (a == 1) { a } else { a == 2 } }; "
+      "[f(1), f(2), f(\"x\"), f(true)];",
+      // errors raised inside the native code
+      "let f = fn(a) { a + true }; f(1);",
+      "let f = fn(a) { -a }; f(\"x\");",
+      "let f = fn(a) { a / 0 }; f(3);",
+      "let f = fn(a) { a[1] }; f(2);",
+  };
+
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    Parser *p = Parser_new(Lexer_new(String_from(inputs[i])));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+    Compiler *compiler = Compiler_new();
+    assert(compile_program(compiler, program));
+
+    int32_t compiled;
+    String expected = run_with_jit(compiler_bytecode(compiler), 0, &compiled);
+    ASSERT_EQ("%d", compiled, 0);
+    String actual = run_with_jit(compiler_bytecode(compiler), 1, &compiled);
+    if (strcmp(actual.chars, expected.chars) != 0) {
+      printf("input = %s\n", inputs[i]);
+      ASSERT_EQ("%s", actual.chars, expected.chars);
+    }
+    if (JIT_SUPPORTED)
+      assert(compiled > 0);
+
+    free_string(&expected);
+    free_string(&actual);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+
+  // an error in the native code leaves the frame and the stack where the
+  // interpreter leaves them
+  Parser *p = Parser_new(Lexer_new(
+      String_from("let f = fn(a, b) { [a, b - 1, a / b] }; f(1, 0);")));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  Compiler *compiler = Compiler_new();
+  assert(compile_program(compiler, program));
+  int32_t error_ip[2], error_sp[2];
+  for (int32_t threshold = 0; threshold < 2; threshold++) {
+    VM *vm = VM_new(compiler_bytecode(compiler));
+    vm->jit_threshold = threshold;
+    assert(vm_run(vm) == VM_RUNTIME_ERROR);
+    error_ip[threshold] = vm->frames[vm->frame_index].ip;
+    error_sp[threshold] = vm->sp;
+    free_vm(vm);
+  }
+  ASSERT_EQ("%d", error_ip[1], error_ip[0]);
+  ASSERT_EQ("%d", error_sp[1], error_sp[0]);
+  free_compiler(compiler);
+  free_program(program);
+  free_parser(p);
+
+  // only functions called often enough are compiled
+  VM *vm = compile_and_run("let once = fn(x) { x }; let hot = fn(x) { x }; "
+                           "let loop = fn(n) { if (n > 0) { hot(n); "
+                           "loop(n - 1) } }; once(1); loop(150);",
+                           &compiler);
+  int32_t expected_compiled = JIT_SUPPORTED ? 2 : 0;
+  ASSERT_EQ("%d", vm->jit_compiled, expected_compiled);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  TEST_PASSED;
+}
+
+typedef struct {
+  const char *input;
+  int64_t expected;
+  int32_t osr_entries;
+} OSRTestCase;
+
+void test_jit_on_stack_replacement(void) {
+  TEST_STARTED;
+  int32_t osr = JIT_SUPPORTED ? 1 : 0;
+  OSRTestCase test_cases[] = {
+      // the top level runs once, only its back edges get it compiled
+      {"let s = 0; for (i in 0..5000) { let s = s + i; } s;", 12497500, osr},
+      // the builtin call leaves the native code in every iteration
+      {"let f = fn(a) { let t = 0; for (i in 0..3000) { "
+       "let t = t + len(a) * i; } t }; f([1, 2]);",
+       8997000, osr},
+      // the frame moves over in the inner loop, the outer one is native then
+      {"let f = fn() { let t = 0; for (i in 0..40) { for (j in 0..40) { "
+       "let t = t + i * j; } } t }; f();",
+       608400, osr},
+      {"let t = 0; for (i in 0..10) { let t = t + i; } t;", 45, 0},
+  };
+
+  for (size_t i = 0; i < sizeof(test_cases) / sizeof(test_cases[0]); i++) {
+    Compiler *compiler;
+    VM *vm = compile_and_run(test_cases[i].input, &compiler);
+    if (vm_last_popped(vm).as.integer != test_cases[i].expected)
+      printf("input = %s\n", test_cases[i].input);
+    ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer,
+              test_cases[i].expected);
+    ASSERT_EQ("%d", vm->osr_entries, test_cases[i].osr_entries);
+    ASSERT_EQ("%d", vm->jit_compiled, test_cases[i].osr_entries);
+    free_vm(vm);
+    free_compiler(compiler);
+  }
+
+  TEST_PASSED;
+}
+
+// runs `input` in the interpreter only and returns the VM, the body of the
+// first function literal in `fn`
+static VM *run_interpreted(const char *input, Compiler **compiler,
+                           bool quicken, bool superinstructions,
+                           CompiledFunction **fn) {
+  Parser *p = Parser_new(Lexer_new(String_from(input)));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  *compiler = Compiler_new();
+  (*compiler)->superinstructions = superinstructions;
+  assert(compile_program(*compiler, program));
+
+  VM *vm = VM_new(compiler_bytecode(*compiler));
+  vm->jit_threshold = 0;
+  vm->quicken = quicken;
+  assert(vm_run(vm) == VM_OK);
+
+  *fn = NULL;
+  for (int32_t i = 0; i < vm->constants->size && *fn == NULL; i++) {
+    if (IS_OBJ_TYPE(vm->constants->data[i], OBJ_FUNCTION))
+      *fn = (CompiledFunction *)vm->constants->data[i].as.obj;
+  }
+  assert(*fn != NULL);
+
+  free_program(program);
+  free_parser(p);
+  return vm;
+}
+
+static bool has_opcode(const CompiledFunction *fn, Opcode op) {
+  const Instructions *ins = &fn->instructions;
+  for (int32_t i = 0; i < ins->size;) {
+    const OpDefinition *def = opcode_lookup((Opcode)ins->data[i]);
+    if (ins->data[i] == op)
+      return true;
+    i += 1 + def->operand_widths[0] + def->operand_widths[1];
+  }
+  return false;
+}
+
+void test_vm_quickening(void) {
+  TEST_STARTED;
+  Compiler *compiler;
+  CompiledFunction *fn;
+
+  VM *vm = run_interpreted("let fib = fn(x) { if (x < 2) { x } else { "
+                           "fib(x - 1) + fib(x - 2) } }; fib(15);",
+                           &compiler, true, false, &fn);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(610));
+  assert(has_opcode(fn, OP_LT_INT_CONST));
+  assert(has_opcode(fn, OP_SUB_INT_CONST));
+  assert(has_opcode(fn, OP_ADD_INT_INT));
+  assert(!has_opcode(fn, OP_ADD));
+  ASSERT_EQ("%" PRIu64, vm->deopts, (uint64_t)0);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // the forms are only written while quickening is on
+  vm = run_interpreted("let f = fn(x) { x - 1 }; f(3);", &compiler, false,
+                       false, &fn);
+  assert(has_opcode(fn, OP_SUB) && !has_opcode(fn, OP_SUB_INT_CONST));
+  ASSERT_EQ("%" PRIu64, vm->quickened, (uint64_t)0);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // failed guards fall back to the generic instruction with the same result
+  vm = run_interpreted(
+      "let add = fn(a, b) { a + b }; let inc = fn(a) { a + 1 }; "
+      "let zero = fn(a) { a == 0 }; let r = [add(1, 2), inc(1), zero(0)]; "
+      "[add(\"a\", \"b\"), inc(9223372036854775807), zero(true), "
+      "add(3, 4)];",
+      &compiler, true, false, &fn);
+  String result = value_inspect(vm_last_popped(vm));
+  assert(strcmp(result.chars, "[ab, 9223372036854775808, false, 7]") == 0);
+  // the operator behind a fused constant may have been quickened as well
+  assert(vm->deopts >= 3);
+  // the site saw integers again after its deopt
+  assert(has_opcode(fn, OP_ADD_INT_INT));
+  free_string(&result);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  TEST_PASSED;
+}
+
+void test_vm_superinstructions(void) {
+  TEST_STARTED;
+  Compiler *compiler;
+  CompiledFunction *fn;
+
+  const char *fib = "let fib = fn(x) { if (x < 2) { x } else { "
+                    "fib(x - 1) + fib(x - 2) } }; fib(15);";
+  VM *vm = run_interpreted(fib, &compiler, false, true, &fn);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(610));
+  assert(has_opcode(fn, OP_LOCAL_CONST_LT_JUMP_FALSE));
+  assert(has_opcode(fn, OP_LOCAL_CONST_SUB));
+  // the fused instructions are still in place behind the first one
+  assert(has_opcode(fn, OP_CONSTANT) && has_opcode(fn, OP_JUMP_FALSE));
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // fusing a listing again leaves it as it is
+  vm = run_interpreted("let f = fn(a, b) { let c = a + b; for (i in 0..c) { "
+                       "let c = c - 1; } a * 3 }; f(2, 3);",
+                       &compiler, false, true, &fn);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(6));
+  assert(has_opcode(fn, OP_GET_LOCAL_2));
+  assert(has_opcode(fn, OP_LOCAL_LOCAL_LT_JUMP_FALSE));
+  assert(has_opcode(fn, OP_LOCAL_CONST_MUL));
+  Instructions fused = instructions_clone(&fn->instructions);
+  instructions_fuse(&fused);
+  assert(memcmp(fused.data, fn->instructions.data, fused.size) == 0);
+  free_instructions(&fused);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // operands that are not integers run the sequence one by one
+  const char *mixed =
+      "let add = fn(a) { a + 1 }; let dbl = fn(a) { a * 2 }; "
+      "let zero = fn(a) { if (a == 0) { 1 } else { 2 } }; "
+      "let sq = fn(a) { a * a }; [add(1), add(9223372036854775807), "
+      "dbl(9223372036854775807 + 1), zero(0), zero(\"a\"), zero(true), sq(3)];";
+  for (int i = 0; i < 2; i++) {
+    vm = run_interpreted(mixed, &compiler, i == 1, true, &fn);
+    String result = value_inspect(vm_last_popped(vm));
+    assert(strcmp(result.chars, "[2, 9223372036854775808, "
+                                "18446744073709551616, 1, 2, 2, 9]") == 0);
+    free_string(&result);
+    free_vm(vm);
+    free_compiler(compiler);
+  }
+
+  TEST_PASSED;
+}
+
+void test_vm_region_arguments(void) {
+  TEST_STARTED;
+  Compiler *compiler;
+  CompiledFunction *fn;
+
+  VM *vm = run_interpreted(
+      "let twice = fn(f, x) { f(f(x)) }; "
+      "let sum = fn(xs) { xs[0] + xs[1] + len(xs) }; "
+      "let run = fn(n) { let acc = 0; for (i in 0..n) { "
+      "let acc = acc + twice(fn(x) { x + i }, 1) + sum([i, 1]); } acc }; "
+      "run(100);",
+      &compiler, true, true, &fn);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(15250));
+  ASSERT_EQ("%" PRIu64, vm->heap->stats.region_objects, UINT64_C(200));
+  ASSERT_EQ("%d", vm->heap->region_objects.size, 0);
+  ASSERT_EQ("%d", vm->num_regions, 0);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // a return among the arguments leaves the region before the frame
+  vm = run_interpreted(
+      "let twice = fn(f, x) { f(f(x)) }; "
+      "let g = fn(c) { twice(fn(x) { x + 5 }, if (c) { return 1; } else { "
+      "10 }) + 0 }; "
+      "let run = fn(n) { let acc = 0; for (i in 0..n) { "
+      "let acc = acc + g(i < 250); } acc }; run(500);",
+      &compiler, true, true, &fn);
+  ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(5250));
+  assert(vm->verified);
+  ASSERT_EQ("%" PRIu64, vm->heap->stats.region_objects, UINT64_C(500));
+  ASSERT_EQ("%d", vm->heap->region_objects.size, 0);
+  ASSERT_EQ("%d", vm->num_regions, 0);
+  free_vm(vm);
+  free_compiler(compiler);
+
+  // returned, captured, stored or bound arguments stay on the heap
+  const char *escaping[] = {
+      "let keep = fn(f) { f }; let g = keep(fn(x) { x * 2 }); g(21);",
+      "let wrap = fn(f) { fn(x) { f(x) } }; wrap(fn(x) { x * 2 })(21);",
+      "let box = fn(a) { push([], a) }; box([42])[0][0];",
+      "let name = fn(a) { let b = a; b }; name([42])[0];",
+      "let first = fn(a) { if (true) { a } else { [] } }; first([42])[0];",
+      // bound again after the caller was compiled
+      "let apply = fn(f) { f(1) }; let call = fn() { apply(fn(x) { x }) }; "
+      "let apply = fn(f) { f }; call()(42);",
+  };
+  for (size_t i = 0; i < sizeof(escaping) / sizeof(escaping[0]); i++) {
+    vm = run_interpreted(escaping[i], &compiler, true, true, &fn);
+    ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(42));
+    ASSERT_EQ("%" PRIu64, vm->heap->stats.region_objects, UINT64_C(0));
+    free_vm(vm);
+    free_compiler(compiler);
+  }
+
+  TEST_PASSED;
+}
+
+// result or error of `bytecode` with pmap and preduce split over `workers`
+// threads however short the array, or on the calling thread for 0
+static String run_parallel(Bytecode bytecode, int32_t workers) {
+  VM *vm = VM_new(bytecode);
+  vm->parallel_workers = workers;
+  if (workers > 0)
+    vm->parallel_min_length = 0;
+  String out = vm_run(vm) == VM_OK ? value_inspect(vm_last_popped(vm))
+                                   : String_from(vm->error.chars);
+  free_vm(vm);
+  return out;
+}
+
+void test_vm_parallel_builtins(void) {
+  TEST_STARTED;
+  const char *range = "let range = fn(n) { let xs = []; for (i in 0..n) { "
+                      "let xs = push(xs, i); } xs }; ";
+  const struct {
+    const char *input;
+    const char *expected;
+  } tests[] = {
+      {"pmap(range(6), fn(x) { x * x });", "[0, 1, 4, 9, 16, 25]"},
+      {"pmap([], fn(x) { x });", "[]"},
+      {"preduce([], 7, fn(a, b) { a + b });", "7"},
+      {"preduce(range(1000), 0, fn(a, b) { a + b });", "499500"},
+      // the parts are folded in order, concatenation does not commute
+      {"let digits = pmap(range(10), fn(x) { \"\" + [\"0\", \"1\", \"2\", "
+       "\"3\", \"4\", \"5\", \"6\", \"7\", \"8\", \"9\"][x] }); "
+       "preduce(digits, \">\", fn(a, b) { a + b });",
+       ">0123456789"},
+      // captured values and pure globals are copied to the worker heaps and
+      // the results back
+      {"let sq = fn(x) { x * x }; let go = fn(big) { pmap(range(3), fn(x) { "
+       "{\"n\": sq(x) + big, \"s\": \"v\" + \"w\", x: [x]} }) }; "
+       "go(99999999999999999999);",
+       "[{n: 99999999999999999999, s: vw, 0: [0]}, "
+       "{n: 100000000000000000000, s: vw, 1: [1]}, "
+       "{n: 100000000000000000003, s: vw, 2: [2]}]"},
+      {"pmap([[1, 2], [3]], len);", "[2, 1]"},
+      {"pmap(range(4), fn(x) { echo(x) });",
+       "function passed to pmap is not pure"},
+      {"pmap(range(300), fn(x) { 10 / (x - 200) });", "division by zero"},
+      {"preduce(1, 0, len);", "first argument to preduce must be ARRAY, "
+                              "got INTEGER"},
+  };
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    String prelude = STR_NEW(range);
+    String body = STR_NEW(tests[i].input);
+    Parser *p = Parser_new(Lexer_new(String_join(2, &prelude, &body)));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+    Compiler *compiler = Compiler_new();
+    assert(compile_program(compiler, program));
+
+    int32_t workers[] = {0, 1, 4};
+    for (size_t j = 0; j < sizeof(workers) / sizeof(workers[0]); j++) {
+      String out = run_parallel(compiler_bytecode(compiler), workers[j]);
+      if (strcmp(out.chars, tests[i].expected) != 0) {
+        printf("input = %s\nworkers = %d\n", tests[i].input, workers[j]);
+        printf("want = %s\ngot = %s\n", tests[i].expected, out.chars);
+        assert(false);
+      }
+      free_string(&out);
+    }
+
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+
+  TEST_PASSED;
+}
+
+// inspected result of `source`, or its error
+static String eval_in(FizzContext *ctx, const char *source) {
+  Value out;
+  return fizz_eval(ctx, source, &out) ? value_inspect(out)
+                                      : String_clone(&ctx->error);
+}
+
+void test_context_programs(void) {
+  TEST_STARTED;
+  FizzContext *ctx = FizzContext_new();
+  const struct {
+    const char *input;
+    const char *expected;
+  } steps[] = {
+      {"let a = 20; let f = fn(x) { x * 2 }; f(a);", "40"},
+      // later programs see the globals and functions of the earlier ones
+      {"let b = f(a) + 2; b;", "42"},
+      {"let s = \"ab\"; s + s;", "abab"},
+      {"let c = ;", "no prefix parse function"},
+      {"d;", "compile error: undefined variable d"},
+      {"f(a) / 0;", "division by zero"},
+      // a runtime error leaves the VM ready for the next program
+      {"let g = fn(n) { if (n < 2) { n } else { g(n - 1) + g(n - 2) } }; "
+       "g(15) + b;",
+       "652"},
+      {"[a, b, len(s), {\"k\": a}[\"k\"]];", "[20, 42, 2, 20]"},
+  };
+
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    String out = eval_in(ctx, steps[i].input);
+    if (strstr(out.chars, steps[i].expected) == NULL) {
+      printf("input = %s\nwant = %s\ngot = %s\n", steps[i].input,
+             steps[i].expected, out.chars);
+      assert(false);
+    }
+    free_string(&out);
+  }
+
+  free_fizz_context(ctx);
+  TEST_PASSED;
+}
+
+typedef struct ContextThread {
+  pthread_t thread;
+  int32_t seed;
+  // programs whose result did not match
+  int32_t failures;
+} ContextThread;
+
+// builds its own context, defines a few functions and calls them over and
+// over, every allocation and JIT compilation stays inside the context
+static void *run_context_thread(void *arg) {
+  ContextThread *self = arg;
+  FizzContext *ctx = FizzContext_new();
+  ctx->vm->heap->stress = self->seed % 4 == 0;
+  ctx->vm->jit_threshold = self->seed % 2 == 0 ? 2 : 0;
+
+  Value out;
+  if (!fizz_eval(ctx,
+                 "let fib = fn(x) { if (x < 2) { x } else { "
+                 "fib(x - 1) + fib(x - 2) } }; "
+                 "let big = @memo fn(n) { if (n == 0) { 1 } else { "
+                 "big(n - 1) * 1000000007 } }; "
+                 "let words = fn(n) { let s = \"\"; for (i in 0..n) { "
+                 "let s = s + \"ab\"; } len(s) }; "
+                 "let rec = fn(n) { {\"n\": n, \"sq\": [n * n]} };",
+                 &out))
+    self->failures++;
+
+  for (int32_t round = 0; round < 20; round++) {
+    int32_t n = self->seed + round;
+    char source[160];
+    snprintf(source, sizeof(source),
+             "fib(%d) + words(%d) + rec(%d)[\"sq\"][0] + "
+             "len(push([1], big(%d)));",
+             n % 15, n, n, n % 6);
+    // fib(k) for k up to 14
+    int64_t fib[15] = {0, 1};
+    for (int32_t k = 2; k < 15; k++)
+      fib[k] = fib[k - 1] + fib[k - 2];
+    int64_t expected = fib[n % 15] + 2 * n + (int64_t)n * n + 2;
+
+    if (!fizz_eval(ctx, source, &out) || !IS_INT(out) ||
+        out.as.integer != expected)
+      self->failures++;
+  }
+
+  free_fizz_context(ctx);
+  return NULL;
+}
+
+void test_context_threads(void) {
+  TEST_STARTED;
+  enum { NUM_THREADS = 8 };
+  ContextThread threads[NUM_THREADS];
+  for (int32_t i = 0; i < NUM_THREADS; i++) {
+    threads[i] = (ContextThread){.seed = i, .failures = 0};
+    int failed = pthread_create(&threads[i].thread, NULL, run_context_thread,
+                                &threads[i]);
+    assert(failed == 0);
+  }
+  for (int32_t i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i].thread, NULL);
+    ASSERT_EQ("%d", threads[i].failures, 0);
+  }
+
+  TEST_PASSED;
+}
+
+typedef struct FrozenThread {
+  pthread_t thread;
+  FrozenProgram *program;
+  int32_t seed;
+  int32_t failures;
+} FrozenThread;
+
+// runs the top level in a VM of its own, then calls `score` with the
+// arguments of this thread
+static void *run_frozen_thread(void *arg) {
+  FrozenThread *self = arg;
+  VM *vm = VM_new_frozen(self->program);
+  vm->heap->stress = self->seed % 4 == 0;
+  if (vm_run(vm) != VM_OK)
+    self->failures++;
+
+  int32_t score = frozen_program_global(self->program, "score");
+  int64_t fib[15] = {0, 1};
+  for (int32_t k = 2; k < 15; k++)
+    fib[k] = fib[k - 1] + fib[k - 2];
+  for (int32_t round = 0; round < 20; round++) {
+    int32_t n = (self->seed + round) % 15;
+    Value arg = INT_VAL(n), out;
+    // read again every time, collections move the closure
+    if (!vm_call(vm, vm->globals[score], &arg, 1, &out) || !IS_INT(out) ||
+        out.as.integer != fib[n] + (int64_t)n * n + 4)
+      self->failures++;
+  }
+
+  free_vm(vm);
+  return NULL;
+}
+
+// bytes of every function in the program, summed
+static uint64_t frozen_code_sum(const FrozenProgram *program) {
+  uint64_t sum = 0;
+  for (int32_t i = 0; i < program->constants.size; i++) {
+    Value constant = program->constants.data[i];
+    if (!IS_OBJ_TYPE(constant, OBJ_FUNCTION))
+      continue;
+    const Instructions *ins =
+        &((const CompiledFunction *)constant.as.obj)->instructions;
+    for (int32_t j = 0; j < ins->size; j++)
+      sum = sum * 31 + ins->data[j];
+  }
+  return sum;
+}
+
+void test_frozen_program_threads(void) {
+  TEST_STARTED;
+  Parser *p = Parser_new(Lexer_new(String_from(
+      "let fib = fn(x) { if (x < 2) { x } else { fib(x - 1) + fib(x - 2) } };"
+      "let score = fn(n) { let r = {\"n\": n, \"sq\": [n * n]}; "
+      "fib(n) + r[\"sq\"][0] + len(\"ab\" + \"cd\") };")));
+  Program *source = parse_program(p);
+  check_parser_errors(p);
+  Compiler *compiler = Compiler_new();
+  assert(compile_program(compiler, source));
+  FrozenProgram *program = program_freeze(compiler, true);
+  free_compiler(compiler);
+  free_program(source);
+  free_parser(p);
+
+  ASSERT_EQ("%d", frozen_program_global(program, "fib"), 0);
+  ASSERT_EQ("%d", frozen_program_global(program, "score"), 1);
+  ASSERT_EQ("%d", frozen_program_global(program, "missing"), -1);
+  uint64_t code = frozen_code_sum(program);
+
+  enum { NUM_THREADS = 8 };
+  FrozenThread threads[NUM_THREADS];
+  for (int32_t i = 0; i < NUM_THREADS; i++) {
+    threads[i] = (FrozenThread){.program = program, .seed = i};
+    int failed = pthread_create(&threads[i].thread, NULL, run_frozen_thread,
+                                &threads[i]);
+    assert(failed == 0);
+  }
+  for (int32_t i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i].thread, NULL);
+    ASSERT_EQ("%d", threads[i].failures, 0);
+  }
+
+  // nothing was quickened, and every VM let go of the program
+  assert(frozen_code_sum(program) == code);
+  ASSERT_EQ("%d", program->refs, 1);
+  frozen_program_release(program);
+
+  TEST_PASSED;
+}
+
+// compiles the expression statement `source` for batch evaluation, NULL
+// with `error` set when it does not compile
+static BatchProgram *batch_program(const char *source, String *error) {
+  Parser *p = Parser_new(Lexer_new(String_from(source)));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  const Statement *statement = program->statements.data[0];
+  assert(statement->vt->kind == NODE_EXPR_STATEMENT);
+  BatchProgram *batch =
+      batch_compile(((const ExpressionStatement *)statement)->expr, error);
+  free_program(program);
+  free_parser(p);
+  return batch;
+}
+
+void test_batch_expressions(void) {
+  TEST_STARTED;
+  // not a multiple of the chunk, nor of the vector width
+  enum { ROWS = 2 * BATCH_CHUNK + 77 };
+  int64_t *x = malloc(sizeof(int64_t) * ROWS);
+  int64_t *y = malloc(sizeof(int64_t) * ROWS);
+  int64_t *out = malloc(sizeof(int64_t) * ROWS);
+  uint64_t selection[(ROWS + 63) / 64];
+  for (int64_t i = 0; i < ROWS; i++) {
+    x[i] = i * 7 % 23 - 11;
+    y[i] = i % 5 - 2;
+  }
+  String error;
+
+  BatchProgram *filter = batch_program("x * 2 + y > 10", &error);
+  assert(filter != NULL);
+  ASSERT_EQ("%d", filter->type, BATCH_BOOL);
+  ASSERT_EQ("%d", batch_column(filter, "x"), 0);
+  ASSERT_EQ("%d", batch_column(filter, "y"), 1);
+  ASSERT_EQ("%d", batch_column(filter, "z"), -1);
+  const int64_t *xy[] = {x, y};
+  memset(selection, 0xff, sizeof(selection));
+  assert(batch_select(filter, xy, ROWS, selection, &error));
+  for (int64_t i = 0; i < ROWS; i++) {
+    bool bit = selection[i / 64] >> (i % 64) & 1;
+    ASSERT_EQ("%d", bit, (x[i] * 2 + y[i] > 10));
+  }
+  // bits past the last row are cleared
+  ASSERT_EQ("%d", (int)(selection[ROWS / 64] >> (ROWS % 64)), 0);
+  free_batch_program(filter);
+
+  // the division only counts in the rows taking its branch, columns are
+  // passed in order of first use
+  BatchProgram *ratio = batch_program(
+      "if (y == 0) { -x } else { if (!(x > 0)) { x * y } else { x / y } }",
+      &error);
+  assert(ratio != NULL);
+  ASSERT_EQ("%d", batch_column(ratio, "y"), 0);
+  const int64_t *yx[] = {y, x};
+  assert(batch_eval(ratio, yx, ROWS, out, &error));
+  for (int64_t i = 0; i < ROWS; i++) {
+    int64_t expected =
+        y[i] == 0 ? -x[i] : (x[i] > 0 ? x[i] / y[i] : x[i] * y[i]);
+    ASSERT_EQ("%" PRId64, out[i], expected);
+  }
+  free_batch_program(ratio);
+
+  const struct {
+    const char *source;
+    int64_t last_x;
+    const char *error;
+  } failing[] = {
+      {"x / y", 0, "division by zero"},
+      {"x + 1", INT64_MAX, "integer overflow"},
+      {"x * 3", INT64_MAX / 2, "integer overflow"},
+      {"y - x", INT64_MIN, "integer overflow"},
+      {"len(x)", 0, "unsupported in batch expressions: len(x)"},
+      {"x + true", 0, "operands have to be ints: (x + true)"},
+      {"!x", 0, "`!` needs a boolean: (!x)"},
+  };
+  for (size_t i = 0; i < sizeof(failing) / sizeof(failing[0]); i++) {
+    // only the last row fails, in the scalar tail
+    int64_t saved = x[ROWS - 1];
+    if (failing[i].last_x != 0)
+      x[ROWS - 1] = failing[i].last_x;
+    BatchProgram *program = batch_program(failing[i].source, &error);
+    if (program != NULL) {
+      const int64_t *cols[] = {x, y};
+      assert(!batch_eval(program, cols, ROWS, out, &error));
+    }
+    if (strcmp(error.chars, failing[i].error) != 0)
+      ASSERT_EQ("%s", error.chars, failing[i].error);
+    free_string(&error);
+    free_batch_program(program);
+    x[ROWS - 1] = saved;
+  }
+
+  free(x);
+  free(y);
+  free(out);
+  TEST_PASSED;
+}
+
+// result or error message of running `source` on the closure tier
+static String run_tree(const char *source) {
+  Parser *p = Parser_new(Lexer_new(String_from(source)));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  String error;
+  TreeProgram *tree = tree_compile(program, &error);
+  free_program(program);
+  free_parser(p);
+  if (tree == NULL)
+    return error;
+
+  VM *vm = VM_new(tree_program_bytecode(tree));
+  Value result;
+  String out = tree_run(tree, vm, &result) ? value_inspect(result)
+                                           : String_from(vm->error.chars);
+  free_vm(vm);
+  free_tree_program(tree);
+  return out;
+}
+
+void test_tree_programs(void) {
+  TEST_STARTED;
+  const char *inputs[] = {
+      "let fib = fn(x) { if (x < 2) { x } else { fib(x - 1) + fib(x - 2) } };"
+      "fib(20);",
+      "let g = 10; let f = fn(n) { let m = n + g; fn(k) { m * k } }; "
+      "f(1)(2) + f(3)(4);",
+      "let f = fn(n) { let r = {\"a\": n, \"b\": [n, n * 2]}; "
+      "r[\"b\"][1] + r[\"a\"] + len(r) }; f(20);",
+      "let f = fn(s) { s + \"!\" }; f(f(\"hi\"));",
+      "let f = fn(a, b) { [a < b, a > b, a == b, a != b, !a, !!b, -a] }; "
+      "[f(1, 2), f(2, 2), f(true, false), f(\"x\", \"x\")];",
+      "let f = fn(a) { a * a * a - a * a * a + 1 }; f(9223372036);",
+      "let a = 9223372036854775807; [a + 1, a * a / a, 99999999999999999999];",
+      "let fact = fn(n) { let acc = 1; "
+      "for (i in 1..n + 1) { let acc = acc * i; } acc }; fact(25);",
+      "let n = 0; for (let i = 0; i < 4; let i = i + 1) { let n = n + i; } "
+      "n * 10 + i;",
+      "let find = fn(limit) { for (i in 0..limit) { "
+      "if (i * i > 50) { return i; } } -1 }; find(100) * 10 + find(5);",
+      "let g = fn() { let f = 0; "
+      "for (i in 0..3) { if (i == 1) { let f = fn() { i }; } } f }; g()();",
+      "let a = push(push([], 1), \"two\"); [len(a), a[1], a];",
+      "let apply = fn(f, x) { f(x) }; apply(len, \"four\") + apply(fn(y) { "
+      "y * 2 }, 5);",
+      "if (1 > 2) { 10 }",
+      "let f = fn() { return 7; 8 }; f();",
+      "return 3; 4;",
+      // runtime errors
+      "let f = fn(a) { a / 0 }; f(3);",
+      "let f = fn(a) { a + true }; f(1);",
+      "let f = fn(a, b) { a }; f(1);",
+      "let f = fn(a) { a[1] }; f(2);",
+      "5();",
+      "let f = fn(n) { 1 + f(n + 1) }; f(0);",
+  };
+
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+    Parser *p = Parser_new(Lexer_new(String_from(inputs[i])));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+    Compiler *compiler = Compiler_new();
+    assert(compile_program(compiler, program));
+
+    int32_t compiled;
+    String expected = run_with_jit(compiler_bytecode(compiler), 0, &compiled);
+    String actual = run_tree(inputs[i]);
+    if (strcmp(actual.chars, expected.chars) != 0) {
+      printf("input = %s\n", inputs[i]);
+      ASSERT_EQ("%s", actual.chars, expected.chars);
+    }
+
+    free_string(&expected);
+    free_string(&actual);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+
+  const char *undefined = "compile error: undefined variable x";
+  String error = run_tree("let f = fn() { x }; f();");
+  if (strcmp(error.chars, undefined) != 0)
+    ASSERT_EQ("%s", error.chars, undefined);
+  free_string(&error);
+
+  // a program runs again on the same VM, and the host calls its functions
+  Parser *p = Parser_new(Lexer_new(String_from(
+      "let calls = 0; let build = fn(n) { let s = \"\"; "
+      "for (i in 0..n) { let s = s + \"ab\"; } len(s) }; "
+      "let calls = calls + 1;")));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  TreeProgram *tree = tree_compile(program, &error);
+  assert(tree != NULL);
+  VM *vm = VM_new(tree_program_bytecode(tree));
+  vm->heap->stress = true;
+  Value result;
+  assert(tree_run(tree, vm, &result));
+  assert(tree_run(tree, vm, &result));
+  ASSERT_EQ("%" PRId64, vm->globals[0].as.integer, (int64_t)1);
+  int64_t total = 0;
+  for (int32_t i = 0; i < 50; i++) {
+    Value arg = INT_VAL(i);
+    assert(vm_call(vm, vm->globals[1], &arg, 1, &result));
+    total += result.as.integer;
+  }
+  ASSERT_EQ("%" PRId64, total, (int64_t)2450);
+  assert(vm->heap->stats.collections > 0);
+  free_vm(vm);
+  free_tree_program(tree);
+  free_program(program);
+  free_parser(p);
+
+  TEST_PASSED;
+}
+
+// C translation of `source`, or the error
+static String emit_c(const char *source, bool *ok) {
+  Parser *p = Parser_new(Lexer_new(String_from(source)));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  String code, error;
+  *ok = aot_emit_c(program, "test.fz", &code, &error);
+  free_program(program);
+  free_parser(p);
+  return *ok ? code : error;
+}
+
+void test_aot_c_translation(void) {
+  TEST_STARTED;
+  bool ok;
+  String code = emit_c(
+      "let limit = 20;"
+      "let fib = fn(x) { if (x < 2) { x } else { fib(x - 1) + fib(x - 2) } };"
+      "let even = fn(n) { if (n < 2) { n == 0 } else { even(n - 2) } };"
+      "let show = fn(a) { echo(a, even(a)); };"
+      "for (i in 0..3) { show(fib(limit + i)); }",
+      &ok);
+  assert(ok);
+  const char *expected[] = {
+      "static int64_t g_limit;",
+      "int64_t fz_fib(int64_t l_x) {",
+      "int64_t t5 = fizz_sub(t4, INT64_C(1));",
+      // calls to itself return what the body does
+      "bool fz_even(int64_t l_n) {",
+      "void fz_show(int64_t l_a) {",
+      "printf(\"%\" PRId64 \" %s\\n\", t0, t2 ? \"true\" : \"false\");",
+      "  while (g_i < INT64_C(3)) {",
+      "#ifndef FIZZ_NO_MAIN",
+  };
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    if (strstr(code.chars, expected[i]) == NULL)
+      printf("missing = %s\n", expected[i]);
+    assert(strstr(code.chars, expected[i]) != NULL);
+  }
+  free_string(&code);
+
+  struct {
+    const char *input;
+    const char *error;
+  } rejected[] = {
+      {"let s = \"x\";", "strings have no C translation: x"},
+      {"let x = 9223372036854775808;",
+       "big int literals have no C translation: 9223372036854775808"},
+      {"let f = fn(a) { a }; let g = fn() { f };",
+       "functions can only be called: f"},
+      {"let f = fn() { let g = fn() { 1 }; g() };",
+       "functions have to be bound by a top level let: let g = fn(){ 1 };"},
+      {"let f = fn(n) { n }; let f = fn(n) { n };",
+       "functions can only be bound once: let f = fn(n){ n };"},
+      {"let f = @memo fn(n) { n };",
+       "@memo functions have no C translation: let f = @memo fn(n){ n };"},
+      {"let f = fn(n) { n }; f(true);", "arguments have to be ints: true"},
+      {"let x = 1; let x = true;",
+       "variables keep the type they were bound with: let x = true;"},
+      // the interpreter would read a null
+      {"let f = fn(n) { if (n > 0) { let y = 1; } y };",
+       "variable may be unbound here: y"},
+      {"len(1);", "builtin has no C translation: len(1)"},
+  };
+  for (size_t i = 0; i < sizeof(rejected) / sizeof(rejected[0]); i++) {
+    String error = emit_c(rejected[i].input, &ok);
+    assert(!ok);
+    if (strcmp(error.chars, rejected[i].error) != 0) {
+      printf("input = %s\n", rejected[i].input);
+      ASSERT_EQ("%s", error.chars, rejected[i].error);
+    }
+    free_string(&error);
+  }
+
+  TEST_PASSED;
+}
+
+static FrozenProgram *freeze_source(const char *source) {
+  Parser *p = Parser_new(Lexer_new(String_from(source)));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  Compiler *compiler = Compiler_new();
+  assert(compile_program(compiler, program));
+  FrozenProgram *frozen = program_freeze(compiler, false);
+  free_compiler(compiler);
+  free_program(program);
+  free_parser(p);
+  return frozen;
+}
+
+// the globals of `program` after running its top level, inspected
+static String frozen_globals_string(FrozenProgram *program) {
+  VM *vm = VM_new_frozen(program);
+  assert(vm_run(vm) == VM_OK);
+  StringArray values = string_array_init(program->num_globals + 1);
+  for (int32_t i = 0; i < program->num_globals; i++)
+    string_array_push(&values, value_inspect(vm->globals[i]));
+  String out = string_array_join(&values, STR_NEW(", "));
+  free_string_array(&values);
+  free_vm(vm);
+  return out;
+}
+
+// error of loading `size` bytes of `data` written to `path`
+static String fzc_load_error(const char *path, const uint8_t *data,
+                             size_t size) {
+  FILE *file = fopen(path, "wb");
+  assert(file != NULL);
+  assert(fwrite(data, 1, size, file) == size);
+  fclose(file);
+  String error;
+  FrozenProgram *program = fzc_load(path, &error);
+  assert(program == NULL);
+  return error;
+}
+
+void test_fzc_files(void) {
+  TEST_STARTED;
+  const char *path = "fizz_test_program.fzc";
+  const char *broken_path = "fizz_test_broken.fzc";
+  FrozenProgram *frozen = freeze_source(
+      "let fib = fn(x) { if (x < 2) { x } else { fib(x - 1) + fib(x - 2) } };"
+      "let score = fn(n) { let r = {\"n\": n, \"sq\": [n * n]}; "
+      "fib(n) + r[\"sq\"][0] + len(\"ab\" + \"cd\") };"
+      "let big = 123456789012345678901234567890 * 2;"
+      "let fibonacci = @memo fn(x) { if (x < 2) { x } else { "
+      "fibonacci(x - 1) + fibonacci(x - 2) } };"
+      "let add = fn(k) { fn(x) { x + k } };"
+      "let words = [\"one\", \"two\"];"
+      "let total = add(fib(10))(fibonacci(60)) + score(3);");
+
+  String error;
+  bool written = fzc_write(frozen, path, &error);
+  if (!written)
+    printf("%s\n", error.chars);
+  assert(written);
+  assert(fzc_is_file(path));
+
+  FrozenProgram *loaded = fzc_load(path, &error);
+  if (loaded == NULL)
+    printf("%s\n", error.chars);
+  assert(loaded != NULL);
+  assert(loaded->mapping != NULL);
+  assert(loaded->verified);
+  ASSERT_EQ("%d", loaded->num_globals, frozen->num_globals);
+  ASSERT_EQ("%d", frozen_program_global(loaded, "score"), 1);
+
+  // the same constants and code, and the same results
+  String listing = fzc_disassemble(frozen);
+  String loaded_listing = fzc_disassemble(loaded);
+  if (strcmp(listing.chars, loaded_listing.chars) != 0)
+    ASSERT_EQ("%s", loaded_listing.chars, listing.chars);
+  const char *fib_line = "fn fib (parameters 1, locals 1, pure)";
+  assert(strstr(listing.chars, fib_line) != NULL);
+  assert(strstr(listing.chars, "OP_RETURN_VALUE") != NULL);
+  String globals = frozen_globals_string(frozen);
+  String loaded_globals = frozen_globals_string(loaded);
+  if (strcmp(globals.chars, loaded_globals.chars) != 0)
+    ASSERT_EQ("%s", loaded_globals.chars, globals.chars);
+  assert(strstr(globals.chars, "246913578024691357802469135780") != NULL);
+
+  // VMs on other threads share the code of the mapping
+  enum { NUM_THREADS = 4 };
+  FrozenThread threads[NUM_THREADS];
+  for (int32_t i = 0; i < NUM_THREADS; i++) {
+    threads[i] = (FrozenThread){.program = loaded, .seed = i};
+    int failed = pthread_create(&threads[i].thread, NULL, run_frozen_thread,
+                                &threads[i]);
+    assert(failed == 0);
+  }
+  for (int32_t i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i].thread, NULL);
+    ASSERT_EQ("%d", threads[i].failures, 0);
+  }
+  ASSERT_EQ("%d", loaded->refs, 1);
+
+  // a saved loaded program gives the same file again
+  const char *copy_path = "fizz_test_copy.fzc";
+  assert(fzc_write(loaded, copy_path, &error));
+  FILE *file = fopen(path, "rb");
+  assert(file != NULL);
+  uint8_t data[8192];
+  size_t size = fread(data, 1, sizeof(data), file);
+  fclose(file);
+  assert(size > 0 && size < sizeof(data));
+  file = fopen(copy_path, "rb");
+  assert(file != NULL);
+  uint8_t copy[8192];
+  assert(fread(copy, 1, sizeof(copy), file) == size);
+  fclose(file);
+  assert(memcmp(data, copy, size) == 0);
+
+  const char *expected = "file size does not match";
+  error = fzc_load_error(broken_path, data, size - 1);
+  if (strcmp(error.chars, expected) != 0)
+    ASSERT_EQ("%s", error.chars, expected);
+  free_string(&error);
+
+  // the top level is the last payload, its final OP_RETURN the last byte
+  data[size - 1] = 0xff;
+  expected = "unknown opcode";
+  error = fzc_load_error(broken_path, data, size);
+  if (strcmp(error.chars, expected) != 0)
+    ASSERT_EQ("%s", error.chars, expected);
+  free_string(&error);
+  data[size - 1] = OP_POP;
+  expected = "code does not end by returning";
+  error = fzc_load_error(broken_path, data, size);
+  if (strcmp(error.chars, expected) != 0)
+    ASSERT_EQ("%s", error.chars, expected);
+  free_string(&error);
+
+  data[0] = 'X';
+  expected = "not a .fzc file";
+  error = fzc_load_error(broken_path, data, size);
+  if (strcmp(error.chars, expected) != 0)
+    ASSERT_EQ("%s", error.chars, expected);
+  free_string(&error);
+  assert(!fzc_is_file(broken_path));
+
+  // more locals or parameters than one byte addresses are rejected on load
+  for (int32_t i = 0; i < frozen->constants.size; i++) {
+    if (!IS_OBJ_TYPE(frozen->constants.data[i], OBJ_FUNCTION))
+      continue;
+    CompiledFunction *fn = (CompiledFunction *)frozen->constants.data[i].as.obj;
+    int32_t num_locals = fn->num_locals;
+    fn->num_locals = INT32_MAX;
+    assert(fzc_write(frozen, broken_path, &error));
+    fn->num_locals = num_locals;
+    FrozenProgram *program = fzc_load(broken_path, &error);
+    assert(program == NULL);
+    expected = "malformed function";
+    if (strcmp(error.chars, expected) != 0)
+      ASSERT_EQ("%s", error.chars, expected);
+    free_string(&error);
+    break;
+  }
+
+  // nothing in a file proves a region allocation stays in its region, the
+  // loaded code allocates on the heap instead
+  FrozenProgram *regions = freeze_source(
+      "let sum = fn(xs) { xs[0] + xs[1] };"
+      "let twice = fn(n) { sum([n, n]) + sum([n, 1]) };"
+      "let total = twice(4);");
+  assert(fzc_write(regions, broken_path, &error));
+  FrozenProgram *loaded_regions = fzc_load(broken_path, &error);
+  assert(loaded_regions != NULL && loaded_regions->verified);
+  const CompiledFunction *twice = NULL;
+  for (int32_t i = 0; i < regions->constants.size; i++) {
+    Value constant = regions->constants.data[i];
+    if (IS_OBJ_TYPE(constant, OBJ_FUNCTION) &&
+        strcmp(((CompiledFunction *)constant.as.obj)->name.chars, "twice") ==
+            0) {
+      assert(has_opcode((CompiledFunction *)constant.as.obj, OP_REGION_ARRAY));
+      twice = (CompiledFunction *)loaded_regions->constants.data[i].as.obj;
+    }
+  }
+  assert(twice != NULL);
+  assert(!has_opcode(twice, OP_REGION_ARRAY) && has_opcode(twice, OP_ARRAY));
+  assert(twice->instructions.capacity > 0);
+  String region_globals = frozen_globals_string(loaded_regions);
+  expected = "Closure[sum], Closure[twice], 13";
+  if (strcmp(region_globals.chars, expected) != 0)
+    ASSERT_EQ("%s", region_globals.chars, expected);
+  free_string(&region_globals);
+  frozen_program_release(loaded_regions);
+  frozen_program_release(regions);
+
+  remove(path);
+  remove(copy_path);
+  remove(broken_path);
+  free_string(&listing);
+  free_string(&loaded_listing);
+  free_string(&globals);
+  free_string(&loaded_globals);
+  frozen_program_release(loaded);
+  frozen_program_release(frozen);
+  TEST_PASSED;
+}
+
+typedef struct VerifyCase {
+  // opcode and operands of each instruction, ended by a -1 opcode
+  int32_t code[8][3];
+  const char *expected;
+} VerifyCase;
+
+static Instructions verify_case_code(const VerifyCase *test) {
+  Instructions ins = instructions_init(0);
+  for (int32_t i = 0; test->code[i][0] >= 0; i++)
+    instructions_emit(&ins, (Opcode)test->code[i][0], test->code[i][1],
+                      test->code[i][2]);
+  return ins;
+}
+
+void test_bytecode_verifier(void) {
+  TEST_STARTED;
+  // every function the compiler makes passes, with the stack it needs
+  Parser *p = Parser_new(Lexer_new(String_from(
+      "let add = fn(a, b) { a + b };"
+      "let make = fn(k) {"
+      "  fn(x) { if (x > k) { [x, k] } else { {\"x\": x} } } };"
+      "let total = 0;"
+      "for (i in 0..10) { let total = add(total, make(i)(20)[0]); } total;"
+      // returns out of the region of the call
+      "let twice = fn(f, x) { f(f(x)) };"
+      "let early = fn(c) { twice(fn(x) { x + 5 }, "
+      "  if (c) { return 1; } else { 10 }) + 0 };"
+      "early(true) + early(false);")));
+  Program *program = parse_program(p);
+  check_parser_errors(p);
+  Compiler *compiler = Compiler_new();
+  assert(compile_program(compiler, program));
+  VM *vm = VM_new(compiler_bytecode(compiler));
+  assert(vm->verified);
+  assert(vm->main_fn->max_stack >= 0);
+  for (int32_t i = 0; i < compiler->constants.size; i++) {
+    Value constant = compiler->constants.data[i];
+    if (!IS_OBJ_TYPE(constant, OBJ_FUNCTION))
+      continue;
+    const CompiledFunction *fn = (const CompiledFunction *)constant.as.obj;
+    assert(fn->max_stack >= 0);
+    if (fn->name.chars != NULL && strcmp(fn->name.chars, "add") == 0)
+      ASSERT_EQ("%d", fn->max_stack, 2);
+  }
+  assert(vm_run(vm) == VM_OK);
+  free_vm(vm);
+  free_compiler(compiler);
+  free_program(program);
+  free_parser(p);
+
+  // 0 an int, 1 a function reading one free variable
+  ValuesArray constants = values_array_init(2);
+  values_push(&constants, INT_VAL(7));
+  Instructions capture_code = instructions_init(0);
+  instructions_emit(&capture_code, OP_GET_FREE, 0, 0);
+  instructions_emit(&capture_code, OP_RETURN_VALUE, 0, 0);
+  values_push(&constants, OBJ_VAL(compiled_function_new(
+                              capture_code, 0, 0, String_from("capture"))));
+  BytecodeLimits limits = {.constants = &constants,
+                           .num_globals = 1,
+                           .num_call_sites = 1,
+                           .num_shape_sites = 1};
+
+  VerifyCase tests[] = {
+      {{{OP_CONSTANT, 0, 0}, {OP_CONSTANT, 0, 0}, {OP_ADD, 0, 0},
+        {OP_POP, 0, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       NULL},
+      {{{OP_POP, 0, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "stack underflow at 0 in the top level"},
+      {{{OP_CONSTANT, 5, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "constant index out of range at 0 in the top level"},
+      {{{OP_JUMP, 1, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "jump into the middle of an instruction at 1 in the top level"},
+      {{{OP_JUMP, 40, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "jump target out of range at 0 in the top level"},
+      {{{OP_TRUE, 0, 0}, {OP_JUMP_FALSE, 7, 0}, {OP_CONSTANT, 0, 0},
+        {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "stack heights differ where paths meet at 7 in the top level"},
+      {{{OP_CONSTANT, 0, 0}, {-1, 0, 0}},
+       "code runs off its end at 3 in the top level"},
+      {{{OP_GET_LOCAL, 0, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "local slot out of range at 0 in the top level"},
+      {{{OP_GET_GLOBAL, 3, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "global index out of range at 0 in the top level"},
+      {{{OP_GET_FREE, 0, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "free variable out of range at 0 in the top level"},
+      {{{OP_CLOSURE, 0, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "closure of a constant that is not a function at 0 in the top level"},
+      {{{OP_CLOSURE, 1, 0}, {OP_POP, 0, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "closure captures fewer values than its function reads at 0 in the "
+       "top level"},
+      {{{OP_LEAVE_REGION, 0, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "region left without entering it at 0 in the top level"},
+      {{{OP_ADD_INT_CONST, 0, 0}, {OP_RETURN, 0, 0}, {-1, 0, 0}},
+       "fused constant without its operator at 0 in the top level"},
+      {{{OP_CONSTANT, 0, 0}, {OP_GET_FIELD, 0, 0}, {OP_RETURN, 0, 0},
+        {-1, 0, 0}},
+       "field key that is not a string at 3 in the top level"},
+  };
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    CompiledFunction *main_fn =
+        compiled_function_new(verify_case_code(&tests[i]), 0, 0, STR_NULL);
+    String error;
+    bool ok = bytecode_verify(main_fn, &limits, &error);
+    if (tests[i].expected == NULL) {
+      assert(ok);
+      ASSERT_EQ("%d", main_fn->max_stack, 2);
+    } else {
+      assert(!ok);
+      ASSERT_EQ("%d", main_fn->max_stack, -1);
+      if (strcmp(error.chars, tests[i].expected) != 0)
+        ASSERT_EQ("%s", error.chars, tests[i].expected);
+    }
+    free_string(&error);
+    object_free((Object *)main_fn);
+  }
+  // passed on the first call and not looked at again
+  ASSERT_EQ("%d",
+            ((CompiledFunction *)constants.data[1].as.obj)->max_stack, 1);
+
+  // code the verifier rejects runs checked, failing where it goes wrong
+  VerifyCase runs[] = {
+      // heights differ where paths meet, the path taken is fine
+      {{{OP_TRUE, 0, 0}, {OP_JUMP_FALSE, 7, 0}, {OP_CONSTANT, 0, 0},
+        {OP_POP, 0, 0}, {-1, 0, 0}},
+       NULL},
+      {{{OP_CONSTANT, 0, 0}, {OP_ADD, 0, 0}, {-1, 0, 0}},
+       "malformed bytecode: stack underflow at 3"},
+      {{{OP_GET_GLOBAL, 3, 0}, {-1, 0, 0}},
+       "malformed bytecode: global index out of range at 0"},
+      // into the operand of the jump, decoded as an OP_CONSTANT
+      {{{OP_JUMP, 1, 0}, {-1, 0, 0}},
+       "malformed bytecode: constant index out of range at 1"},
+      {{{OP_CONSTANT, 0, 0}, {OP_GET_FIELD, 0, 0}, {-1, 0, 0}},
+       "malformed bytecode: field key that is not a string at 3"},
+  };
+  for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+    Instructions ins = verify_case_code(&runs[i]);
+    vm = VM_new((Bytecode){.instructions = &ins,
+                           .constants = &constants,
+                           .num_globals = 1,
+                           .num_call_sites = 0,
+                           .num_shape_sites = 1});
+    assert(!vm->verified);
+    VMResult result = vm_run(vm);
+    if (runs[i].expected == NULL) {
+      ASSERT_EQ("%d", result, VM_OK);
+    } else {
+      ASSERT_EQ("%d", result, VM_RUNTIME_ERROR);
+      if (strcmp(vm->error.chars, runs[i].expected) != 0)
+        ASSERT_EQ("%s", vm->error.chars, runs[i].expected);
+    }
+    free_vm(vm);
+    free_instructions(&ins);
+  }
+
+  // a function the verifier rejects runs checked on its own, the verified
+  // ones around it still run unchecked and get quickened
+  const char *mixed = "let mk = fn(x) { fn() { x } }; let g = fn() { true }; "
+                      "let f = fn(n) { n + 1 }; "
+                      "let run = fn(n) { let acc = 0; for (i in 0..n) { "
+                      "let acc = if (g()) { acc + f(i) } else { 0 }; } acc }; ";
+  struct {
+    VerifyCase g;
+    const char *run;
+  } mixed_runs[] = {
+      // heights differ where paths meet, the path taken returns true
+      {{{{OP_TRUE, 0, 0}, {OP_JUMP_FALSE, 6, 0}, {OP_TRUE, 0, 0},
+         {OP_RETURN_VALUE, 0, 0}, {OP_RETURN_VALUE, 0, 0}, {-1, 0, 0}},
+        NULL},
+       "run(100);"},
+      {{{{OP_TRUE, 0, 0}, {OP_ADD, 0, 0}, {OP_RETURN_VALUE, 0, 0}, {-1, 0, 0}},
+        "malformed bytecode: stack underflow at 1"},
+       "run(100);"},
+      // a closure of the function mk returns that captures nothing, called
+      // from verified code
+      {{{{OP_CLOSURE, 0, 0}, {OP_RETURN_VALUE, 0, 0}, {-1, 0, 0}},
+        "malformed bytecode: free variable out of range at 0"},
+       "g()();"},
+  };
+  for (size_t i = 0; i < sizeof(mixed_runs) / sizeof(mixed_runs[0]); i++) {
+    String prelude = STR_NEW(mixed);
+    String body = STR_NEW(mixed_runs[i].run);
+    p = Parser_new(Lexer_new(String_join(2, &prelude, &body)));
+    program = parse_program(p);
+    check_parser_errors(p);
+    compiler = Compiler_new();
+    assert(compile_program(compiler, program));
+
+    CompiledFunction *g = NULL, *f = NULL;
+    for (int32_t j = 0; j < compiler->constants.size; j++) {
+      Value constant = compiler->constants.data[j];
+      if (!IS_OBJ_TYPE(constant, OBJ_FUNCTION))
+        continue;
+      CompiledFunction *fn = (CompiledFunction *)constant.as.obj;
+      if (has_opcode(fn, OP_GET_FREE))
+        mixed_runs[i].g.code[0][1] = j;
+      else if (fn->name.chars != NULL && strcmp(fn->name.chars, "g") == 0)
+        g = fn;
+      else if (fn->name.chars != NULL && strcmp(fn->name.chars, "f") == 0)
+        f = fn;
+    }
+    assert(g != NULL && f != NULL);
+    free_instructions(&g->instructions);
+    g->instructions = verify_case_code(&mixed_runs[i].g);
+
+    vm = VM_new(compiler_bytecode(compiler));
+    vm->jit_threshold = 0;
+    assert(!vm->verified);
+    ASSERT_EQ("%d", g->max_stack, -1);
+    assert(f->max_stack >= 0);
+    VMResult result = vm_run(vm);
+    if (mixed_runs[i].g.expected == NULL) {
+      ASSERT_EQ("%d", result, VM_OK);
+      ASSERT_EQ("%" PRId64, vm_last_popped(vm).as.integer, INT64_C(5050));
+      assert(vm->quickened > 0);
+    } else {
+      ASSERT_EQ("%d", result, VM_RUNTIME_ERROR);
+      if (strcmp(vm->error.chars, mixed_runs[i].g.expected) != 0)
+        ASSERT_EQ("%s", vm->error.chars, mixed_runs[i].g.expected);
+    }
+    free_vm(vm);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+
+  free_values(&constants);
+  TEST_PASSED;
+}
+
+void test_gc_roots_and_stats(void) {
+  TEST_STARTED;
+  Heap *heap = Heap_new();
+  // the size class reuse below is only visible without the nursery
+  heap->generational = false;
+  String digits = String_from("123456789012345678901234567890");
+
+  Value kept = bigint_parse(heap, &digits);
+  assert(IS_BIGINT(kept));
+  heap_push_root(heap, &kept);
+  for (int i = 0; i < 10; i++) {
+    Value garbage = bigint_parse(heap, &digits);
+    assert(IS_BIGINT(garbage));
+  }
+
+  heap_collect(heap);
+  ASSERT_EQ("%" PRIu64, heap->stats.collections, UINT64_C(1));
+  ASSERT_EQ("%" PRIu64, heap->stats.objects_freed, UINT64_C(10));
+  assert(heap->stats.bytes_live > 0);
+  assert(heap->stats.bytes_live == heap->bytes_allocated);
+
+  // freed blocks are reused by the next allocation of the same class
+  size_t live = heap->bytes_allocated;
+  Value again = bigint_parse(heap, &digits);
+  assert(IS_BIGINT(again));
+  assert(heap->bytes_allocated == live * 2);
+
+  String inspected = value_inspect(kept);
+  assert(strcmp(inspected.chars, digits.chars) == 0);
+  free_string(&inspected);
+
+  heap_pop_root(heap);
+  heap_collect(heap);
+  ASSERT_EQ("%zu", heap->stats.bytes_live, (size_t)0);
+
+  free_string(&digits);
+  free_heap(heap);
+  TEST_PASSED;
+}
+
+void test_gc_generations(void) {
+  TEST_STARTED;
+  Heap *heap = Heap_new();
+  CompiledFunction *fn =
+      compiled_function_new(instructions_init(0), 0, 0, STR_NULL);
+  Value holder = OBJ_VAL(closure_new(heap, fn, 1));
+  heap_push_root(heap, &holder);
+  assert(heap_is_young(heap, holder.as.obj));
+
+  // copied to a survivor space first, promoted by the second collection
+  heap_collect_minor(heap);
+  assert(heap_is_young(heap, holder.as.obj));
+  heap_collect_minor(heap);
+  assert(!heap_is_young(heap, holder.as.obj));
+  assert(heap->stats.bytes_promoted > 0);
+
+  // a young value only reachable from an old object is found through the
+  // card the write barrier dirtied
+  String digits = String_from("98765432109876543210");
+  Closure *cl = (Closure *)holder.as.obj;
+  cl->free_vars[0] = bigint_parse(heap, &digits);
+  gc_write_barrier(heap, &cl->base, cl->free_vars[0]);
+  for (int i = 0; i < 100; i++) {
+    Value garbage = bigint_parse(heap, &digits);
+    assert(IS_BIGINT(garbage));
+  }
+
+  uint64_t freed = heap->stats.objects_freed;
+  heap_collect_minor(heap);
+  heap_collect_minor(heap);
+  ASSERT_EQ("%" PRIu64, heap->stats.objects_freed - freed, UINT64_C(100));
+  assert(!heap_is_young(heap, cl->free_vars[0].as.obj));
+
+  String inspected = value_inspect(cl->free_vars[0]);
+  assert(strcmp(inspected.chars, digits.chars) == 0);
+  free_string(&inspected);
+
+  heap_collect(heap);
+  ASSERT_EQ("%" PRIu64, heap->stats.minor_collections, UINT64_C(4));
+  ASSERT_EQ("%" PRIu64, heap->stats.collections, UINT64_C(5));
+  inspected = value_inspect(cl->free_vars[0]);
+  assert(strcmp(inspected.chars, digits.chars) == 0);
+  free_string(&inspected);
+
+  heap_pop_root(heap);
+  free_string(&digits);
+  free_heap(heap);
+  object_free((Object *)fn);
+  TEST_PASSED;
+}
+
+void test_gc_concurrent_cycle(void) {
+  TEST_STARTED;
+  Heap *heap = Heap_new();
+  heap->generational = false;
+  heap->mark_threads = 4;
+  CompiledFunction *fn =
+      compiled_function_new(instructions_init(0), 1, 0, STR_NULL);
+  fn->memoize = true;
+  String digits = String_from("123456789012345678901234567890");
+
+  // a long chain keeps the helper threads busy, every link leaves a piece of
+  // garbage behind
+  Value chain = NULL_VAL;
+  heap_push_root(heap, &chain);
+  for (int i = 0; i < 5000; i++) {
+    Closure *cl = closure_new(heap, fn, 1);
+    cl->free_vars[0] = chain;
+    chain = OBJ_VAL(cl);
+    Closure *garbage = closure_new(heap, fn, 1);
+    assert(garbage != NULL);
+  }
+
+  Closure *head = (Closure *)chain.as.obj;
+  head->memo = MemoTable_new(1, 1);
+  Value one = INT_VAL(1);
+  memo_store(head->memo, &one, bigint_parse(heap, &digits));
+
+  heap_start_cycle(heap);
+  assert(heap->phase == GC_MARKING);
+  ASSERT_EQ("%" PRIu64,
+            heap->stats.pauses_by_kind[GC_PAUSE_INITIAL_MARK].count,
+            UINT64_C(1));
+
+  // the cached result moves to a root the cycle never scans, only the
+  // barrier keeps it alive
+  Value two = INT_VAL(2);
+  Value moved = memo_store(head->memo, &two, INT_VAL(0));
+  gc_satb_barrier(heap, moved);
+  heap_push_root(heap, &moved);
+  // allocated black
+  Value late = bigint_parse(heap, &digits);
+  heap_push_root(heap, &late);
+
+  heap_finish_cycle(heap);
+  assert(heap->phase == GC_IDLE);
+  ASSERT_EQ("%" PRIu64, heap->stats.concurrent_cycles, UINT64_C(1));
+  ASSERT_EQ("%" PRIu64, heap->stats.pauses_by_kind[GC_PAUSE_REMARK].count,
+            UINT64_C(1));
+  ASSERT_EQ("%" PRIu64, heap->stats.objects_freed, UINT64_C(5000));
+  assert(gc_pause_percentile_us(&heap->stats.pauses, 1.0) > 0);
+
+  int32_t length = 0;
+  for (Value v = chain; !IS_NULL(v); v = ((Closure *)v.as.obj)->free_vars[0])
+    length++;
+  ASSERT_EQ("%d", length, 5000);
+  String inspected = value_inspect(moved);
+  assert(strcmp(inspected.chars, digits.chars) == 0);
+  free_string(&inspected);
+  inspected = value_inspect(late);
+  assert(strcmp(inspected.chars, digits.chars) == 0);
+  free_string(&inspected);
+
+  heap_pop_root(heap);
+  heap_pop_root(heap);
+  heap_pop_root(heap);
+  free_string(&digits);
+  free_heap(heap);
+  object_free((Object *)fn);
+  TEST_PASSED;
+}
+
+void test_vm_gc_stress(void) {
+  TEST_STARTED;
+  VMTestCase test_cases[] = {
+      {"let make = fn(x) { fn(y) { x + y } }; "
+       "let loop = fn(n, acc) { if (n == 0) { acc } else { "
+       "loop(n - 1, acc + make(n)(1)) } }; loop(2000, 0);",
+       2003000},
+      // cached BigInt results are only reachable through the memo table
+      {"let fact = @memo fn(n) { if (n < 2) { 1 } else { n * fact(n - 1) } }; "
+       "fact(30); fact(30) / fact(29);",
+       30},
+      {"let big = 100000000000000000000; let pair = fn(a) { fn() { a } }; "
+       "let p = pair(big * big); p() / big / big;",
+       1},
+      {"let build = fn(n, acc) { if (n == 0) { acc } else { "
+       "build(n - 1, acc + \"ab\") } }; "
+       "if (build(300, \"\") == build(299, \"ab\")) { 1 } else { 0 }",
+       1},
+      // generic arrays are traced, packed ones are not
+      {"let fill = fn(n, a, b) { if (n == 0) { a[len(a) - 1][0] + "
+       "b[len(b) - 1] } else { fill(n - 1, push(a, [n]), push(b, n)) } }; "
+       "fill(500, [], []);",
+       2},
+      {"let wrap = fn(n, m) { if (n == 0) { m[\"v\"][\"k\"] } else { "
+       "wrap(n - 1, {\"v\": {\"k\": m[\"v\"][\"k\"] + \"x\"}}) } }; "
+       "len(wrap(300, {\"v\": {\"k\": \"\"}}));",
+       300},
+      // region objects are not moved, what they hold is
+      {"let apply = fn(f, xs) { f(xs[0]) + xs[1] }; "
+       "let run = fn(n, acc) { if (n == 0) { acc } else { "
+       "let big = 100000000000000000000 * n; "
+       "run(n - 1, acc + apply(fn(x) { x + big - big }, [n, big]) - big) } }; "
+       "run(300, 0);",
+       45150},
+  };
+
+  // old space collections stop the world on odd rounds
+  for (size_t i = 0; i < 2 * sizeof(test_cases) / sizeof(test_cases[0]);
+       i++) {
+    const VMTestCase *test = &test_cases[i / 2];
+    Parser *p = Parser_new(Lexer_new(String_from(test->input)));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+
+    Compiler *compiler = Compiler_new();
+    assert(compile_program(compiler, program));
+    VM *vm = VM_new(compiler_bytecode(compiler));
+    vm->heap->stress = true;
+    vm->heap->concurrent = i % 2 == 0;
+    if (vm_run(vm) != VM_OK) {
+      printf("input = %s\nruntime error: %s\n", test->input,
+             vm->error.chars);
+      assert(false);
+    }
+
+    Value result = vm_last_popped(vm);
+    assert(IS_INT(result));
+    ASSERT_EQ("%" PRId64, result.as.integer, test->expected);
+    assert(vm->heap->stats.collections > 0);
+
+    free_vm(vm);
+    free_compiler(compiler);
+    free_program(program);
+    free_parser(p);
+  }
+  TEST_PASSED;
+}
+
 typedef struct {
   const char *input;
   int argument_num;
@@ -305,7 +2654,7 @@ void test_if_expression_parsing(void) {
   TEST_PASSED;
 }
 
-void test_integer_literal(Expression *expr, int32_t value);
+void test_integer_literal(Expression *expr, int64_t value);
 
 typedef struct {
   char *input;
@@ -319,6 +2668,53 @@ typedef struct {
   char *input;
   char *expected;
 } TestCase;
+void test_for_statement_parsing(void) {
+  TEST_STARTED;
+  TestCase test_cases[] = {
+      {"for (i in 0..10) { echo(i); }", "for (i in 0..10) {echo(i)}"},
+      {"for (i in a + 1..len(b)) {}", "for (i in (a + 1)..len(b)) {}"},
+      {"for (let i = 0; i < n; let i = i + 1) { x }",
+       "for (let i = 0; (i < n); let i = (i + 1)) {x}"},
+      {"for (;;) {}", "for (; ; ) {}"},
+      {"for (; x;) { let y = 1; }", "for (; x; ) {let y = 1;}"},
+  };
+
+  for (size_t i = 0; i < sizeof(test_cases) / sizeof(test_cases[0]); i++) {
+    Parser *p = Parser_new(Lexer_new(String_from(test_cases[i].input)));
+    Program *program = parse_program(p);
+    check_parser_errors(p);
+
+    ASSERT_EQ("%d", program->statements.size, 1);
+    Statement *st = statements_get(&program->statements, 0);
+    assert(st->vt->kind == NODE_FOR_STATEMENT);
+    String actual = st->vt->string(st);
+    if (strcmp(actual.chars, test_cases[i].expected) != 0) {
+      printf("input = %s\n", test_cases[i].input);
+      ASSERT_EQ("%s", actual.chars, test_cases[i].expected);
+    }
+
+    free_string(&actual);
+    free_program(program);
+    free_parser(p);
+  }
+
+  const char *invalid[] = {
+      "for i in 0..10 {}",
+      "for (i in 0 10) {}",
+      "for (let i = 0; i < 3) {}",
+      "for (i in 0..3)",
+  };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    Parser *p = Parser_new(Lexer_new(String_from(invalid[i])));
+    Program *program = parse_program(p);
+    assert(parser_errors(p)->size > 0);
+    free_program(program);
+    free_parser(p);
+  }
+
+  TEST_PASSED;
+}
+
 void test_operator_precedence_parsing(void) {
   TEST_STARTED;
   TestCase test_cases[] = {
@@ -343,6 +2739,14 @@ void test_operator_precedence_parsing(void) {
       {"3 + 4; -5 * 5", "(3 + 4) ((-5) * 5)"},
       {"5 > 4 == 3 < 4", "((5 > 4) == (3 < 4))"},
       {"3 + 4 * 5 == 3 * 1 + 4 * 5", "((3 + (4 * 5)) == ((3 * 1) + (4 * 5)))"},
+      {"[]", "[]"},
+      {"[1, 2 * 3, a]", "[1, (2 * 3), a]"},
+      {"a * [1, 2, 3, 4][b * c] * d", "((a * ([1, 2, 3, 4][(b * c)])) * d)"},
+      {"add(a * b[2], b[1], 2 * [1, 2][1])",
+       "add((a * (b[2])), (b[1]), (2 * ([1, 2][1])))"},
+      {"{}", "{}"},
+      {"{\"one\": 1, 2: 1 + 1,}", "{one: 1, 2: (1 + 1)}"},
+      {"{a: b}[a] + 1", "(({a: b}[a]) + 1)"},
 
   };
 
@@ -584,6 +2988,34 @@ void test_let_statements(void) {
   TEST_PASSED;
 }
 
+void test_string_tokens(void) {
+  TEST_STARTED;
+  Lexer *l = Lexer_new(String_from("let name = \"Hornet\"; \"\" \"open"));
+
+  Token t = next_token(l);
+  free_token(&t);
+  TokenType expected[] = {TOKEN_LET,    TOKEN_IDENT,  TOKEN_ASSIGN,
+                          TOKEN_STRING, TOKEN_SEMICOLON, TOKEN_STRING,
+                          TOKEN_ILLEGAL};
+  Token tokens[sizeof(expected) / sizeof(expected[0])];
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    tokens[i] = next_token(l);
+    ASSERT_EQ("%s", token_type_to_string(tokens[i].type),
+              token_type_to_string(expected[i]));
+  }
+
+  // the contents point into the input, nothing was copied
+  assert(tokens[3].literal.chars == l->input.chars + 12);
+  ASSERT_EQ("%d", tokens[3].literal.length, 6);
+  assert(strncmp(tokens[3].literal.chars, "Hornet", 6) == 0);
+  ASSERT_EQ("%d", tokens[5].literal.length, 0);
+
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    free_token(&tokens[i]);
+  free_lexer(l);
+  TEST_PASSED;
+}
+
 void test_token_scanning(void) {
   TEST_STARTED;
   const char *input = "let a = 10; "
@@ -803,7 +3235,7 @@ void check_parser_errors(Parser *p) {
 
   assert(false);
 }
-void test_integer_literal(Expression *expr, int32_t value) {
+void test_integer_literal(Expression *expr, int64_t value) {
   IntExpr *int_expr = (IntExpr *)expr;
   assert(int_expr->value == value);
 
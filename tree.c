@@ -0,0 +1,865 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "bigint.h"
+#include "builtins.h"
+#include "code.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+#include "rope.h"
+#include "tree.h"
+#include "vm.h"
+
+#include "cstring.h/cstring.h"
+
+#define TREE_ERROR_MAX 256
+
+// Runners -------------------------------------------------------------------
+
+static bool push(VM *vm, Value value) {
+  if (vm->sp >= STACK_SIZE)
+    return vm_error(vm, "stack overflow");
+  vm->stack[vm->sp++] = value;
+  return true;
+}
+
+#define PUSH(value)                                                            \
+  do {                                                                         \
+    if (!push(vm, (value)))                                                    \
+      return TREE_ERROR;                                                       \
+  } while (0)
+
+// runs `node` in the same function, anything but TREE_NEXT ends the caller
+#define RUN(node)                                                              \
+  do {                                                                         \
+    const TreeNode *node_ = (node);                                            \
+    TreeSignal signal_ = node_->run(node_, vm, base);                          \
+    if (signal_ != TREE_NEXT)                                                  \
+      return signal_;                                                          \
+  } while (0)
+
+static TreeSignal status(bool ok) { return ok ? TREE_NEXT : TREE_ERROR; }
+
+static TreeSignal run_constant(const TreeNode *self, VM *vm, int32_t base) {
+  (void)base;
+  PUSH(self->constant);
+  return TREE_NEXT;
+}
+
+static TreeSignal run_local(const TreeNode *self, VM *vm, int32_t base) {
+  PUSH(vm->stack[base + self->index]);
+  return TREE_NEXT;
+}
+
+static TreeSignal run_global(const TreeNode *self, VM *vm, int32_t base) {
+  (void)base;
+  PUSH(vm->globals[self->index]);
+  return TREE_NEXT;
+}
+
+// the callee sits right below the first local
+static TreeSignal run_free(const TreeNode *self, VM *vm, int32_t base) {
+  const Closure *cl = (const Closure *)vm->stack[base - 1].as.obj;
+  PUSH(cl->free_vars[self->index]);
+  return TREE_NEXT;
+}
+
+static TreeSignal run_current_closure(const TreeNode *self, VM *vm,
+                                      int32_t base) {
+  (void)self;
+  PUSH(vm->stack[base - 1]);
+  return TREE_NEXT;
+}
+
+// stores the value on top of the stack into the slot of `self`
+static void store_slot(const TreeNode *self, VM *vm, int32_t base) {
+  Value value = vm->stack[--vm->sp];
+  if (self->global)
+    vm->globals[self->index] = value;
+  else
+    vm->stack[base + self->index] = value;
+}
+
+static Value load_slot(const TreeNode *self, const VM *vm, int32_t base) {
+  return self->global ? vm->globals[self->index]
+                      : vm->stack[base + self->index];
+}
+
+static TreeSignal run_set(const TreeNode *self, VM *vm, int32_t base) {
+  RUN(self->left);
+  store_slot(self, vm, base);
+  return TREE_NEXT;
+}
+
+// Both operands ints without overflow stay here, everything else goes to
+// the slow path of the VM.
+#define TREE_INT_OP(name, overflow_fn, opcode)                                 \
+  static TreeSignal name(const TreeNode *self, VM *vm, int32_t base) {         \
+    RUN(self->left);                                                           \
+    RUN(self->right);                                                          \
+    Value *operands = &vm->stack[vm->sp - 2];                                  \
+    int64_t result;                                                            \
+    if (IS_INT(operands[0]) && IS_INT(operands[1]) &&                          \
+        !overflow_fn(operands[0].as.integer, operands[1].as.integer,           \
+                     &result)) {                                               \
+      vm->sp--;                                                                \
+      operands[0] = INT_VAL(result);                                           \
+      return TREE_NEXT;                                                        \
+    }                                                                          \
+    return status(vm_binary_op(vm, opcode));                                   \
+  }
+
+TREE_INT_OP(run_add, __builtin_add_overflow, OP_ADD)
+TREE_INT_OP(run_sub, __builtin_sub_overflow, OP_SUB)
+TREE_INT_OP(run_mul, __builtin_mul_overflow, OP_MUL)
+
+#define TREE_COMPARE_OP(name, compare, opcode)                                 \
+  static TreeSignal name(const TreeNode *self, VM *vm, int32_t base) {         \
+    RUN(self->left);                                                           \
+    RUN(self->right);                                                          \
+    Value *operands = &vm->stack[vm->sp - 2];                                  \
+    if (IS_INT(operands[0]) && IS_INT(operands[1])) {                          \
+      vm->sp--;                                                                \
+      operands[0] =                                                            \
+          BOOL_VAL(operands[0].as.integer compare operands[1].as.integer);     \
+      return TREE_NEXT;                                                        \
+    }                                                                          \
+    return status(vm_binary_op(vm, opcode));                                   \
+  }
+
+TREE_COMPARE_OP(run_lt, <, OP_LT)
+TREE_COMPARE_OP(run_gt, >, OP_GT)
+TREE_COMPARE_OP(run_eq, ==, OP_EQ)
+TREE_COMPARE_OP(run_not_eq, !=, OP_NOT_EQ)
+
+// division and whatever operator has no fast path
+static TreeSignal run_binary(const TreeNode *self, VM *vm, int32_t base) {
+  RUN(self->left);
+  RUN(self->right);
+  return status(vm_binary_op(vm, self->op));
+}
+
+static TreeSignal run_not(const TreeNode *self, VM *vm, int32_t base) {
+  RUN(self->left);
+  Value *top = &vm->stack[vm->sp - 1];
+  *top = BOOL_VAL(!value_is_truthy(*top));
+  return TREE_NEXT;
+}
+
+static TreeSignal run_negate(const TreeNode *self, VM *vm, int32_t base) {
+  RUN(self->left);
+  return status(vm_negate(vm));
+}
+
+// statements that leave nothing behind
+static TreeSignal run_statements(const TreeNode *self, VM *vm, int32_t base) {
+  for (int32_t i = 0; i < self->num_children; i++)
+    RUN(self->children[i]);
+  return TREE_NEXT;
+}
+
+// the statements, then the value of the trailing expression or null
+static TreeSignal run_block_value(const TreeNode *self, VM *vm,
+                                  int32_t base) {
+  for (int32_t i = 0; i < self->num_children; i++)
+    RUN(self->children[i]);
+  if (self->left != NULL)
+    return self->left->run(self->left, vm, base);
+  PUSH(NULL_VAL);
+  return TREE_NEXT;
+}
+
+static TreeSignal run_expression_statement(const TreeNode *self, VM *vm,
+                                           int32_t base) {
+  RUN(self->left);
+  vm->last_popped = vm->stack[--vm->sp];
+  return TREE_NEXT;
+}
+
+static TreeSignal run_return(const TreeNode *self, VM *vm, int32_t base) {
+  RUN(self->left);
+  return TREE_RETURN;
+}
+
+static TreeSignal run_if(const TreeNode *self, VM *vm, int32_t base) {
+  RUN(self->left);
+  if (value_is_truthy(vm->stack[--vm->sp]))
+    return self->right->run(self->right, vm, base);
+  if (self->extra != NULL)
+    return self->extra->run(self->extra, vm, base);
+  PUSH(NULL_VAL);
+  return TREE_NEXT;
+}
+
+// `left` binds the counter, `right` is the bound and `extra` the body
+static TreeSignal run_for_range(const TreeNode *self, VM *vm, int32_t base) {
+  RUN(self->left);
+  store_slot(self, vm, base);
+  // the bound stays on the stack for the whole loop
+  RUN(self->right);
+  int32_t bound = vm->sp - 1;
+
+  for (;;) {
+    Value counter = load_slot(self, vm, base);
+    if (IS_INT(counter) && IS_INT(vm->stack[bound])) {
+      if (counter.as.integer >= vm->stack[bound].as.integer)
+        break;
+    } else {
+      PUSH(counter);
+      PUSH(vm->stack[bound]);
+      if (!vm_binary_op(vm, OP_LT))
+        return TREE_ERROR;
+      if (!value_is_truthy(vm->stack[--vm->sp]))
+        break;
+    }
+
+    RUN(self->extra);
+
+    counter = load_slot(self, vm, base);
+    PUSH(counter);
+    if (IS_INT(counter) && counter.as.integer < INT64_MAX) {
+      vm->stack[vm->sp - 1] = INT_VAL(counter.as.integer + 1);
+    } else {
+      PUSH(INT_VAL(1));
+      if (!vm_binary_op(vm, OP_ADD))
+        return TREE_ERROR;
+    }
+    store_slot(self, vm, base);
+  }
+
+  vm->sp--;
+  return TREE_NEXT;
+}
+
+// `left` is the init statement, `right` the condition and `extra` the body
+// followed by the update, each of them can be missing but the body
+static TreeSignal run_for(const TreeNode *self, VM *vm, int32_t base) {
+  if (self->left != NULL)
+    RUN(self->left);
+  for (;;) {
+    if (self->right != NULL) {
+      RUN(self->right);
+      if (!value_is_truthy(vm->stack[--vm->sp]))
+        break;
+    }
+    RUN(self->extra);
+  }
+  return TREE_NEXT;
+}
+
+static TreeSignal run_closure(const TreeNode *self, VM *vm, int32_t base) {
+  for (int32_t i = 0; i < self->num_children; i++)
+    RUN(self->children[i]);
+  return status(vm_make_closure(vm, self->index, self->num_children));
+}
+
+static TreeSignal run_array(const TreeNode *self, VM *vm, int32_t base) {
+  for (int32_t i = 0; i < self->num_children; i++)
+    RUN(self->children[i]);
+  return status(vm_build_array(vm, self->num_children));
+}
+
+static TreeSignal run_map(const TreeNode *self, VM *vm, int32_t base) {
+  for (int32_t i = 0; i < self->num_children; i++)
+    RUN(self->children[i]);
+  return status(vm_build_map(vm, self->num_children / 2));
+}
+
+static TreeSignal run_index(const TreeNode *self, VM *vm, int32_t base) {
+  RUN(self->left);
+  RUN(self->right);
+  return status(vm_index(vm));
+}
+
+bool tree_run_frame(VM *vm) {
+  const Frame *frame = &vm->frames[vm->frame_index];
+  int32_t base = frame->base_pointer;
+  const TreeNode *body = frame->cl->fn->tree;
+  assert(body != NULL);
+  if (body->run(body, vm, base) == TREE_ERROR)
+    return false;
+
+  // a return leaves its value on top like the end of the body does
+  Value result = vm->stack[vm->sp - 1];
+  vm->frame_index--;
+  vm->sp = base - 1;
+  vm->stack[vm->sp++] = result;
+  return true;
+}
+
+// calls the callee at `callee_slot` with the `nargs` values above it and
+// leaves the result in its place
+static TreeSignal call_value(VM *vm, int32_t callee_slot, int32_t nargs) {
+  Value callee = vm->stack[callee_slot];
+  Value *args = &vm->stack[callee_slot + 1];
+  Value result;
+
+  if (IS_BUILTIN(callee)) {
+    if (!builtin_get(callee.as.builtin)->fn(vm, args, nargs, &result))
+      return TREE_ERROR;
+    vm->sp = callee_slot;
+    vm->stack[vm->sp++] = result;
+    return TREE_NEXT;
+  }
+  if (!IS_OBJ_TYPE(callee, OBJ_CLOSURE) ||
+      ((const Closure *)callee.as.obj)->fn->tree == NULL) {
+    // bytecode closures, and the error for anything else
+    if (!vm_call(vm, callee, args, nargs, &result))
+      return TREE_ERROR;
+    vm->sp = callee_slot;
+    vm->stack[vm->sp++] = result;
+    return TREE_NEXT;
+  }
+
+  Closure *cl = (Closure *)callee.as.obj;
+  const CompiledFunction *fn = cl->fn;
+  if (nargs != fn->num_parameters) {
+    vm_error(vm, "wrong number of arguments: want=%d, got=%d",
+             fn->num_parameters, nargs);
+    return TREE_ERROR;
+  }
+  int32_t base = callee_slot + 1;
+  if (vm->frame_index + 1 >= MAX_FRAMES ||
+      base + fn->num_locals >= STACK_SIZE) {
+    vm_error(vm, "stack overflow");
+    return TREE_ERROR;
+  }
+
+  for (int32_t i = base + nargs; i < base + fn->num_locals; i++)
+    vm->stack[i] = NULL_VAL;
+  vm->sp = base + fn->num_locals;
+  // the frame keeps the callee alive and lets builtins call back in
+  vm->frames[++vm->frame_index] = (Frame){
+      .cl = cl, .ip = 0, .base_pointer = base, .memoizing = false};
+  return status(tree_run_frame(vm));
+}
+
+static TreeSignal run_call(const TreeNode *self, VM *vm, int32_t base) {
+  int32_t callee_slot = vm->sp;
+  RUN(self->left);
+  for (int32_t i = 0; i < self->num_children; i++)
+    RUN(self->children[i]);
+  return call_value(vm, callee_slot, self->num_children);
+}
+
+// Compiling -----------------------------------------------------------------
+
+typedef struct TreeCompiler {
+  TreeProgram *program;
+  SymbolTable *symbols;
+  String *error;
+} TreeCompiler;
+
+static TreeNode *compile_expression(TreeCompiler *self,
+                                    const Expression *expr);
+static TreeNode *compile_statement(TreeCompiler *self, const Statement *st);
+
+// always returns NULL, the node of a failed compilation
+static TreeNode *tree_error(TreeCompiler *self, const char *message,
+                            const String *detail) {
+  char buf[TREE_ERROR_MAX];
+  snprintf(buf, TREE_ERROR_MAX, "compile error: %s%s", message,
+           detail != NULL ? detail->chars : "");
+  *self->error = String_from(buf);
+  return NULL;
+}
+
+static TreeNode *new_node(TreeCompiler *self, TreeRunFn run) {
+  TreeProgram *program = self->program;
+  if (program->num_nodes == program->nodes_capacity) {
+    program->nodes_capacity *= 2;
+    program->nodes = realloc(program->nodes,
+                             sizeof(TreeNode *) * program->nodes_capacity);
+    assert(program->nodes != NULL);
+  }
+
+  TreeNode *node = calloc(1, sizeof(TreeNode));
+  assert(node != NULL);
+  node->run = run;
+  node->constant = NULL_VAL;
+  program->nodes[program->num_nodes++] = node;
+  return node;
+}
+
+static void set_children(TreeNode *node, int32_t count) {
+  node->children = calloc(count + 1, sizeof(TreeNode *));
+  assert(node->children != NULL);
+  node->num_children = count;
+}
+
+static TreeNode *constant_node(TreeCompiler *self, Value value, bool owned) {
+  // the program frees the unmanaged literals with its constants
+  if (owned)
+    values_push(&self->program->constants, value);
+  TreeNode *node = new_node(self, run_constant);
+  node->constant = value;
+  return node;
+}
+
+static TreeNode *load_symbol(TreeCompiler *self, Symbol symbol) {
+  switch (symbol.scope) {
+  case SCOPE_GLOBAL: {
+    TreeNode *node = new_node(self, run_global);
+    node->index = symbol.index;
+    return node;
+  }
+  case SCOPE_LOCAL: {
+    TreeNode *node = new_node(self, run_local);
+    node->index = symbol.index;
+    return node;
+  }
+  case SCOPE_BUILTIN:
+    return constant_node(self, BUILTIN_VAL(symbol.index), false);
+  case SCOPE_FREE: {
+    TreeNode *node = new_node(self, run_free);
+    node->index = symbol.index;
+    return node;
+  }
+  case SCOPE_FUNCTION:
+    return new_node(self, run_current_closure);
+  }
+  return NULL;
+}
+
+// the slot a `let` of `name` stores into, the one the name already has in
+// this scope if it is a variable
+static Symbol bind_name(TreeCompiler *self, const String *name) {
+  SymbolTable *table = self->symbols;
+  for (int32_t i = table->size - 1; i >= 0; i--) {
+    const Symbol *symbol = &table->store[i];
+    if (!String_cmp((String *)&symbol->name, (String *)name))
+      continue;
+    if (symbol->scope == SCOPE_GLOBAL || symbol->scope == SCOPE_LOCAL)
+      return *symbol;
+    break;
+  }
+  return symbol_define(table, String_clone(name));
+}
+
+static void set_slot(TreeNode *node, Symbol symbol) {
+  assert(symbol.scope == SCOPE_GLOBAL || symbol.scope == SCOPE_LOCAL);
+  node->index = symbol.index;
+  node->global = symbol.scope == SCOPE_GLOBAL;
+}
+
+static TreeNode *compile_block_value(TreeCompiler *self,
+                                     const BlockStatement *block) {
+  TreeNode *node = new_node(self, run_block_value);
+  int32_t size = block->statements.size;
+  const Statement *last = size > 0 ? block->statements.data[size - 1] : NULL;
+  bool has_value = last != NULL && last->vt->kind == NODE_EXPR_STATEMENT;
+  if (has_value)
+    size--;
+
+  set_children(node, size);
+  for (int32_t i = 0; i < size; i++) {
+    node->children[i] = compile_statement(self, block->statements.data[i]);
+    if (node->children[i] == NULL)
+      return NULL;
+  }
+  if (has_value) {
+    // compiled last, it can use the names the statements bind
+    node->left =
+        compile_expression(self, ((const ExpressionStatement *)last)->expr);
+    if (node->left == NULL)
+      return NULL;
+  }
+  return node;
+}
+
+static TreeNode *compile_fn(TreeCompiler *self, const FnExpression *fn,
+                            const String *name) {
+  if (fn->body == NULL)
+    return tree_error(self, "missing function body", NULL);
+
+  self->symbols = SymbolTable_new(self->symbols);
+  if (name != NULL)
+    symbol_define_function_name(self->symbols, String_clone(name));
+  for (int32_t i = 0; i < fn->parameters.size; i++)
+    symbol_define(self->symbols,
+                  String_clone(&fn->parameters.data[i]->value));
+
+  TreeNode *body = compile_block_value(self, fn->body);
+  SymbolTable *inner = self->symbols;
+  self->symbols = inner->outer;
+  int32_t num_locals = inner->num_definitions;
+  int32_t num_free = inner->num_free;
+  // borrowed from the enclosing tables, still valid once `inner` is gone
+  Symbol *free_symbols = inner->free_symbols;
+  inner->free_symbols = NULL;
+  free_symbol_table(inner);
+  if (body == NULL) {
+    free(free_symbols);
+    return NULL;
+  }
+
+  CompiledFunction *compiled = compiled_function_new(
+      instructions_init(0), num_locals, fn->parameters.size,
+      name != NULL ? String_clone(name) : STR_NULL);
+  compiled->tree = body;
+  TreeNode *node = new_node(self, run_closure);
+  node->index = values_push(&self->program->constants, OBJ_VAL(compiled)) - 1;
+
+  // captured values are loaded in the enclosing scope
+  set_children(node, num_free);
+  for (int32_t i = 0; i < num_free; i++)
+    node->children[i] = load_symbol(self, free_symbols[i]);
+  free(free_symbols);
+  return node;
+}
+
+static TreeNode *compile_infix(TreeCompiler *self,
+                               const InfixExpression *infix) {
+  TreeRunFn run;
+  Opcode op = OP_ADD;
+  switch (infix->token.type) {
+  case TOKEN_PLUS:
+    run = run_add;
+    break;
+  case TOKEN_MINUS:
+    run = run_sub;
+    break;
+  case TOKEN_ASTERISK:
+    run = run_mul;
+    break;
+  case TOKEN_SLASH:
+    run = run_binary;
+    op = OP_DIV;
+    break;
+  case TOKEN_LT:
+    run = run_lt;
+    break;
+  case TOKEN_GT:
+    run = run_gt;
+    break;
+  case TOKEN_EQ:
+    run = run_eq;
+    break;
+  case TOKEN_NOT_EQ:
+    run = run_not_eq;
+    break;
+  default:
+    return tree_error(self, "unknown infix operator ", &infix->op);
+  }
+
+  TreeNode *node = new_node(self, run);
+  node->op = op;
+  node->left = compile_expression(self, infix->left);
+  if (node->left == NULL)
+    return NULL;
+  node->right = compile_expression(self, infix->right);
+  return node->right != NULL ? node : NULL;
+}
+
+static TreeNode *compile_prefix(TreeCompiler *self,
+                                const PrefixExpression *prefix) {
+  TreeRunFn run;
+  switch (prefix->token.type) {
+  case TOKEN_BANG:
+    run = run_not;
+    break;
+  case TOKEN_MINUS:
+    run = run_negate;
+    break;
+  case TOKEN_PLUS:
+    return compile_expression(self, prefix->right);
+  default:
+    return tree_error(self, "unknown prefix operator ", &prefix->op);
+  }
+
+  TreeNode *node = new_node(self, run);
+  node->left = compile_expression(self, prefix->right);
+  return node->left != NULL ? node : NULL;
+}
+
+static TreeNode *compile_if(TreeCompiler *self, const IfExpression *if_expr) {
+  if (if_expr->condition == NULL || if_expr->consequence == NULL)
+    return tree_error(self, "incomplete if expression", NULL);
+
+  TreeNode *node = new_node(self, run_if);
+  node->left = compile_expression(self, if_expr->condition);
+  if (node->left == NULL)
+    return NULL;
+  node->right = compile_block_value(self, if_expr->consequence);
+  if (node->right == NULL)
+    return NULL;
+  if (if_expr->alternative != NULL) {
+    node->extra = compile_block_value(self, if_expr->alternative);
+    if (node->extra == NULL)
+      return NULL;
+  }
+  return node;
+}
+
+// `node` runs the expressions of `exprs` as its children
+static TreeNode *compile_children(TreeCompiler *self, TreeNode *node,
+                                  const ExpressionsArray *exprs) {
+  set_children(node, exprs->size);
+  for (int32_t i = 0; i < exprs->size; i++) {
+    node->children[i] = compile_expression(self, exprs->data[i]);
+    if (node->children[i] == NULL)
+      return NULL;
+  }
+  return node;
+}
+
+static TreeNode *compile_map(TreeCompiler *self, const MapExpression *map) {
+  TreeNode *node = new_node(self, run_map);
+  // pairs stay in source order, later duplicates replace earlier values
+  set_children(node, 2 * map->keys.size);
+  for (int32_t i = 0; i < map->keys.size; i++) {
+    node->children[2 * i] = compile_expression(self, map->keys.data[i]);
+    node->children[2 * i + 1] = compile_expression(self, map->values.data[i]);
+    if (node->children[2 * i] == NULL || node->children[2 * i + 1] == NULL)
+      return NULL;
+  }
+  return node;
+}
+
+static TreeNode *compile_expression(TreeCompiler *self,
+                                    const Expression *expr) {
+  if (expr == NULL)
+    return tree_error(self, "invalid expression", NULL);
+
+  switch (expr->vt->kind) {
+  case NODE_INT_EXPR: {
+    const IntExpr *int_expr = (const IntExpr *)expr;
+    if (!int_expr->is_big)
+      return constant_node(self, INT_VAL(int_expr->value), false);
+    return constant_node(self, bigint_parse(NULL, &int_expr->token.literal),
+                         true);
+  }
+  case NODE_STRING_EXPR: {
+    const String *contents = &((const StringExpr *)expr)->token.literal;
+    Value value = OBJ_VAL(string_new(NULL, contents->chars, contents->length));
+    // hashed now, the program may run on several threads
+    string_hash((StringObject *)value.as.obj);
+    return constant_node(self, value, true);
+  }
+  case NODE_BOOLEAN_EXPR:
+    return constant_node(
+        self, BOOL_VAL(((const BooleanExpression *)expr)->value), false);
+  case NODE_IDENTIFIER: {
+    const Identifier *ident = (const Identifier *)expr;
+    Symbol symbol;
+    if (!symbol_resolve(self->symbols, &ident->value, &symbol))
+      return tree_error(self, "undefined variable ", &ident->value);
+    return load_symbol(self, symbol);
+  }
+  case NODE_PREFIX_EXPR:
+    return compile_prefix(self, (const PrefixExpression *)expr);
+  case NODE_INFIX_EXPR:
+    return compile_infix(self, (const InfixExpression *)expr);
+  case NODE_IF_EXPR:
+    return compile_if(self, (const IfExpression *)expr);
+  case NODE_FN_EXPR:
+    return compile_fn(self, (const FnExpression *)expr, NULL);
+  case NODE_CALL_EXPR: {
+    const CallExpression *call = (const CallExpression *)expr;
+    TreeNode *node = new_node(self, run_call);
+    node->left = compile_expression(self, call->function);
+    if (node->left == NULL)
+      return NULL;
+    return compile_children(self, node, &call->arguments);
+  }
+  case NODE_ARRAY_EXPR:
+    return compile_children(self, new_node(self, run_array),
+                            &((const ArrayExpression *)expr)->elements);
+  case NODE_MAP_EXPR:
+    return compile_map(self, (const MapExpression *)expr);
+  case NODE_INDEX_EXPR: {
+    const IndexExpression *index_expr = (const IndexExpression *)expr;
+    if (index_expr->left == NULL || index_expr->index == NULL)
+      return tree_error(self, "incomplete index expression", NULL);
+    TreeNode *node = new_node(self, run_index);
+    node->left = compile_expression(self, index_expr->left);
+    if (node->left == NULL)
+      return NULL;
+    node->right = compile_expression(self, index_expr->index);
+    return node->right != NULL ? node : NULL;
+  }
+  default:
+    return tree_error(self, "unsupported expression", NULL);
+  }
+}
+
+static TreeNode *compile_let(TreeCompiler *self, const LetStatement *let_st) {
+  if (let_st->name == NULL || let_st->value == NULL)
+    return tree_error(self, "incomplete let statement", NULL);
+
+  // bound before the value so functions can call themselves
+  Symbol symbol = bind_name(self, &let_st->name->value);
+  TreeNode *node = new_node(self, run_set);
+  set_slot(node, symbol);
+  node->left =
+      let_st->value->vt->kind == NODE_FN_EXPR
+          ? compile_fn(self, (const FnExpression *)let_st->value,
+                       &let_st->name->value)
+          : compile_expression(self, let_st->value);
+  return node->left != NULL ? node : NULL;
+}
+
+// the body followed by `update`, which can be NULL
+static TreeNode *compile_loop_body(TreeCompiler *self,
+                                   const BlockStatement *body,
+                                   const Statement *update) {
+  TreeNode *node = new_node(self, run_statements);
+  int32_t size = body->statements.size;
+  set_children(node, size + (update != NULL));
+  for (int32_t i = 0; i < size; i++) {
+    node->children[i] = compile_statement(self, body->statements.data[i]);
+    if (node->children[i] == NULL)
+      return NULL;
+  }
+  if (update != NULL) {
+    node->children[size] = compile_statement(self, update);
+    if (node->children[size] == NULL)
+      return NULL;
+  }
+  return node;
+}
+
+static TreeNode *compile_for(TreeCompiler *self, const ForStatement *for_st) {
+  if (for_st->body == NULL)
+    return tree_error(self, "missing for body", NULL);
+
+  if (for_st->variable != NULL) {
+    if (for_st->start == NULL || for_st->end == NULL)
+      return tree_error(self, "incomplete for range", NULL);
+    TreeNode *node = new_node(self, run_for_range);
+    node->left = compile_expression(self, for_st->start);
+    if (node->left == NULL)
+      return NULL;
+    set_slot(node, bind_name(self, &for_st->variable->value));
+    node->right = compile_expression(self, for_st->end);
+    if (node->right == NULL)
+      return NULL;
+    node->extra = compile_loop_body(self, for_st->body, NULL);
+    return node->extra != NULL ? node : NULL;
+  }
+
+  TreeNode *node = new_node(self, run_for);
+  if (for_st->init != NULL &&
+      (node->left = compile_statement(self, for_st->init)) == NULL)
+    return NULL;
+  if (for_st->condition != NULL &&
+      (node->right = compile_expression(self, for_st->condition)) == NULL)
+    return NULL;
+  node->extra = compile_loop_body(self, for_st->body, for_st->update);
+  return node->extra != NULL ? node : NULL;
+}
+
+static TreeNode *compile_statement(TreeCompiler *self, const Statement *st) {
+  if (st == NULL)
+    return tree_error(self, "invalid statement", NULL);
+
+  switch (st->vt->kind) {
+  case NODE_LET_STATEMENT:
+    return compile_let(self, (const LetStatement *)st);
+  case NODE_RETURN_STATEMENT: {
+    TreeNode *node = new_node(self, run_return);
+    node->left =
+        compile_expression(self, ((const ReturnStatement *)st)->value);
+    return node->left != NULL ? node : NULL;
+  }
+  case NODE_EXPR_STATEMENT: {
+    TreeNode *node = new_node(self, run_expression_statement);
+    node->left =
+        compile_expression(self, ((const ExpressionStatement *)st)->expr);
+    return node->left != NULL ? node : NULL;
+  }
+  case NODE_BLOCK_STATEMENT: {
+    TreeNode *node = new_node(self, run_expression_statement);
+    node->left = compile_block_value(self, (const BlockStatement *)st);
+    return node->left != NULL ? node : NULL;
+  }
+  case NODE_FOR_STATEMENT:
+    return compile_for(self, (const ForStatement *)st);
+  default:
+    return tree_error(self, "unsupported statement", NULL);
+  }
+}
+
+TreeProgram *tree_compile(const Program *program, String *error) {
+  assert(program != NULL);
+  assert(error != NULL);
+  *error = STR_NULL;
+
+  TreeProgram *tree = malloc(sizeof(TreeProgram));
+  assert(tree != NULL);
+  tree->constants = values_array_init(0);
+  tree->nodes_capacity = 64;
+  tree->nodes = malloc(sizeof(TreeNode *) * tree->nodes_capacity);
+  assert(tree->nodes != NULL);
+  tree->num_nodes = 0;
+  tree->empty = instructions_init(0);
+
+  TreeCompiler compiler = {
+      .program = tree, .symbols = SymbolTable_new(NULL), .error = error};
+  for (int32_t i = 0; i < builtins_count(); i++)
+    symbol_define_builtin(compiler.symbols, i,
+                          String_from(builtin_get(i)->name));
+
+  tree->main = new_node(&compiler, run_statements);
+  set_children(tree->main, program->statements.size);
+  bool ok = true;
+  for (int32_t i = 0; i < program->statements.size && ok; i++) {
+    tree->main->children[i] =
+        compile_statement(&compiler, program->statements.data[i]);
+    ok = tree->main->children[i] != NULL;
+  }
+  tree->num_globals = compiler.symbols->num_definitions;
+  free_symbol_table(compiler.symbols);
+
+  if (!ok) {
+    free_tree_program(tree);
+    return NULL;
+  }
+  return tree;
+}
+
+void free_tree_program(TreeProgram *self) {
+  if (self == NULL)
+    return;
+
+  for (int32_t i = 0; i < self->num_nodes; i++) {
+    free(self->nodes[i]->children);
+    free(self->nodes[i]);
+  }
+  free(self->nodes);
+  free_values(&self->constants);
+  free_instructions(&self->empty);
+  free(self);
+}
+
+Bytecode tree_program_bytecode(const TreeProgram *self) {
+  assert(self != NULL);
+  return (Bytecode){
+      .instructions = &self->empty,
+      .constants = &self->constants,
+      .num_globals = self->num_globals,
+      .num_call_sites = 0,
+      .num_shape_sites = 0,
+  };
+}
+
+bool tree_run(const TreeProgram *self, VM *vm, Value *out) {
+  assert(self != NULL);
+  assert(vm->constants == &self->constants);
+  assert(vm->num_globals >= self->num_globals);
+  vm->sp = 0;
+  vm->frame_index = 0;
+  vm->last_popped = NULL_VAL;
+
+  TreeSignal signal = self->main->run(self->main, vm, 0);
+  if (signal == TREE_RETURN)
+    vm->last_popped = vm->stack[vm->sp - 1];
+  vm->sp = 0;
+  vm->frame_index = 0;
+  *out = vm->last_popped;
+  return signal != TREE_ERROR;
+}
@@ -0,0 +1,93 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "code.h"
+#include "compiler.h"
+#include "object.h"
+#include "parser.h"
+
+#include "cstring.h/cstring.h"
+
+struct VM;
+
+// how a node finished running
+typedef enum TreeSignal {
+  // an expression pushed its value, a statement left the stack as it was
+  TREE_NEXT,
+  // a `return` pushed the value of the function, the call it ends unwinds
+  TREE_RETURN,
+  // the error is recorded in the VM
+  TREE_ERROR,
+} TreeSignal;
+
+typedef struct TreeNode TreeNode;
+
+// runs `self` in the function whose first local is at stack slot `base`
+typedef TreeSignal (*TreeRunFn)(const TreeNode *self, struct VM *vm,
+                                int32_t base);
+
+// One AST node compiled to the callback running it and the operands the
+// callback reads. Names are resolved to slots and operator strings to the
+// callback doing the operation while compiling, running a node only pushes
+// and pops values on the VM stack.
+struct TreeNode {
+  TreeRunFn run;
+  // literal pushed by constant nodes
+  Value constant;
+  // slot, global, free variable or builtin index, or a literal length
+  int32_t index;
+  // set when `index` is a global
+  bool global;
+  // operator of the nodes leaving it to the slow paths of the VM
+  Opcode op;
+  TreeNode *left;
+  TreeNode *right;
+  TreeNode *extra;
+  // statements of a block, call arguments, array elements, map keys and
+  // values in turn, or the values captured by a closure
+  TreeNode **children;
+  int32_t num_children;
+};
+
+// An AST compiled to callbacks, an execution tier without bytecode for
+// embedders that run a script a few times and want no compile step worth
+// mentioning. It runs on a VM made from tree_program_bytecode, sharing the
+// heap, builtins and value semantics of the interpreter.
+//
+// Scoping follows the compiler, except that a `let` of a name already bound
+// in the same scope always reuses its slot and `@memo` is ignored.
+typedef struct TreeProgram {
+  // function literals, their `tree` set, and string and big int literals
+  ValuesArray constants;
+  // statements of the top level
+  TreeNode *main;
+  int32_t num_globals;
+  // every node of the program
+  TreeNode **nodes;
+  int32_t num_nodes;
+  int32_t nodes_capacity;
+  // the top level code handed to the VM, always empty
+  Instructions empty;
+} TreeProgram;
+
+// NULL with `error` set when the program uses an undefined name
+TreeProgram *tree_compile(const Program *program, String *error);
+void free_tree_program(TreeProgram *self);
+
+// what VM_new needs to run the program
+Bytecode tree_program_bytecode(const TreeProgram *self);
+
+// runs the top level, `out` receives the value of the last expression
+// statement or of a top level `return`. False after a runtime error, the
+// VM is rewound and can run the program again.
+bool tree_run(const TreeProgram *self, struct VM *vm, Value *out);
+
+// runs the body of the closure tier function in the innermost VM frame,
+// set up like a call from the interpreter. The frame is popped and the
+// result left on the stack in place of the callee.
+bool tree_run_frame(struct VM *vm);
+
+#endif // !TREE_H
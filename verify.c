@@ -0,0 +1,412 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "builtins.h"
+#include "code.h"
+#include "object.h"
+#include "rope.h"
+#include "verify.h"
+
+#include "cstring.h/cstring.h"
+
+StackEffect instruction_stack_effect(const Instructions *code, int32_t ip) {
+  assert(code != NULL);
+  assert(ip >= 0 && ip < code->size);
+  const uint8_t *operands = &code->data[ip + 1];
+
+  switch (opcode_generic((Opcode)code->data[ip])) {
+  case OP_CONSTANT:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_NULL:
+  case OP_GET_GLOBAL:
+  case OP_GET_LOCAL:
+  case OP_GET_BUILTIN:
+  case OP_GET_FREE:
+  case OP_CURRENT_CLOSURE:
+    return (StackEffect){0, 1};
+  case OP_POP:
+  case OP_JUMP_FALSE:
+  case OP_SET_GLOBAL:
+  case OP_SET_LOCAL:
+  case OP_RETURN_VALUE:
+    return (StackEffect){1, 0};
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+  case OP_DIV:
+  case OP_EQ:
+  case OP_NOT_EQ:
+  case OP_LT:
+  case OP_GT:
+  case OP_INDEX:
+    return (StackEffect){2, 1};
+  case OP_MINUS:
+  case OP_BANG:
+  case OP_GET_FIELD:
+  // looks at the callee pushed before the arguments
+  case OP_ENTER_REGION:
+    return (StackEffect){1, 1};
+  case OP_ARRAY:
+  case OP_REGION_ARRAY:
+    return (StackEffect){read_u16(operands), 1};
+  case OP_MAP:
+    return (StackEffect){2 * read_u16(operands), 1};
+  case OP_CLOSURE:
+  case OP_REGION_CLOSURE:
+    return (StackEffect){read_u8(&operands[2]), 1};
+  case OP_CALL:
+  case OP_TAIL_CALL:
+    // the callee and its arguments
+    return (StackEffect){read_u8(operands) + 1, 1};
+  default:
+    return (StackEffect){0, 0};
+  }
+}
+
+const char *instruction_check(const Instructions *code, int32_t ip,
+                              const BytecodeLimits *limits) {
+  assert(code != NULL);
+  assert(limits != NULL);
+  if (ip < 0 || ip >= code->size)
+    return "instruction outside of the code";
+  Opcode op = (Opcode)code->data[ip];
+  if (op >= OPCODE_COUNT)
+    return "unknown opcode";
+  if (ip + opcode_width(op) > code->size)
+    return "truncated instruction";
+
+  const uint8_t *operands = &code->data[ip + 1];
+  int32_t num_constants = limits->constants->size;
+  switch (opcode_generic(op)) {
+  case OP_CONSTANT:
+  case OP_ENTER_REGION:
+    if (read_u16(operands) >= num_constants)
+      return "constant index out of range";
+    return NULL;
+  case OP_GET_FIELD:
+    if (read_u16(operands) >= num_constants)
+      return "constant index out of range";
+    if (!IS_STRING(limits->constants->data[read_u16(operands)]))
+      return "field key that is not a string";
+    if (read_u16(&operands[2]) >= limits->num_shape_sites)
+      return "field site out of range";
+    return NULL;
+  case OP_CLOSURE:
+  case OP_REGION_CLOSURE: {
+    uint16_t index = read_u16(operands);
+    if (index >= num_constants)
+      return "constant index out of range";
+    if (!IS_OBJ_TYPE(limits->constants->data[index], OBJ_FUNCTION))
+      return "closure of a constant that is not a function";
+    return NULL;
+  }
+  case OP_JUMP:
+  case OP_JUMP_FALSE:
+    if (read_u16(operands) >= code->size)
+      return "jump target out of range";
+    return NULL;
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+    if (read_u16(operands) >= limits->num_globals)
+      return "global index out of range";
+    return NULL;
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+    if (read_u8(operands) >= limits->num_locals)
+      return "local slot out of range";
+    return NULL;
+  case OP_GET_BUILTIN:
+    if (read_u8(operands) >= builtins_count())
+      return "builtin index out of range";
+    return NULL;
+  case OP_GET_FREE:
+    if (read_u8(operands) >= limits->num_free)
+      return "free variable out of range";
+    return NULL;
+  case OP_CALL:
+  case OP_TAIL_CALL:
+    if (read_u16(&operands[1]) >= limits->num_call_sites)
+      return "call site out of range";
+    return NULL;
+  default:
+    return NULL;
+  }
+}
+
+// The fast paths of a quickened constant and of a superinstruction read the
+// instructions after it, which have to be the ones it stands for.
+static const char *fused_check(const Instructions *code, int32_t ip,
+                               const BytecodeLimits *limits) {
+  Opcode op = (Opcode)code->data[ip];
+  int32_t length;
+  const Opcode *fused = superinstruction_sequence(op, &length);
+  if (fused != NULL) {
+    int32_t at = ip + opcode_width(op);
+    for (int32_t i = 1; i < length; at += opcode_width(fused[i]), i++)
+      if (at >= code->size ||
+          opcode_generic((Opcode)code->data[at]) != fused[i])
+        return "superinstruction without the instructions it fuses";
+    return NULL;
+  }
+
+  Opcode fused_op;
+  switch (op) {
+  case OP_ADD_INT_CONST:
+    fused_op = OP_ADD;
+    break;
+  case OP_SUB_INT_CONST:
+    fused_op = OP_SUB;
+    break;
+  case OP_LT_INT_CONST:
+    fused_op = OP_LT;
+    break;
+  case OP_GT_INT_CONST:
+    fused_op = OP_GT;
+    break;
+  case OP_EQ_INT_CONST:
+    fused_op = OP_EQ;
+    break;
+  default:
+    return NULL;
+  }
+  int32_t next = ip + opcode_width(op);
+  if (next >= code->size ||
+      opcode_generic((Opcode)code->data[next]) != fused_op)
+    return "fused constant without its operator";
+  if (!IS_INT(limits->constants->data[read_u16(&code->data[ip + 1])]))
+    return "fused constant is not an int";
+  return NULL;
+}
+
+// one past the highest free variable `fn` reads, 0 when its code does not
+// decode, the check of the function itself fails then
+static int32_t free_slots_read(const CompiledFunction *fn) {
+  const Instructions *code = &fn->instructions;
+  int32_t slots = 0;
+  for (int32_t ip = 0; ip < code->size;) {
+    Opcode op = (Opcode)code->data[ip];
+    if (op >= OPCODE_COUNT || ip + opcode_width(op) > code->size)
+      return 0;
+    if (op == OP_GET_FREE && code->data[ip + 1] + 1 > slots)
+      slots = code->data[ip + 1] + 1;
+    ip += opcode_width(op);
+  }
+  return slots;
+}
+
+typedef struct Verifier {
+  const Instructions *code;
+  // set at the first byte of every instruction
+  bool *starts;
+  // stack height above the locals and regions entered on the first path
+  // reaching an instruction, -1 before one does
+  int32_t *heights;
+  int32_t *regions;
+  // reached instructions not followed yet
+  int32_t *pending;
+  int32_t num_pending;
+  const char *reason;
+  int32_t at;
+} Verifier;
+
+static bool verifier_fail(Verifier *self, const char *reason, int32_t at) {
+  self->reason = reason;
+  self->at = at;
+  return false;
+}
+
+// a path reaches `target` with `height` values on the stack
+static bool verifier_flow(Verifier *self, int32_t target, int32_t height,
+                          int32_t regions) {
+  if (target >= self->code->size)
+    return verifier_fail(self, "code runs off its end", target);
+  if (!self->starts[target])
+    return verifier_fail(self, "jump into the middle of an instruction",
+                         target);
+  if (self->heights[target] < 0) {
+    self->heights[target] = height;
+    self->regions[target] = regions;
+    self->pending[self->num_pending++] = target;
+    return true;
+  }
+  if (self->heights[target] != height)
+    return verifier_fail(self, "stack heights differ where paths meet",
+                         target);
+  if (self->regions[target] != regions)
+    return verifier_fail(self, "regions differ where paths meet", target);
+  return true;
+}
+
+// follows the instruction at `ip` to the ones running after it
+static bool verifier_step(Verifier *self, int32_t ip,
+                          const BytecodeLimits *limits,
+                          const int32_t *free_slots, int32_t *max_stack) {
+  const Instructions *code = self->code;
+  const uint8_t *operands = &code->data[ip + 1];
+  Opcode op = (Opcode)code->data[ip];
+  Opcode generic = opcode_generic(op);
+  int32_t next = ip + opcode_width(op);
+  int32_t height = self->heights[ip];
+  int32_t regions = self->regions[ip];
+
+  const char *reason = fused_check(code, ip, limits);
+  if (reason != NULL)
+    return verifier_fail(self, reason, ip);
+  StackEffect effect = instruction_stack_effect(code, ip);
+  if (height < effect.pops)
+    return verifier_fail(self, "stack underflow", ip);
+  height += effect.pushes - effect.pops;
+  if (height > *max_stack)
+    *max_stack = height;
+
+  switch (generic) {
+  case OP_ENTER_REGION:
+    regions++;
+    break;
+  case OP_LEAVE_REGION:
+    if (regions == 0)
+      return verifier_fail(self, "region left without entering it", ip);
+    regions--;
+    break;
+  case OP_REGION_ARRAY:
+  case OP_REGION_CLOSURE:
+  case OP_CLOSURE:
+    if (generic != OP_CLOSURE && regions == 0)
+      return verifier_fail(self, "region allocation outside of a region", ip);
+    if (read_u8(&operands[2]) < free_slots[read_u16(operands)])
+      return verifier_fail(
+          self, "closure captures fewer values than its function reads", ip);
+    break;
+  case OP_TAIL_CALL:
+  case OP_RETURN:
+  case OP_RETURN_VALUE:
+    // a frame replaced or popped never gets to leave them
+    if (regions > 0)
+      return verifier_fail(self, "frame left inside a region", ip);
+    break;
+  default:
+    break;
+  }
+
+  switch (generic) {
+  case OP_JUMP:
+    return verifier_flow(self, read_u16(operands), height, regions);
+  case OP_JUMP_FALSE:
+    return verifier_flow(self, read_u16(operands), height, regions) &&
+           verifier_flow(self, next, height, regions);
+  case OP_RETURN:
+  case OP_RETURN_VALUE:
+    return true;
+  default:
+    return verifier_flow(self, next, height, regions);
+  }
+}
+
+static bool verify_code(CompiledFunction *fn, const BytecodeLimits *limits,
+                        const int32_t *free_slots, Verifier *self) {
+  const Instructions *code = &fn->instructions;
+  if (code->size == 0)
+    return verifier_fail(self, "code runs off its end", 0);
+
+  self->code = code;
+  self->starts = calloc(code->size, sizeof(bool));
+  self->heights = malloc(sizeof(int32_t) * code->size);
+  self->regions = malloc(sizeof(int32_t) * code->size);
+  self->pending = malloc(sizeof(int32_t) * code->size);
+  assert(self->starts != NULL && self->heights != NULL &&
+         self->regions != NULL && self->pending != NULL);
+  self->num_pending = 0;
+
+  bool ok = true;
+  for (int32_t ip = 0; ok && ip < code->size;) {
+    const char *reason = instruction_check(code, ip, limits);
+    if (reason != NULL) {
+      ok = verifier_fail(self, reason, ip);
+      break;
+    }
+    self->starts[ip] = true;
+    self->heights[ip] = -1;
+    ip += opcode_width((Opcode)code->data[ip]);
+  }
+
+  int32_t max_stack = 0;
+  ok = ok && verifier_flow(self, 0, 0, 0);
+  while (ok && self->num_pending > 0) {
+    int32_t ip = self->pending[--self->num_pending];
+    ok = verifier_step(self, ip, limits, free_slots, &max_stack);
+  }
+  if (ok)
+    fn->max_stack = max_stack;
+
+  free(self->starts);
+  free(self->heights);
+  free(self->regions);
+  free(self->pending);
+  return ok;
+}
+
+bool bytecode_verify(CompiledFunction *main_fn, const BytecodeLimits *limits,
+                     String *error) {
+  assert(main_fn != NULL);
+  assert(limits != NULL);
+  assert(error != NULL);
+  *error = STR_NULL;
+
+  // functions of the closure tier have no bytecode to run
+  const ValuesArray *constants = limits->constants;
+  int32_t *free_slots = calloc(constants->size + 1, sizeof(int32_t));
+  assert(free_slots != NULL);
+  for (int32_t i = 0; i < constants->size; i++) {
+    Value constant = constants->data[i];
+    if (IS_OBJ_TYPE(constant, OBJ_FUNCTION) &&
+        ((CompiledFunction *)constant.as.obj)->tree == NULL)
+      free_slots[i] = free_slots_read((CompiledFunction *)constant.as.obj);
+  }
+
+  // every function is checked, the ones that pass run unchecked whatever
+  // the others do
+  Verifier verifier = {.reason = NULL, .at = 0};
+  const char *reason = NULL;
+  int32_t at = 0;
+  BytecodeLimits own = *limits;
+  const CompiledFunction *failed = NULL;
+  for (int32_t i = 0; i < constants->size; i++) {
+    Value constant = constants->data[i];
+    if (!IS_OBJ_TYPE(constant, OBJ_FUNCTION))
+      continue;
+    CompiledFunction *fn = (CompiledFunction *)constant.as.obj;
+    if (fn->tree != NULL || fn->max_stack >= 0)
+      continue;
+    // any capture count, checked where verified code makes closures of it
+    // and by the VM for the closures made elsewhere
+    own.num_locals = fn->num_locals;
+    own.num_free = UINT8_MAX + 1;
+    fn->free_reads = free_slots[i];
+    if (!verify_code(fn, &own, free_slots, &verifier) && failed == NULL) {
+      failed = fn;
+      reason = verifier.reason;
+      at = verifier.at;
+    }
+  }
+  own.num_locals = main_fn->num_locals;
+  own.num_free = 0;
+  if (main_fn->max_stack < 0 &&
+      !verify_code(main_fn, &own, free_slots, &verifier) && failed == NULL) {
+    failed = main_fn;
+    reason = verifier.reason;
+    at = verifier.at;
+  }
+  free(free_slots);
+
+  if (failed == NULL)
+    return true;
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s at %d in %.100s", reason, at,
+           failed == main_fn          ? "the top level"
+           : failed->name.chars != NULL ? failed->name.chars
+                                        : "<anonymous>");
+  *error = String_from(buf);
+  return false;
+}
@@ -0,0 +1,56 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "code.h"
+#include "object.h"
+
+#include "cstring.h/cstring.h"
+
+// what the operands of an instruction are checked against
+typedef struct BytecodeLimits {
+  const ValuesArray *constants;
+  int32_t num_globals;
+  int32_t num_call_sites;
+  int32_t num_shape_sites;
+  // of the function the instruction belongs to
+  int32_t num_locals;
+  int32_t num_free;
+} BytecodeLimits;
+
+// values an instruction takes off the stack and puts back on it, the ones it
+// only looks at count as both
+typedef struct StackEffect {
+  int32_t pops;
+  int32_t pushes;
+} StackEffect;
+
+// effect of the instruction at `ip`, which has to fit in `code`. A quickened
+// instruction or a superinstruction has the effect of its generic form.
+StackEffect instruction_stack_effect(const Instructions *code, int32_t ip);
+
+// NULL when the instruction at `ip` fits in `code` and its operands are in
+// range of `limits`: constant, global, local, free variable, builtin, call
+// and field sites and jump targets, with closures made of functions and
+// fields read by strings. Otherwise what is wrong with it.
+const char *instruction_check(const Instructions *code, int32_t ip,
+                              const BytecodeLimits *limits);
+
+// Proves once for every function what vm_run would otherwise check on every
+// instruction: each instruction decodes inside the code, jumps land on an
+// instruction, operands are in range, the stack never drops below the locals
+// and has the same height wherever paths meet, regions are left where they
+// are entered, closures capture every free variable their function reads and
+// the code returns instead of running off its end.
+//
+// Checks `main_fn`, the top level run with no free variables, and every
+// function in `limits->constants` that was not verified before. Each one
+// that passes gets its `max_stack` set, the deepest its stack goes above its
+// locals, also when others fail. False with `error` set to the first
+// failure.
+bool bytecode_verify(CompiledFunction *main_fn, const BytecodeLimits *limits,
+                     String *error);
+
+#endif // !VERIFY_H
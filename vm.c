@@ -0,0 +1,1359 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "bigint.h"
+#include "builtins.h"
+#include "code.h"
+#include "frozen.h"
+#include "gc.h"
+#include "jit.h"
+#include "map.h"
+#include "memo.h"
+#include "object.h"
+#include "pool.h"
+#include "rope.h"
+#include "shape.h"
+#include "tree.h"
+#include "verify.h"
+#include "vm.h"
+
+#include "cstring.h/cstring.h"
+
+#define ERROR_STRING_MAX 256
+
+// the stack up to `sp`, so vm_run stores its cached `sp` before allocating
+static void vm_mark_roots(Heap *heap, void *ctx) {
+  VM *self = ctx;
+
+  for (int32_t i = 0; i < self->sp; i++)
+    gc_visit_value(heap, &self->stack[i]);
+  for (int32_t i = 0; i < self->num_globals; i++)
+    gc_visit_value(heap, &self->globals[i]);
+  for (int32_t i = 0; i <= self->frame_index; i++)
+    gc_visit_object(heap, (Object **)&self->frames[i].cl);
+  gc_visit_value(heap, &self->last_popped);
+}
+
+static VM *vm_create(Bytecode bytecode) {
+  VM *vm = malloc(sizeof(VM));
+  assert(vm != NULL);
+
+  vm->constants = bytecode.constants;
+
+  vm->stack = malloc(sizeof(Value) * STACK_SIZE);
+  assert(vm->stack != NULL);
+  vm->sp = 0;
+
+  vm->num_globals = bytecode.num_globals;
+  vm->globals = malloc(sizeof(Value) * (vm->num_globals + 1));
+  assert(vm->globals != NULL);
+  for (int32_t i = 0; i < vm->num_globals; i++)
+    vm->globals[i] = NULL_VAL;
+
+  vm->num_call_caches = bytecode.num_call_sites;
+  vm->call_caches = calloc(vm->num_call_caches + 1, sizeof(CallCache));
+  assert(vm->call_caches != NULL);
+  vm->ic_hits = 0;
+  vm->ic_misses = 0;
+
+  vm->num_shape_caches = bytecode.num_shape_sites;
+  vm->shape_caches = calloc(vm->num_shape_caches + 1, sizeof(ShapeCache));
+  assert(vm->shape_caches != NULL);
+  vm->shape_hits = 0;
+  vm->shape_misses = 0;
+  vm->shapes = ShapeTable_new();
+  vm->jit_threshold = JIT_DEFAULT_THRESHOLD;
+  vm->osr_threshold = JIT_DEFAULT_OSR_THRESHOLD;
+  vm->jit_compiled = 0;
+  vm->osr_entries = 0;
+  vm->verified = false;
+  vm->quicken = true;
+  vm->quickened = 0;
+  vm->deopts = 0;
+  vm->profile = NULL;
+
+  vm->last_popped = NULL_VAL;
+  vm->error = STR_NULL;
+  vm->frame_index = 0;
+  vm->base_frame = 0;
+  vm->frames[0].cl = NULL;
+
+  vm->heap = Heap_new();
+  heap_set_roots(vm->heap, vm_mark_roots, vm);
+  vm->regions = NULL;
+  vm->num_regions = 0;
+  vm->regions_capacity = 0;
+  vm->pool = NULL;
+  vm->parallel_workers = 0;
+  vm->parallel_min_length = PARALLEL_MIN_LENGTH;
+
+  // the trailing OP_RETURN halts the VM once the main frame runs out of code
+  Instructions main_ins = instructions_clone(bytecode.instructions);
+  instructions_emit(&main_ins, OP_RETURN, 0, 0);
+  vm->main_fn = compiled_function_new(main_ins, 0, 0, STR_NULL);
+  vm->program = NULL;
+
+  Closure *main_cl = closure_new(vm->heap, vm->main_fn, 0);
+
+  vm->frames[0] =
+      (Frame){.cl = main_cl, .ip = 0, .base_pointer = 0, .memoizing = false};
+
+  return vm;
+}
+
+// the top level and the functions it can make closures of
+static bool vm_verify(VM *self) {
+  BytecodeLimits limits = {
+      .constants = self->constants,
+      .num_globals = self->num_globals,
+      .num_call_sites = self->num_call_caches,
+      .num_shape_sites = self->num_shape_caches,
+  };
+  String error;
+  bool ok = bytecode_verify(self->main_fn, &limits, &error);
+  free_string(&error);
+  return ok;
+}
+
+VM *VM_new(Bytecode bytecode) {
+  VM *vm = vm_create(bytecode);
+  vm->verified = vm_verify(vm);
+  return vm;
+}
+
+VM *VM_new_worker(const VM *parent) {
+  assert(parent != NULL);
+  Instructions empty = instructions_init(0);
+  VM *vm = vm_create((Bytecode){
+      .instructions = &empty,
+      .constants = parent->constants,
+      .num_globals = parent->num_globals,
+      .num_call_sites = parent->num_call_caches,
+      .num_shape_sites = parent->num_shape_caches,
+  });
+  free_instructions(&empty);
+
+  // nothing but the code of the parent runs on it
+  vm->verified = parent->verified;
+  vm->jit_threshold = 0;
+  vm->quicken = false;
+  // one marking thread per worker would be more threads than cores
+  vm->heap->concurrent = false;
+  return vm;
+}
+
+VM *VM_new_frozen(FrozenProgram *program) {
+  assert(program != NULL);
+  Instructions empty = instructions_init(0);
+  VM *vm = vm_create((Bytecode){
+      .instructions = &empty,
+      .constants = &program->constants,
+      .num_globals = program->num_globals,
+      .num_call_sites = program->num_call_sites,
+      .num_shape_sites = program->num_shape_sites,
+  });
+  free_instructions(&empty);
+
+  // the main closure runs the top level of the program instead of a copy
+  object_free((Object *)vm->main_fn);
+  vm->main_fn = program->main_fn;
+  vm->frames[0].cl->fn = program->main_fn;
+  vm->program = frozen_program_retain(program);
+  // verified before it was shared, the functions are not written to again
+  vm->verified = program->verified;
+  // the counters of the JIT are off in a frozen program, quickening is the
+  // one thing left that would write to it
+  vm->quicken = false;
+  return vm;
+}
+
+// `count` zeroed caches after the `old_count` kept from the last program
+static void *grow_caches(void *caches, int32_t old_count, int32_t count,
+                         size_t size) {
+  if (count <= old_count)
+    return caches;
+  uint8_t *grown = realloc(caches, size * (count + 1));
+  assert(grown != NULL);
+  memset(grown + size * old_count, 0, size * (count + 1 - old_count));
+  return grown;
+}
+
+void vm_load_program(VM *self, Bytecode bytecode) {
+  assert(self != NULL);
+  assert(self->program == NULL);
+  assert(bytecode.constants == self->constants);
+  assert(bytecode.num_globals >= self->num_globals);
+
+  Value *globals =
+      realloc(self->globals, sizeof(Value) * (bytecode.num_globals + 1));
+  assert(globals != NULL);
+  for (int32_t i = self->num_globals; i < bytecode.num_globals; i++)
+    globals[i] = NULL_VAL;
+  self->globals = globals;
+  self->num_globals = bytecode.num_globals;
+
+  self->call_caches =
+      grow_caches(self->call_caches, self->num_call_caches,
+                  bytecode.num_call_sites, sizeof(CallCache));
+  if (bytecode.num_call_sites > self->num_call_caches)
+    self->num_call_caches = bytecode.num_call_sites;
+  self->shape_caches =
+      grow_caches(self->shape_caches, self->num_shape_caches,
+                  bytecode.num_shape_sites, sizeof(ShapeCache));
+  if (bytecode.num_shape_sites > self->num_shape_caches)
+    self->num_shape_caches = bytecode.num_shape_sites;
+
+  // the main closure stays, only the code of its function changes
+  CompiledFunction *main_fn = self->main_fn;
+  free_instructions(&main_fn->instructions);
+  main_fn->instructions = instructions_clone(bytecode.instructions);
+  instructions_emit(&main_fn->instructions, OP_RETURN, 0, 0);
+  free_jit_code(main_fn->native);
+  main_fn->native = NULL;
+  main_fn->calls = 0;
+  main_fn->back_edges = 0;
+  main_fn->max_stack = -1;
+
+  // whatever an error left behind
+  heap_region_release(self->heap, (HeapRegionMark){{NULL, 0}, 0});
+  self->num_regions = 0;
+  self->sp = 0;
+  self->frame_index = 0;
+  self->base_frame = 0;
+  self->frames[0].ip = 0;
+  self->frames[0].memoizing = false;
+  self->last_popped = NULL_VAL;
+  free_string(&self->error);
+  self->error = STR_NULL;
+  // the functions verified before are not checked again
+  self->verified = vm_verify(self);
+}
+
+void free_vm(VM *self) {
+  if (self == NULL)
+    return;
+
+  // the workers are idle between calls, none of them touches the heap
+  free_work_pool(self->pool);
+  free_heap(self->heap);
+  if (self->program != NULL)
+    frozen_program_release(self->program);
+  else
+    object_free((Object *)self->main_fn);
+  free(self->stack);
+  free(self->globals);
+  free(self->regions);
+  free(self->call_caches);
+  free(self->shape_caches);
+  // after the heap, records point at their shapes
+  free_shape_table(self->shapes);
+  free_string(&self->error);
+  free(self);
+}
+
+bool vm_error(VM *self, const char *fmt, ...) {
+  char buf[ERROR_STRING_MAX];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, ERROR_STRING_MAX, fmt, args);
+  va_end(args);
+
+  free_string(&self->error);
+  self->error = String_from(buf);
+
+  return false;
+}
+
+Value vm_last_popped(const VM *self) { return self->last_popped; }
+
+static void call_cache_insert(CallCache *cache, const CompiledFunction *fn) {
+  if (cache->megamorphic)
+    return;
+
+  if (cache->size == CALL_CACHE_ENTRIES) {
+    // too many targets, stop probing the entries at this site
+    cache->megamorphic = true;
+    cache->size = 0;
+    return;
+  }
+
+  cache->entries[cache->size++] = (CallCacheEntry){
+      .fn = fn,
+      .code = fn->instructions.data,
+      .num_locals = fn->num_locals,
+  };
+}
+
+static void shape_cache_insert(ShapeCache *cache, const Shape *shape,
+                               int32_t slot) {
+  if (cache->megamorphic)
+    return;
+
+  if (cache->size == SHAPE_CACHE_ENTRIES) {
+    cache->megamorphic = true;
+    cache->size = 0;
+    return;
+  }
+
+  cache->entries[cache->size++] =
+      (ShapeCacheEntry){.shape = shape, .slot = slot};
+}
+
+static const JitCode *compile_native(VM *self, CompiledFunction *fn) {
+  fn->native = jit_compile(fn, self->constants);
+  if (fn->native == NULL) {
+    // no JIT on this platform, do not try again
+    fn->calls = -1;
+    return NULL;
+  }
+  self->jit_compiled++;
+  return fn->native;
+}
+
+// native code of `fn` if the JIT is on, compiles it once it got hot
+static const JitCode *native_code(VM *self, CompiledFunction *fn) {
+  if (self->jit_threshold <= 0)
+    return NULL;
+  if (fn->native != NULL || fn->calls < 0 ||
+      ++fn->calls < self->jit_threshold)
+    return fn->native;
+  return compile_native(self, fn);
+}
+
+// Counts a backward jump of `fn`. A loop that runs long enough compiles the
+// function even if it was called only once, the caller then moves the
+// running frame into the native code at the loop header.
+static const JitCode *loop_native_code(VM *self, CompiledFunction *fn) {
+  if (self->jit_threshold <= 0)
+    return NULL;
+  if (fn->native != NULL || fn->calls < 0 ||
+      ++fn->back_edges < self->osr_threshold)
+    return fn->native;
+  return compile_native(self, fn);
+}
+
+static bool binary_string_op(VM *self, Opcode op, Value left, Value right,
+                             Value *out) {
+  if (op != OP_ADD)
+    return vm_error(self, "unknown string operator %s",
+                    opcode_lookup(op)->name);
+  if (!string_concat(self->heap, left, right, out))
+    return vm_error(self, "string too long");
+  return true;
+}
+
+// slow path of the arithmetic opcodes, taken when an operand is a BigInt or
+// a string, or the int64_t fast path in vm_run overflowed
+static bool binary_number_op(VM *self, Opcode op, Value left, Value right,
+                             Value *out) {
+  if (IS_STRING(left) && IS_STRING(right))
+    return binary_string_op(self, op, left, right, out);
+  if (!IS_NUMBER(left) || !IS_NUMBER(right)) {
+    return vm_error(self, "unsupported types for %s: %s %s",
+                    opcode_lookup(op)->name, value_type_name(left),
+                    value_type_name(right));
+  }
+
+  switch (op) {
+  case OP_ADD:
+    *out = bigint_add(self->heap, left, right);
+    return true;
+  case OP_SUB:
+    *out = bigint_sub(self->heap, left, right);
+    return true;
+  case OP_MUL:
+    *out = bigint_mul(self->heap, left, right);
+    return true;
+  case OP_DIV:
+    if (IS_INT(right) && right.as.integer == 0)
+      return vm_error(self, "division by zero");
+    *out = bigint_div(self->heap, left, right);
+    return true;
+  case OP_LT:
+    *out = BOOL_VAL(bigint_compare(left, right) < 0);
+    return true;
+  case OP_GT:
+    *out = BOOL_VAL(bigint_compare(left, right) > 0);
+    return true;
+  default:
+    return vm_error(self, "unknown integer operator %s",
+                    opcode_lookup(op)->name);
+  }
+}
+
+bool vm_binary_op(VM *self, Opcode op) {
+  Value *operands = &self->stack[self->sp - 2];
+  Value result;
+  if (op == OP_EQ || op == OP_NOT_EQ) {
+    result = BOOL_VAL(value_equals(operands[0], operands[1]) == (op == OP_EQ));
+  } else if (!binary_number_op(self, op, operands[0], operands[1], &result)) {
+    return false;
+  }
+  self->sp--;
+  self->stack[self->sp - 1] = result;
+  return true;
+}
+
+bool vm_negate(VM *self) {
+  Value operand = self->stack[self->sp - 1];
+  if (IS_INT(operand) && operand.as.integer != INT64_MIN) {
+    self->stack[self->sp - 1] = INT_VAL(-operand.as.integer);
+    return true;
+  }
+  if (!IS_NUMBER(operand))
+    return vm_error(self, "unsupported type for negation: %s",
+                    value_type_name(operand));
+  self->stack[self->sp - 1] = bigint_negate(self->heap, operand);
+  return true;
+}
+
+bool vm_build_array(VM *self, int32_t length) {
+  if (self->sp - length >= STACK_SIZE)
+    return vm_error(self, "stack overflow");
+  // the elements are still on the stack if this collects
+  Value array;
+  if (!array_new(self->heap, &self->stack[self->sp - length], length, &array))
+    return vm_error(self, "array too long");
+  self->sp -= length;
+  self->stack[self->sp++] = array;
+  return true;
+}
+
+bool vm_build_map(VM *self, int32_t num_pairs) {
+  if (self->sp - 2 * num_pairs >= STACK_SIZE)
+    return vm_error(self, "stack overflow");
+  Value *items = &self->stack[self->sp - 2 * num_pairs];
+  for (int32_t i = 0; i < num_pairs; i++) {
+    if (!map_key_is_hashable(items[2 * i]))
+      return vm_error(self, "unusable as map key: %s",
+                      value_type_name(items[2 * i]));
+  }
+  // the pairs are still on the stack if this collects
+  Value map;
+  if (!map_new(self->heap, self->shapes, items, num_pairs, &map))
+    return vm_error(self, "map too large");
+  self->sp -= 2 * num_pairs;
+  self->stack[self->sp++] = map;
+  return true;
+}
+
+bool vm_index(VM *self) {
+  Value index = self->stack[--self->sp];
+  Value *top = &self->stack[self->sp - 1];
+  Value left = *top;
+  if (IS_ARRAY(left) && IS_INT(index)) {
+    ArrayObject *arr = (ArrayObject *)left.as.obj;
+    int64_t i = index.as.integer;
+    if (i < 0 || i >= arr->length)
+      *top = NULL_VAL;
+    else
+      *top = arr->packed ? INT_VAL(array_ints(arr)[i]) : array_values(arr)[i];
+    return true;
+  }
+  if (IS_MAP(left) && map_key_is_hashable(index)) {
+    Value value;
+    *top = map_get((MapObject *)left.as.obj, index, &value) ? value : NULL_VAL;
+    return true;
+  }
+  return vm_error(self, "index operator not supported: %s[%s]",
+                  value_type_name(left), value_type_name(index));
+}
+
+bool vm_get_field(VM *self, int32_t key_index, int32_t site) {
+  Value key = self->constants->data[key_index];
+  ShapeCache *cache = &self->shape_caches[site];
+  Value *top = &self->stack[self->sp - 1];
+  Value left = *top;
+  if (!IS_MAP(left))
+    return vm_error(self, "index operator not supported: %s[%s]",
+                    value_type_name(left), value_type_name(key));
+
+  MapObject *map = (MapObject *)left.as.obj;
+  const Shape *shape = map->shape;
+  if (shape == NULL) {
+    Value value;
+    *top = map_get(map, key, &value) ? value : NULL_VAL;
+    return true;
+  }
+
+  int32_t slot = -1;
+  bool cached = false;
+  for (int32_t i = 0; i < cache->size; i++) {
+    if (cache->entries[i].shape == shape) {
+      slot = cache->entries[i].slot;
+      cached = true;
+      break;
+    }
+  }
+  if (cached) {
+    self->shape_hits++;
+  } else {
+    self->shape_misses++;
+    slot = shape_field_index(shape, (StringObject *)key.as.obj);
+    shape_cache_insert(cache, shape, slot);
+  }
+  *top = slot >= 0 ? map_fields(map)[slot] : NULL_VAL;
+  return true;
+}
+
+bool vm_make_closure(VM *self, int32_t index, int32_t num_free) {
+  if (self->sp - num_free >= STACK_SIZE)
+    return vm_error(self, "stack overflow");
+  Value constant = self->constants->data[index];
+  assert(IS_OBJ_TYPE(constant, OBJ_FUNCTION));
+  // the captured values are still on the stack if this collects
+  Closure *cl =
+      closure_new(self->heap, (CompiledFunction *)constant.as.obj, num_free);
+  Value *captured = &self->stack[self->sp - num_free];
+  for (int32_t i = 0; i < num_free; i++) {
+    cl->free_vars[i] = captured[i];
+    gc_write_barrier(self->heap, &cl->base, cl->free_vars[i]);
+  }
+  self->sp -= num_free;
+  self->stack[self->sp++] = OBJ_VAL(cl);
+  return true;
+}
+
+bool vm_enter_region(VM *self, int32_t fn_index) {
+  if (self->num_regions == self->regions_capacity) {
+    int32_t new_cap =
+        self->regions_capacity > 0 ? self->regions_capacity * 2 : 16;
+    RegionScope *new_ptr =
+        realloc(self->regions, sizeof(RegionScope) * new_cap);
+    assert(new_ptr != NULL);
+    self->regions = new_ptr;
+    self->regions_capacity = new_cap;
+  }
+
+  // the callee was pushed right before its arguments
+  Value callee = self->stack[self->sp - 1];
+  Value expected = self->constants->data[fn_index];
+  bool active = IS_OBJ_TYPE(callee, OBJ_CLOSURE) &&
+                &((Closure *)callee.as.obj)->fn->base == expected.as.obj;
+  self->regions[self->num_regions++] =
+      (RegionScope){heap_region_mark(self->heap), active};
+  return true;
+}
+
+bool vm_leave_region(VM *self) {
+  assert(self->num_regions > 0);
+  heap_region_release(self->heap, self->regions[--self->num_regions].mark);
+  return true;
+}
+
+bool vm_build_region_array(VM *self, int32_t length) {
+  assert(self->num_regions > 0);
+  self->heap->allocate_in_region = self->regions[self->num_regions - 1].active;
+  bool ok = vm_build_array(self, length);
+  self->heap->allocate_in_region = false;
+  return ok;
+}
+
+bool vm_make_region_closure(VM *self, int32_t index, int32_t num_free) {
+  assert(self->num_regions > 0);
+  self->heap->allocate_in_region = self->regions[self->num_regions - 1].active;
+  bool ok = vm_make_closure(self, index, num_free);
+  self->heap->allocate_in_region = false;
+  return ok;
+}
+
+// what the checked loop makes sure of before the instruction at `ip` of the
+// innermost frame runs, false with the error set
+static bool vm_check_instruction(VM *self, const Frame *frame, int32_t ip,
+                                 int32_t sp) {
+  const Closure *cl = frame->cl;
+  const Instructions *code = &cl->fn->instructions;
+  BytecodeLimits limits = {
+      .constants = self->constants,
+      .num_globals = self->num_globals,
+      .num_call_sites = self->num_call_caches,
+      .num_shape_sites = self->num_shape_caches,
+      .num_locals = cl->fn->num_locals,
+      .num_free = cl->num_free,
+  };
+  const char *reason = instruction_check(code, ip, &limits);
+  if (reason == NULL) {
+    StackEffect effect = instruction_stack_effect(code, ip);
+    Opcode op = opcode_generic((Opcode)code->data[ip]);
+    if (sp - effect.pops < frame->base_pointer + cl->fn->num_locals)
+      reason = "stack underflow";
+    else if (self->num_regions == 0 &&
+             (op == OP_LEAVE_REGION || op == OP_REGION_ARRAY ||
+              op == OP_REGION_CLOSURE))
+      reason = "region instruction outside of a region";
+  }
+  if (reason == NULL)
+    return true;
+  return vm_error(self, "malformed bytecode: %s at %d", reason, ip);
+}
+
+static VMResult run_checked(VM *self);
+static VMResult run_unchecked(VM *self);
+
+// the verifier only saw the closures verified code makes, the others have
+// to capture every free variable the function reads
+static inline bool runs_unchecked(const VM *self, const Closure *cl) {
+  return self->profile == NULL && cl->fn->max_stack >= 0 &&
+         cl->num_free >= cl->fn->free_reads;
+}
+
+// The dispatch loop, instantiated once with `checked` for code the verifier
+// did not pass and once without for verified code, where the checks fold
+// away.
+static inline __attribute__((always_inline)) VMResult
+run_loop(VM *self, const bool checked) {
+  Value *stack = self->stack;
+  Frame *frame = &self->frames[self->frame_index];
+  uint8_t *ins = frame->cl->fn->instructions.data;
+  int32_t ip = frame->ip;
+  int32_t sp = self->sp;
+  const JitCode *native;
+
+// verified frames reserve their stack when they are pushed
+#define PUSH(v)                                                                \
+  do {                                                                         \
+    if (checked && sp >= STACK_SIZE)                                           \
+      goto stack_overflow;                                                     \
+    stack[sp++] = (v);                                                         \
+  } while (0)
+#define POP() (stack[--sp])
+#define PEEK(distance) (stack[sp - 1 - (distance)])
+// rewrites the instruction at `position` into a specialized form, checked
+// code runs every instruction in its generic form
+#define QUICKEN(position, quick)                                               \
+  do {                                                                         \
+    if (self->quicken && !checked) {                                           \
+      ins[position] = (quick);                                                 \
+      self->quickened++;                                                       \
+    }                                                                          \
+  } while (0)
+// writes the generic form back over a quickened instruction whose guard
+// failed and runs it from the start. A VM that does not quicken may share
+// the bytecode with other threads and only runs the generic form.
+#define DEOPTIMIZE(position, generic)                                          \
+  do {                                                                         \
+    int32_t at = (position);                                                   \
+    op = (generic);                                                            \
+    if (self->quicken) {                                                       \
+      ins[at] = op;                                                            \
+      self->deopts++;                                                          \
+    }                                                                          \
+    ip = at + 1;                                                               \
+    goto dispatch;                                                             \
+  } while (0)
+#define LOAD_FRAME()                                                           \
+  do {                                                                         \
+    frame = &self->frames[self->frame_index];                                  \
+    ins = frame->cl->fn->instructions.data;                                    \
+    ip = frame->ip;                                                            \
+  } while (0)
+
+  for (;;) {
+    if (checked && !vm_check_instruction(self, frame, ip, sp))
+      goto error;
+    // profiled VMs run checked, keeping the branch out of the fast loop
+    if (checked && self->profile != NULL)
+      opcode_profile_record(self->profile, ins, ip);
+    Opcode op = (Opcode)ins[ip++];
+    // the fast paths of quickened instructions and superinstructions read
+    // the instructions after them, which are only checked when they run
+    if (checked)
+      op = opcode_generic(op);
+
+  dispatch:
+    switch (op) {
+    case OP_CONSTANT: {
+      uint16_t index = read_u16(&ins[ip]);
+      ip += 2;
+      Value constant = self->constants->data[index];
+      // an integer operand of the next operator is folded into it
+      if (!checked && IS_INT(constant) && sp > 0 && IS_INT(PEEK(0))) {
+        Opcode fused = opcode_fused_constant((Opcode)ins[ip]);
+        if (fused != OP_CONSTANT)
+          QUICKEN(ip - 3, fused);
+      }
+      PUSH(constant);
+      break;
+    }
+
+    case OP_POP:
+      self->last_popped = POP();
+      break;
+
+// both operands are checked with a single branch, anything else including an
+// overflow falls through to binary_number_op
+#define BOTH_INT() (IS_INT(PEEK(0)) & IS_INT(PEEK(1)))
+// expands to a bare `if` so the `break` leaves the dispatch switch
+#define INT_FAST_PATH(overflow_fn, quick)                                      \
+  int64_t result;                                                              \
+  if (BOTH_INT() &&                                                            \
+      !overflow_fn(PEEK(1).as.integer, PEEK(0).as.integer, &result)) {         \
+    if ((quick) != op)                                                         \
+      QUICKEN(ip - 1, quick);                                                  \
+    sp--;                                                                      \
+    stack[sp - 1] = INT_VAL(result);                                           \
+    break;                                                                     \
+  }
+#define COMPARE_INT_INT(compare)                                               \
+  do {                                                                         \
+    bool result = PEEK(1).as.integer compare PEEK(0).as.integer;               \
+    sp--;                                                                      \
+    stack[sp - 1] = BOOL_VAL(result);                                          \
+  } while (0)
+
+    case OP_ADD: {
+      INT_FAST_PATH(__builtin_add_overflow, OP_ADD_INT_INT)
+      goto slow_binary;
+    }
+
+    case OP_SUB: {
+      INT_FAST_PATH(__builtin_sub_overflow, OP_SUB_INT_INT)
+      goto slow_binary;
+    }
+
+    case OP_MUL: {
+      INT_FAST_PATH(__builtin_mul_overflow, OP_MUL)
+      goto slow_binary;
+    }
+
+    case OP_DIV:
+      // INT64_MIN / -1 is the only quotient that overflows
+      if (BOTH_INT() && PEEK(0).as.integer != 0 &&
+          !(PEEK(0).as.integer == -1 && PEEK(1).as.integer == INT64_MIN)) {
+        int64_t result = PEEK(1).as.integer / PEEK(0).as.integer;
+        sp--;
+        stack[sp - 1] = INT_VAL(result);
+        break;
+      }
+      goto slow_binary;
+
+    case OP_LT:
+      if (BOTH_INT()) {
+        QUICKEN(ip - 1, OP_LT_INT_INT);
+        COMPARE_INT_INT(<);
+        break;
+      }
+      goto slow_binary;
+
+    case OP_GT:
+      if (BOTH_INT()) {
+        QUICKEN(ip - 1, OP_GT_INT_INT);
+        COMPARE_INT_INT(>);
+        break;
+      }
+    slow_binary: {
+      // the operands stay on the stack while a BigInt or string result is
+      // allocated
+      Value result;
+      self->sp = sp;
+      if (!binary_number_op(self, op, PEEK(1), PEEK(0), &result))
+        goto error;
+      sp--;
+      stack[sp - 1] = result;
+      break;
+    }
+
+    case OP_EQ: {
+      if (BOTH_INT())
+        QUICKEN(ip - 1, OP_EQ_INT_INT);
+      Value right = POP();
+      Value left = POP();
+      PUSH(BOOL_VAL(value_equals(left, right)));
+      break;
+    }
+
+    case OP_NOT_EQ: {
+      Value right = POP();
+      Value left = POP();
+      PUSH(BOOL_VAL(!value_equals(left, right)));
+      break;
+    }
+
+    // Quickened forms. Each one guards the operand types its generic form
+    // saw, a failed guard writes the generic form back and runs it.
+    case OP_ADD_INT_INT: {
+      INT_FAST_PATH(__builtin_add_overflow, OP_ADD_INT_INT)
+      DEOPTIMIZE(ip - 1, OP_ADD);
+      break;
+    }
+
+    case OP_SUB_INT_INT: {
+      INT_FAST_PATH(__builtin_sub_overflow, OP_SUB_INT_INT)
+      DEOPTIMIZE(ip - 1, OP_SUB);
+      break;
+    }
+
+    case OP_LT_INT_INT:
+      if (BOTH_INT()) {
+        COMPARE_INT_INT(<);
+        break;
+      }
+      DEOPTIMIZE(ip - 1, OP_LT);
+      break;
+
+    case OP_GT_INT_INT:
+      if (BOTH_INT()) {
+        COMPARE_INT_INT(>);
+        break;
+      }
+      DEOPTIMIZE(ip - 1, OP_GT);
+      break;
+
+    case OP_EQ_INT_INT:
+      if (BOTH_INT()) {
+        COMPARE_INT_INT(==);
+        break;
+      }
+      DEOPTIMIZE(ip - 1, OP_EQ);
+      break;
+
+    case OP_ADD_INT_CONST:
+    case OP_SUB_INT_CONST:
+    case OP_LT_INT_CONST:
+    case OP_GT_INT_CONST:
+    case OP_EQ_INT_CONST: {
+      // the fused operator right after the operand is skipped
+      int64_t constant =
+          self->constants->data[read_u16(&ins[ip])].as.integer;
+      if (!IS_INT(PEEK(0)))
+        goto deoptimize_constant;
+      int64_t left = PEEK(0).as.integer;
+      int64_t result;
+      switch (op) {
+      case OP_ADD_INT_CONST:
+        if (__builtin_add_overflow(left, constant, &result))
+          goto deoptimize_constant;
+        stack[sp - 1] = INT_VAL(result);
+        break;
+      case OP_SUB_INT_CONST:
+        if (__builtin_sub_overflow(left, constant, &result))
+          goto deoptimize_constant;
+        stack[sp - 1] = INT_VAL(result);
+        break;
+      case OP_LT_INT_CONST:
+        stack[sp - 1] = BOOL_VAL(left < constant);
+        break;
+      case OP_GT_INT_CONST:
+        stack[sp - 1] = BOOL_VAL(left > constant);
+        break;
+      default:
+        stack[sp - 1] = BOOL_VAL(left == constant);
+        break;
+      }
+      ip += 3;
+      break;
+
+    deoptimize_constant:
+      // pushed right here, running OP_CONSTANT would quicken it again
+      DEOPTIMIZE(ip - 1, OP_CONSTANT);
+      ip += 3;
+      PUSH(INT_VAL(constant));
+      break;
+    }
+
+    // Superinstructions, the instructions they fuse follow in place. Without
+    // integer operands only the leading OP_GET_LOCAL runs and the rest of the
+    // sequence is dispatched one by one.
+    case OP_LOCAL_CONST_ADD:
+    case OP_LOCAL_CONST_SUB:
+    case OP_LOCAL_CONST_MUL: {
+      Value local = stack[frame->base_pointer + read_u8(&ins[ip])];
+      Value constant = self->constants->data[read_u16(&ins[ip + 2])];
+      int64_t result;
+      bool overflow = true;
+      if (IS_INT(local) && IS_INT(constant)) {
+        int64_t a = local.as.integer, b = constant.as.integer;
+        if (op == OP_LOCAL_CONST_ADD)
+          overflow = __builtin_add_overflow(a, b, &result);
+        else if (op == OP_LOCAL_CONST_SUB)
+          overflow = __builtin_sub_overflow(a, b, &result);
+        else
+          overflow = __builtin_mul_overflow(a, b, &result);
+      }
+      if (overflow) {
+        ip += 1;
+        PUSH(local);
+        break;
+      }
+      ip += 5;
+      PUSH(INT_VAL(result));
+      break;
+    }
+
+    case OP_LOCAL_CONST_EQ_JUMP_FALSE:
+    case OP_LOCAL_CONST_LT_JUMP_FALSE: {
+      Value local = stack[frame->base_pointer + read_u8(&ins[ip])];
+      Value constant = self->constants->data[read_u16(&ins[ip + 2])];
+      if (!IS_INT(local) || !IS_INT(constant)) {
+        ip += 1;
+        PUSH(local);
+        break;
+      }
+      bool truth = op == OP_LOCAL_CONST_EQ_JUMP_FALSE
+                       ? local.as.integer == constant.as.integer
+                       : local.as.integer < constant.as.integer;
+      ip = truth ? ip + 8 : read_u16(&ins[ip + 6]);
+      break;
+    }
+
+    case OP_LOCAL_LOCAL_LT_JUMP_FALSE: {
+      Value left = stack[frame->base_pointer + read_u8(&ins[ip])];
+      Value right = stack[frame->base_pointer + read_u8(&ins[ip + 2])];
+      if (!IS_INT(left) || !IS_INT(right)) {
+        ip += 1;
+        PUSH(left);
+        break;
+      }
+      ip = left.as.integer < right.as.integer ? ip + 7
+                                              : read_u16(&ins[ip + 5]);
+      break;
+    }
+
+    case OP_GET_LOCAL_2: {
+      uint8_t first = read_u8(&ins[ip]);
+      uint8_t second = read_u8(&ins[ip + 2]);
+      ip += 3;
+      PUSH(stack[frame->base_pointer + first]);
+      PUSH(stack[frame->base_pointer + second]);
+      break;
+    }
+#undef COMPARE_INT_INT
+#undef INT_FAST_PATH
+#undef BOTH_INT
+
+    case OP_TRUE:
+      PUSH(BOOL_VAL(true));
+      break;
+
+    case OP_FALSE:
+      PUSH(BOOL_VAL(false));
+      break;
+
+    case OP_NULL:
+      PUSH(NULL_VAL);
+      break;
+
+    case OP_MINUS: {
+      Value operand = PEEK(0);
+      if (IS_INT(operand) && operand.as.integer != INT64_MIN) {
+        stack[sp - 1] = INT_VAL(-operand.as.integer);
+        break;
+      }
+      self->sp = sp;
+      if (!vm_negate(self))
+        goto error;
+      break;
+    }
+
+    case OP_BANG: {
+      Value operand = POP();
+      PUSH(BOOL_VAL(!value_is_truthy(operand)));
+      break;
+    }
+
+    case OP_ARRAY:
+    case OP_REGION_ARRAY: {
+      uint16_t length = read_u16(&ins[ip]);
+      ip += 2;
+      self->sp = sp;
+      if (op == OP_ARRAY ? !vm_build_array(self, length)
+                         : !vm_build_region_array(self, length))
+        goto error;
+      sp = self->sp;
+      break;
+    }
+
+    case OP_MAP: {
+      uint16_t num_pairs = read_u16(&ins[ip]);
+      ip += 2;
+      self->sp = sp;
+      if (!vm_build_map(self, num_pairs))
+        goto error;
+      sp = self->sp;
+      break;
+    }
+
+    case OP_INDEX:
+      self->sp = sp;
+      if (!vm_index(self))
+        goto error;
+      sp = self->sp;
+      break;
+
+    case OP_GET_FIELD: {
+      uint16_t key = read_u16(&ins[ip]);
+      uint16_t site = read_u16(&ins[ip + 2]);
+      ip += 4;
+      self->sp = sp;
+      if (!vm_get_field(self, key, site))
+        goto error;
+      break;
+    }
+
+    case OP_JUMP: {
+      uint16_t target = read_u16(&ins[ip]);
+      if (target > ip) {
+        ip = target;
+        break;
+      }
+      // a loop back edge, every instruction is an entry point of the native
+      // code so the frame continues there as it is
+      ip = target;
+      native = checked ? NULL : loop_native_code(self, frame->cl->fn);
+      if (native == NULL)
+        break;
+      self->osr_entries++;
+      goto run_native;
+    }
+
+    case OP_JUMP_FALSE: {
+      uint16_t target = read_u16(&ins[ip]);
+      ip += 2;
+      if (!value_is_truthy(POP()))
+        ip = target;
+      break;
+    }
+
+    case OP_SET_GLOBAL: {
+      uint16_t index = read_u16(&ins[ip]);
+      ip += 2;
+      self->globals[index] = POP();
+      break;
+    }
+
+    case OP_GET_GLOBAL: {
+      uint16_t index = read_u16(&ins[ip]);
+      ip += 2;
+      PUSH(self->globals[index]);
+      break;
+    }
+
+    case OP_SET_LOCAL: {
+      uint8_t index = read_u8(&ins[ip]);
+      ip += 1;
+      stack[frame->base_pointer + index] = POP();
+      break;
+    }
+
+    case OP_GET_LOCAL: {
+      uint8_t index = read_u8(&ins[ip]);
+      ip += 1;
+      PUSH(stack[frame->base_pointer + index]);
+      break;
+    }
+
+    case OP_GET_BUILTIN: {
+      uint8_t index = read_u8(&ins[ip]);
+      ip += 1;
+      PUSH(BUILTIN_VAL(index));
+      break;
+    }
+
+    case OP_GET_FREE: {
+      uint8_t index = read_u8(&ins[ip]);
+      ip += 1;
+      PUSH(frame->cl->free_vars[index]);
+      break;
+    }
+
+    case OP_CURRENT_CLOSURE:
+      PUSH(OBJ_VAL(frame->cl));
+      break;
+
+    case OP_CLOSURE:
+    case OP_REGION_CLOSURE: {
+      uint16_t index = read_u16(&ins[ip]);
+      uint8_t num_free = read_u8(&ins[ip + 2]);
+      ip += 3;
+      self->sp = sp;
+      if (op == OP_CLOSURE ? !vm_make_closure(self, index, num_free)
+                           : !vm_make_region_closure(self, index, num_free))
+        goto error;
+      sp = self->sp;
+      break;
+    }
+
+    case OP_ENTER_REGION:
+      self->sp = sp;
+      vm_enter_region(self, read_u16(&ins[ip]));
+      ip += 2;
+      break;
+
+    case OP_LEAVE_REGION:
+      vm_leave_region(self);
+      break;
+
+    case OP_CALL:
+    case OP_TAIL_CALL: {
+      uint8_t nargs = read_u8(&ins[ip]);
+      CallCache *cache = &self->call_caches[read_u16(&ins[ip + 1])];
+      ip += 3;
+      Value callee = PEEK(nargs);
+      Closure *cl = NULL;
+      uint8_t *code;
+      int32_t num_locals;
+      bool memoizing = false;
+
+      if (IS_OBJ_TYPE(callee, OBJ_CLOSURE)) {
+        cl = (Closure *)callee.as.obj;
+        // entries were only added after the generic checks passed for the
+        // same function at this site
+        for (int32_t i = 0; i < cache->size; i++) {
+          if (cache->entries[i].fn == cl->fn) {
+            self->ic_hits++;
+            code = cache->entries[i].code;
+            num_locals = cache->entries[i].num_locals;
+            goto push_frame;
+          }
+        }
+      }
+
+      self->ic_misses++;
+
+      if (IS_BUILTIN(callee)) {
+        Value result;
+        const BuiltinDef *def = builtin_get(callee.as.builtin);
+        self->sp = sp;
+        if (!def->fn(self, &stack[sp - nargs], nargs, &result))
+          goto error;
+        // a builtin has no frame to reuse, the OP_RETURN_VALUE following a
+        // tail call returns its result
+        sp -= nargs + 1;
+        PUSH(result);
+        goto resume_native;
+      }
+
+      if (!IS_OBJ_TYPE(callee, OBJ_CLOSURE)) {
+        vm_error(self, "calling non-function: %s", value_type_name(callee));
+        goto error;
+      }
+
+      CompiledFunction *fn = cl->fn;
+      if (nargs != fn->num_parameters) {
+        vm_error(self, "wrong number of arguments: want=%d, got=%d",
+                 fn->num_parameters, nargs);
+        goto error;
+      }
+
+      if (fn->memoize && memo_key_is_hashable(&stack[sp - nargs], nargs)) {
+        if (cl->memo == NULL)
+          cl->memo = MemoTable_new(nargs, MEMO_CAPACITY);
+
+        Value cached;
+        if (memo_lookup(cl->memo, &stack[sp - nargs], &cached)) {
+          sp -= nargs + 1;
+          PUSH(cached);
+          goto resume_native;
+        }
+        memoizing = true;
+      } else if (!fn->memoize) {
+        call_cache_insert(cache, fn);
+      }
+
+      code = fn->instructions.data;
+      num_locals = fn->num_locals;
+
+    push_frame: {
+      // a callee this loop can not run gets a nested loop of the other kind
+      // until it returns, only code the verifier rejected mixes the two
+      bool nested = checked ? runs_unchecked(self, cl)
+                            : !self->verified && !runs_unchecked(self, cl);
+      // a frame waiting to store its result can not be replaced, nor one a
+      // nested loop returns to
+      int32_t base_pointer;
+      if (op == OP_TAIL_CALL && self->frame_index > 0 && !frame->memoizing &&
+          !nested) {
+        // slide the callee and its arguments over the current frame
+        base_pointer = frame->base_pointer;
+        memmove(&stack[base_pointer - 1], &stack[sp - nargs - 1],
+                sizeof(Value) * (nargs + 1));
+      } else {
+        if (self->frame_index + 1 >= MAX_FRAMES)
+          goto stack_overflow;
+        frame->ip = ip;
+        self->frame_index++;
+        base_pointer = sp - nargs;
+      }
+
+      // verified code pushes no more than the deepest stack of the function,
+      // written so the bound cannot overflow
+      if (num_locals >= STACK_SIZE - base_pointer -
+                            (checked == nested ? cl->fn->max_stack : 0))
+        goto stack_overflow;
+
+      sp = base_pointer + num_locals;
+      for (int32_t i = base_pointer + nargs; i < sp; i++) {
+        stack[i] = NULL_VAL;
+      }
+
+      frame = &self->frames[self->frame_index];
+      *frame = (Frame){.cl = cl,
+                       .ip = 0,
+                       .base_pointer = base_pointer,
+                       .memoizing = memoizing};
+      ins = code;
+      ip = 0;
+      if (nested) {
+        self->sp = sp;
+        int32_t base_frame = self->base_frame;
+        self->base_frame = self->frame_index;
+        VMResult result = checked ? run_unchecked(self) : run_checked(self);
+        self->base_frame = base_frame;
+        if (result != VM_OK)
+          return result;
+        // the result is pushed in the caller's frame
+        sp = self->sp;
+        LOAD_FRAME();
+        goto resume_native;
+      }
+      native = checked ? NULL : native_code(self, cl->fn);
+      if (native != NULL)
+        goto run_native;
+      break;
+    }
+    }
+
+    case OP_RETURN_VALUE:
+    case OP_RETURN: {
+      Value result = op == OP_RETURN_VALUE ? POP() : NULL_VAL;
+
+      if (self->frame_index == 0) {
+        // a return at the top level ends the program
+        if (op == OP_RETURN_VALUE)
+          self->last_popped = result;
+        frame->ip = ip;
+        self->sp = sp;
+        return VM_OK;
+      }
+
+      if (frame->memoizing) {
+        // parameters are never reassigned, they still hold the arguments
+        Value evicted =
+            memo_store(frame->cl->memo, &stack[frame->base_pointer], result);
+        gc_satb_barrier(self->heap, evicted);
+        gc_write_barrier(self->heap, &frame->cl->base, result);
+      }
+
+      sp = frame->base_pointer - 1;
+      bool called = self->frame_index == self->base_frame;
+      self->frame_index--;
+      if (called) {
+        // back in the builtin that started the frame with vm_call
+        PUSH(result);
+        self->sp = sp;
+        return VM_OK;
+      }
+      LOAD_FRAME();
+      PUSH(result);
+      goto resume_native;
+    }
+
+    default:
+      vm_error(self, "unknown opcode %d", op);
+      goto error;
+    }
+    continue;
+
+  resume_native:
+    // back in a frame that may have been compiled while it was waiting
+    if (checked || self->jit_threshold <= 0 || frame->cl->fn->native == NULL)
+      continue;
+    native = frame->cl->fn->native;
+  run_native:
+    self->sp = sp;
+    ip = jit_run(native, self, frame, ip);
+    sp = self->sp;
+    if (ip < 0) {
+      ip = frame->ip;
+      goto error;
+    }
+    // the native code stops at the calls and returns
+  }
+
+stack_overflow:
+  vm_error(self, "stack overflow");
+error:
+  frame->ip = ip;
+  self->sp = sp;
+  return VM_RUNTIME_ERROR;
+
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef QUICKEN
+#undef DEOPTIMIZE
+#undef LOAD_FRAME
+}
+
+static VMResult run_checked(VM *self) { return run_loop(self, true); }
+
+static VMResult run_unchecked(VM *self) { return run_loop(self, false); }
+
+VMResult vm_run(VM *self) {
+  assert(self != NULL);
+  // the frame the loop starts in was pushed without reserving its stack,
+  // the frames it pushes reserve theirs
+  const Frame *frame = &self->frames[self->frame_index];
+  if (runs_unchecked(self, frame->cl) &&
+      frame->cl->fn->max_stack < STACK_SIZE - self->sp)
+    return run_unchecked(self);
+  return run_checked(self);
+}
+
+bool vm_call(VM *self, Value callee, const Value *args, int32_t nargs,
+             Value *out) {
+  assert(self != NULL);
+  if (IS_BUILTIN(callee)) {
+    if (self->sp + nargs >= STACK_SIZE)
+      return vm_error(self, "stack overflow");
+    // the arguments go where an OP_CALL would have left them
+    Value *slots = &self->stack[self->sp];
+    memcpy(slots, args, sizeof(Value) * nargs);
+    self->sp += nargs;
+    bool ok = builtin_get(callee.as.builtin)->fn(self, slots, nargs, out);
+    self->sp -= nargs;
+    return ok;
+  }
+  if (!IS_OBJ_TYPE(callee, OBJ_CLOSURE))
+    return vm_error(self, "calling non-function: %s", value_type_name(callee));
+
+  Closure *cl = (Closure *)callee.as.obj;
+  if (nargs != cl->fn->num_parameters)
+    return vm_error(self, "wrong number of arguments: want=%d, got=%d",
+                    cl->fn->num_parameters, nargs);
+  int32_t base_pointer = self->sp + 1;
+  if (self->frame_index + 1 >= MAX_FRAMES ||
+      cl->fn->num_locals >= STACK_SIZE - base_pointer)
+    return vm_error(self, "stack overflow");
+
+  self->stack[self->sp] = callee;
+  memcpy(&self->stack[base_pointer], args, sizeof(Value) * nargs);
+  for (int32_t i = base_pointer + nargs;
+       i < base_pointer + cl->fn->num_locals; i++)
+    self->stack[i] = NULL_VAL;
+  self->sp = base_pointer + cl->fn->num_locals;
+
+  int32_t caller_frame = self->frame_index;
+  int32_t caller_base = self->base_frame;
+  self->frame_index++;
+  self->frames[self->frame_index] = (Frame){
+      .cl = cl, .ip = 0, .base_pointer = base_pointer, .memoizing = false};
+  self->base_frame = self->frame_index;
+
+  // functions of the closure tier have no instructions to run
+  VMResult result = cl->fn->tree == NULL ? vm_run(self)
+                    : tree_run_frame(self) ? VM_OK
+                                           : VM_RUNTIME_ERROR;
+  self->base_frame = caller_base;
+  if (result != VM_OK) {
+    self->frame_index = caller_frame;
+    self->sp = base_pointer - 1;
+    return false;
+  }
+  *out = self->stack[--self->sp];
+  return true;
+}
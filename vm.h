@@ -0,0 +1,210 @@
+#ifndef VM_H
+#define VM_H
+
+#include "builtins.h"
+#include "code.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+
+#define STACK_SIZE 2048
+#define MAX_FRAMES 1024
+
+// calls after which a function is compiled to native code
+#define JIT_DEFAULT_THRESHOLD 100
+// backward jumps after which a function is compiled and its running frame
+// moved to the native code
+#define JIT_DEFAULT_OSR_THRESHOLD 1000
+
+typedef struct Frame {
+  Closure *cl;
+  // offset of the next instruction in `cl->fn->instructions`
+  int32_t ip;
+  // stack slot of the first local, the callee sits right below it
+  int32_t base_pointer;
+  // the result is stored in `cl->memo` under the arguments on return
+  bool memoizing;
+} Frame;
+
+// number of callees remembered per call site before it turns megamorphic
+#define CALL_CACHE_ENTRIES 4
+
+typedef struct CallCacheEntry {
+  const CompiledFunction *fn;
+  uint8_t *code;
+  int32_t num_locals;
+} CallCacheEntry;
+
+// Inline cache of one OP_CALL/OP_TAIL_CALL site. A callee found here already
+// passed the arity check for this site and is not memoized, so the frame is
+// set up straight from the entry.
+typedef struct CallCache {
+  int32_t size;
+  bool megamorphic;
+  CallCacheEntry entries[CALL_CACHE_ENTRIES];
+} CallCache;
+
+// number of shapes remembered per field access site
+#define SHAPE_CACHE_ENTRIES 4
+
+typedef struct ShapeCacheEntry {
+  const struct Shape *shape;
+  // field holding the key in maps of this shape, -1 when they lack it
+  int32_t slot;
+} ShapeCacheEntry;
+
+// Inline cache of one OP_GET_FIELD site, a record with a shape found here is
+// read at the cached slot without looking at its keys.
+typedef struct ShapeCache {
+  int32_t size;
+  bool megamorphic;
+  ShapeCacheEntry entries[SHAPE_CACHE_ENTRIES];
+} ShapeCache;
+
+// Call whose literal arguments are allocated in the heap region, opened by
+// OP_ENTER_REGION and released by OP_LEAVE_REGION once the call returned.
+typedef struct RegionScope {
+  HeapRegionMark mark;
+  // the callee is the function the compiler proved keeps its arguments to
+  // itself, otherwise the arguments go to the heap as usual
+  bool active;
+} RegionScope;
+
+typedef enum VMResult { VM_OK, VM_RUNTIME_ERROR } VMResult;
+
+// arrays shorter than this are mapped and reduced on the calling thread
+#define PARALLEL_MIN_LENGTH 256
+
+struct WorkPool;
+struct FrozenProgram;
+
+struct VM {
+  const ValuesArray *constants;
+
+  Value *stack;
+  // points to the next free slot, top of the stack is stack[sp - 1]
+  int32_t sp;
+
+  Value *globals;
+  int32_t num_globals;
+
+  Frame frames[MAX_FRAMES];
+  int32_t frame_index;
+  // frame pushed by the innermost vm_call, vm_run returns once it returns,
+  // 0 while running the top level
+  int32_t base_frame;
+
+  // indexed by the call site operand of OP_CALL/OP_TAIL_CALL
+  CallCache *call_caches;
+  int32_t num_call_caches;
+  uint64_t ic_hits;
+  uint64_t ic_misses;
+
+  // indexed by the site operand of OP_GET_FIELD
+  ShapeCache *shape_caches;
+  int32_t num_shape_caches;
+  uint64_t shape_hits;
+  uint64_t shape_misses;
+  // hidden classes of the records created while running
+  struct ShapeTable *shapes;
+
+  // every function the VM can run passed bytecode_verify, calls never
+  // switch between the checked and the unchecked loop then
+  bool verified;
+
+  // rewrite generic instructions into forms specialized for the operand
+  // types they see, instructions quickened earlier run as they are
+  bool quicken;
+  uint64_t quickened;
+  // quickened instructions turned back into their generic form
+  uint64_t deopts;
+  // counts the instructions the interpreter runs when set, owned by the
+  // caller so it can collect over several runs. A profiled VM runs in the
+  // checked loop, which runs every instruction in its generic form.
+  OpcodeProfile *profile;
+
+  // calls after which a function is compiled to native code, 0 keeps every
+  // function in the interpreter
+  int32_t jit_threshold;
+  int32_t osr_threshold;
+  // functions compiled while running
+  int32_t jit_compiled;
+  // interpreted frames moved into native code at a loop back edge
+  int32_t osr_entries;
+
+  // every object created while running, the VM is its only root set
+  Heap *heap;
+  // innermost call last
+  RegionScope *regions;
+  int32_t num_regions;
+  int32_t regions_capacity;
+
+  // threads running pmap and preduce, started by the first call that
+  // splits its work
+  struct WorkPool *pool;
+  // workers in the pool including the calling thread, 0 uses one per core
+  int32_t parallel_workers;
+  int32_t parallel_min_length;
+
+  // function wrapping the top level instructions
+  CompiledFunction *main_fn;
+  // the shared code the VM runs when made with VM_new_frozen, it owns
+  // `main_fn` and the constants then
+  struct FrozenProgram *program;
+
+  Value last_popped;
+  String error;
+};
+
+VM *VM_new(Bytecode bytecode);
+// VM with its own heap and globals that shares the constants of `parent`,
+// for running calls on another thread. It never quickens or compiles, the
+// bytecode may be running on other threads at the same time.
+VM *VM_new_worker(const VM *parent);
+// VM running `program`, which it holds a reference to until it is freed.
+// Any number of them may run the same program on different threads.
+VM *VM_new_frozen(struct FrozenProgram *program);
+void free_vm(VM *self);
+
+// replaces the top level code with the one of `bytecode`, compiled by the
+// compiler of the last program, and rewinds the VM. The globals and the heap
+// are kept, as is the state after a runtime error. Not for frozen VMs.
+void vm_load_program(VM *self, Bytecode bytecode);
+
+// Runs verified code in a dispatch loop trusting what the verifier proved,
+// each frame reserving the deepest stack of its function when it is pushed.
+// Functions that did not pass run in a loop checking every instruction
+// before it runs, failing with "malformed bytecode" instead of reading out
+// of bounds, without quickening or native code. A call into a function of
+// the other kind runs it in a nested loop until it returns.
+VMResult vm_run(VM *self);
+
+// calls `callee` with the `nargs` values at `args` on top of the running
+// frames and writes its result to `out`, used by builtins taking functions.
+// The arguments are copied to the stack before anything is allocated.
+// Memoized callees run without looking at their table.
+bool vm_call(VM *self, Value callee, const Value *args, int32_t nargs,
+             Value *out);
+
+// value of the last expression statement executed at the top level
+Value vm_last_popped(const VM *self);
+
+// records a runtime error, always returns false so callers can `return` it
+bool vm_error(VM *self, const char *fmt, ...);
+
+// Slow paths shared by the interpreter and the native code. Each works on
+// the top of the stack at `self->sp` like the opcode it implements and
+// returns false after recording a runtime error.
+bool vm_binary_op(VM *self, Opcode op);
+bool vm_negate(VM *self);
+bool vm_build_array(VM *self, int32_t length);
+bool vm_build_map(VM *self, int32_t num_pairs);
+bool vm_index(VM *self);
+bool vm_get_field(VM *self, int32_t key_index, int32_t site);
+bool vm_make_closure(VM *self, int32_t index, int32_t num_free);
+bool vm_enter_region(VM *self, int32_t fn_index);
+bool vm_leave_region(VM *self);
+bool vm_build_region_array(VM *self, int32_t length);
+bool vm_make_region_closure(VM *self, int32_t index, int32_t num_free);
+
+#endif // !VM_H